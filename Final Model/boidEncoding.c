@@ -0,0 +1,311 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "boidEncoding.h"
+#include "boidFraming.h"
+#include "boidUpdate.h"
+
+#define Q16_LEVELS 65535.0
+
+// - Layout Helpers - //
+
+static size_t bitmapBytes(int n)
+{
+    return (size_t)((n + 63) / 64) * sizeof(uint64_t);
+}
+
+static size_t padTo8(size_t bytes)
+{
+    return (bytes + 7) & ~(size_t)7;
+}
+
+static int testBit(const uint64_t *bits, int i)
+{
+    return (int)((bits[i >> 6] >> (i & 63)) & 1u);
+}
+
+static void setBit(uint64_t *bits, int i)
+{
+    bits[i >> 6] |= (uint64_t)1 << (i & 63);
+}
+
+// Bytes taken by 'm' boids after the presence bitmap.
+static size_t bodyBytes(int base, int m)
+{
+    switch (base) {
+    case BOID_ENCODING_F64:
+        return (size_t)m * BOID_STATE_SIZE * sizeof(double);
+    case BOID_ENCODING_F32:
+        return bitmapBytes(m) + padTo8((size_t)m * 6 * sizeof(float));
+    case BOID_ENCODING_Q16:
+        return bitmapBytes(m) + 12 * sizeof(double) + padTo8((size_t)m * 6 * sizeof(uint16_t));
+    default:
+        return 0;
+    }
+}
+
+// - End of Layout Helpers - //
+
+// ----------------------------- //
+
+// - parseBoidEncoding / boidEncodingName Functions - //
+
+int parseBoidEncoding(const char *name)
+{
+    if (strcmp(name, "f64") == 0) return BOID_ENCODING_F64;
+    if (strcmp(name, "f32") == 0) return BOID_ENCODING_F32;
+    if (strcmp(name, "q16") == 0) return BOID_ENCODING_Q16;
+    return -1;
+}
+
+const char *boidEncodingName(int encoding)
+{
+    switch (encoding & ~BOID_ENCODING_SPARSE) {
+    case BOID_ENCODING_F64:    return "f64";
+    case BOID_ENCODING_F64_ID: return "f64-id";
+    case BOID_ENCODING_F32:    return "f32";
+    case BOID_ENCODING_Q16:    return "q16";
+    default:                   return "unknown";
+    }
+}
+
+// - End of parseBoidEncoding / boidEncodingName Functions - //
+
+// ----------------------------- //
+
+// - boidEncodingMaxSize Function - //
+
+size_t boidEncodingMaxSize(int encoding, int numBoids)
+{
+    int base = encoding & ~BOID_ENCODING_SPARSE;
+    if ((encoding & ~(BOID_ENCODING_SPARSE | 0xFF)) != 0 || numBoids < 0)
+        return 0;
+    if (base != BOID_ENCODING_F64 && base != BOID_ENCODING_F32 && base != BOID_ENCODING_Q16)
+        return 0;
+    size_t size = bodyBytes(base, numBoids);
+    if (encoding & BOID_ENCODING_SPARSE)
+        size += bitmapBytes(numBoids);
+    return size;
+}
+
+// - End of boidEncodingMaxSize Function - //
+
+// ----------------------------- //
+
+// - initBoidStateEncoder / freeBoidStateEncoder Functions - //
+
+int initBoidStateEncoder(BoidStateEncoder *e, int encoding, int firstBoid, int numBoids)
+{
+    memset(e, 0, sizeof(*e));
+    if (boidEncodingMaxSize(encoding, numBoids) == 0 && numBoids > 0)
+        return -1;
+    e->encoding  = encoding;
+    e->firstBoid = firstBoid;
+    e->numBoids  = numBoids;
+    e->crashSent = (uint64_t*)calloc(1, bitmapBytes(numBoids) + sizeof(uint64_t));
+    e->sent      = (int*)malloc(((size_t)numBoids + 1) * sizeof(int));
+    if (!e->crashSent || !e->sent) {
+        freeBoidStateEncoder(e);
+        return -1;
+    }
+    return 0;
+}
+
+void freeBoidStateEncoder(BoidStateEncoder *e)
+{
+    free(e->crashSent);
+    free(e->sent);
+    free(e->payload);
+    memset(e, 0, sizeof(*e));
+}
+
+// - End of initBoidStateEncoder / freeBoidStateEncoder Functions - //
+
+// ----------------------------- //
+
+// - encodeBoidStates Function - //
+
+// Inputs:
+//   - e,           struct,      ,  Encoder for this rank's slice
+//   - allStates,   double, [Nx7],  Global state (only the encoder's slice is read)
+
+int encodeBoidStates(BoidStateEncoder *e, const double *allStates)
+{
+    int n = e->numBoids;
+    int base = e->encoding & ~BOID_ENCODING_SPARSE;
+    int sparse = (e->encoding & BOID_ENCODING_SPARSE) != 0;
+    const double *states = &allStates[(size_t)e->firstBoid * BOID_STATE_SIZE];
+
+    size_t maxSize = boidEncodingMaxSize(e->encoding, n);
+    if (maxSize > e->payloadCapacity) {
+        unsigned char *grown = (unsigned char*)realloc(e->payload, maxSize);
+        if (!grown)
+            return -1;
+        e->payload = grown;
+        e->payloadCapacity = maxSize;
+    }
+    unsigned char *out = e->payload;
+
+    // 1. Presence bitmap: everything except crashes that were already sent.
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        if (!sparse || !testBit(e->crashSent, i))
+            e->sent[m++] = i;
+    }
+    if (sparse) {
+        uint64_t *present = (uint64_t*)out;
+        memset(present, 0, bitmapBytes(n));
+        for (int k = 0; k < m; k++)
+            setBit(present, e->sent[k]);
+        out += bitmapBytes(n);
+    }
+    size_t used = (size_t)(out - e->payload) + bodyBytes(base, m);
+
+    // 2. Records of the boids sent, in slice order.
+    if (base == BOID_ENCODING_F64) {
+        double *rec = (double*)out;
+        for (int k = 0; k < m; k++)
+            memcpy(&rec[k * BOID_STATE_SIZE], &states[e->sent[k] * BOID_STATE_SIZE], BOID_STATE_SIZE * sizeof(double));
+    } else {
+        uint64_t *alive = (uint64_t*)out;
+        memset(alive, 0, bitmapBytes(m));
+        for (int k = 0; k < m; k++) {
+            if (states[e->sent[k] * BOID_STATE_SIZE + 6] != 0.0)
+                setBit(alive, k);
+        }
+        out += bitmapBytes(m);
+
+        if (base == BOID_ENCODING_F32) {
+            float *rec = (float*)out;
+            memset(rec, 0, padTo8((size_t)m * 6 * sizeof(float)));
+            for (int k = 0; k < m; k++) {
+                const double *s = &states[e->sent[k] * BOID_STATE_SIZE];
+                for (int c = 0; c < 6; c++)
+                    rec[k * 6 + c] = (float)s[c];
+            }
+        } else {
+            // Each component is quantised within its range over the boids sent.
+            double lo[6], hi[6], step[6];
+            for (int c = 0; c < 6; c++) {
+                lo[c] = m > 0 ? HUGE_VAL : 0.0;
+                hi[c] = m > 0 ? -HUGE_VAL : 0.0;
+            }
+            for (int k = 0; k < m; k++) {
+                const double *s = &states[e->sent[k] * BOID_STATE_SIZE];
+                for (int c = 0; c < 6; c++) {
+                    if (s[c] < lo[c]) lo[c] = s[c];
+                    if (s[c] > hi[c]) hi[c] = s[c];
+                }
+            }
+            for (int c = 0; c < 6; c++)
+                step[c] = (hi[c] - lo[c]) / Q16_LEVELS;
+            memcpy(out, lo, sizeof(lo));
+            memcpy(out + sizeof(lo), step, sizeof(step));
+            out += sizeof(lo) + sizeof(step);
+
+            uint16_t *rec = (uint16_t*)out;
+            memset(rec, 0, padTo8((size_t)m * 6 * sizeof(uint16_t)));
+            for (int k = 0; k < m; k++) {
+                const double *s = &states[e->sent[k] * BOID_STATE_SIZE];
+                for (int c = 0; c < 6; c++) {
+                    double q = step[c] > 0.0 ? floor((s[c] - lo[c]) / step[c] + 0.5) : 0.0;
+                    rec[k * 6 + c] = (uint16_t)(q < 0.0 ? 0.0 : (q > Q16_LEVELS ? Q16_LEVELS : q));
+                }
+            }
+        }
+    }
+
+    // Crashes sent in this frame are left out of later sparse frames.
+    if (sparse) {
+        for (int i = 0; i < n; i++) {
+            if (states[i * BOID_STATE_SIZE + 6] == 0.0)
+                setBit(e->crashSent, i);
+        }
+    }
+
+    e->payloadSize = used;
+    e->totalBytes += (double)used;
+    e->frames++;
+    return 0;
+}
+
+// - End of encodeBoidStates Function - //
+
+// ----------------------------- //
+
+// - decodeBoidStates Function - //
+
+// Inputs:
+//   - encoding,    int,    [1x1],  Encoding from the frame header
+//   - numBoids,    int,    [1x1],  Boids covered by the frame
+//   - payload,     void*,       ,  Payload bytes (8-byte aligned)
+//   - size,        size_t, [1x1],  Payload length in bytes
+//   - states,      double, [numBoids x 7],  Rows receiving the decoded boids
+
+int decodeBoidStates(int encoding, int numBoids, const void *payload, size_t size, double *states)
+{
+    int n = numBoids;
+    int base = encoding & ~BOID_ENCODING_SPARSE;
+    int sparse = (encoding & BOID_ENCODING_SPARSE) != 0;
+    if (boidEncodingMaxSize(encoding, n) == 0 && n > 0)
+        return -1;
+    const unsigned char *in = (const unsigned char*)payload;
+
+    const uint64_t *present = NULL;
+    int m = n;
+    if (sparse) {
+        if (size < bitmapBytes(n))
+            return -1;
+        present = (const uint64_t*)in;
+        m = 0;
+        for (int w = 0; w < (n + 63) / 64; w++)
+            m += __builtin_popcountll(present[w]);
+        in += bitmapBytes(n);
+    }
+    if (size != (size_t)(in - (const unsigned char*)payload) + bodyBytes(base, m))
+        return -1;
+
+    // Records arrive in slice order for the boids marked present.
+    if (base == BOID_ENCODING_F64) {
+        const double *rec = (const double*)in;
+        for (int i = 0; i < n; i++) {
+            if (present && !testBit(present, i))
+                continue;
+            memcpy(&states[i * BOID_STATE_SIZE], rec, BOID_STATE_SIZE * sizeof(double));
+            rec += BOID_STATE_SIZE;
+        }
+        return 0;
+    }
+
+    const uint64_t *alive = (const uint64_t*)in;
+    in += bitmapBytes(m);
+    double lo[6], step[6];
+    if (base == BOID_ENCODING_Q16) {
+        memcpy(lo, in, sizeof(lo));
+        memcpy(step, in + sizeof(lo), sizeof(step));
+        in += sizeof(lo) + sizeof(step);
+    }
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        if (present && !testBit(present, i))
+            continue;
+        double *s = &states[i * BOID_STATE_SIZE];
+        if (base == BOID_ENCODING_F32) {
+            const float *rec = (const float*)in + (size_t)k * 6;
+            for (int c = 0; c < 6; c++)
+                s[c] = (double)rec[c];
+        } else {
+            const uint16_t *rec = (const uint16_t*)in + (size_t)k * 6;
+            for (int c = 0; c < 6; c++)
+                s[c] = lo[c] + (double)rec[c] * step[c];
+        }
+        // Crashed boids are at rest; keep their velocity exactly zero.
+        s[6] = testBit(alive, k) ? 1.0 : 0.0;
+        if (s[6] == 0.0)
+            s[3] = s[4] = s[5] = 0.0;
+        k++;
+    }
+    return 0;
+}
+
+// - End of decodeBoidStates Function - //
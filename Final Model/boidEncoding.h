@@ -0,0 +1,65 @@
+#ifndef BOIDENCODING_H
+#define BOIDENCODING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Compact payload layouts for STATE frames (see BOID_ENCODING_* in boidFraming.h).
+// All sections are multiples of 8 bytes, in this order:
+//   [present bitmap]   uint64 words over the slice  (BOID_ENCODING_SPARSE only)
+//   [alive bitmap]     uint64 words over the m boids sent  (F32 and Q16)
+//   [ranges]           double lo[6], double step[6]  (Q16 only)
+//   [records]          m x { 7 doubles | 6 floats | 6 uint16 }, padded to 8 bytes
+// With BOID_ENCODING_SPARSE, boids whose crash has already been sent are left
+// out; crashed boids never move again, so receivers keep their last state.
+
+// Encoder for one rank's slice of the global state.
+typedef struct {
+    int encoding;               // BOID_ENCODING_F64, _F32 or _Q16, optionally | BOID_ENCODING_SPARSE
+    int firstBoid;              // First global index of the slice
+    int numBoids;               // Boids in the slice
+    uint64_t *crashSent;        // Boids whose crashed state has been encoded [bitmap over numBoids]
+    int *sent;                  // Slice indices of the boids in the last frame [numBoids]
+    unsigned char *payload;     // Payload produced by the last encodeBoidStates call
+    size_t payloadCapacity;
+    size_t payloadSize;         // Bytes used in payload
+    double totalBytes;          // Payload bytes encoded so far
+    long frames;                // Frames encoded so far
+} BoidStateEncoder;
+
+// Returns the encoding named by 'name' ("f64", "f32" or "q16"), or -1.
+int parseBoidEncoding(const char *name);
+
+// Name of the base encoding of 'encoding'.
+const char *boidEncodingName(int encoding);
+
+// Largest payload 'encoding' can produce for 'numBoids' boids, or 0 if the
+// encoding is not a STATE encoding.
+size_t boidEncodingMaxSize(int encoding, int numBoids);
+
+// Sets up an encoder for boids firstBoid..firstBoid+numBoids-1.
+// Returns 0 on success, nonzero on error.
+int initBoidStateEncoder(BoidStateEncoder *e, int encoding, int firstBoid, int numBoids);
+
+// Releases the encoder's buffers.
+void freeBoidStateEncoder(BoidStateEncoder *e);
+
+// Encodes the encoder's slice of allStates into e->payload.
+// Returns 0 on success, nonzero on allocation failure.
+int encodeBoidStates(BoidStateEncoder *e, const double *allStates);
+
+// Decodes a payload of 'size' bytes covering 'numBoids' boids into 'states'
+// (the slice's [numBoids x 7] rows). Boids left out of a sparse payload are
+// not touched. 'payload' must be 8-byte aligned.
+// Returns 0 on success, nonzero if the payload is malformed.
+int decodeBoidStates(int encoding, int numBoids, const void *payload, size_t size, double *states);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOIDENCODING_H
@@ -0,0 +1,394 @@
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "boidEnsemble.h"
+#include "boidProfile.h"
+#include "neighbourGrid.h"
+
+// - BoidParams Field Table - //
+
+typedef struct {
+    const char *name;
+    size_t offset;
+} EnsembleField;
+
+static const EnsembleField ensembleFields[] = {
+    { "boundsX",            offsetof(BoidParams, bounds[0]) },
+    { "boundsY",            offsetof(BoidParams, bounds[1]) },
+    { "boundsZ",            offsetof(BoidParams, bounds[2]) },
+    { "maxSpeed",           offsetof(BoidParams, maxSpeed) },
+    { "visualRange",        offsetof(BoidParams, visualRange) },
+    { "matchingFactor",     offsetof(BoidParams, matchingFactor) },
+    { "centeringFactor",    offsetof(BoidParams, centeringFactor) },
+    { "avoidFactor",        offsetof(BoidParams, avoidFactor) },
+    { "minDistance",        offsetof(BoidParams, minDistance) },
+    { "speedLimit",         offsetof(BoidParams, speedLimit) },
+    { "margin",             offsetof(BoidParams, margin) },
+    { "turnFactor",         offsetof(BoidParams, turnFactor) },
+    { "targetX",            offsetof(BoidParams, targetPoint[0]) },
+    { "targetY",            offsetof(BoidParams, targetPoint[1]) },
+    { "targetZ",            offsetof(BoidParams, targetPoint[2]) },
+    { "navigationGain",     offsetof(BoidParams, navigationGain) },
+    { "terrainBuffer",      offsetof(BoidParams, terrainBuffer) },
+    { "terrainAvoidFactor", offsetof(BoidParams, terrainAvoidFactor) },
+    { "terrainAmplitude",   offsetof(BoidParams, terrainAmplitude) },
+    { "terrainScale",       offsetof(BoidParams, terrainScale) },
+    { "terrainBase",        offsetof(BoidParams, terrainBase) },
+};
+
+#define NUM_ENSEMBLE_FIELDS ((int)(sizeof(ensembleFields) / sizeof(ensembleFields[0])))
+
+static const EnsembleField *findField(const char *name)
+{
+    for (int f = 0; f < NUM_ENSEMBLE_FIELDS; f++) {
+        if (strcmp(ensembleFields[f].name, name) == 0)
+            return &ensembleFields[f];
+    }
+    return NULL;
+}
+
+static int isRunSetting(const char *name)
+{
+    return strcmp(name, "seed") == 0 || strcmp(name, "numBoids") == 0 || strcmp(name, "numSteps") == 0;
+}
+
+// - End of BoidParams Field Table - //
+
+// ----------------------------- //
+
+// - loadEnsembleSpec / freeEnsembleSpec Functions - //
+
+static int appendValue(EnsembleAxis *axis, double v)
+{
+    double *values = (double*)realloc(axis->values, (axis->numValues + 1) * sizeof(double));
+    if (!values)
+        return -1;
+    axis->values = values;
+    axis->values[axis->numValues++] = v;
+    return 0;
+}
+
+// Parses the values after '=' on one line into 'axis'. Returns 0 on success.
+static int parseAxisValues(EnsembleAxis *axis, char *text)
+{
+    for (char *tok = strtok(text, " \t,\r\n"); tok; tok = strtok(NULL, " \t,\r\n")) {
+        char *end;
+        double start = strtod(tok, &end);
+        if (end == tok)
+            return -1;
+        if (*end == '\0') {
+            if (appendValue(axis, start) != 0)
+                return -1;
+            continue;
+        }
+        // Range start:step:stop, with stop included up to rounding.
+        double step, stop;
+        char *rest = end;
+        if (*rest != ':')
+            return -1;
+        step = strtod(rest + 1, &end);
+        if (end == rest + 1 || *end != ':')
+            return -1;
+        rest = end;
+        stop = strtod(rest + 1, &end);
+        if (end == rest + 1 || *end != '\0' || step == 0.0 || (stop - start) / step < 0.0)
+            return -1;
+        long count = (long)floor((stop - start) / step + 1e-9) + 1;
+        for (long k = 0; k < count; k++) {
+            if (appendValue(axis, start + k * step) != 0)
+                return -1;
+        }
+    }
+    return axis->numValues > 0 ? 0 : -1;
+}
+
+int loadEnsembleSpec(EnsembleSpec *spec, const char *path)
+{
+    memset(spec, 0, sizeof(*spec));
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    char line[4096];
+    int lineNumber = 0;
+    int status = 0;
+    while (status == 0 && fgets(line, sizeof(line), fp)) {
+        lineNumber++;
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+        char *eq = strchr(line, '=');
+        char *name = line;
+        while (isspace((unsigned char)*name))
+            name++;
+        if (*name == '\0')
+            continue;
+        if (!eq) {
+            fprintf(stderr, "loadEnsembleSpec: %s:%d: expected 'name = values'\n", path, lineNumber);
+            status = -1;
+            break;
+        }
+        char *nameEnd = eq;
+        while (nameEnd > name && isspace((unsigned char)nameEnd[-1]))
+            nameEnd--;
+        *nameEnd = '\0';
+        if (!isRunSetting(name) && !findField(name)) {
+            fprintf(stderr, "loadEnsembleSpec: %s:%d: unknown parameter '%s'\n", path, lineNumber, name);
+            status = -1;
+            break;
+        }
+        for (int a = 0; a < spec->numAxes; a++) {
+            if (strcmp(spec->axes[a].name, name) == 0) {
+                fprintf(stderr, "loadEnsembleSpec: %s:%d: '%s' is given twice\n", path, lineNumber, name);
+                status = -1;
+            }
+        }
+        if (status != 0)
+            break;
+        if (spec->numAxes == ENSEMBLE_MAX_AXES || strlen(name) >= ENSEMBLE_NAME_LENGTH) {
+            fprintf(stderr, "loadEnsembleSpec: %s:%d: too many parameters\n", path, lineNumber);
+            status = -1;
+            break;
+        }
+        EnsembleAxis *axis = &spec->axes[spec->numAxes++];
+        strcpy(axis->name, name);
+        if (parseAxisValues(axis, eq + 1) != 0) {
+            fprintf(stderr, "loadEnsembleSpec: %s:%d: bad values for '%s'\n", path, lineNumber, name);
+            status = -1;
+        }
+    }
+    fclose(fp);
+
+    spec->numRuns = 1;
+    for (int a = 0; status == 0 && a < spec->numAxes; a++) {
+        const EnsembleAxis *axis = &spec->axes[a];
+        for (int k = 0; k < axis->numValues; k++) {
+            double v = axis->values[k];
+            if (isRunSetting(axis->name) && (v != floor(v) || (strcmp(axis->name, "seed") != 0 && v < 1.0))) {
+                fprintf(stderr, "loadEnsembleSpec: %s: '%s' needs whole numbers%s\n", path, axis->name,
+                        strcmp(axis->name, "seed") != 0 ? " of at least 1" : "");
+                status = -1;
+                break;
+            }
+        }
+        spec->numRuns *= axis->numValues;
+    }
+    if (status != 0)
+        freeEnsembleSpec(spec);
+    return status;
+}
+
+void freeEnsembleSpec(EnsembleSpec *spec)
+{
+    for (int a = 0; a < spec->numAxes; a++)
+        free(spec->axes[a].values);
+    memset(spec, 0, sizeof(*spec));
+}
+
+// - End of loadEnsembleSpec / freeEnsembleSpec Functions - //
+
+// ----------------------------- //
+
+// - ensembleRunParameters Function - //
+
+// Value of axis a in run 'run'.
+static double axisValue(const EnsembleSpec *spec, long run, int a)
+{
+    long index = run;
+    for (int b = spec->numAxes - 1; b > a; b--)
+        index /= spec->axes[b].numValues;
+    return spec->axes[a].values[index % spec->axes[a].numValues];
+}
+
+void ensembleRunParameters(const EnsembleSpec *spec, long run, EnsembleRun *out, BoidParams *params)
+{
+    memset(out, 0, sizeof(*out));
+    out->run      = run;
+    out->seed     = ENSEMBLE_DEFAULT_SEED;
+    out->numBoids = ENSEMBLE_DEFAULT_BOIDS;
+    out->numSteps = ENSEMBLE_DEFAULT_STEPS;
+    for (int a = 0; a < spec->numAxes; a++) {
+        if (strcmp(spec->axes[a].name, "seed") == 0)
+            out->seed = (int)axisValue(spec, run, a);
+        else if (strcmp(spec->axes[a].name, "numBoids") == 0)
+            out->numBoids = (int)axisValue(spec, run, a);
+        else if (strcmp(spec->axes[a].name, "numSteps") == 0)
+            out->numSteps = (int)axisValue(spec, run, a);
+    }
+    initParameters(params, out->seed);
+    for (int a = 0; a < spec->numAxes; a++) {
+        const EnsembleField *field = findField(spec->axes[a].name);
+        if (field)
+            *(double*)((char*)params + field->offset) = axisValue(spec, run, a);
+    }
+}
+
+// - End of ensembleRunParameters Function - //
+
+// ----------------------------- //
+
+// - runEnsemble Function - //
+
+typedef struct {
+    const EnsembleSpec *spec;
+    EnsembleRun *runs;
+    pthread_mutex_t lock;       // Protects nextRun
+    long nextRun;
+} EnsembleQueue;
+
+// Runs one simulation and fills in its metrics. Returns 0 on success.
+static int runEnsembleMember(EnsembleQueue *queue, long run, NeighbourGrid *grid)
+{
+    EnsembleRun *out = &queue->runs[run];
+    double start = wallSeconds();
+    BoidParams params;
+    BoidStateBuffers buffers;
+
+    // The initial state is drawn exactly as local_main draws it for the same seed.
+    ensembleRunParameters(queue->spec, run, out, &params);
+    if (initBoidStateBuffers(&buffers, out->numBoids) != 0)
+        return -1;
+    initBoidStates(buffers.prev, 0, out->numBoids, &params);
+    int status = 0;
+
+    int n = out->numBoids;
+    out->firstCrashStep = -1;
+    for (int step = 1; step < out->numSteps && status == 0; step++) {
+        status = stepBoidsSubsetGridSync(buffers.prev, buffers.next, n, 0, n, grid, &params);
+        swapBoidStateBuffers(&buffers);
+        if (out->firstCrashStep < 0) {
+            for (int i = 0; i < n; i++) {
+                if (buffers.prev[i * BOID_STATE_SIZE + 6] == 0.0) {
+                    out->firstCrashStep = step;
+                    break;
+                }
+            }
+        }
+    }
+
+    double velSum[3] = { 0.0, 0.0, 0.0 };
+    double posSum[3] = { 0.0, 0.0, 0.0 };
+    double speedSum = 0.0;
+    int active = 0;
+    for (int i = 0; i < n; i++) {
+        const double *s = &buffers.prev[i * BOID_STATE_SIZE];
+        if (s[6] == 0.0) {
+            out->crashed++;
+            continue;
+        }
+        for (int d = 0; d < 3; d++) {
+            posSum[d] += s[d];
+            velSum[d] += s[3 + d];
+        }
+        speedSum += sqrt(s[3]*s[3] + s[4]*s[4] + s[5]*s[5]);
+        active++;
+    }
+    if (active > 0) {
+        double c[3];
+        for (int d = 0; d < 3; d++)
+            c[d] = posSum[d] / active - params.targetPoint[d];
+        out->meanSpeed      = speedSum / active;
+        out->polarisation   = speedSum > 0.0
+                            ? sqrt(velSum[0]*velSum[0] + velSum[1]*velSum[1] + velSum[2]*velSum[2]) / speedSum
+                            : 0.0;
+        out->targetDistance = sqrt(c[0]*c[0] + c[1]*c[1] + c[2]*c[2]);
+    }
+    freeBoidStateBuffers(&buffers);
+    out->seconds = wallSeconds() - start;
+    out->status  = status;
+    return status;
+}
+
+static void *ensembleWorker(void *arg)
+{
+    EnsembleQueue *queue = (EnsembleQueue*)arg;
+    NeighbourGrid grid;
+    initNeighbourGrid(&grid);
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        long run = queue->nextRun++;
+        pthread_mutex_unlock(&queue->lock);
+        if (run >= queue->spec->numRuns)
+            break;
+        if (runEnsembleMember(queue, run, &grid) != 0)
+            queue->runs[run].status = -1;
+    }
+    freeNeighbourGrid(&grid);
+    return NULL;
+}
+
+int runEnsemble(const EnsembleSpec *spec, EnsembleRun *runs, int numThreads)
+{
+    if (numThreads <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = online > 0 ? (int)online : 1;
+    }
+    if (numThreads > spec->numRuns)
+        numThreads = spec->numRuns > 0 ? (int)spec->numRuns : 1;
+
+    EnsembleQueue queue;
+    queue.spec    = spec;
+    queue.runs    = runs;
+    queue.nextRun = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+    for (long r = 0; r < spec->numRuns; r++)
+        runs[r].status = -1;
+
+    // The calling thread works as well, so one thread starts no extra threads.
+    pthread_t *threads = (pthread_t*)calloc(numThreads, sizeof(pthread_t));
+    int started = 0;
+    for (int t = 1; threads && t < numThreads; t++) {
+        if (pthread_create(&threads[t], NULL, ensembleWorker, &queue) != 0)
+            break;
+        started = t;
+    }
+    ensembleWorker(&queue);
+    for (int t = 1; t <= started; t++)
+        pthread_join(threads[t], NULL);
+    free(threads);
+    pthread_mutex_destroy(&queue.lock);
+
+    for (long r = 0; r < spec->numRuns; r++) {
+        if (runs[r].status != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// - End of runEnsemble Function - //
+
+// ----------------------------- //
+
+// - writeEnsembleSummary Function - //
+
+int writeEnsembleSummary(const char *path, const EnsembleSpec *spec, const EnsembleRun *runs)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return -1;
+    fprintf(fp, "run,seed,numBoids,numSteps");
+    for (int a = 0; a < spec->numAxes; a++) {
+        if (!isRunSetting(spec->axes[a].name))
+            fprintf(fp, ",%s", spec->axes[a].name);
+    }
+    fprintf(fp, ",status,crashed,firstCrashStep,meanSpeed,polarisation,targetDistance,seconds\n");
+    for (long r = 0; r < spec->numRuns; r++) {
+        const EnsembleRun *run = &runs[r];
+        fprintf(fp, "%ld,%d,%d,%d", run->run, run->seed, run->numBoids, run->numSteps);
+        for (int a = 0; a < spec->numAxes; a++) {
+            if (!isRunSetting(spec->axes[a].name))
+                fprintf(fp, ",%.6g", axisValue(spec, r, a));
+        }
+        fprintf(fp, ",%d,%d,%d,%.6f,%.6f,%.6f,%.6f\n", run->status, run->crashed, run->firstCrashStep,
+                run->meanSpeed, run->polarisation, run->targetDistance, run->seconds);
+    }
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+// - End of writeEnsembleSummary Function - //
@@ -0,0 +1,77 @@
+#ifndef BOIDENSEMBLE_H
+#define BOIDENSEMBLE_H
+
+#include "boidUpdate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Defaults for runs whose specification does not sweep these.
+#define ENSEMBLE_DEFAULT_SEED   124
+#define ENSEMBLE_DEFAULT_BOIDS  1000
+#define ENSEMBLE_DEFAULT_STEPS  500
+
+#define ENSEMBLE_MAX_AXES 32
+#define ENSEMBLE_NAME_LENGTH 32
+
+// Sweep specification, read from a text file of "name = values" lines ('#'
+// starts a comment). Values are numbers separated by spaces or commas, or a
+// range "start:step:stop" (stop included). Names are "seed", "numBoids",
+// "numSteps" or a BoidParams field (e.g. "visualRange", "terrainAmplitude",
+// "boundsX", "targetZ"). The ensemble is every combination of the values, the
+// last axis varying fastest.
+typedef struct {
+    char name[ENSEMBLE_NAME_LENGTH];
+    double *values;
+    int numValues;
+} EnsembleAxis;
+
+typedef struct {
+    EnsembleAxis axes[ENSEMBLE_MAX_AXES];
+    int numAxes;
+    long numRuns;               // Product of the axis lengths
+} EnsembleSpec;
+
+// One simulation of the ensemble: its configuration and summary metrics.
+typedef struct {
+    long run;                   // Index in the ensemble
+    int seed;
+    int numBoids;
+    int numSteps;
+    int status;                 // 0 once the run has finished, nonzero on failure
+
+    int crashed;                // Boids crashed by the last step
+    int firstCrashStep;         // First step with a crashed boid, or -1
+    double meanSpeed;           // Mean speed of the active boids at the last step
+    double polarisation;        // |sum of velocities| / sum of speeds of the active boids
+    double targetDistance;      // Distance from the active boids' centroid to targetPoint
+    double seconds;             // Wall time of the run
+} EnsembleRun;
+
+// Reads the specification at 'path'. Problems are reported on stderr with
+// their line number. Returns 0 on success, nonzero on error.
+int loadEnsembleSpec(EnsembleSpec *spec, const char *path);
+
+// Releases the value lists.
+void freeEnsembleSpec(EnsembleSpec *spec);
+
+// Fills in the parameters of run 'run' (0..numRuns-1): initParameters with the
+// run's seed, then every swept BoidParams field.
+void ensembleRunParameters(const EnsembleSpec *spec, long run, EnsembleRun *out, BoidParams *params);
+
+// Runs every simulation of the ensemble on 'numThreads' threads (<= 0 selects
+// the number of online CPUs), each stepping its runs synchronously through the
+// neighbour grid. 'runs' receives numRuns results in ensemble order.
+// Returns 0 if every run succeeded, nonzero otherwise.
+int runEnsemble(const EnsembleSpec *spec, EnsembleRun *runs, int numThreads);
+
+// Writes one CSV row per run: the configuration (with every swept axis) and
+// the summary metrics. Returns 0 on success, nonzero on error.
+int writeEnsembleSummary(const char *path, const EnsembleSpec *spec, const EnsembleRun *runs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOIDENSEMBLE_H
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "boidExchange.h"
+#include "boidFraming.h"
+#include "boidProfile.h"
+
+// - Rank Set Helpers - //
+
+static int ownerOf(const BoidExchange *x, int j)
+{
+    int r = j / x->boidsPerProc;
+    return r >= x->nProcs ? x->nProcs - 1 : r;
+}
+
+static int rankSetCovers(const uint64_t *have, const uint64_t *need, int words)
+{
+    for (int w = 0; w < words; w++) {
+        if (need[w] & ~have[w])
+            return 0;
+    }
+    return 1;
+}
+
+// - End of Rank Set Helpers - //
+
+// ----------------------------- //
+
+// - transportMain Function - //
+
+// Runs one exchange per posted step: publish this rank's slice, then receive
+// the other slices one at a time, announcing each arrival to the stepping thread.
+
+static void *transportMain(void *arg)
+{
+    BoidExchange *x = (BoidExchange*)arg;
+    pthread_mutex_lock(&x->lock);
+    for (;;) {
+        while (!x->shutdown && !x->jobReady)
+            pthread_cond_wait(&x->cond, &x->lock);
+        if (x->shutdown)
+            break;
+        x->jobReady = 0;
+        int step = x->jobStep;
+        const double *publish = x->jobPublish;
+        double *receive = x->jobReceive;
+        pthread_mutex_unlock(&x->lock);
+
+        int status = publishEncodedBoidStates(x->encoder, publish, step, x->rank);
+        int received = 0;
+        while (status == 0 && received < x->nProcs - 1) {
+            int src;
+            status = consumeNextBoidStates(receive, x->numBoids, step, x->rank, &src);
+            if (status != 0)
+                break;
+            pthread_mutex_lock(&x->lock);
+            if (src >= 0 && src < x->nProcs && !x->arrived[src]) {
+                x->arrived[src] = 1;
+                x->numArrived++;
+                received++;
+                pthread_cond_broadcast(&x->cond);
+            }
+            pthread_mutex_unlock(&x->lock);
+        }
+
+        pthread_mutex_lock(&x->lock);
+        if (status != 0)
+            x->status = status;
+        x->jobRunning = 0;
+        pthread_cond_broadcast(&x->cond);
+    }
+    pthread_mutex_unlock(&x->lock);
+    return NULL;
+}
+
+// - End of transportMain Function - //
+
+// ----------------------------- //
+
+// - initBoidExchange / freeBoidExchange Functions - //
+
+int initBoidExchange(BoidExchange *x, const double *allStates, int numBoids,
+                     int rank, int nProcs, BoidStateEncoder *encoder)
+{
+    memset(x, 0, sizeof(*x));
+    if (nProcs < 1 || rank < 0 || rank >= nProcs || numBoids < nProcs)
+        return -1;
+    x->encoder      = encoder;
+    x->rank         = rank;
+    x->nProcs       = nProcs;
+    x->numBoids     = numBoids;
+    x->boidsPerProc = numBoids / nProcs;
+    x->startIdx     = rank * x->boidsPerProc;
+    x->endIdx       = (rank == nProcs - 1) ? numBoids : x->startIdx + x->boidsPerProc;
+    x->rankWords    = (nProcs + 63) / 64;
+    initNeighbourGrid(&x->grid);
+
+    int localBoids = x->endIdx - x->startIdx;
+    if (initBoidStateBuffers(&x->buffers, numBoids) != 0)
+        return -1;
+    x->scratch  = (int*)malloc(numBoids * sizeof(int));
+    x->boundary = (int*)malloc(localBoids * sizeof(int));
+    x->needs    = (uint64_t*)malloc((size_t)localBoids * x->rankWords * sizeof(uint64_t));
+    x->copied   = (uint64_t*)malloc(x->rankWords * sizeof(uint64_t));
+    x->arrived  = (int*)calloc(nProcs, sizeof(int));
+    if (!x->scratch || !x->boundary || !x->needs || !x->copied || !x->arrived) {
+        freeBoidExchange(x);
+        return -1;
+    }
+    memcpy(x->buffers.prev, allStates, (size_t)numBoids * BOID_STATE_SIZE * sizeof(double));
+    memcpy(x->buffers.next, allStates, (size_t)numBoids * BOID_STATE_SIZE * sizeof(double));
+
+    pthread_mutex_init(&x->lock, NULL);
+    pthread_cond_init(&x->cond, NULL);
+    if (pthread_create(&x->thread, NULL, transportMain, x) != 0) {
+        pthread_mutex_destroy(&x->lock);
+        pthread_cond_destroy(&x->cond);
+        freeBoidExchange(x);
+        return -1;
+    }
+    x->threadStarted = 1;
+    return 0;
+}
+
+void freeBoidExchange(BoidExchange *x)
+{
+    if (x->threadStarted) {
+        pthread_mutex_lock(&x->lock);
+        x->shutdown = 1;
+        pthread_cond_broadcast(&x->cond);
+        pthread_mutex_unlock(&x->lock);
+        pthread_join(x->thread, NULL);
+        pthread_mutex_destroy(&x->lock);
+        pthread_cond_destroy(&x->cond);
+    }
+    freeBoidStateBuffers(&x->buffers);
+    freeNeighbourGrid(&x->grid);
+    free(x->scratch);
+    free(x->boundary);
+    free(x->needs);
+    free(x->copied);
+    free(x->arrived);
+    memset(x, 0, sizeof(*x));
+}
+
+// - End of initBoidExchange / freeBoidExchange Functions - //
+
+// ----------------------------- //
+
+// - mergeArrivedSlices Function - //
+
+// Copies the slices that arrived since the last call from buffers.next into
+// buffers.prev. Blocks until at least one new slice is in, or the exchange has
+// finished. Sets '*finished' once every slice has been merged.
+// Returns 0 on success, nonzero if the exchange failed.
+
+static int mergeArrivedSlices(BoidExchange *x, int *numMerged, int *finished)
+{
+    pthread_mutex_lock(&x->lock);
+    while (x->status == 0 && x->jobRunning && x->numArrived == *numMerged)
+        pthread_cond_wait(&x->cond, &x->lock);
+    int status = x->status;
+    int running = x->jobRunning;
+    int fresh[64];
+    int numFresh = 0;
+    for (int r = 0; r < x->nProcs && numFresh < 64; r++) {
+        if (x->arrived[r] && !(x->copied[r >> 6] >> (r & 63) & 1u))
+            fresh[numFresh++] = r;
+    }
+    pthread_mutex_unlock(&x->lock);
+    if (status != 0)
+        return -1;
+
+    // The transport thread has finished writing these slices and will not
+    // touch them again until the next exchange is posted.
+    for (int k = 0; k < numFresh; k++) {
+        int r = fresh[k];
+        int first = r * x->boidsPerProc;
+        int last  = (r == x->nProcs - 1) ? x->numBoids : first + x->boidsPerProc;
+        memcpy(&x->buffers.prev[(size_t)first * BOID_STATE_SIZE], &x->buffers.next[(size_t)first * BOID_STATE_SIZE],
+               (size_t)(last - first) * BOID_STATE_SIZE * sizeof(double));
+        x->copied[r >> 6] |= (uint64_t)1 << (r & 63);
+    }
+    *numMerged += numFresh;
+    *finished = !running && *numMerged == x->nProcs - 1;
+    return 0;
+}
+
+// - End of mergeArrivedSlices Function - //
+
+// ----------------------------- //
+
+// - stepBoidExchange Function - //
+
+// Inputs:
+//   - x,           struct,      ,  Exchange for this rank
+//   - step,        int,    [1x1],  Step being computed (tags the published slice)
+//   - BoidParams,  struct,      ,  Simulation parameters
+
+int stepBoidExchange(BoidExchange *x, int step, const BoidParams *p)
+{
+    const double *prev = x->buffers.prev;
+    double *next = x->buffers.next;
+    double cellSize = neighbourGridCellSize(p);
+    BOID_PROFILE_BEGIN(searchStart);
+    if (buildNeighbourGrid(&x->grid, prev, x->numBoids, cellSize) != 0)
+        return -1;
+    BOID_PROFILE_END(searchStart, BOID_PHASE_SEARCH, -1);
+    // Includes waiting for the slices the boundary boids need; the transport
+    // thread records the receives themselves.
+    BOID_PROFILE_BEGIN(forcesStart);
+
+    if (!x->exchangeActive) {
+        // Every slice in prev is current (first step): nothing to wait for.
+        for (int i = x->startIdx; i < x->endIdx; i++)
+            updateOneBoidGridSync(prev, next, i, &x->grid, x->scratch, p);
+        x->interiorUpdates += x->endIdx - x->startIdx;
+    } else {
+        // 1. Update interior boids; note which ranks each boundary boid waits for.
+        int words = x->rankWords;
+        int numBoundary = 0;
+        for (int i = x->startIdx; i < x->endIdx; i++) {
+            uint64_t *need = &x->needs[(size_t)numBoundary * words];
+            memset(need, 0, words * sizeof(uint64_t));
+            int remote = 0;
+            if (prev[i * BOID_STATE_SIZE + 6] != 0.0) {
+                int count = neighbourGridQuery(&x->grid, prev, i, cellSize, x->scratch);
+                for (int k = 0; k < count; k++) {
+                    int j = x->scratch[k];
+                    if (j >= x->startIdx && j < x->endIdx)
+                        continue;
+                    int r = ownerOf(x, j);
+                    need[r >> 6] |= (uint64_t)1 << (r & 63);
+                    remote = 1;
+                }
+            }
+            if (remote) {
+                x->boundary[numBoundary++] = i;
+            } else {
+                updateOneBoidGridSync(prev, next, i, &x->grid, x->scratch, p);
+                x->interiorUpdates++;
+            }
+        }
+
+        // 2. Merge slices as they arrive and update each boundary boid once
+        //    all the ranks near it are in.
+        memset(x->copied, 0, words * sizeof(uint64_t));
+        x->copied[x->rank >> 6] |= (uint64_t)1 << (x->rank & 63);
+        int numMerged = 0;
+        int finished = x->nProcs == 1;
+        for (;;) {
+            if (!finished && mergeArrivedSlices(x, &numMerged, &finished) != 0)
+                return -1;
+            int kept = 0;
+            for (int b = 0; b < numBoundary; b++) {
+                const uint64_t *need = &x->needs[(size_t)b * words];
+                if (rankSetCovers(x->copied, need, words)) {
+                    updateOneBoidGridSync(prev, next, x->boundary[b], &x->grid, x->scratch, p);
+                    x->boundaryUpdates++;
+                } else {
+                    x->boundary[kept] = x->boundary[b];
+                    memmove(&x->needs[(size_t)kept * words], need, words * sizeof(uint64_t));
+                    kept++;
+                }
+            }
+            numBoundary = kept;
+            if (finished)
+                break;
+        }
+        x->exchangeActive = 0;
+    }
+    BOID_PROFILE_END(forcesStart, BOID_PHASE_FORCES, -1);
+
+    // 3. Hand the new state to the transport thread: publish our slice from
+    //    it and receive the other slices for this step into the spare buffer.
+    pthread_mutex_lock(&x->lock);
+    while (x->jobRunning)
+        pthread_cond_wait(&x->cond, &x->lock);
+    if (x->status != 0) {
+        pthread_mutex_unlock(&x->lock);
+        return -1;
+    }
+    swapBoidStateBuffers(&x->buffers);
+    x->jobStep    = step;
+    x->jobPublish = x->buffers.prev;
+    x->jobReceive = x->buffers.next;
+    memset(x->arrived, 0, x->nProcs * sizeof(int));
+    x->numArrived = 0;
+    x->jobReady   = 1;
+    x->jobRunning = 1;
+    pthread_cond_broadcast(&x->cond);
+    pthread_mutex_unlock(&x->lock);
+    x->exchangeActive = 1;
+    return 0;
+}
+
+// - End of stepBoidExchange Function - //
+
+// ----------------------------- //
+
+// - finishBoidExchange Function - //
+
+int finishBoidExchange(BoidExchange *x)
+{
+    if (!x->exchangeActive)
+        return 0;
+    memset(x->copied, 0, x->rankWords * sizeof(uint64_t));
+    x->copied[x->rank >> 6] |= (uint64_t)1 << (x->rank & 63);
+    int numMerged = 0;
+    int finished = x->nProcs == 1;
+    while (!finished) {
+        if (mergeArrivedSlices(x, &numMerged, &finished) != 0)
+            return -1;
+    }
+    // Wait for the publish as well when there was nothing to receive.
+    pthread_mutex_lock(&x->lock);
+    while (x->jobRunning)
+        pthread_cond_wait(&x->cond, &x->lock);
+    int status = x->status;
+    pthread_mutex_unlock(&x->lock);
+    x->exchangeActive = 0;
+    return status == 0 ? 0 : -1;
+}
+
+// - End of finishBoidExchange Function - //
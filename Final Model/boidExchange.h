@@ -0,0 +1,84 @@
+#ifndef BOIDEXCHANGE_H
+#define BOIDEXCHANGE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "boidUpdate.h"
+#include "boidEncoding.h"
+#include "neighbourGrid.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Index-decomposed stepping that overlaps the state exchange with computation.
+// A transport thread publishes this rank's slice and receives the other
+// slices while the calling thread updates its own boids.
+//
+// Steps are synchronous (every boid reads the previous step's state). At the
+// start of a step the other ranks' slices in buffers.prev are one step old;
+// the current ones are still arriving into buffers.next. Because no boid
+// moves further than the grid padding in one step, a boid with no other-rank
+// boid within one cell size of the old positions cannot have one within
+// visual range now. Such interior boids are updated straight away. Each
+// boundary boid waits only for the ranks whose boids are near it, and is
+// updated as soon as those slices have arrived. Results are identical to a
+// single-process synchronous step.
+typedef struct {
+    // Transport thread and the exchange it is running.
+    pthread_t thread;
+    int threadStarted;
+    pthread_mutex_t lock;       // Protects the fields down to numArrived
+    pthread_cond_t cond;        // Signalled for a new exchange, each arrival, completion and shutdown
+    int jobReady;               // An exchange has been posted but not started
+    int jobRunning;             // An exchange is posted or in progress
+    int shutdown;
+    int status;                 // Nonzero once an exchange has failed
+    int jobStep;
+    const double *jobPublish;   // States whose own slice is published
+    double *jobReceive;         // States receiving the other slices
+    int *arrived;               // Per rank: slice for jobStep received [nProcs]
+    int numArrived;
+
+    BoidStateEncoder *encoder;  // Encoding of the published slice
+    int rank, nProcs;
+    int numBoids;
+    int boidsPerProc;           // Slice length (the last rank also takes the remainder)
+    int startIdx, endIdx;       // This rank's slice
+
+    // Overlapped stepping state.
+    BoidStateBuffers buffers;   // prev holds the latest state of this rank's boids
+    NeighbourGrid grid;
+    int *scratch;               // Grid query workspace [numBoids]
+    int *boundary;              // Own boids waiting for other ranks [endIdx - startIdx]
+    uint64_t *needs;            // Ranks each boundary boid waits for [rankWords per boundary boid]
+    int rankWords;              // 64-bit words per rank set
+    uint64_t *copied;           // Ranks whose slice is current in buffers.prev [rankWords]
+    int exchangeActive;         // The previous step's exchange has not been merged yet
+    long interiorUpdates;       // Boids updated before any remote data was needed
+    long boundaryUpdates;       // Boids updated after waiting for remote data
+} BoidExchange;
+
+// Copies the full state into the exchange's buffers and starts the transport
+// thread for 'rank' of 'nProcs'. Returns 0 on success, nonzero on error.
+int initBoidExchange(BoidExchange *x, const double *allStates, int numBoids,
+                     int rank, int nProcs, BoidStateEncoder *encoder);
+
+// Advances this rank's boids to 'step', then starts publishing them and
+// receiving the other ranks' 'step' slices in the background. The new state
+// of this rank's boids is in x->buffers.prev.
+// Returns 0 on success, nonzero on messaging or allocation failure.
+int stepBoidExchange(BoidExchange *x, int step, const BoidParams *p);
+
+// Waits for the exchange started by the last step, leaving the full state in
+// x->buffers.prev. Returns 0 on success, nonzero on messaging failure.
+int finishBoidExchange(BoidExchange *x);
+
+// Stops the transport thread and releases the exchange.
+void freeBoidExchange(BoidExchange *x);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOIDEXCHANGE_H
@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "boidFraming.h"
+#include "boidEncoding.h"
+#include "boidProfile.h"
+#include "boidUpdate.h"
+#include "messaging.h"
+
+// Frame that arrived before the call waiting for it. Its payload buffer is
+// kept when the frame is consumed, so frames are recycled rather than freed.
+typedef struct PendingFrame {
+    struct PendingFrame *next;
+    BoidFrameHeader header;
+    void *payload;
+    size_t payloadSize;
+    size_t capacity;
+} PendingFrame;
+
+static PendingFrame *pendingFrames = NULL;     // Frames kept for later
+static PendingFrame *freeFrames = NULL;        // Recycled frames
+
+// Frame returned by waitBoidFrame: a stashed frame, or NULL when the payload
+// is still unread in the current message.
+static PendingFrame *currentFrame = NULL;
+static size_t currentPayloadSize = 0;
+
+// Ranks already received by the current consumeBoidStates call.
+static int *seenRanks = NULL;
+static int seenCapacity = 0;
+
+// Compact STATE payloads are read here before being decoded into allStates.
+static void *decodeBuffer = NULL;
+static size_t decodeCapacity = 0;
+
+// - boidFramePayloadSize Function - //
+
+size_t boidFramePayloadSize(int encoding, int numBoids)
+{
+    switch (encoding) {
+    case BOID_ENCODING_F64:
+        return (size_t)numBoids * BOID_STATE_SIZE * sizeof(double);
+    case BOID_ENCODING_F64_ID:
+        return (size_t)numBoids * (BOID_STATE_SIZE + 1) * sizeof(double);
+    default:
+        return 0;
+    }
+}
+
+// - End of boidFramePayloadSize Function - //
+
+// ----------------------------- //
+
+// - Frame Helpers - //
+
+// Checks that a message of 'size' bytes starting with 'header' is a complete
+// frame. Compact encodings vary in length, so only their upper bound is checked
+// here; decodeBoidStates checks the rest. Returns 0 if it is.
+static int readFrameHeader(const BoidFrameHeader *header, size_t size)
+{
+    if (header->magic != BOID_FRAME_MAGIC || header->numBoids < 0 || size < sizeof(BoidFrameHeader))
+        return -1;
+    size_t payload = size - sizeof(BoidFrameHeader);
+    if (header->encoding == BOID_ENCODING_F64 || header->encoding == BOID_ENCODING_F64_ID)
+        return payload == boidFramePayloadSize(header->encoding, header->numBoids) ? 0 : -1;
+    size_t maxSize = boidEncodingMaxSize(header->encoding, header->numBoids);
+    return maxSize > 0 && payload <= maxSize ? 0 : -1;
+}
+
+static int frameMatches(const BoidFrameHeader *h, int step, int kind, int srcRank)
+{
+    return h->step == step && h->kind == kind && (srcRank < 0 || h->srcRank == srcRank);
+}
+
+// Takes a recycled frame whose buffer holds at least 'size' bytes.
+static PendingFrame *acquireFrame(size_t size)
+{
+    PendingFrame *f = freeFrames;
+    if (f) {
+        freeFrames = f->next;
+    } else {
+        f = (PendingFrame*)calloc(1, sizeof(PendingFrame));
+        if (!f)
+            return NULL;
+    }
+    if (f->capacity < size) {
+        size_t cap = f->capacity > 0 ? f->capacity : 4096;
+        while (cap < size)
+            cap *= 2;
+        void *grown = realloc(f->payload, cap);
+        if (!grown) {
+            f->next = freeFrames;
+            freeFrames = f;
+            return NULL;
+        }
+        f->payload = grown;
+        f->capacity = cap;
+    }
+    return f;
+}
+
+static void recycleFrame(PendingFrame *f)
+{
+    f->next = freeFrames;
+    freeFrames = f;
+}
+
+// Waits for the next well-formed frame and reads its header, leaving the
+// payload unread in the message.
+static int receiveFrameHeader(BoidFrameHeader *header, size_t *payloadSize)
+{
+    for (;;) {
+        size_t size;
+        if (receiveMessage(&size) != 0)
+            return -1;
+        if (size >= sizeof(BoidFrameHeader)) {
+            if (readMessageBody(header, sizeof(*header)) != 0)
+                return -1;
+            if (readFrameHeader(header, size) == 0) {
+                *payloadSize = size - sizeof(BoidFrameHeader);
+                return 0;
+            }
+        }
+        fprintf(stderr, "waitBoidFrame: Discarding malformed %zu byte message\n", size);
+    }
+}
+
+// - End of Frame Helpers - //
+
+// ----------------------------- //
+
+// - Publish Functions - //
+
+int publishBoidFrame(const BoidFrameHeader *header, const void *payload, size_t payloadSize, int destRank)
+{
+    BOID_PROFILE_BEGIN(start);
+    int status = publishMessageParts(header, sizeof(*header), payload, payloadSize, destRank, header->srcRank);
+    BOID_PROFILE_END(start, BOID_PHASE_PUBLISH, destRank);
+    return status;
+}
+
+int publishBoidStates(const double *allStates, int firstBoid, int numBoids, int step, int rank)
+{
+    BoidFrameHeader header = { BOID_FRAME_MAGIC, BOID_FRAME_STATE, BOID_ENCODING_F64,
+                               step, rank, firstBoid, numBoids };
+    return publishBoidFrame(&header, &allStates[(size_t)firstBoid * BOID_STATE_SIZE],
+                            boidFramePayloadSize(BOID_ENCODING_F64, numBoids), -1);
+}
+
+int publishEncodedBoidStates(BoidStateEncoder *e, const double *allStates, int step, int rank)
+{
+    // Plain F64 goes straight from allStates without an encoding pass.
+    if (e->encoding == BOID_ENCODING_F64) {
+        e->totalBytes += (double)boidFramePayloadSize(BOID_ENCODING_F64, e->numBoids);
+        e->frames++;
+        return publishBoidStates(allStates, e->firstBoid, e->numBoids, step, rank);
+    }
+    if (encodeBoidStates(e, allStates) != 0) {
+        fprintf(stderr, "publishEncodedBoidStates: Out of memory encoding %d boids\n", e->numBoids);
+        return -1;
+    }
+    BoidFrameHeader header = { BOID_FRAME_MAGIC, BOID_FRAME_STATE, (uint16_t)e->encoding,
+                               step, rank, e->firstBoid, e->numBoids };
+    return publishBoidFrame(&header, e->payload, e->payloadSize, -1);
+}
+
+// - End of Publish Functions - //
+
+// ----------------------------- //
+
+// - waitBoidFrame / readBoidFramePayload Functions - //
+
+// Inputs:
+//   - step,        int,    [1x1],  Step the frame must belong to
+//   - kind,        int,    [1x1],  BOID_FRAME_* kind
+//   - srcRank,     int,    [1x1],  Sending rank, or -1 for any rank
+//   - header,      struct,      ,  Receives the frame header
+//   - payloadSize, size_t*,     ,  Receives the payload length in bytes
+
+int waitBoidFrame(int step, int kind, int srcRank, BoidFrameHeader *header, size_t *payloadSize)
+{
+    BOID_PROFILE_BEGIN(start);
+
+    // A payload left unread by the caller is dropped.
+    if (currentFrame) {
+        recycleFrame(currentFrame);
+        currentFrame = NULL;
+    }
+
+    // Frames stashed by earlier calls come first. Frames for steps that have
+    // already completed can no longer match anything and are dropped.
+    PendingFrame **link = &pendingFrames;
+    while (*link) {
+        PendingFrame *f = *link;
+        if (f->header.step < step) {
+            *link = f->next;
+            recycleFrame(f);
+            continue;
+        }
+        if (frameMatches(&f->header, step, kind, srcRank)) {
+            *link = f->next;
+            currentFrame = f;
+            *header = f->header;
+            currentPayloadSize = f->payloadSize;
+            *payloadSize = currentPayloadSize;
+            BOID_PROFILE_END(start, BOID_PHASE_RECEIVE, f->header.srcRank);
+            return 0;
+        }
+        link = &f->next;
+    }
+
+    for (;;) {
+        BoidFrameHeader h;
+        size_t size;
+        if (receiveFrameHeader(&h, &size) != 0)
+            return -1;
+        if (h.step < step)
+            continue;
+        if (frameMatches(&h, step, kind, srcRank)) {
+            *header = h;
+            currentPayloadSize = size;
+            *payloadSize = size;
+            BOID_PROFILE_END(start, BOID_PHASE_RECEIVE, h.srcRank);
+            return 0;
+        }
+        // Early frame: copy it into a recycled buffer for the call that wants it.
+        PendingFrame *f = acquireFrame(size);
+        if (!f || readMessageBody(f->payload, size) != 0) {
+            if (f)
+                recycleFrame(f);
+            return -1;
+        }
+        f->header = h;
+        f->payloadSize = size;
+        f->next = pendingFrames;
+        pendingFrames = f;
+    }
+}
+
+int readBoidFramePayload(void *dest)
+{
+    if (currentFrame) {
+        if (dest)
+            memcpy(dest, currentFrame->payload, currentPayloadSize);
+        recycleFrame(currentFrame);
+        currentFrame = NULL;
+        return 0;
+    }
+    return readMessageBody(dest, currentPayloadSize);
+}
+
+// - End of waitBoidFrame / readBoidFramePayload Functions - //
+
+// ----------------------------- //
+
+// - consumeNextBoidStates / consumeBoidStates Functions - //
+
+// Inputs:
+//   - allStates,        double,  [totalBoids x 7],  Global state receiving the slices
+//   - totalBoids,       int,     [1x1],             Number of boids in allStates
+//   - step,             int,     [1x1],             Step the slices must belong to
+//   - rank,             int,     [1x1],             This rank (its own frames are skipped)
+//   - srcRank,          int*,    [1x1],             Receives the sender of the slice
+
+int consumeNextBoidStates(double *allStates, int totalBoids, int step, int rank, int *srcRank)
+{
+    for (;;) {
+        BoidFrameHeader h;
+        size_t size;
+        if (waitBoidFrame(step, BOID_FRAME_STATE, -1, &h, &size) != 0)
+            return -1;
+
+        // The fanout exchange delivers our own publications back to us.
+        if (h.srcRank == rank) {
+            if (readBoidFramePayload(NULL) != 0)
+                return -1;
+            continue;
+        }
+
+        if (h.encoding == BOID_ENCODING_F64_ID || h.firstBoid < 0 || h.firstBoid + h.numBoids > totalBoids) {
+            fprintf(stderr, "consumeBoidStates: Rank %d sent boids %d..%d, outside 0..%d\n",
+                    h.srcRank, h.firstBoid, h.firstBoid + h.numBoids - 1, totalBoids - 1);
+            return -1;
+        }
+        double *slice = &allStates[(size_t)h.firstBoid * BOID_STATE_SIZE];
+        if (h.encoding == BOID_ENCODING_F64) {
+            // Decoded in place: the payload is already in the allStates layout.
+            if (readBoidFramePayload(slice) != 0)
+                return -1;
+        } else {
+            if (size > decodeCapacity) {
+                void *grown = realloc(decodeBuffer, size);
+                if (!grown)
+                    return -1;
+                decodeBuffer = grown;
+                decodeCapacity = size;
+            }
+            if (readBoidFramePayload(decodeBuffer) != 0)
+                return -1;
+            if (decodeBoidStates(h.encoding, h.numBoids, decodeBuffer, size, slice) != 0) {
+                fprintf(stderr, "consumeBoidStates: Malformed %s payload from rank %d\n",
+                        boidEncodingName(h.encoding), h.srcRank);
+                return -1;
+            }
+        }
+        *srcRank = h.srcRank;
+        return 0;
+    }
+}
+
+int consumeBoidStates(double *allStates, int totalBoids, int step, int rank, int expectedMessages)
+{
+    if (expectedMessages > seenCapacity) {
+        int *grown = (int*)realloc(seenRanks, expectedMessages * sizeof(int));
+        if (!grown)
+            return -1;
+        seenRanks = grown;
+        seenCapacity = expectedMessages;
+    }
+
+    int received = 0;
+    while (received < expectedMessages) {
+        int src;
+        if (consumeNextBoidStates(allStates, totalBoids, step, rank, &src) != 0) {
+            fprintf(stderr, "consumeBoidStates: Received %d of %d state messages for step %d\n",
+                    received, expectedMessages, step);
+            return -1;
+        }
+        int duplicate = 0;
+        for (int k = 0; k < received && !duplicate; k++)
+            duplicate = seenRanks[k] == src;
+        if (!duplicate)
+            seenRanks[received++] = src;
+    }
+    return 0;
+}
+
+// - End of consumeNextBoidStates / consumeBoidStates Functions - //
+
+// ----------------------------- //
+
+// - releaseBoidFrames Function - //
+
+static void freeFrameList(PendingFrame *f)
+{
+    while (f) {
+        PendingFrame *next = f->next;
+        free(f->payload);
+        free(f);
+        f = next;
+    }
+}
+
+void releaseBoidFrames(void)
+{
+    if (currentFrame) {
+        recycleFrame(currentFrame);
+        currentFrame = NULL;
+    }
+    freeFrameList(pendingFrames);
+    freeFrameList(freeFrames);
+    pendingFrames = NULL;
+    freeFrames = NULL;
+    free(seenRanks);
+    seenRanks = NULL;
+    seenCapacity = 0;
+    free(decodeBuffer);
+    decodeBuffer = NULL;
+    decodeCapacity = 0;
+}
+
+// - End of releaseBoidFrames Function - //
@@ -0,0 +1,90 @@
+#ifndef BOIDFRAMING_H
+#define BOIDFRAMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "boidEncoding.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Every boid message starts with this magic number ("BOID" in memory order).
+#define BOID_FRAME_MAGIC 0x44494F42u
+
+// Frame kinds.
+#define BOID_FRAME_STATE    1   // Contiguous slice of the global state, placed by firstBoid
+#define BOID_FRAME_HALO     2   // Ghost boids for a neighbouring slab (slab decomposition)
+#define BOID_FRAME_MIGRATE  3   // Boids handed over to a neighbouring slab (slab decomposition)
+
+// Payload encodings.
+#define BOID_ENCODING_F64     0 // BOID_STATE_SIZE doubles per boid (the allStates layout)
+#define BOID_ENCODING_F64_ID  1 // Global ID followed by BOID_STATE_SIZE doubles per boid
+#define BOID_ENCODING_F32     2 // Alive bitmap, then position and velocity as floats
+#define BOID_ENCODING_Q16     3 // Alive bitmap, then 16-bit fixed point within the frame's ranges
+
+// Flag added to F64, F32 or Q16: a presence bitmap leads the payload and boids
+// whose crash was sent in an earlier frame are omitted (see boidEncoding.h).
+#define BOID_ENCODING_SPARSE  0x100
+
+// Header at the start of every framed message. The payload follows directly
+// and starts 8-byte aligned.
+typedef struct {
+    uint32_t magic;             // BOID_FRAME_MAGIC
+    uint16_t kind;              // BOID_FRAME_*
+    uint16_t encoding;          // BOID_ENCODING_*
+    int32_t step;               // Simulation step the payload belongs to
+    int32_t srcRank;            // Sending rank
+    int32_t firstBoid;          // First global boid index covered (STATE frames)
+    int32_t numBoids;           // Number of boids in the payload
+} BoidFrameHeader;
+
+// Payload size in bytes for 'numBoids' boids in a fixed-size encoding
+// (F64 or F64_ID), or 0 for other encodings.
+size_t boidFramePayloadSize(int encoding, int numBoids);
+
+// Publishes the frame 'header' with 'payloadSize' bytes read in place from
+// 'payload'. destRank < 0 sends to every rank. Returns 0 on success, nonzero on error.
+int publishBoidFrame(const BoidFrameHeader *header, const void *payload, size_t payloadSize, int destRank);
+
+// Publishes boids firstBoid..firstBoid+numBoids-1 of allStates to every rank
+// as a STATE frame for 'step', sending straight from allStates.
+// Returns 0 on success, nonzero on error.
+int publishBoidStates(const double *allStates, int firstBoid, int numBoids, int step, int rank);
+
+// Publishes the encoder's slice of allStates as a STATE frame for 'step' in
+// the encoder's encoding. Returns 0 on success, nonzero on error.
+int publishEncodedBoidStates(BoidStateEncoder *e, const double *allStates, int step, int rank);
+
+// Receives the next STATE frame for 'step' from a rank other than 'rank',
+// decodes it into allStates at its firstBoid and stores the sender in '*srcRank'.
+// Returns 0 on success, nonzero on timeout, error or an out-of-range frame.
+int consumeNextBoidStates(double *allStates, int totalBoids, int step, int rank, int *srcRank);
+
+// Receives STATE frames for 'step' from 'expectedMessages' distinct ranks other
+// than 'rank' and decodes each payload into allStates at its firstBoid, in
+// whichever encoding the sender chose.
+// Frames may arrive in any order; frames for later steps are kept for the
+// matching call and frames for earlier steps are discarded.
+// Returns 0 on success, nonzero on timeout, error or an out-of-range frame.
+int consumeBoidStates(double *allStates, int totalBoids, int step, int rank, int expectedMessages);
+
+// Waits for the frame with the given step, kind and source rank (any rank if
+// srcRank < 0), keeping other frames for later, and stores its header in
+// '*header' and its payload length in '*payloadSize'. The payload must then be read with readBoidFramePayload before
+// the next frame is waited for. Returns 0 on success, nonzero on timeout or error.
+int waitBoidFrame(int step, int kind, int srcRank, BoidFrameHeader *header, size_t *payloadSize);
+
+// Copies the payload of the frame returned by waitBoidFrame into 'dest', which
+// must hold the payload length it reported. A NULL 'dest' discards the payload.
+// Returns 0 on success, nonzero on error.
+int readBoidFramePayload(void *dest);
+
+// Releases the frames kept for later steps and the buffers kept for reuse.
+void releaseBoidFrames(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOIDFRAMING_H
@@ -0,0 +1,62 @@
+#ifndef BOIDKERNELS_H
+#define BOIDKERNELS_H
+
+#include "boidUpdate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Instruction sets available for the neighbour accumulation kernel.
+typedef enum {
+    NEIGHBOUR_KERNEL_SCALAR = 0,    // Portable C, exact reference summation order
+    NEIGHBOUR_KERNEL_SSE2,          // 2 neighbours per instruction
+    NEIGHBOUR_KERNEL_AVX2,          // 4 neighbours per instruction
+    NEIGHBOUR_KERNEL_AVX512,        // 8 neighbours per instruction
+    NEIGHBOUR_KERNEL_COUNT
+} NeighbourKernelType;
+
+// Half-open range j0..j1-1 of neighbour indices.
+typedef struct {
+    int j0, j1;
+} NeighbourRange;
+
+// Adds the cohesion, alignment and separation contributions of the boids in
+// 'ranges', held in structure-of-arrays form, to 'sums' for a boid at 'pos'.
+// The vector kernels select the same neighbours as the scalar kernel (the
+// distance is computed with identical rounding) but sum them lane by lane, so
+// their totals can differ from the scalar result in the last bits. They reduce
+// their lanes once per call, so many short ranges (the cell rows of a grid
+// search) should be passed in one call.
+typedef void (*NeighbourKernelFn)(const double *px, const double *py, const double *pz,
+                                  const double *vx, const double *vy, const double *vz,
+                                  const NeighbourRange *ranges, int numRanges, const double pos[3],
+                                  double visualSq, double minSq, BoidNeighbourSums *sums);
+
+// Scalar reference loop over boids j0..j1-1, always available. The scalar
+// kernel runs it over each range in turn.
+void accumulateNeighboursScalar(const double *px, const double *py, const double *pz,
+                                const double *vx, const double *vy, const double *vz,
+                                int j0, int j1, const double pos[3],
+                                double visualSq, double minSq, BoidNeighbourSums *sums);
+
+// Returns the widest kernel supported by both this build and the running CPU,
+// never SSE2 (slower than scalar), or scalar if there is none.
+NeighbourKernelType detectNeighbourKernel(void);
+
+// Returns the kernel for 'type', or NULL if it is not compiled in or the CPU lacks it.
+NeighbourKernelFn getNeighbourKernel(NeighbourKernelType type);
+
+// Kernel chosen once at first use: the BOIDS_KERNEL environment variable
+// (scalar, sse2, avx2, avx512) if set and supported, otherwise detectNeighbourKernel().
+NeighbourKernelFn activeNeighbourKernel(void);
+NeighbourKernelType activeNeighbourKernelType(void);
+
+// Short lower-case name of a kernel type, e.g. "avx2".
+const char *neighbourKernelName(NeighbourKernelType type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOIDKERNELS_H
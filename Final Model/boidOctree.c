@@ -0,0 +1,330 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "boidOctree.h"
+#include "neighbourGrid.h"
+
+// - initBoidOctree / freeBoidOctree Functions - //
+
+void initBoidOctree(BoidOctree *tree)
+{
+    memset(tree, 0, sizeof(*tree));
+}
+
+void freeBoidOctree(BoidOctree *tree)
+{
+    free(tree->nodes);
+    free(tree->boids);
+    free(tree->boidEntry);
+    free(tree->scratch);
+    initBoidOctree(tree);
+}
+
+// - End of initBoidOctree / freeBoidOctree Functions - //
+
+// ----------------------------- //
+
+// - buildBoidOctree Function - //
+
+// Inputs:
+//   - tree,        struct,         ,  Tree to (re)build
+//   - states,      double, [Nx7]   ,  Boid states to build from
+//   - numBoids,    int,    [1x1]   ,  Number of boids
+
+static int reserveNodes(BoidOctree *tree, int needed)
+{
+    if (needed <= tree->nodeCapacity)
+        return 0;
+    int cap = tree->nodeCapacity > 0 ? tree->nodeCapacity : 64;
+    while (cap < needed)
+        cap *= 2;
+    BoidOctreeNode *nodes = (BoidOctreeNode*)realloc(tree->nodes, (size_t)cap * sizeof(BoidOctreeNode));
+    if (!nodes)
+        return -1;
+    tree->nodes = nodes;
+    tree->nodeCapacity = cap;
+    return 0;
+}
+
+// Fills in node 'node' (whose start and count are set) and splits it into the
+// non-empty octants around the middle of its bounding box.
+static int buildNode(BoidOctree *tree, const double *states, int node, int depth)
+{
+    BoidOctreeNode *n = &tree->nodes[node];
+    const int *boids = &tree->boids[n->start];
+    for (int d = 0; d < 3; d++) {
+        n->posSum[d] = 0.0;
+        n->velSum[d] = 0.0;
+    }
+    for (int k = 0; k < n->count; k++) {
+        const double *s = &states[boids[k] * BOID_STATE_SIZE];
+        for (int d = 0; d < 3; d++) {
+            if (k == 0 || s[d] < n->lo[d]) n->lo[d] = s[d];
+            if (k == 0 || s[d] > n->hi[d]) n->hi[d] = s[d];
+            n->posSum[d] += s[d];
+            n->velSum[d] += s[3 + d];
+        }
+    }
+    n->firstChild  = -1;
+    n->numChildren = 0;
+    if (n->count <= BOID_OCTREE_LEAF || depth >= BOID_OCTREE_MAX_DEPTH)
+        return 0;
+    if (!(n->hi[0] > n->lo[0]) && !(n->hi[1] > n->lo[1]) && !(n->hi[2] > n->lo[2]))
+        return 0;   // Every boid at the same point.
+
+    // Counting sort of the node's boids by octant.
+    double mid[3];
+    for (int d = 0; d < 3; d++)
+        mid[d] = 0.5 * (n->lo[d] + n->hi[d]);
+    int *octant = tree->scratch;
+    int *sorted = &tree->scratch[tree->boidCapacity];
+    int offsets[9] = { 0 };
+    for (int k = 0; k < n->count; k++) {
+        const double *s = &states[boids[k] * BOID_STATE_SIZE];
+        octant[k] = (s[0] > mid[0]) | ((s[1] > mid[1]) << 1) | ((s[2] > mid[2]) << 2);
+        offsets[octant[k] + 1]++;
+    }
+    int numChildren = 0;
+    for (int o = 0; o < 8; o++) {
+        numChildren += offsets[o + 1] > 0;
+        offsets[o + 1] += offsets[o];
+    }
+    int cursor[8];
+    memcpy(cursor, offsets, sizeof(cursor));
+    for (int k = 0; k < n->count; k++)
+        sorted[cursor[octant[k]]++] = boids[k];
+    memcpy(&tree->boids[n->start], sorted, n->count * sizeof(int));
+
+    int first = tree->numNodes;
+    if (reserveNodes(tree, first + numChildren) != 0)
+        return -1;
+    tree->numNodes += numChildren;
+    n = &tree->nodes[node];     // The array may have moved.
+    n->firstChild  = first;
+    n->numChildren = numChildren;
+    int start = n->start;
+    int c = first;
+    for (int o = 0; o < 8; o++) {
+        if (offsets[o + 1] == offsets[o])
+            continue;
+        tree->nodes[c].start = start + offsets[o];
+        tree->nodes[c].count = offsets[o + 1] - offsets[o];
+        c++;
+    }
+    for (c = first; c < first + numChildren; c++) {
+        if (buildNode(tree, states, c, depth + 1) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int buildBoidOctree(BoidOctree *tree, const double *states, int numBoids)
+{
+    if (numBoids > tree->boidCapacity) {
+        int *boids = (int*)realloc(tree->boids, numBoids * sizeof(int));
+        if (!boids)
+            return -1;
+        tree->boids = boids;
+        int *boidEntry = (int*)realloc(tree->boidEntry, numBoids * sizeof(int));
+        if (!boidEntry)
+            return -1;
+        tree->boidEntry = boidEntry;
+        int *scratch = (int*)realloc(tree->scratch, 2 * (size_t)numBoids * sizeof(int));
+        if (!scratch)
+            return -1;
+        tree->scratch = scratch;
+        tree->boidCapacity = numBoids;
+    }
+    tree->numBoids = numBoids;
+    tree->numNodes = 0;
+    if (reserveNodes(tree, 1) != 0)
+        return -1;
+    for (int i = 0; i < numBoids; i++)
+        tree->boids[i] = i;
+    tree->numNodes = 1;
+    tree->nodes[0].start = 0;
+    tree->nodes[0].count = numBoids;
+    if (buildNode(tree, states, 0, 0) != 0)
+        return -1;
+    for (int k = 0; k < numBoids; k++)
+        tree->boidEntry[tree->boids[k]] = k;
+    return 0;
+}
+
+// - End of buildBoidOctree Function - //
+
+// ----------------------------- //
+
+// - updateOneBoidOctreeSync Function - //
+
+// Inputs:
+//   - prevStates,  double, [Nx7]   ,  State at the start of the step
+//   - nextStates,  double, [Nx7]   ,  State written for boid i
+//   - i,           int,    [1x1]   ,  Index of the boid to update
+//   - tree,        struct,         ,  Tree built from prevStates
+//   - theta,       double, [1x1]   ,  Opening angle (0 for exact neighbour sets)
+//   - BoidParams,  struct,         ,  Simulation parameters
+
+typedef struct {
+    const double *states;
+    const BoidOctree *tree;
+    int self;                   // Boid being updated
+    int selfEntry;              // Its entry in tree->boids
+    double pos[3];
+    double visualSq, minSq, rangeSq, thetaSq;
+    BoidNeighbourSums *sums;
+} OctreeQuery;
+
+// Adds a whole node to the cohesion and alignment sums, leaving out the boid
+// being updated if the node holds it.
+static void addNodeSums(OctreeQuery *q, const BoidOctreeNode *n)
+{
+    const double *me = &q->states[q->self * BOID_STATE_SIZE];
+    int holdsSelf = q->selfEntry >= n->start && q->selfEntry < n->start + n->count;
+    for (int d = 0; d < 3; d++) {
+        q->sums->cohesionSum[d]  += holdsSelf ? n->posSum[d] - me[d] : n->posSum[d];
+        q->sums->alignmentSum[d] += holdsSelf ? n->velSum[d] - me[3 + d] : n->velSum[d];
+    }
+    q->sums->neighbourCount += holdsSelf ? n->count - 1 : n->count;
+}
+
+// Box distances are bounds on every boid's distance, since rounding is monotonic.
+static void visitNode(OctreeQuery *q, int node)
+{
+    const BoidOctreeNode *n = &q->tree->nodes[node];
+    double nearSq = 0.0, farSq = 0.0;
+    for (int d = 0; d < 3; d++) {
+        double below = n->lo[d] - q->pos[d];
+        double above = q->pos[d] - n->hi[d];
+        double nearD = below > 0.0 ? below : (above > 0.0 ? above : 0.0);
+        double farD  = fabs(q->pos[d] - n->lo[d]) > fabs(q->pos[d] - n->hi[d])
+                     ? fabs(q->pos[d] - n->lo[d]) : fabs(q->pos[d] - n->hi[d]);
+        nearSq += nearD * nearD;
+        farSq  += farD * farD;
+    }
+    if (nearSq >= q->rangeSq)
+        return;                 // No boid of the node is in range.
+    if (farSq < q->visualSq && nearSq >= q->minSq) {
+        addNodeSums(q, n);      // All in visual range, none too close.
+        return;
+    }
+
+    // Distant, small nodes count as a whole if their centre of mass is in range.
+    int holdsSelf = q->selfEntry >= n->start && q->selfEntry < n->start + n->count;
+    if (q->thetaSq > 0.0 && nearSq >= q->minSq && !holdsSelf) {
+        double centreSq = 0.0, sizeSq = 0.0;
+        for (int d = 0; d < 3; d++) {
+            double c = q->pos[d] - n->posSum[d] / n->count;
+            double e = n->hi[d] - n->lo[d];
+            centreSq += c * c;
+            sizeSq   += e * e;
+        }
+        if (sizeSq <= q->thetaSq * centreSq) {
+            if (centreSq < q->visualSq)
+                addNodeSums(q, n);
+            return;
+        }
+    }
+
+    if (n->firstChild < 0) {
+        // Leaf: resolve every boid exactly.
+        for (int k = n->start; k < n->start + n->count; k++) {
+            int j = q->tree->boids[k];
+            if (j == q->self)
+                continue;
+            const double *nbr = &q->states[j * BOID_STATE_SIZE];
+            double diff[3] = { q->pos[0] - nbr[0], q->pos[1] - nbr[1], q->pos[2] - nbr[2] };
+            double distSq  = diff[0]*diff[0] + diff[1]*diff[1] + diff[2]*diff[2];
+            if (distSq < q->visualSq) {
+                q->sums->cohesionSum[0]  += nbr[0];
+                q->sums->cohesionSum[1]  += nbr[1];
+                q->sums->cohesionSum[2]  += nbr[2];
+                q->sums->alignmentSum[0] += nbr[3];
+                q->sums->alignmentSum[1] += nbr[4];
+                q->sums->alignmentSum[2] += nbr[5];
+                q->sums->neighbourCount++;
+            }
+            if (distSq < q->minSq) {
+                q->sums->separationVec[0] += diff[0];
+                q->sums->separationVec[1] += diff[1];
+                q->sums->separationVec[2] += diff[2];
+            }
+        }
+        return;
+    }
+    for (int c = n->firstChild; c < n->firstChild + n->numChildren; c++)
+        visitNode(q, c);
+}
+
+void updateOneBoidOctreeSync(const double *prevStates, double *nextStates, int i,
+                             const BoidOctree *tree, double theta, const BoidParams *p)
+{
+    const double *myState = &prevStates[i * BOID_STATE_SIZE];
+    double *outState      = &nextStates[i * BOID_STATE_SIZE];
+    if (myState[6] == 0.0) {
+        // Already crashed; carry the state over unchanged.
+        memcpy(outState, myState, BOID_STATE_SIZE * sizeof(double));
+        return;
+    }
+
+    BoidNeighbourSums sums;
+    initNeighbourSums(&sums);
+    OctreeQuery q;
+    q.states    = prevStates;
+    q.tree      = tree;
+    q.self      = i;
+    q.selfEntry = tree->boidEntry[i];
+    for (int d = 0; d < 3; d++)
+        q.pos[d] = myState[d];
+    q.visualSq = p->visualRange * p->visualRange;
+    q.minSq    = p->minDistance * p->minDistance;
+    q.rangeSq  = q.visualSq > q.minSq ? q.visualSq : q.minSq;
+    q.thetaSq  = theta * theta;
+    q.sums     = &sums;
+    if (tree->numNodes > 0)
+        visitNode(&q, 0);
+
+    double vel[3] = { myState[3], myState[4], myState[5] };
+    applyBoidRules(outState, q.pos, vel, &sums, p);
+}
+
+// - End of updateOneBoidOctreeSync Function - //
+
+// ----------------------------- //
+
+// - measureBoidOctreeError Function - //
+
+int measureBoidOctreeError(BoidOctree *tree, const double *states, int numBoids, double theta,
+                           const BoidParams *p, BoidOctreeError *err)
+{
+    size_t bytes = (size_t)(numBoids > 0 ? numBoids : 1) * BOID_STATE_SIZE * sizeof(double);
+    double *exact  = (double*)malloc(bytes);
+    double *approx = (double*)malloc(bytes);
+    NeighbourGrid grid;
+    initNeighbourGrid(&grid);
+    int status = -1;
+    if (exact && approx
+        && stepBoidsSubsetGridSync(states, exact, numBoids, 0, numBoids, &grid, p) == 0
+        && buildBoidOctree(tree, states, numBoids) == 0) {
+        for (int i = 0; i < numBoids; i++) {
+            updateOneBoidOctreeSync(states, approx, i, tree, theta, p);
+            const double *a = &approx[i * BOID_STATE_SIZE];
+            const double *e = &exact[i * BOID_STATE_SIZE];
+            double dv[3] = { a[3] - e[3], a[4] - e[4], a[5] - e[5] };
+            double errSq = dv[0]*dv[0] + dv[1]*dv[1] + dv[2]*dv[2];
+            if (sqrt(errSq) > err->maxVelError)
+                err->maxVelError = sqrt(errSq);
+            err->sumSqVelError += errSq;
+            err->boidUpdates++;
+            if (a[6] != e[6])
+                err->crashMismatches++;
+        }
+        status = 0;
+    }
+    freeNeighbourGrid(&grid);
+    free(exact);
+    free(approx);
+    return status;
+}
+
+// - End of measureBoidOctreeError Function - //
@@ -0,0 +1,79 @@
+#ifndef BOIDOCTREE_H
+#define BOIDOCTREE_H
+
+#include "boidUpdate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Boids per leaf, and the depth at which splitting stops regardless (boids at
+// identical positions cannot be separated).
+#define BOID_OCTREE_LEAF      8
+#define BOID_OCTREE_MAX_DEPTH 32
+
+// Octree node over a contiguous run of BoidOctree.boids, with the tight
+// bounding box of those boids and their position and velocity sums.
+typedef struct {
+    double lo[3], hi[3];        // Bounding box of the boids below the node
+    double posSum[3];           // Sum of their positions
+    double velSum[3];           // Sum of their velocities
+    int start;                  // First entry in BoidOctree.boids
+    int count;                  // Boids below the node
+    int firstChild;             // Index of the first child node, or -1 for a leaf
+    int numChildren;            // Children stored from firstChild on (non-empty octants only)
+} BoidOctreeNode;
+
+// Barnes-Hut style octree for large visual ranges. Cohesion and alignment take
+// a node's sums in one go when the whole node lies within visualRange (and
+// outside minDistance), and separation is resolved boid by boid at the leaves.
+// With an opening angle theta > 0, a node whose size is at most theta times
+// its distance from the boid is also taken whole if its centre of mass is in
+// range, and skipped otherwise; theta = 0 only takes nodes that lie entirely
+// in range, so neighbour sets are exact and only the summation order differs.
+typedef struct {
+    BoidOctreeNode *nodes;      // Node 0 is the root [numNodes]
+    int numNodes;
+    int nodeCapacity;
+    int *boids;                 // Boid indices grouped by node [numBoids]
+    int *boidEntry;             // Entry of each boid in 'boids' [numBoids]
+    int *scratch;               // Partition workspace [2 x boidCapacity]
+    int numBoids;
+    int boidCapacity;
+} BoidOctree;
+
+// One-step error of the octree update against the exact update.
+typedef struct {
+    double maxVelError;         // Largest |v_octree - v_exact| seen
+    double sumSqVelError;       // Sum of |v_octree - v_exact|^2
+    long boidUpdates;           // Boid updates compared
+    long crashMismatches;       // Updates where the crash flags differ
+} BoidOctreeError;
+
+// Initialises an empty tree. No memory is allocated until the first build.
+void initBoidOctree(BoidOctree *tree);
+
+// Releases all memory held by the tree.
+void freeBoidOctree(BoidOctree *tree);
+
+// Builds the tree over every boid in 'states'.
+// Returns 0 on success, nonzero on allocation failure.
+int buildBoidOctree(BoidOctree *tree, const double *states, int numBoids);
+
+// Synchronous update of boid i using the tree built from prevStates, with
+// opening angle 'theta' (see BoidOctree).
+void updateOneBoidOctreeSync(const double *prevStates, double *nextStates, int i,
+                             const BoidOctree *tree, double theta, const BoidParams *p);
+
+// Updates every boid in 'states' once through the tree and once exactly (the
+// grid search, which matches updateOneBoid bit for bit) and adds the
+// differences to 'err'. 'tree' is rebuilt from 'states'.
+// Returns 0 on success, nonzero on allocation failure.
+int measureBoidOctreeError(BoidOctree *tree, const double *states, int numBoids, double theta,
+                           const BoidParams *p, BoidOctreeError *err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOIDOCTREE_H
@@ -0,0 +1,179 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "boidOrdering.h"
+
+// - initBoidOrdering / freeBoidOrdering Functions - //
+
+void initBoidOrdering(BoidOrdering *o)
+{
+    memset(o, 0, sizeof(*o));
+}
+
+void freeBoidOrdering(BoidOrdering *o)
+{
+    free(o->ids);
+    free(o->slots);
+    free(o->entries);
+    free(o->tmpStates);
+    initBoidOrdering(o);
+}
+
+// - End of initBoidOrdering / freeBoidOrdering Functions - //
+
+// ----------------------------- //
+
+// - resetBoidOrdering Function - //
+
+int resetBoidOrdering(BoidOrdering *o, int numBoids)
+{
+    size_t count = numBoids > 0 ? (size_t)numBoids : 1;
+    int *ids = (int*)realloc(o->ids, count * sizeof(int));
+    if (!ids)
+        return -1;
+    o->ids = ids;
+    int *slots = (int*)realloc(o->slots, count * sizeof(int));
+    if (!slots)
+        return -1;
+    o->slots = slots;
+    double *tmpStates = (double*)realloc(o->tmpStates, count * BOID_STATE_SIZE * sizeof(double));
+    if (!tmpStates)
+        return -1;
+    o->tmpStates = tmpStates;
+    for (int i = 0; i < numBoids; i++) {
+        o->ids[i] = i;
+        o->slots[i] = i;
+    }
+    o->numBoids = numBoids;
+    return 0;
+}
+
+// - End of resetBoidOrdering Function - //
+
+// ----------------------------- //
+
+// - mortonOrderBoids Function - //
+
+// Inputs:
+//   - o,           struct,         ,  Ordering providing the sort workspace
+//   - x, y, z,     double, [Nx1]   ,  Coordinates read with 'stride'
+//   - stride,      int,    [1x1]   ,  Distance between consecutive boids' coordinates
+//   - ids,         int,    [Nx1]   ,  Global IDs used to break ties, or NULL
+//   - numBoids,    int,    [1x1]   ,  Number of boids
+//   - order,       int,    [Nx1]   ,  Receives the sorted indices
+
+// Spreads the low 21 bits of v so that two zero bits follow each of them.
+static uint64_t spreadMortonBits(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8)  & 0x100f00f00f00f00fULL;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2)  & 0x1249249249249249ULL;
+    return v;
+}
+
+static int compareMortonEntries(const void *a, const void *b)
+{
+    const BoidMortonEntry *ea = (const BoidMortonEntry*)a;
+    const BoidMortonEntry *eb = (const BoidMortonEntry*)b;
+    if (ea->key != eb->key)
+        return ea->key < eb->key ? -1 : 1;
+    return (ea->id > eb->id) - (ea->id < eb->id);
+}
+
+int mortonOrderBoids(BoidOrdering *o, const double *x, const double *y, const double *z,
+                     int stride, const int *ids, int numBoids, int *order)
+{
+    if (numBoids > o->entryCapacity) {
+        BoidMortonEntry *entries = (BoidMortonEntry*)realloc(o->entries, numBoids * sizeof(BoidMortonEntry));
+        if (!entries)
+            return -1;
+        o->entries = entries;
+        o->entryCapacity = numBoids;
+    }
+
+    // Extent of the flock; non-finite coordinates are ignored here and sort to
+    // the lower corner below.
+    double lo[3] = { 0.0, 0.0, 0.0 };
+    double hi[3] = { 0.0, 0.0, 0.0 };
+    int seen = 0;
+    for (int i = 0; i < numBoids; i++) {
+        double s[3] = { x[i * stride], y[i * stride], z[i * stride] };
+        if (!isfinite(s[0]) || !isfinite(s[1]) || !isfinite(s[2]))
+            continue;
+        for (int d = 0; d < 3; d++) {
+            if (!seen || s[d] < lo[d]) lo[d] = s[d];
+            if (!seen || s[d] > hi[d]) hi[d] = s[d];
+        }
+        seen = 1;
+    }
+
+    double maxCode = (double)((1 << BOID_MORTON_BITS) - 1);
+    double scale[3];
+    for (int d = 0; d < 3; d++)
+        scale[d] = hi[d] > lo[d] ? maxCode / (hi[d] - lo[d]) : 0.0;
+
+    for (int i = 0; i < numBoids; i++) {
+        double s[3] = { x[i * stride], y[i * stride], z[i * stride] };
+        uint64_t key = 0;
+        for (int d = 0; d < 3; d++) {
+            double q = (s[d] - lo[d]) * scale[d];
+            if (!(q > 0.0))
+                q = 0.0;
+            if (q > maxCode)
+                q = maxCode;
+            key |= spreadMortonBits((uint64_t)q) << d;
+        }
+        o->entries[i].key   = key;
+        o->entries[i].id    = ids ? ids[i] : i;
+        o->entries[i].index = i;
+    }
+    qsort(o->entries, numBoids, sizeof(BoidMortonEntry), compareMortonEntries);
+    for (int k = 0; k < numBoids; k++)
+        order[k] = o->entries[k].index;
+    return 0;
+}
+
+// - End of mortonOrderBoids Function - //
+
+// ----------------------------- //
+
+// - reorderBoidStates Function - //
+
+int reorderBoidStates(BoidOrdering *o, double *states)
+{
+    int n = o->numBoids;
+    if (n <= 0)
+        return 0;
+    // o->slots doubles as the order until the maps are rebuilt.
+    if (mortonOrderBoids(o, &states[0], &states[1], &states[2], BOID_STATE_SIZE, o->ids, n, o->slots) != 0)
+        return -1;
+    for (int k = 0; k < n; k++) {
+        memcpy(&o->tmpStates[k * BOID_STATE_SIZE], &states[o->slots[k] * BOID_STATE_SIZE],
+               BOID_STATE_SIZE * sizeof(double));
+    }
+    memcpy(states, o->tmpStates, (size_t)n * BOID_STATE_SIZE * sizeof(double));
+    for (int k = 0; k < n; k++) {
+        o->ids[k] = o->entries[k].id;
+        o->slots[o->ids[k]] = k;
+    }
+    return 0;
+}
+
+// - End of reorderBoidStates Function - //
+
+// ----------------------------- //
+
+// - gatherBoidStates Function - //
+
+void gatherBoidStates(const BoidOrdering *o, const double *states, double *out)
+{
+    for (int id = 0; id < o->numBoids; id++) {
+        memcpy(&out[id * BOID_STATE_SIZE], &states[o->slots[id] * BOID_STATE_SIZE],
+               BOID_STATE_SIZE * sizeof(double));
+    }
+}
+
+// - End of gatherBoidStates Function - //
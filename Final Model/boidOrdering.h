@@ -0,0 +1,61 @@
+#ifndef BOIDORDERING_H
+#define BOIDORDERING_H
+
+#include <stdint.h>
+#include "boidUpdate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Boids are reordered so that neighbours in space are neighbours in memory.
+// Sort keys interleave the bits of the positions quantised to
+// BOID_MORTON_BITS per axis over the flock's extent (a Morton or Z-order curve).
+#define BOID_MORTON_BITS 21
+
+typedef struct {
+    uint64_t key;               // Morton code of the boid's position
+    int id;                     // Global ID (breaks ties)
+    int index;                  // Position in the array being sorted
+} BoidMortonEntry;
+
+// Permutation between the slots of a reordered state array and the global boid
+// IDs, which stay those of the initial state. Starts as the identity.
+typedef struct {
+    int numBoids;
+    int *ids;                   // Global ID of the boid in each slot [numBoids]
+    int *slots;                 // Slot holding each global ID [numBoids]
+    BoidMortonEntry *entries;   // Sort workspace [entryCapacity]
+    int entryCapacity;
+    double *tmpStates;          // Permutation workspace [numBoids x 7]
+} BoidOrdering;
+
+// Initialises an empty ordering. No memory is allocated until the first reset.
+void initBoidOrdering(BoidOrdering *o);
+
+// Releases all memory held by the ordering.
+void freeBoidOrdering(BoidOrdering *o);
+
+// Sets the identity ordering for 'numBoids' boids.
+// Returns 0 on success, nonzero on allocation failure.
+int resetBoidOrdering(BoidOrdering *o, int numBoids);
+
+// Fills 'order' with 0..numBoids-1 sorted by the Morton code of the positions
+// read from x, y, z with the given element stride, ties going to the lower of
+// ids[] (or the lower index if ids is NULL). Only the sort workspace of 'o' is
+// used. Returns 0 on success, nonzero on allocation failure.
+int mortonOrderBoids(BoidOrdering *o, const double *x, const double *y, const double *z,
+                     int stride, const int *ids, int numBoids, int *order);
+
+// Permutes the o->numBoids states in place into Morton order and updates the
+// slot/ID maps. Returns 0 on success, nonzero on allocation failure.
+int reorderBoidStates(BoidOrdering *o, double *states);
+
+// Copies 'states' (in slot order) to 'out' in global ID order.
+void gatherBoidStates(const BoidOrdering *o, const double *states, double *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOIDORDERING_H
@@ -0,0 +1,235 @@
+#include "boidProfile.h"
+
+#include <time.h>
+
+double wallSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+#if BOIDS_PROFILE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_MAX_THREADS 64
+
+static const char *phaseNames[BOID_NUM_PHASES] = {
+    "step", "search", "forces", "record", "publish", "receive", "output"
+};
+
+typedef struct {
+    double start, end;          // Seconds since startBoidProfile
+    int phase;
+    int peer;
+    int step;
+    int thread;                 // Index in 'threads'
+} ProfileSpan;
+
+typedef struct {
+    long count;
+    double total;
+    double max;
+    int maxStep;                // Step of the longest span
+} ProfileStats;
+
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+static int profiling = 0;
+static int profileRank = 0;
+static int profileStep = 0;
+static double profileOrigin = 0.0;
+
+static ProfileSpan *spans = NULL;
+static long numSpans = 0;
+static long spanCapacity = 0;
+
+static pthread_t threads[PROFILE_MAX_THREADS];
+static int numThreads = 0;
+
+static ProfileStats phaseStats[BOID_NUM_PHASES];
+static ProfileStats *peerStats = NULL;      // Receive waits by sending rank
+static int numPeers = 0;
+
+// - Recording Functions - //
+
+double boidProfileNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+void startBoidProfile(int rank)
+{
+    pthread_mutex_lock(&profileLock);
+    profiling     = 1;
+    profileRank   = rank;
+    profileStep   = 0;
+    profileOrigin = boidProfileNow();
+    numSpans      = 0;
+    numThreads    = 0;
+    memset(phaseStats, 0, sizeof(phaseStats));
+    pthread_mutex_unlock(&profileLock);
+}
+
+void setBoidProfileStep(int step)
+{
+    pthread_mutex_lock(&profileLock);
+    profileStep = step;
+    pthread_mutex_unlock(&profileLock);
+}
+
+static void addStats(ProfileStats *s, double seconds, int step)
+{
+    if (s->count == 0 || seconds > s->max) {
+        s->max = seconds;
+        s->maxStep = step;
+    }
+    s->count++;
+    s->total += seconds;
+}
+
+static int threadIndex(void)
+{
+    pthread_t self = pthread_self();
+    for (int t = 0; t < numThreads; t++) {
+        if (pthread_equal(threads[t], self))
+            return t;
+    }
+    if (numThreads == PROFILE_MAX_THREADS)
+        return PROFILE_MAX_THREADS - 1;
+    threads[numThreads] = self;
+    return numThreads++;
+}
+
+void recordBoidProfileSpan(int phase, int peer, double start, double end)
+{
+    pthread_mutex_lock(&profileLock);
+    if (!profiling || phase < 0 || phase >= BOID_NUM_PHASES) {
+        pthread_mutex_unlock(&profileLock);
+        return;
+    }
+    if (numSpans == spanCapacity) {
+        long capacity = spanCapacity > 0 ? 2 * spanCapacity : 4096;
+        ProfileSpan *grown = (ProfileSpan*)realloc(spans, capacity * sizeof(ProfileSpan));
+        if (!grown) {
+            pthread_mutex_unlock(&profileLock);
+            return;
+        }
+        spans = grown;
+        spanCapacity = capacity;
+    }
+    ProfileSpan *s = &spans[numSpans++];
+    s->start  = start - profileOrigin;
+    s->end    = end - profileOrigin;
+    s->phase  = phase;
+    s->peer   = peer;
+    s->step   = profileStep;
+    s->thread = threadIndex();
+
+    addStats(&phaseStats[phase], end - start, profileStep);
+    // The fanout exchange also delivers a rank's own frames back to it.
+    if (phase == BOID_PHASE_RECEIVE && peer >= 0 && peer != profileRank) {
+        if (peer >= numPeers) {
+            ProfileStats *grown = (ProfileStats*)realloc(peerStats, (peer + 1) * sizeof(ProfileStats));
+            if (grown) {
+                memset(&grown[numPeers], 0, (peer + 1 - numPeers) * sizeof(ProfileStats));
+                peerStats = grown;
+                numPeers = peer + 1;
+            }
+        }
+        if (peer < numPeers)
+            addStats(&peerStats[peer], end - start, profileStep);
+    }
+    pthread_mutex_unlock(&profileLock);
+}
+
+// - End of Recording Functions - //
+
+// ----------------------------- //
+
+// - writeBoidProfile Function - //
+
+static void writeStats(FILE *fp, const ProfileStats *s)
+{
+    fprintf(fp, "{\"count\": %ld, \"totalSeconds\": %.9f, \"meanSeconds\": %.9f, "
+                "\"maxSeconds\": %.9f, \"maxStep\": %d}",
+            s->count, s->total, s->count > 0 ? s->total / s->count : 0.0, s->max, s->maxStep);
+}
+
+static int writeSummary(const char *path, double elapsed)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return -1;
+    fprintf(fp, "{\n  \"rank\": %d,\n  \"steps\": %d,\n  \"wallSeconds\": %.6f,\n  \"phases\": {\n",
+            profileRank, profileStep, elapsed);
+    for (int phase = 0; phase < BOID_NUM_PHASES; phase++) {
+        fprintf(fp, "    \"%s\": ", phaseNames[phase]);
+        writeStats(fp, &phaseStats[phase]);
+        fprintf(fp, "%s\n", phase + 1 < BOID_NUM_PHASES ? "," : "");
+    }
+    fprintf(fp, "  },\n  \"receiveByRank\": {");
+    int first = 1;
+    for (int peer = 0; peer < numPeers; peer++) {
+        if (peerStats[peer].count == 0)
+            continue;
+        fprintf(fp, "%s\n    \"%d\": ", first ? "" : ",", peer);
+        writeStats(fp, &peerStats[peer]);
+        first = 0;
+    }
+    fprintf(fp, "%s}\n}\n", first ? "" : "\n  ");
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+// Chrome trace event format: one complete ("X") event per span, in
+// microseconds, with the rank as the process and the recording thread as the
+// thread.
+static int writeTrace(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return -1;
+    double originMicros = profileOrigin * 1e6;
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"rank %d\"}}",
+            profileRank, profileRank);
+    for (long k = 0; k < numSpans; k++) {
+        const ProfileSpan *s = &spans[k];
+        fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"boids\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                    "\"pid\": %d, \"tid\": %d, \"args\": {\"step\": %d",
+                phaseNames[s->phase], originMicros + s->start * 1e6, (s->end - s->start) * 1e6,
+                profileRank, s->thread, s->step);
+        if (s->peer >= 0)
+            fprintf(fp, ", \"peer\": %d", s->peer);
+        fprintf(fp, "}}");
+    }
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+int writeBoidProfile(const char *summaryPath, const char *tracePath)
+{
+    pthread_mutex_lock(&profileLock);
+    double elapsed = boidProfileNow() - profileOrigin;
+    profiling = 0;
+    int status = 0;
+    if (writeSummary(summaryPath, elapsed) != 0 || writeTrace(tracePath) != 0)
+        status = -1;
+    free(spans);
+    free(peerStats);
+    spans = NULL;
+    peerStats = NULL;
+    numSpans = spanCapacity = 0;
+    numPeers = 0;
+    pthread_mutex_unlock(&profileLock);
+    return status;
+}
+
+// - End of writeBoidProfile Function - //
+
+#endif // BOIDS_PROFILE
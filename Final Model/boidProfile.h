@@ -0,0 +1,73 @@
+#ifndef BOIDPROFILE_H
+#define BOIDPROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Monotonic wall-clock time in seconds, for timing runs and benchmarks.
+// Always available. clock() would count only CPU time and miss the time spent
+// blocked on other threads or on the broker.
+double wallSeconds(void);
+
+// Wall-clock timing of the phases of each step, built only when BOIDS_PROFILE
+// is defined to 1 (cmake -DBOIDS_PROFILE=ON). Otherwise the macros below
+// expand to nothing and boidProfile.c holds only wallSeconds.
+//
+// Spans are recorded per step and per thread, and the receive spans of the
+// transports are tagged with the rank the message came from, so a slow step
+// can be attributed to computation, to the broker or to a straggling rank.
+// writeBoidProfile exports a JSON summary and a Chrome trace (open it in
+// chrome://tracing or ui.perfetto.dev; the files of several ranks can be
+// loaded together since timestamps are wall-clock time).
+
+enum {
+    BOID_PHASE_STEP,            // A whole step, in the mains
+    BOID_PHASE_SEARCH,          // Neighbour search structure (grid, lists, octree, slab working set)
+    BOID_PHASE_FORCES,          // Neighbour sums and steering rules
+    BOID_PHASE_RECORD,          // Appending the step to the trajectory or history
+    BOID_PHASE_PUBLISH,         // Sending a frame
+    BOID_PHASE_RECEIVE,         // Waiting for a frame (tagged with the sender)
+    BOID_PHASE_OUTPUT,          // Writing the output files at the end
+    BOID_NUM_PHASES
+};
+
+#if BOIDS_PROFILE
+
+// Starts recording for 'rank' (0 outside distributed runs). Spans recorded
+// before this call are ignored.
+void startBoidProfile(int rank);
+
+// Sets the step that subsequent spans belong to.
+void setBoidProfileStep(int step);
+
+// Wall-clock time in seconds.
+double boidProfileNow(void);
+
+// Records a span of 'phase' from start to end (boidProfileNow times). 'peer'
+// is the other rank involved, or -1. Safe to call from any thread.
+void recordBoidProfileSpan(int phase, int peer, double start, double end);
+
+// Writes the per-phase summary to 'summaryPath' and the trace to 'tracePath'
+// and stops recording. Returns 0 on success, nonzero on error.
+int writeBoidProfile(const char *summaryPath, const char *tracePath);
+
+#define BOID_PROFILE_START(rank)          startBoidProfile(rank)
+#define BOID_PROFILE_BEGIN(t)             double t = boidProfileNow()
+#define BOID_PROFILE_END(t, phase, peer)  recordBoidProfileSpan((phase), (peer), (t), boidProfileNow())
+#define BOID_PROFILE_STEP(step)           setBoidProfileStep(step)
+
+#else
+
+#define BOID_PROFILE_START(rank)          ((void)0)
+#define BOID_PROFILE_BEGIN(t)             ((void)0)
+#define BOID_PROFILE_END(t, phase, peer)  ((void)0)
+#define BOID_PROFILE_STEP(step)           ((void)0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOIDPROFILE_H
@@ -0,0 +1,65 @@
+#include "boidRandom.h"
+
+// Philox4x32 multipliers and Weyl key increments.
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+// - philox4x32 Function - //
+
+// Inputs:
+//   - counter,  uint32_t, [4x1],  Counter to encrypt
+//   - key,      uint32_t, [2x1],  Key (the seed)
+//   - out,      uint32_t, [4x1],  Receives the random words
+
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+{
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t)p1;
+        c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// - End of philox4x32 Function - //
+
+// ----------------------------- //
+
+// - boidRandomUniforms Function - //
+
+// Inputs:
+//   - seed,    uint32_t, [1x1],  Simulation seed
+//   - stream,  uint32_t, [1x1],  Purpose of the draws (BOID_RANDOM_*)
+//   - index,   uint32_t, [1x1],  Item the draws belong to (e.g. boid ID)
+//   - out,     double,   [Nx1],  Receives the uniform values
+//   - count,   int,      [1x1],  Number of values
+
+void boidRandomUniforms(uint32_t seed, uint32_t stream, uint32_t index, double *out, int count)
+{
+    const uint32_t key[2] = { seed, 0u };
+    uint32_t counter[4] = { index, 0u, stream, 0u };
+    uint32_t words[4];
+    // Each block gives two values of 27 + 26 bits.
+    for (int k = 0; k < count; k += 2) {
+        counter[1] = (uint32_t)(k / 2);
+        philox4x32(counter, key, words);
+        out[k] = ((words[0] >> 5) * 67108864.0 + (words[1] >> 6)) * (1.0 / 9007199254740992.0);
+        if (k + 1 < count)
+            out[k + 1] = ((words[2] >> 5) * 67108864.0 + (words[3] >> 6)) * (1.0 / 9007199254740992.0);
+    }
+}
+
+// - End of boidRandomUniforms Function - //
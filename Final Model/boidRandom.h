@@ -0,0 +1,33 @@
+#ifndef BOIDRANDOM_H
+#define BOIDRANDOM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Counter-based random numbers (Philox4x32-10, Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"). Every draw is a pure function of the seed, a
+// stream, an index (usually the boid ID) and a block number, so any rank or
+// thread can generate any boid's numbers without sharing generator state, and
+// the results do not depend on how the work is divided.
+
+// Streams keep the draws of different purposes apart for the same seed.
+#define BOID_RANDOM_PARAMS 0    // Randomised simulation parameters (index 0)
+#define BOID_RANDOM_STATES 1    // Initial boid states (index = boid ID)
+
+// One Philox4x32-10 block: 'out' receives four random words for 'counter'
+// under 'key'.
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+
+// Fills out[0..count-1] with uniform doubles in [0, 1) (53 random bits each)
+// drawn for 'index' in 'stream' under 'seed'. The k-th value is the same
+// whatever 'count' is.
+void boidRandomUniforms(uint32_t seed, uint32_t stream, uint32_t index, double *out, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOIDRANDOM_H
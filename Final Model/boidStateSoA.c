@@ -0,0 +1,382 @@
+#include <stdlib.h>
+#include <string.h>
+#include "boidStateSoA.h"
+#include "boidProfile.h"
+
+// Pad each array to a whole number of cache lines within the shared block.
+#define SOA_ALIGN_DOUBLES 8
+
+// - initBoidStateSoA Function - //
+
+int initBoidStateSoA(BoidStateSoA *s, int numBoids)
+{
+    memset(s, 0, sizeof(*s));
+    size_t stride = ((size_t)numBoids + SOA_ALIGN_DOUBLES - 1) / SOA_ALIGN_DOUBLES * SOA_ALIGN_DOUBLES;
+    if (stride == 0)
+        stride = SOA_ALIGN_DOUBLES;
+    s->block = (double*)malloc(6 * stride * sizeof(double));
+    s->alive = (uint64_t*)calloc(((size_t)numBoids + 63) / 64 + 1, sizeof(uint64_t));
+    if (!s->block || !s->alive) {
+        freeBoidStateSoA(s);
+        return -1;
+    }
+    s->numBoids = numBoids;
+    s->posX = s->block;
+    s->posY = s->block + stride;
+    s->posZ = s->block + 2 * stride;
+    s->velX = s->block + 3 * stride;
+    s->velY = s->block + 4 * stride;
+    s->velZ = s->block + 5 * stride;
+    return 0;
+}
+
+// - End of initBoidStateSoA Function - //
+
+// ----------------------------- //
+
+// - freeBoidStateSoA Function - //
+
+void freeBoidStateSoA(BoidStateSoA *s)
+{
+    free(s->block);
+    free(s->alive);
+    memset(s, 0, sizeof(*s));
+}
+
+// - End of freeBoidStateSoA Function - //
+
+// ----------------------------- //
+
+// - boidStateFromFlat / boidStateToFlat Functions - //
+
+static void setAlive(BoidStateSoA *s, int i, int alive)
+{
+    uint64_t bit = (uint64_t)1 << (i & 63);
+    if (alive)
+        s->alive[i >> 6] |= bit;
+    else
+        s->alive[i >> 6] &= ~bit;
+}
+
+void boidStateFromFlat(BoidStateSoA *s, const double *allStates)
+{
+    for (int i = 0; i < s->numBoids; i++) {
+        const double *b = &allStates[i * BOID_STATE_SIZE];
+        s->posX[i] = b[0];
+        s->posY[i] = b[1];
+        s->posZ[i] = b[2];
+        s->velX[i] = b[3];
+        s->velY[i] = b[4];
+        s->velZ[i] = b[5];
+        setAlive(s, i, b[6] != 0.0);
+    }
+}
+
+void boidStateToFlat(const BoidStateSoA *s, double *allStates)
+{
+    for (int i = 0; i < s->numBoids; i++) {
+        double *b = &allStates[i * BOID_STATE_SIZE];
+        b[0] = s->posX[i];
+        b[1] = s->posY[i];
+        b[2] = s->posZ[i];
+        b[3] = s->velX[i];
+        b[4] = s->velY[i];
+        b[5] = s->velZ[i];
+        b[6] = boidIsAlive(s, i) ? 1.0 : 0.0;
+    }
+}
+
+// - End of boidStateFromFlat / boidStateToFlat Functions - //
+
+// ----------------------------- //
+
+// - storeBoid Function - //
+
+// Writes the 7-double result of applyBoidRules back into the arrays.
+static void storeBoid(BoidStateSoA *s, int i, const double out[BOID_STATE_SIZE])
+{
+    s->posX[i] = out[0];
+    s->posY[i] = out[1];
+    s->posZ[i] = out[2];
+    s->velX[i] = out[3];
+    s->velY[i] = out[4];
+    s->velZ[i] = out[5];
+    setAlive(s, i, out[6] != 0.0);
+}
+
+// - End of storeBoid Function - //
+
+// ----------------------------- //
+
+// - updateOneBoidSoA / updateOneBoidSoAKernel Functions - //
+
+void updateOneBoidSoA(BoidStateSoA *s, int i, const BoidParams *p)
+{
+    updateOneBoidSoAKernel(s, i, getNeighbourKernel(NEIGHBOUR_KERNEL_SCALAR), p);
+}
+
+void updateOneBoidSoAKernel(BoidStateSoA *s, int i, NeighbourKernelFn kernel, const BoidParams *p)
+{
+    if (!boidIsAlive(s, i))
+        return;
+
+    double pos[3] = { s->posX[i], s->posY[i], s->posZ[i] };
+    double vel[3] = { s->velX[i], s->velY[i], s->velZ[i] };
+    double visualSq = p->visualRange * p->visualRange;
+    double minSq    = p->minDistance * p->minDistance;
+
+    BoidNeighbourSums sums;
+    initNeighbourSums(&sums);
+    // Two ranges around i so the kernels never need a j == i test.
+    NeighbourRange ranges[2] = { { 0, i }, { i + 1, s->numBoids } };
+    kernel(s->posX, s->posY, s->posZ, s->velX, s->velY, s->velZ, ranges, 2, pos, visualSq, minSq, &sums);
+
+    double out[BOID_STATE_SIZE];
+    applyBoidRules(out, pos, vel, &sums, p);
+    storeBoid(s, i, out);
+}
+
+// - End of updateOneBoidSoA / updateOneBoidSoAKernel Functions - //
+
+// ----------------------------- //
+
+// - stepBoidsSubsetSoA Function - //
+
+// Grid-backed SoA step. Same search as updateOneBoidGrid: gather candidates from
+// the 27 surrounding cells, sort them, then accumulate in index order.
+
+int stepBoidsSubsetSoA(BoidStateSoA *s, int startIdx, int endIdx, NeighbourGrid *grid, const BoidParams *p)
+{
+    if (buildNeighbourGridCoords(grid, s->posX, s->posY, s->posZ, 1, s->numBoids,
+                                 neighbourGridCellSize(p)) != 0)
+        return -1;
+    int *scratch = (int*)malloc((s->numBoids > 0 ? s->numBoids : 1) * sizeof(int));
+    if (!scratch)
+        return -1;
+
+    double visualSq = p->visualRange * p->visualRange;
+    double minSq    = p->minDistance * p->minDistance;
+    double rangeSq  = visualSq > minSq ? visualSq : minSq;
+
+    for (int i = startIdx; i < endIdx; i++) {
+        if (!boidIsAlive(s, i))
+            continue;
+        double pos[3] = { s->posX[i], s->posY[i], s->posZ[i] };
+        double vel[3] = { s->velX[i], s->velY[i], s->velZ[i] };
+
+        int home = grid->boidCell[i];
+        int cx   = home % grid->dims[0];
+        int cy   = (home / grid->dims[0]) % grid->dims[1];
+        int cz   = home / (grid->dims[0] * grid->dims[1]);
+        int count = 0;
+        for (int z = cz - 1; z <= cz + 1; z++) {
+            if (z < 0 || z >= grid->dims[2])
+                continue;
+            for (int y = cy - 1; y <= cy + 1; y++) {
+                if (y < 0 || y >= grid->dims[1])
+                    continue;
+                for (int x = cx - 1; x <= cx + 1; x++) {
+                    if (x < 0 || x >= grid->dims[0])
+                        continue;
+                    int c = (z * grid->dims[1] + y) * grid->dims[0] + x;
+                    for (int k = grid->cellStart[c]; k < grid->cellStart[c + 1]; k++) {
+                        int j = grid->cellBoids[k];
+                        double dx = pos[0] - s->posX[j];
+                        double dy = pos[1] - s->posY[j];
+                        double dz = pos[2] - s->posZ[j];
+                        if (j != i && dx*dx + dy*dy + dz*dz < rangeSq)
+                            scratch[count++] = j;
+                    }
+                }
+            }
+        }
+        sortNeighbourIndices(scratch, count);
+
+        BoidNeighbourSums sums;
+        initNeighbourSums(&sums);
+        for (int k = 0; k < count; k++)
+            accumulateNeighboursScalar(s->posX, s->posY, s->posZ, s->velX, s->velY, s->velZ,
+                                       scratch[k], scratch[k] + 1, pos, visualSq, minSq, &sums);
+
+        double out[BOID_STATE_SIZE];
+        applyBoidRules(out, pos, vel, &sums, p);
+        storeBoid(s, i, out);
+    }
+    free(scratch);
+    return 0;
+}
+
+// - End of stepBoidsSubsetSoA Function - //
+
+// ----------------------------- //
+
+// - boidStateFromFlatByCell Function - //
+
+// Inputs:
+//   - s,           struct,         ,  Destination, holding grid->numBoids boids
+//   - allStates,   double, [Nx7]   ,  States 'grid' was built from
+//   - grid,        struct,         ,  Grid giving the order (grid->cellBoids)
+
+void boidStateFromFlatByCell(BoidStateSoA *s, const double *allStates, const NeighbourGrid *grid)
+{
+    for (int k = 0; k < grid->numBoids; k++) {
+        const double *b = &allStates[grid->cellBoids[k] * BOID_STATE_SIZE];
+        s->posX[k] = b[0];
+        s->posY[k] = b[1];
+        s->posZ[k] = b[2];
+        s->velX[k] = b[3];
+        s->velY[k] = b[4];
+        s->velZ[k] = b[5];
+        setAlive(s, k, b[6] != 0.0);
+    }
+}
+
+// - End of boidStateFromFlatByCell Function - //
+
+// ----------------------------- //
+
+// - updateOneBoidGridKernel / updateOneBoidGridKernelSync Functions - //
+
+// Inputs:
+//   - srcStates,   double, [Nx7]   ,  States read for boid i
+//   - dstStates,   double, [Nx7]   ,  States written for boid i (may equal srcStates)
+//   - i,           int,    [1x1]   ,  Index of the boid to update
+//   - grid,        struct,         ,  Grid built at the start of the step
+//   - cells,       struct,         ,  Neighbour states in grid cell order
+//   - kernel,      function,       ,  Neighbour accumulation kernel
+//   - BoidParams,  struct,         ,  Simulation parameters
+//   - store,       struct,         ,  'cells' when updating in place (the result is
+//                                     stored there too), otherwise NULL
+
+// Cells along x are adjacent in cellBoids, so each of the 9 rows of three cells
+// around boid i is one contiguous range of 'cells', and all of them go to the
+// kernel in one call. Boid i is found in its home cell and its row is split
+// around it, so the kernels need no j == i test.
+
+static void updateOneBoidGridKernelFrom(const double *srcStates, double *dstStates, int i,
+                                        const NeighbourGrid *grid, const BoidStateSoA *cells,
+                                        NeighbourKernelFn kernel, const BoidParams *p, BoidStateSoA *store)
+{
+    const double *myState = &srcStates[i * BOID_STATE_SIZE];
+    double *outState      = &dstStates[i * BOID_STATE_SIZE];
+    if (myState[6] == 0.0) {
+        if (outState != myState)
+            memcpy(outState, myState, BOID_STATE_SIZE * sizeof(double));
+        return;
+    }
+
+    double pos[3] = { myState[0], myState[1], myState[2] };
+    double vel[3] = { myState[3], myState[4], myState[5] };
+    double visualSq = p->visualRange * p->visualRange;
+    double minSq    = p->minDistance * p->minDistance;
+
+    int home = grid->boidCell[i];
+    int self = grid->cellStart[home];
+    while (grid->cellBoids[self] != i)
+        self++;
+    int cx = home % grid->dims[0];
+    int cy = (home / grid->dims[0]) % grid->dims[1];
+    int cz = home / (grid->dims[0] * grid->dims[1]);
+    int x0 = cx > 0 ? cx - 1 : 0;
+    int x1 = cx < grid->dims[0] - 1 ? cx + 1 : cx;
+
+    NeighbourRange ranges[10];
+    int numRanges = 0;
+    for (int z = cz - 1; z <= cz + 1; z++) {
+        if (z < 0 || z >= grid->dims[2])
+            continue;
+        for (int y = cy - 1; y <= cy + 1; y++) {
+            if (y < 0 || y >= grid->dims[1])
+                continue;
+            int row = (z * grid->dims[1] + y) * grid->dims[0];
+            int j0 = grid->cellStart[row + x0];
+            int j1 = grid->cellStart[row + x1 + 1];
+            if (self >= j0 && self < j1) {
+                ranges[numRanges].j0 = j0;
+                ranges[numRanges].j1 = self;
+                numRanges++;
+                j0 = self + 1;
+            }
+            ranges[numRanges].j0 = j0;
+            ranges[numRanges].j1 = j1;
+            numRanges++;
+        }
+    }
+    BoidNeighbourSums sums;
+    initNeighbourSums(&sums);
+    kernel(cells->posX, cells->posY, cells->posZ, cells->velX, cells->velY, cells->velZ,
+           ranges, numRanges, pos, visualSq, minSq, &sums);
+
+    applyBoidRules(outState, pos, vel, &sums, p);
+    if (store)
+        storeBoid(store, self, outState);
+}
+
+void updateOneBoidGridKernel(double *allStates, int i, const NeighbourGrid *grid, BoidStateSoA *cells,
+                             NeighbourKernelFn kernel, const BoidParams *p)
+{
+    updateOneBoidGridKernelFrom(allStates, allStates, i, grid, cells, kernel, p, cells);
+}
+
+void updateOneBoidGridKernelSync(const double *prevStates, double *nextStates, int i,
+                                 const NeighbourGrid *grid, const BoidStateSoA *cells,
+                                 NeighbourKernelFn kernel, const BoidParams *p)
+{
+    updateOneBoidGridKernelFrom(prevStates, nextStates, i, grid, cells, kernel, p, NULL);
+}
+
+// - End of updateOneBoidGridKernel / updateOneBoidGridKernelSync Functions - //
+
+// ----------------------------- //
+
+// - stepBoidsSubsetGridKernel / stepBoidsSubsetGridKernelSync Functions - //
+
+// Rebuilds the grid and its cell-ordered copy of the states. 'cells' is
+// reallocated when the number of boids changes.
+static int buildKernelGrid(const double *allStates, int numBoids, NeighbourGrid *grid,
+                           BoidStateSoA *cells, const BoidParams *p)
+{
+    if (buildNeighbourGrid(grid, allStates, numBoids, neighbourGridCellSize(p)) != 0)
+        return -1;
+    if (cells->numBoids != numBoids) {
+        freeBoidStateSoA(cells);
+        if (initBoidStateSoA(cells, numBoids) != 0)
+            return -1;
+    }
+    boidStateFromFlatByCell(cells, allStates, grid);
+    return 0;
+}
+
+int stepBoidsSubsetGridKernel(double *allStates, int numBoids, int startIdx, int endIdx,
+                              NeighbourGrid *grid, BoidStateSoA *cells, NeighbourKernelFn kernel,
+                              const BoidParams *p)
+{
+    BOID_PROFILE_BEGIN(searchStart);
+    if (buildKernelGrid(allStates, numBoids, grid, cells, p) != 0)
+        return -1;
+    BOID_PROFILE_END(searchStart, BOID_PHASE_SEARCH, -1);
+    BOID_PROFILE_BEGIN(forcesStart);
+    for (int i = startIdx; i < endIdx; i++) {
+        updateOneBoidGridKernel(allStates, i, grid, cells, kernel, p);
+    }
+    BOID_PROFILE_END(forcesStart, BOID_PHASE_FORCES, -1);
+    return 0;
+}
+
+int stepBoidsSubsetGridKernelSync(const double *prevStates, double *nextStates, int numBoids,
+                                  int startIdx, int endIdx, NeighbourGrid *grid, BoidStateSoA *cells,
+                                  NeighbourKernelFn kernel, const BoidParams *p)
+{
+    BOID_PROFILE_BEGIN(searchStart);
+    if (buildKernelGrid(prevStates, numBoids, grid, cells, p) != 0)
+        return -1;
+    BOID_PROFILE_END(searchStart, BOID_PHASE_SEARCH, -1);
+    BOID_PROFILE_BEGIN(forcesStart);
+    for (int i = startIdx; i < endIdx; i++) {
+        updateOneBoidGridKernelSync(prevStates, nextStates, i, grid, cells, kernel, p);
+    }
+    BOID_PROFILE_END(forcesStart, BOID_PHASE_FORCES, -1);
+    return 0;
+}
+
+// - End of stepBoidsSubsetGridKernel / stepBoidsSubsetGridKernelSync Functions - //
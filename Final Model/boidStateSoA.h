@@ -0,0 +1,89 @@
+#ifndef BOIDSTATESOA_H
+#define BOIDSTATESOA_H
+
+#include <stdint.h>
+#include "boidUpdate.h"
+#include "neighbourGrid.h"
+#include "boidKernels.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Structure-of-arrays boid state. The neighbour loop only touches the six
+// position/velocity arrays; the crash flag is packed one bit per boid.
+typedef struct {
+    int numBoids;               // Number of boids held
+    double *posX;               // Positions [numBoids]
+    double *posY;
+    double *posZ;
+    double *velX;               // Velocities [numBoids]
+    double *velY;
+    double *velZ;
+    uint64_t *alive;            // Bit i set while boid i is flying [(numBoids + 63) / 64]
+    double *block;              // Single allocation backing the six arrays
+} BoidStateSoA;
+
+// Allocates storage for numBoids boids. Returns 0 on success, nonzero on error.
+int initBoidStateSoA(BoidStateSoA *s, int numBoids);
+
+// Releases the storage held by s.
+void freeBoidStateSoA(BoidStateSoA *s);
+
+// Copies the flat 7-double layout into s (s->numBoids boids).
+void boidStateFromFlat(BoidStateSoA *s, const double *allStates);
+
+// Copies s back into the flat 7-double layout used by messaging and output.
+void boidStateToFlat(const BoidStateSoA *s, double *allStates);
+
+// Returns nonzero if boid i has not crashed.
+static inline int boidIsAlive(const BoidStateSoA *s, int i)
+{
+    return (int)((s->alive[i >> 6] >> (i & 63)) & 1u);
+}
+
+// Updates boid i in place using an all-pairs scan over the SoA arrays.
+// Matches updateOneBoid on the equivalent flat array bit for bit.
+void updateOneBoidSoA(BoidStateSoA *s, int i, const BoidParams *p);
+
+// As updateOneBoidSoA, but accumulates neighbours with the given kernel
+// (see boidKernels.h, e.g. activeNeighbourKernel()).
+void updateOneBoidSoAKernel(BoidStateSoA *s, int i, NeighbourKernelFn kernel, const BoidParams *p);
+
+// Updates boids startIdx..endIdx-1 in place using a grid rebuilt from s.
+// 'grid' is reused between calls. Returns 0 on success, nonzero on allocation failure.
+int stepBoidsSubsetSoA(BoidStateSoA *s, int startIdx, int endIdx, NeighbourGrid *grid, const BoidParams *p);
+
+// Copies the flat states 'grid' was built from into s (grid->numBoids boids) in
+// grid cell order: entry k holds boid grid->cellBoids[k].
+void boidStateFromFlatByCell(BoidStateSoA *s, const double *allStates, const NeighbourGrid *grid);
+
+// Grid search summed with a neighbour kernel (see boidKernels.h). 'cells' holds
+// the states in grid cell order (boidStateFromFlatByCell), so the 9 rows of
+// three cells around a boid are contiguous ranges, passed to the kernel in one
+// call. Neighbours are summed in cell order, lane by lane: results differ from
+// updateOneBoidGrid in the last bits, but do not depend on thread count,
+// chunking or reordering.
+// The in-place variant also stores boid i's result in 'cells', so boids
+// updated later in the step see it, as with updateOneBoidGrid.
+void updateOneBoidGridKernel(double *allStates, int i, const NeighbourGrid *grid, BoidStateSoA *cells,
+                             NeighbourKernelFn kernel, const BoidParams *p);
+void updateOneBoidGridKernelSync(const double *prevStates, double *nextStates, int i,
+                                 const NeighbourGrid *grid, const BoidStateSoA *cells,
+                                 NeighbourKernelFn kernel, const BoidParams *p);
+
+// As stepBoidsSubsetGrid / stepBoidsSubsetGridSync, accumulating with 'kernel'.
+// 'cells' must be initialised (initBoidStateSoA) and is reallocated if it does
+// not hold numBoids boids. Returns 0 on success, nonzero on allocation failure.
+int stepBoidsSubsetGridKernel(double *allStates, int numBoids, int startIdx, int endIdx,
+                              NeighbourGrid *grid, BoidStateSoA *cells, NeighbourKernelFn kernel,
+                              const BoidParams *p);
+int stepBoidsSubsetGridKernelSync(const double *prevStates, double *nextStates, int numBoids,
+                                  int startIdx, int endIdx, NeighbourGrid *grid, BoidStateSoA *cells,
+                                  NeighbourKernelFn kernel, const BoidParams *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOIDSTATESOA_H
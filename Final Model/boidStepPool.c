@@ -0,0 +1,365 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "boidStepPool.h"
+#include "boidProfile.h"
+
+// Neighbour search used by a step, chosen from the pool settings.
+#define SEARCH_GRID   0         // Grid rebuilt every step
+#define SEARCH_LISTS  1         // Verlet lists
+#define SEARCH_PAIRS  2         // Symmetric sweep over half lists
+#define SEARCH_OCTREE 3         // Octree aggregates
+
+// - Chunk Queue Functions - //
+
+// Owner side: take the next chunk from the front of worker w's queue.
+static int takeOwnChunk(BoidStepQueue *q)
+{
+    int chunk = -1;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail)
+        chunk = q->head++;
+    pthread_mutex_unlock(&q->lock);
+    return chunk;
+}
+
+// Thief side: take one chunk from the back of another worker's queue. Chunks
+// are never added during a step, so one empty pass means the step is drained.
+static int stealChunk(BoidStepPool *pool, int w)
+{
+    for (int k = 1; k < pool->numThreads; k++) {
+        BoidStepQueue *victim = &pool->queues[(w + k) % pool->numThreads];
+        int chunk = -1;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail)
+            chunk = --victim->tail;
+        pthread_mutex_unlock(&victim->lock);
+        if (chunk >= 0)
+            return chunk;
+    }
+    return -1;
+}
+
+// - End of Chunk Queue Functions - //
+
+// ----------------------------- //
+
+// - runWorker Function - //
+
+// Processes chunks for worker w until no unclaimed chunk remains anywhere.
+// The first pass of a symmetric step marks the pairs of each chunk's boids.
+
+static void runWorker(BoidStepPool *pool, int w)
+{
+    BoidStepQueue *own = &pool->queues[w];
+    for (;;) {
+        int chunk = takeOwnChunk(own);
+        if (chunk < 0) {
+            chunk = stealChunk(pool, w);
+            if (chunk < 0)
+                break;
+            own->chunksStolen++;
+        }
+        int start = chunk * pool->chunkSize;
+        int end   = start + pool->chunkSize;
+        if (end > pool->numBoids)
+            end = pool->numBoids;
+        if (pool->pairSweep) {
+            markNeighbourPairs(pool->prevStates, start, end, &pool->lists, pool->pairFlags, pool->params);
+            own->chunksDone++;
+            continue;
+        }
+        switch (pool->search) {
+        case SEARCH_PAIRS:
+            for (int i = start; i < end; i++) {
+                updateOneBoidPairsSync(pool->prevStates, pool->nextStates, i, &pool->lists,
+                                       pool->pairFlags, pool->params);
+            }
+            break;
+        case SEARCH_LISTS:
+            for (int i = start; i < end; i++) {
+                updateOneBoidListSync(pool->prevStates, pool->nextStates, i, &pool->lists, pool->params);
+            }
+            break;
+        case SEARCH_OCTREE:
+            for (int i = start; i < end; i++) {
+                updateOneBoidOctreeSync(pool->prevStates, pool->nextStates, i, &pool->octree,
+                                        pool->octreeTheta, pool->params);
+            }
+            break;
+        default:
+            if (pool->kernel) {
+                for (int i = start; i < end; i++) {
+                    updateOneBoidGridKernelSync(pool->prevStates, pool->nextStates, i, &pool->grid,
+                                                &pool->cells, pool->kernel, pool->params);
+                }
+                break;
+            }
+            for (int i = start; i < end; i++) {
+                updateOneBoidGridSync(pool->prevStates, pool->nextStates, i, &pool->grid, own->scratch, pool->params);
+            }
+            break;
+        }
+        own->chunksDone++;
+    }
+}
+
+// - End of runWorker Function - //
+
+// ----------------------------- //
+
+// - workerMain Function - //
+
+typedef struct {
+    BoidStepPool *pool;
+    int index;
+} WorkerArg;
+
+static void *workerMain(void *argPtr)
+{
+    WorkerArg arg = *(WorkerArg*)argPtr;
+    free(argPtr);
+    BoidStepPool *pool = arg.pool;
+
+    // Pools start at generation 0; a step may be posted before this thread
+    // first takes the lock, so do not read the current generation here.
+    long seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->shutdown && pool->generation == seen)
+            pthread_cond_wait(&pool->startCond, &pool->lock);
+        if (pool->shutdown)
+            break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        runWorker(pool, arg.index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->doneCond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// - End of workerMain Function - //
+
+// ----------------------------- //
+
+// - initBoidStepPool Function - //
+
+int initBoidStepPool(BoidStepPool *pool, int numThreads, int chunkSize)
+{
+    memset(pool, 0, sizeof(*pool));
+    if (numThreads <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = online > 0 ? (int)online : 1;
+    }
+    pool->numThreads = numThreads;
+    pool->chunkSize  = chunkSize > 0 ? chunkSize : BOID_STEP_CHUNK;
+    initNeighbourGrid(&pool->grid);
+    initNeighbourList(&pool->lists);
+    initBoidOrdering(&pool->ordering);
+    initBoidOctree(&pool->octree);
+
+    pool->queues = (BoidStepQueue*)calloc(numThreads, sizeof(BoidStepQueue));
+    pool->threads = (pthread_t*)calloc(numThreads, sizeof(pthread_t));
+    if (!pool->queues || !pool->threads) {
+        free(pool->queues);
+        free(pool->threads);
+        return -1;
+    }
+    for (int w = 0; w < numThreads; w++)
+        pthread_mutex_init(&pool->queues[w].lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->startCond, NULL);
+    pthread_cond_init(&pool->doneCond, NULL);
+
+    for (int w = 1; w < numThreads; w++) {
+        WorkerArg *arg = (WorkerArg*)malloc(sizeof(WorkerArg));
+        if (arg) {
+            arg->pool  = pool;
+            arg->index = w;
+        }
+        if (!arg || pthread_create(&pool->threads[w - 1], NULL, workerMain, arg) != 0) {
+            free(arg);
+            pool->numThreads = w;   // Only join the threads that started.
+            freeBoidStepPool(pool);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// - End of initBoidStepPool Function - //
+
+// ----------------------------- //
+
+// - freeBoidStepPool Function - //
+
+void freeBoidStepPool(BoidStepPool *pool)
+{
+    if (!pool->queues)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->startCond);
+    pthread_mutex_unlock(&pool->lock);
+    for (int w = 1; w < pool->numThreads; w++)
+        pthread_join(pool->threads[w - 1], NULL);
+
+    for (int w = 0; w < pool->numThreads; w++) {
+        pthread_mutex_destroy(&pool->queues[w].lock);
+        free(pool->queues[w].scratch);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->startCond);
+    pthread_cond_destroy(&pool->doneCond);
+    freeNeighbourGrid(&pool->grid);
+    freeBoidStateSoA(&pool->cells);
+    freeNeighbourList(&pool->lists);
+    freeBoidOrdering(&pool->ordering);
+    freeBoidOctree(&pool->octree);
+    free(pool->pairFlags);
+    free(pool->queues);
+    free(pool->threads);
+    memset(pool, 0, sizeof(*pool));
+}
+
+// - End of freeBoidStepPool Function - //
+
+// ----------------------------- //
+
+// - runPoolPass Function - //
+
+// Deals contiguous runs of chunks to the queues so each worker starts on nearby
+// boids, posts the work described in the pool to the helper threads, takes
+// part as worker 0 and waits for every worker to finish.
+
+static void runPoolPass(BoidStepPool *pool)
+{
+    for (int w = 0; w < pool->numThreads; w++) {
+        pool->queues[w].head = (int)((long)pool->numChunks * w / pool->numThreads);
+        pool->queues[w].tail = (int)((long)pool->numChunks * (w + 1) / pool->numThreads);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running = pool->numThreads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->startCond);
+    pthread_mutex_unlock(&pool->lock);
+
+    runWorker(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running--;
+    while (pool->running > 0)
+        pthread_cond_wait(&pool->doneCond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// - End of runPoolPass Function - //
+
+// ----------------------------- //
+
+// - stepBoidsParallel Function - //
+
+// Inputs:
+//   - pool,        struct,      ,  Running step pool
+//   - buffers,     struct,      ,  Double-buffered boid state (swapped on return)
+//   - BoidParams,  struct,      ,  Simulation parameters
+
+int stepBoidsParallel(BoidStepPool *pool, BoidStateBuffers *buffers, const BoidParams *p)
+{
+    int numBoids = buffers->numBoids;
+    BOID_PROFILE_BEGIN(searchStart);
+
+    // Neighbours are still accumulated in global ID order after a reordering,
+    // so the result does not depend on where the boids sit in memory.
+    if (pool->reorderInterval > 0) {
+        if (pool->ordering.numBoids != numBoids && resetBoidOrdering(&pool->ordering, numBoids) != 0)
+            return -1;
+        if (pool->stepsTaken % pool->reorderInterval == 0) {
+            if (reorderBoidStates(&pool->ordering, buffers->prev) != 0)
+                return -1;
+            invalidateNeighbourList(&pool->lists);
+        }
+        pool->grid.ordering  = &pool->ordering;
+        pool->lists.ordering = &pool->ordering;
+    }
+    pool->stepsTaken++;
+
+    int search = SEARCH_GRID;
+    if (pool->useOctree)
+        search = SEARCH_OCTREE;
+    else if (pool->symmetricPairs)
+        search = SEARCH_PAIRS;
+    else if (pool->neighbourSkin > 0.0)
+        search = SEARCH_LISTS;
+
+    if (search == SEARCH_OCTREE) {
+        if (buildBoidOctree(&pool->octree, buffers->prev, numBoids) != 0)
+            return -1;
+    } else if (search == SEARCH_PAIRS || search == SEARCH_LISTS) {
+        if (updateNeighbourList(&pool->lists, buffers->prev, numBoids, pool->neighbourSkin,
+                                search == SEARCH_PAIRS, p) < 0)
+            return -1;
+    } else {
+        if (buildNeighbourGrid(&pool->grid, buffers->prev, numBoids, neighbourGridCellSize(p)) != 0)
+            return -1;
+        if (pool->kernel) {
+            if (pool->cells.numBoids != numBoids) {
+                freeBoidStateSoA(&pool->cells);
+                if (initBoidStateSoA(&pool->cells, numBoids) != 0)
+                    return -1;
+            }
+            boidStateFromFlatByCell(&pool->cells, buffers->prev, &pool->grid);
+        }
+    }
+    BOID_PROFILE_END(searchStart, BOID_PHASE_SEARCH, -1);
+
+    // Workers are idle here, so their scratch space can be resized safely.
+    for (int w = 0; w < pool->numThreads; w++) {
+        BoidStepQueue *q = &pool->queues[w];
+        if (q->scratchCapacity < numBoids) {
+            int *scratch = (int*)realloc(q->scratch, numBoids * sizeof(int));
+            if (!scratch)
+                return -1;
+            q->scratch = scratch;
+            q->scratchCapacity = numBoids;
+        }
+    }
+    if (search == SEARCH_PAIRS && pool->pairFlagsCapacity < pool->lists.entries) {
+        unsigned char *pairFlags = (unsigned char*)realloc(pool->pairFlags, pool->lists.entries);
+        if (!pairFlags)
+            return -1;
+        pool->pairFlags = pairFlags;
+        pool->pairFlagsCapacity = pool->lists.entries;
+    }
+    for (int w = 0; w < pool->numThreads; w++) {
+        pool->queues[w].chunksDone = 0;
+        pool->queues[w].chunksStolen = 0;
+    }
+    int numChunks = (numBoids + pool->chunkSize - 1) / pool->chunkSize;
+
+    pool->prevStates = buffers->prev;
+    pool->nextStates = buffers->next;
+    pool->numBoids   = numBoids;
+    pool->numChunks  = numChunks;
+    pool->params     = p;
+    pool->search     = search;
+    BOID_PROFILE_BEGIN(forcesStart);
+    if (search == SEARCH_PAIRS) {
+        pool->pairSweep = 1;
+        runPoolPass(pool);
+        pool->pairSweep = 0;
+    }
+    runPoolPass(pool);
+    BOID_PROFILE_END(forcesStart, BOID_PHASE_FORCES, -1);
+
+    swapBoidStateBuffers(buffers);
+    return 0;
+}
+
+// - End of stepBoidsParallel Function - //
@@ -0,0 +1,100 @@
+#ifndef BOIDSTEPPOOL_H
+#define BOIDSTEPPOOL_H
+
+#include <pthread.h>
+#include "boidOctree.h"
+#include "boidOrdering.h"
+#include "boidStateSoA.h"
+#include "boidUpdate.h"
+#include "neighbourGrid.h"
+#include "neighbourList.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Default number of boids per work item handed to a thread.
+#define BOID_STEP_CHUNK 256
+
+// Range of chunk indices owned by one worker. The owner takes chunks from the
+// front; idle workers steal from the back.
+typedef struct {
+    pthread_mutex_t lock;
+    int head;                   // Next chunk the owner will take
+    int tail;                   // One past the last unclaimed chunk
+    int *scratch;               // Candidate workspace for the grid search [scratchCapacity]
+    int scratchCapacity;
+    long chunksDone;            // Chunks this worker processed (own + stolen) in the last step
+    long chunksStolen;          // Chunks this worker stole in the last step
+} BoidStepQueue;
+
+// Persistent pool of worker threads that advances a BoidStateBuffers by one
+// synchronous step at a time. The calling thread acts as worker 0, so a pool
+// of one thread starts no extra threads. Setting neighbourSkin after
+// initBoidStepPool switches the neighbour search to Verlet lists, setting
+// symmetricPairs evaluates each pair once on half lists (see neighbourList.h)
+// and then sums and applies the rules in a second pass, setting useOctree searches an
+// octree instead (taking precedence over both), setting kernel sums the grid
+// search with that neighbour kernel (see boidKernels.h), and setting
+// reorderInterval sorts the buffers into Morton order every that many steps.
+// The slots of a reordered buffer hold boids ordering.ids[slot]; use
+// gatherBoidStates to read them back in ID order.
+typedef struct {
+    int numThreads;             // Workers including the caller
+    int chunkSize;              // Boids per chunk
+    pthread_t *threads;         // Helper threads [numThreads - 1]
+    BoidStepQueue *queues;      // Per-worker chunk queues [numThreads]
+    NeighbourGrid grid;         // Grid rebuilt from 'prev' every step
+    NeighbourKernelFn kernel;   // Kernel for the grid search, or NULL for the exact scalar loop
+    BoidStateSoA cells;         // 'prev' in grid cell order when kernel is set
+    double neighbourSkin;       // Skin of the Verlet lists, or 0 to search the grid every step
+    NeighbourList lists;        // Verlet lists used when neighbourSkin > 0 or symmetricPairs is set
+    int symmetricPairs;         // Nonzero to evaluate each pair once on half lists
+    unsigned char *pairFlags;   // Flags of each half-list pair this step [pairFlagsCapacity]
+    long pairFlagsCapacity;
+    int useOctree;              // Nonzero to search an octree with aggregates (see boidOctree.h)
+    double octreeTheta;         // Opening angle of the octree search
+    BoidOctree octree;          // Octree rebuilt from 'prev' every step when useOctree is set
+    int reorderInterval;        // Steps between Morton reorderings of the boids, or 0 for none
+    BoidOrdering ordering;      // Slot/ID maps of the reordered boids (reorderInterval > 0)
+    long stepsTaken;            // Steps advanced by the pool
+
+    pthread_mutex_t lock;       // Protects the fields below
+    pthread_cond_t startCond;   // Signalled when a new step (or shutdown) is posted
+    pthread_cond_t doneCond;    // Signalled when the last worker finishes a step
+    long generation;            // Incremented for every posted step
+    int running;                // Workers still busy with the current step
+    int shutdown;               // Set to stop the helper threads
+
+    // Work description for the current step.
+    int search;                 // Neighbour search used by the step
+    int pairSweep;              // Nonzero while the workers mark the half-list pairs
+    const double *prevStates;
+    double *nextStates;
+    int numBoids;
+    int numChunks;
+    const BoidParams *params;
+} BoidStepPool;
+
+// Starts a pool with 'numThreads' workers (<= 0 selects the number of online
+// CPUs) and 'chunkSize' boids per chunk (<= 0 selects BOID_STEP_CHUNK).
+// Returns 0 on success, nonzero on error.
+int initBoidStepPool(BoidStepPool *pool, int numThreads, int chunkSize);
+
+// Stops the helper threads and releases the pool.
+void freeBoidStepPool(BoidStepPool *pool);
+
+// Advances all boids in 'buffers' by one step: reads buffers->prev, writes
+// buffers->next, then swaps them. The result is bit-identical for any thread
+// count, chunk size or reordering. A kernel sums neighbours in a different
+// order, so its results differ from the exact loop in the last bits, but they
+// too are the same for any thread count. The octree search approximates the
+// rules by design (see BoidOctree) but is reproducible for any thread count.
+// Returns 0 on success, nonzero on allocation failure.
+int stepBoidsParallel(BoidStepPool *pool, BoidStateBuffers *buffers, const BoidParams *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOIDSTEPPOOL_H
@@ -0,0 +1,388 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "boidTrajectory.h"
+#include "boidUpdate.h"
+
+// Size of each writer buffer; a buffer always holds at least one frame.
+#define TRAJECTORY_BUFFER_BYTES (4u << 20)
+
+// Values stored per boid in each frame.
+static int recordValues(int layout)
+{
+    return layout == BOID_TRAJECTORY_CRASH_EVENTS ? 3 : 4;
+}
+
+// - parseBoidTrajectoryDtype Function - //
+
+int parseBoidTrajectoryDtype(const char *name)
+{
+    if (strcmp(name, "f64") == 0) return BOID_TRAJECTORY_F64;
+    if (strcmp(name, "f32") == 0) return BOID_TRAJECTORY_F32;
+    return -1;
+}
+
+// - End of parseBoidTrajectoryDtype Function - //
+
+// ----------------------------- //
+
+// - writerMain Function - //
+
+// Writes each buffer handed over by appendBoidTrajectoryFrame until shutdown.
+
+static void *writerMain(void *arg)
+{
+    BoidTrajectoryWriter *w = (BoidTrajectoryWriter*)arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->shutdown && w->queued < 0)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (w->queued < 0)
+            break;
+        const unsigned char *buffer = w->buffers[w->queued];
+        size_t bytes = (size_t)w->queuedFrames * w->header.frameBytes;
+        pthread_mutex_unlock(&w->lock);
+
+        int failed = fwrite(buffer, 1, bytes, w->fp) != bytes;
+
+        pthread_mutex_lock(&w->lock);
+        if (failed)
+            w->status = -1;
+        w->queued = -1;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+// - End of writerMain Function - //
+
+// ----------------------------- //
+
+// - openBoidTrajectoryWriter Function - //
+
+// Inputs:
+//   - w,           struct,      ,  Writer to set up
+//   - path,        char*,       ,  File to create
+//   - dtype,       int,    [1x1],  BOID_TRAJECTORY_F64 or BOID_TRAJECTORY_F32
+//   - layout,      int,    [1x1],  BOID_TRAJECTORY_STATUS_FRAMES or BOID_TRAJECTORY_CRASH_EVENTS
+//   - numBoids,    int,    [1x1],  Boids recorded per frame
+//   - firstBoid,   int,    [1x1],  Global index of the first recorded boid
+//   - bounds,      double, [1x3],  Simulation bounds stored in the header
+
+int openBoidTrajectoryWriter(BoidTrajectoryWriter *w, const char *path, int dtype, int layout,
+                             int numBoids, int firstBoid, const double bounds[3])
+{
+    memset(w, 0, sizeof(*w));
+    w->queued = -1;
+    if ((dtype != BOID_TRAJECTORY_F64 && dtype != BOID_TRAJECTORY_F32) || numBoids < 1
+        || (layout != BOID_TRAJECTORY_STATUS_FRAMES && layout != BOID_TRAJECTORY_CRASH_EVENTS))
+        return -1;
+
+    BoidTrajectoryHeader *h = &w->header;
+    memcpy(h->magic, BOID_TRAJECTORY_MAGIC, sizeof(h->magic));
+    h->version    = BOID_TRAJECTORY_VERSION;
+    h->dtype      = (uint32_t)dtype;
+    h->numBoids   = numBoids;
+    h->firstBoid  = firstBoid;
+    h->layout     = layout;
+    h->bounds[0]  = bounds[0];
+    h->bounds[1]  = bounds[1];
+    h->bounds[2]  = bounds[2];
+    h->frameBytes = (uint64_t)numBoids * recordValues(layout)
+                  * (dtype == BOID_TRAJECTORY_F64 ? sizeof(double) : sizeof(float));
+
+    if (layout == BOID_TRAJECTORY_CRASH_EVENTS) {
+        w->crashed = (unsigned char*)calloc(numBoids, 1);
+        if (!w->crashed) {
+            closeBoidTrajectoryWriter(w);
+            return -1;
+        }
+    }
+
+    size_t frames = TRAJECTORY_BUFFER_BYTES / h->frameBytes;
+    w->framesPerBuffer = frames > 0 ? (int)frames : 1;
+    for (int b = 0; b < 2; b++) {
+        w->buffers[b] = (unsigned char*)malloc((size_t)w->framesPerBuffer * h->frameBytes);
+        if (!w->buffers[b]) {
+            closeBoidTrajectoryWriter(w);
+            return -1;
+        }
+    }
+
+    w->fp = fopen(path, "wb");
+    if (!w->fp || fwrite(h, sizeof(*h), 1, w->fp) != 1) {
+        closeBoidTrajectoryWriter(w);
+        return -1;
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->thread, NULL, writerMain, w) != 0) {
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+        closeBoidTrajectoryWriter(w);
+        return -1;
+    }
+    w->threadStarted = 1;
+    return 0;
+}
+
+// - End of openBoidTrajectoryWriter Function - //
+
+// ----------------------------- //
+
+// - appendBoidTrajectoryFrame / closeBoidTrajectoryWriter Functions - //
+
+// Hands the active buffer to the writer thread once the previous one has
+// been written, and switches to the other buffer.
+static int queueActiveBuffer(BoidTrajectoryWriter *w)
+{
+    pthread_mutex_lock(&w->lock);
+    while (w->queued >= 0)
+        pthread_cond_wait(&w->cond, &w->lock);
+    int status = w->status;
+    if (status == 0 && w->activeFrames > 0) {
+        w->queued = w->active;
+        w->queuedFrames = w->activeFrames;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    w->active = 1 - w->active;
+    w->activeFrames = 0;
+    return status;
+}
+
+// Records a crash event for each boid that crashed since the last frame.
+static int recordCrashes(BoidTrajectoryWriter *w, const double *states)
+{
+    for (int i = 0; i < w->header.numBoids; i++) {
+        if (w->crashed[i] || states[i * BOID_STATE_SIZE + 6] != 0.0)
+            continue;
+        if (w->numEvents == w->eventCapacity) {
+            int capacity = w->eventCapacity > 0 ? w->eventCapacity * 2 : 64;
+            BoidCrashEvent *grown = (BoidCrashEvent*)realloc(w->events, capacity * sizeof(BoidCrashEvent));
+            if (!grown)
+                return -1;
+            w->events = grown;
+            w->eventCapacity = capacity;
+        }
+        BoidCrashEvent *e = &w->events[w->numEvents++];
+        e->boid        = i;
+        e->step        = w->header.numSteps;
+        e->position[0] = states[i * BOID_STATE_SIZE + 0];
+        e->position[1] = states[i * BOID_STATE_SIZE + 1];
+        e->position[2] = states[i * BOID_STATE_SIZE + 2];
+        w->crashed[i]  = 1;
+    }
+    return 0;
+}
+
+int appendBoidTrajectoryFrame(BoidTrajectoryWriter *w, const double *allStates)
+{
+    const BoidTrajectoryHeader *h = &w->header;
+    const double *states = &allStates[(size_t)h->firstBoid * BOID_STATE_SIZE];
+    unsigned char *frame = w->buffers[w->active] + (size_t)w->activeFrames * h->frameBytes;
+    int values = recordValues(h->layout);
+
+    if (h->dtype == BOID_TRAJECTORY_F64) {
+        double *rec = (double*)frame;
+        for (int i = 0; i < h->numBoids; i++, rec += values) {
+            for (int c = 0; c < 3; c++)
+                rec[c] = states[i * BOID_STATE_SIZE + c];
+            if (values == 4)
+                rec[3] = states[i * BOID_STATE_SIZE + 6];
+        }
+    } else {
+        float *rec = (float*)frame;
+        for (int i = 0; i < h->numBoids; i++, rec += values) {
+            for (int c = 0; c < 3; c++)
+                rec[c] = (float)states[i * BOID_STATE_SIZE + c];
+            if (values == 4)
+                rec[3] = (float)states[i * BOID_STATE_SIZE + 6];
+        }
+    }
+    if (h->layout == BOID_TRAJECTORY_CRASH_EVENTS && recordCrashes(w, states) != 0)
+        return -1;
+    w->header.numSteps++;
+
+    if (++w->activeFrames == w->framesPerBuffer)
+        return queueActiveBuffer(w);
+    return 0;
+}
+
+int closeBoidTrajectoryWriter(BoidTrajectoryWriter *w)
+{
+    int status = 0;
+    if (w->threadStarted) {
+        status = queueActiveBuffer(w);
+        pthread_mutex_lock(&w->lock);
+        w->shutdown = 1;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+        if (w->status != 0)
+            status = w->status;
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+
+        // Crash events follow the last frame.
+        if (w->numEvents > 0 && fwrite(w->events, sizeof(BoidCrashEvent), w->numEvents, w->fp) != (size_t)w->numEvents)
+            status = -1;
+
+        // The step count goes in last, so a reader can tell a finished file.
+        if (fseek(w->fp, 0, SEEK_SET) != 0 || fwrite(&w->header, sizeof(w->header), 1, w->fp) != 1)
+            status = -1;
+    } else {
+        status = -1;
+    }
+    if (w->fp && fclose(w->fp) != 0)
+        status = -1;
+    free(w->buffers[0]);
+    free(w->buffers[1]);
+    free(w->crashed);
+    free(w->events);
+    memset(w, 0, sizeof(*w));
+    return status;
+}
+
+// - End of appendBoidTrajectoryFrame / closeBoidTrajectoryWriter Functions - //
+
+// ----------------------------- //
+
+// - openBoidTrajectory / closeBoidTrajectory Functions - //
+
+int openBoidTrajectory(BoidTrajectory *t, const char *path)
+{
+    memset(t, 0, sizeof(*t));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BoidTrajectoryHeader)) {
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+    t->data = (const unsigned char*)data;
+    t->mappedBytes = (size_t)st.st_size;
+
+    BoidTrajectoryHeader *h = &t->header;
+    memcpy(h, t->data, sizeof(*h));
+    size_t valueSize = h->dtype == BOID_TRAJECTORY_F64 ? sizeof(double) : sizeof(float);
+    if (memcmp(h->magic, BOID_TRAJECTORY_MAGIC, sizeof(h->magic)) != 0
+        || h->version != BOID_TRAJECTORY_VERSION
+        || (h->dtype != BOID_TRAJECTORY_F64 && h->dtype != BOID_TRAJECTORY_F32)
+        || (h->layout != BOID_TRAJECTORY_STATUS_FRAMES && h->layout != BOID_TRAJECTORY_CRASH_EVENTS)
+        || h->numBoids < 1
+        || h->frameBytes != (uint64_t)h->numBoids * recordValues(h->layout) * valueSize) {
+        closeBoidTrajectory(t);
+        return -1;
+    }
+
+    // Unfinished files have no step count (or events): use the complete frames present.
+    uint64_t available = (t->mappedBytes - sizeof(*h)) / h->frameBytes;
+    int finished = h->numSteps > 0 && (uint64_t)h->numSteps <= available;
+    if (!finished)
+        h->numSteps = (int32_t)available;
+    if (h->layout != BOID_TRAJECTORY_CRASH_EVENTS)
+        return 0;
+
+    // Rebuild each boid's crash step from the events after the last frame.
+    t->crashStep = (int*)malloc(h->numBoids * sizeof(int));
+    if (!t->crashStep) {
+        closeBoidTrajectory(t);
+        return -1;
+    }
+    for (int i = 0; i < h->numBoids; i++)
+        t->crashStep[i] = h->numSteps;
+    size_t eventsOffset = sizeof(*h) + (size_t)h->numSteps * h->frameBytes;
+    size_t numEvents = finished ? (t->mappedBytes - eventsOffset) / sizeof(BoidCrashEvent) : 0;
+    for (size_t k = 0; k < numEvents; k++) {
+        BoidCrashEvent e;
+        memcpy(&e, t->data + eventsOffset + k * sizeof(e), sizeof(e));
+        if (e.boid >= 0 && e.boid < h->numBoids && e.step >= 0 && e.step < t->crashStep[e.boid])
+            t->crashStep[e.boid] = e.step;
+    }
+    return 0;
+}
+
+void closeBoidTrajectory(BoidTrajectory *t)
+{
+    if (t->data)
+        munmap((void*)t->data, t->mappedBytes);
+    free(t->crashStep);
+    memset(t, 0, sizeof(*t));
+}
+
+// - End of openBoidTrajectory / closeBoidTrajectory Functions - //
+
+// ----------------------------- //
+
+// - readBoidTrajectoryRecord Function - //
+
+void readBoidTrajectoryRecord(const BoidTrajectory *t, int step, int boid, double record[4])
+{
+    const unsigned char *frame = t->data + sizeof(BoidTrajectoryHeader) + (size_t)step * t->header.frameBytes;
+    int values = recordValues(t->header.layout);
+    if (t->header.dtype == BOID_TRAJECTORY_F64) {
+        memcpy(record, (const double*)frame + (size_t)boid * values, values * sizeof(double));
+    } else {
+        const float *rec = (const float*)frame + (size_t)boid * values;
+        for (int c = 0; c < values; c++)
+            record[c] = (double)rec[c];
+    }
+    if (t->crashStep)
+        record[3] = step < t->crashStep[boid] ? 1.0 : 0.0;
+}
+
+// - End of readBoidTrajectoryRecord Function - //
+
+// ----------------------------- //
+
+// - writeBoidTrajectoryCSV Function - //
+
+// Inputs:
+//   - t,               struct,      ,  Mapped trajectory
+//   - positionsPath,   char*,       ,  CSV receiving boid,step,x,y,z
+//   - statusesPath,    char*,       ,  CSV receiving boid,step,status
+
+int writeBoidTrajectoryCSV(const BoidTrajectory *t, const char *positionsPath, const char *statusesPath)
+{
+    FILE *positions = fopen(positionsPath, "w");
+    if (!positions)
+        return -1;
+    FILE *statuses = fopen(statusesPath, "w");
+    if (!statuses) {
+        fclose(positions);
+        return -1;
+    }
+
+    // Boids sharing a page are read one after another, so going boid by boid
+    // through the mapping only keeps about one page per step resident.
+    fprintf(positions, "boid,step,x,y,z\n");
+    fprintf(statuses, "boid,step,status\n");
+    for (int boid = 0; boid < t->header.numBoids; boid++) {
+        for (int step = 0; step < t->header.numSteps; step++) {
+            double rec[4];
+            readBoidTrajectoryRecord(t, step, boid, rec);
+            fprintf(positions, "%d,%d,%.6f,%.6f,%.6f\n", boid, step, rec[0], rec[1], rec[2]);
+            fprintf(statuses, "%d,%d,%.0f\n", boid, step, rec[3]);
+        }
+    }
+
+    int status = ferror(positions) || ferror(statuses) ? -1 : 0;
+    if (fclose(positions) != 0)
+        status = -1;
+    if (fclose(statuses) != 0)
+        status = -1;
+    return status;
+}
+
+// - End of writeBoidTrajectoryCSV Function - //
@@ -0,0 +1,123 @@
+#ifndef BOIDTRAJECTORY_H
+#define BOIDTRAJECTORY_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Binary trajectory file: a 64-byte header followed by one fixed-size frame per
+// step, so frame s starts at sizeof(BoidTrajectoryHeader) + s * frameBytes and
+// the file can be memory-mapped and read in place. Each frame holds numBoids
+// records stored as BOID_TRAJECTORY_F64 or _F32:
+//   BOID_TRAJECTORY_STATUS_FRAMES   { x, y, z, status }
+//   BOID_TRAJECTORY_CRASH_EVENTS    { x, y, z }, followed after the last frame
+//                                   by one BoidCrashEvent per crashed boid
+// A boid's status only ever goes from 1 to 0, so its crash step is enough to
+// rebuild the status of every frame.
+#define BOID_TRAJECTORY_MAGIC   "BOIDTRJ1"
+#define BOID_TRAJECTORY_VERSION 1
+
+#define BOID_TRAJECTORY_F64 0
+#define BOID_TRAJECTORY_F32 1
+
+#define BOID_TRAJECTORY_STATUS_FRAMES 0
+#define BOID_TRAJECTORY_CRASH_EVENTS  1
+
+typedef struct {
+    char magic[8];              // BOID_TRAJECTORY_MAGIC (not NUL-terminated)
+    uint32_t version;           // BOID_TRAJECTORY_VERSION
+    uint32_t dtype;             // BOID_TRAJECTORY_F64 or BOID_TRAJECTORY_F32
+    int32_t numBoids;           // Boids per frame
+    int32_t firstBoid;          // Global index of the first boid
+    int32_t numSteps;           // Frames in the file; 0 while still being written
+    int32_t layout;             // BOID_TRAJECTORY_STATUS_FRAMES or BOID_TRAJECTORY_CRASH_EVENTS
+    double bounds[3];           // Simulation bounds (x, y, z)
+    uint64_t frameBytes;        // Bytes per frame
+} BoidTrajectoryHeader;
+
+// First frame in which a boid is crashed, and where it came to rest.
+typedef struct {
+    int32_t boid;               // Index within the frame (0..numBoids-1)
+    int32_t step;
+    double position[3];
+} BoidCrashEvent;
+
+// Appends frames to a trajectory file. Frames are converted into one of two
+// buffers on the calling thread; a full buffer is handed to a writer thread
+// while the other one fills, so the step loop only waits when the disk falls
+// a whole buffer behind.
+typedef struct {
+    FILE *fp;
+    BoidTrajectoryHeader header;
+    unsigned char *buffers[2];
+    int framesPerBuffer;        // Frames held by each buffer
+    int active;                 // Buffer being filled
+    int activeFrames;           // Frames in the active buffer
+    unsigned char *crashed;     // Boids with a crash event [numBoids]
+    BoidCrashEvent *events;     // Crash events, written after the last frame
+    int numEvents;
+    int eventCapacity;
+
+    pthread_t thread;
+    int threadStarted;
+    pthread_mutex_t lock;       // Protects the fields below
+    pthread_cond_t cond;        // Signalled when a buffer is handed over or written
+    int queued;                 // Buffer waiting for the writer thread, or -1
+    int queuedFrames;
+    int shutdown;
+    int status;                 // Nonzero once a write has failed
+} BoidTrajectoryWriter;
+
+// Read-only view of a trajectory file mapped into memory.
+typedef struct {
+    BoidTrajectoryHeader header;
+    const unsigned char *data;  // Mapping of the whole file
+    size_t mappedBytes;
+    int *crashStep;             // Crash step per boid, or numSteps if it never crashed
+                                // (BOID_TRAJECTORY_CRASH_EVENTS only) [numBoids]
+} BoidTrajectory;
+
+// Returns BOID_TRAJECTORY_F64 or _F32 for "f64" or "f32", or -1.
+int parseBoidTrajectoryDtype(const char *name);
+
+// Creates 'path' and starts the writer thread. Frames will record boids
+// firstBoid..firstBoid+numBoids-1 of the global state, with statuses stored
+// as given by 'layout'. Returns 0 on success, nonzero on error.
+int openBoidTrajectoryWriter(BoidTrajectoryWriter *w, const char *path, int dtype, int layout,
+                             int numBoids, int firstBoid, const double bounds[3]);
+
+// Appends the writer's slice of allStates as the next frame.
+// Returns 0 on success, nonzero if an earlier write failed.
+int appendBoidTrajectoryFrame(BoidTrajectoryWriter *w, const double *allStates);
+
+// Writes the remaining frames and any crash events, records the step count in
+// the header and closes the file. Returns 0 on success, nonzero if any write failed.
+int closeBoidTrajectoryWriter(BoidTrajectoryWriter *w);
+
+// Maps the trajectory at 'path'. A file whose writer did not finish keeps
+// every complete frame, but not its crash events.
+// Returns 0 on success, nonzero on error.
+int openBoidTrajectory(BoidTrajectory *t, const char *path);
+
+// Unmaps the trajectory.
+void closeBoidTrajectory(BoidTrajectory *t);
+
+// Reads { x, y, z, status } of boid 'boid' (0..numBoids-1) at 'step', whatever
+// the layout.
+void readBoidTrajectoryRecord(const BoidTrajectory *t, int step, int boid, double record[4]);
+
+// Writes the trajectory in the CSV layout of the simulation outputs:
+// "boid,step,x,y,z" and "boid,step,status", grouped by boid then step.
+// Returns 0 on success, nonzero on error.
+int writeBoidTrajectoryCSV(const BoidTrajectory *t, const char *positionsPath, const char *statusesPath);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOIDTRAJECTORY_H
@@ -1,6 +1,10 @@
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include "boidRandom.h"
 #include "boidUpdate.h"
+#include "neighbourGrid.h"
+#include "terrain.h"
 
 // - myInvSqrt Function - //
 
@@ -30,10 +34,13 @@ static double myInvSqrt(double x)
 //   - y,           double, [1x1],  Y-coordinate
 //   - BoidParams,  struct,      ,  Terrain parameters 
 
-// Internal function that Computes a wave-like terrain based on amplitude, scale, base stored in params.
+// Internal function that Computes a wave-like terrain based on amplitude, scale, base stored in params,
+// or looks the height up in params->terrainMap when one is set.
 
 static double terrainHeight(double x, double y, const BoidParams *p)
 {
+    if (p->terrainMap)
+        return terrainMapHeight(p->terrainMap, x, y);
     return p->terrainAmplitude * sin(x / p->terrainScale) * cos(y / p->terrainScale) + p->terrainBase;
 }
 
@@ -60,7 +67,9 @@ double getTerrainHeight(double x, double y, const BoidParams *p)
 
 void initParameters(BoidParams *p, int seed)
 {
-    srand(seed);
+    double amplitudeDraw;
+    p->seed = (unsigned int)seed;
+    boidRandomUniforms(p->seed, BOID_RANDOM_PARAMS, 0, &amplitudeDraw, 1);
     // Set simulation parameters.
     p->bounds[0]            = 2000.0;   // Simulation Boundary (x)
     p->bounds[1]            = 2000.0;    // Simulation Boundary (y)
@@ -80,85 +89,105 @@ void initParameters(BoidParams *p, int seed)
     p->navigationGain       = 0.05;     // Navigation gain
     p->terrainBuffer        = 10.0;     // Vertical distance to begin pushing up
     p->terrainAvoidFactor   = 0.6;      // Strength of upward push
-    p->terrainAmplitude     = ((double)rand() / RAND_MAX) * 80.0; // Random terrain amplitude
+    p->terrainAmplitude     = amplitudeDraw * 80.0; // Random terrain amplitude
     p->terrainScale         = 50.0;     // Horizontal scale for sin/cos
     p->terrainBase          = 0.0;      // Base offset
+    p->terrainMap           = NULL;     // Analytic terrain
 }
 
 // - End of initParameters Function - //
 
 // ----------------------------- //
 
-// - updateOneBoid Function - //
+// - initBoidStates Function - //
 
-// Core function: update the state of one boid (index i) based on its neighbours.
+// Inputs:
+//   - states,      double, [Nx7],  Receives the initial boid states
+//   - firstBoid,   int,    [1x1],  Global ID of the first boid to generate
+//   - numBoids,    int,    [1x1],  Number of boids
+//   - BoidParams,  struct,      ,  Simulation parameters
 
-void updateOneBoid(double *allStates, int i, int numBoids, const BoidParams *p)
+void initBoidStates(double *states, int firstBoid, int numBoids, const BoidParams *p)
 {
-    double *myState = &allStates[i * BOID_STATE_SIZE];
-    if (myState[6] == 0.0) {
-        // Already crashed.
-        return;
+    for (int i = 0; i < numBoids; i++) {
+        double u[6];
+        boidRandomUniforms(p->seed, BOID_RANDOM_STATES, (uint32_t)(firstBoid + i), u, 6);
+        double x = u[0] * p->bounds[0];
+        double y = u[1] * p->bounds[1];
+        double ground = terrainHeight(x, y, p);
+        // Choose z as ground + margin plus a random fraction of the remaining depth.
+        double z = ground + p->margin + (u[2] * (p->bounds[2] - ground));
+        double vx = (u[3] - 0.5) * p->maxSpeed;
+        double vy = (u[4] - 0.5) * p->maxSpeed;
+        double vz = (u[5] - 0.5) * p->maxSpeed;
+        states[i * BOID_STATE_SIZE + 0] = x;
+        states[i * BOID_STATE_SIZE + 1] = y;
+        states[i * BOID_STATE_SIZE + 2] = z;
+        states[i * BOID_STATE_SIZE + 3] = vx;
+        states[i * BOID_STATE_SIZE + 4] = vy;
+        states[i * BOID_STATE_SIZE + 5] = vz;
+        states[i * BOID_STATE_SIZE + 6] = 1.0;  // active
     }
-    
-    // Extract current position and velocity.
-    double pos[3] = { myState[0], myState[1], myState[2] };
-    double vel[3] = { myState[3], myState[4], myState[5] };
-    
-    // Initialise sum arrays for cohesion, alignment, and separation.
-    double cohesionSum[3]   = { 0.0, 0.0, 0.0 };
-    double alignmentSum[3]  = { 0.0, 0.0, 0.0 };
-    double separationVec[3] = { 0.0, 0.0, 0.0 };
-    int neighbourCount      = 10;
-    
-    // Loop over all other boids.
-    for (int j = 0; j < numBoids; j++) {
-        if (j == i)
-            continue;
-        double *nbr     = &allStates[j * BOID_STATE_SIZE];
-        double diff[3]  = { pos[0] - nbr[0], pos[1] - nbr[1], pos[2] - nbr[2] };
-        double distSq   = diff[0]*diff[0] + diff[1]*diff[1] + diff[2]*diff[2];
-        
-        // If within visual range, add for cohesion and alignment.
-        if (distSq < p->visualRange * p->visualRange) {
-            cohesionSum[0]  += nbr[0];
-            cohesionSum[1]  += nbr[1];
-            cohesionSum[2]  += nbr[2];
-            alignmentSum[0] += nbr[3];
-            alignmentSum[1] += nbr[4];
-            alignmentSum[2] += nbr[5];
-            neighbourCount++;
-        }
-        // If too close, add for separation.
-        if (distSq < p->minDistance * p->minDistance) {
-            separationVec[0] += diff[0];
-            separationVec[1] += diff[1];
-            separationVec[2] += diff[2];
-        }
+}
+
+// - End of initBoidStates Function - //
+
+// ----------------------------- //
+
+// - initNeighbourSums Function - //
+
+void initNeighbourSums(BoidNeighbourSums *sums)
+{
+    for (int k = 0; k < 3; k++) {
+        sums->cohesionSum[k]   = 0.0;
+        sums->alignmentSum[k]  = 0.0;
+        sums->separationVec[k] = 0.0;
     }
+    sums->neighbourCount = 10;
+}
+
+// - End of initNeighbourSums Function - //
+
+// ----------------------------- //
+
+// - applyBoidRules Function - //
+
+// Inputs:
+//   - outState,    double, [1x7],  Destination for the updated boid state
+//   - pos,         double, [1x3],  Current position
+//   - vel,         double, [1x3],  Current velocity
+//   - sums,        struct,      ,  Neighbour sums for this boid
+//   - BoidParams,  struct,      ,  Simulation parameters
+
+// Shared by every neighbour-search strategy so that only the search differs.
+
+void applyBoidRules(double *outState, const double pos[3], const double velIn[3],
+                    const BoidNeighbourSums *sums, const BoidParams *p)
+{
+    double vel[3] = { velIn[0], velIn[1], velIn[2] };
+    int neighbourCount = sums->neighbourCount;
     
     double cohesionForce[3]  = { 0.0, 0.0, 0.0 };
     double alignmentForce[3] = { 0.0, 0.0, 0.0 };
     if (neighbourCount > 0) {
-        double center[3]  = { cohesionSum[0] / neighbourCount,
-                              cohesionSum[1] / neighbourCount,
-                              cohesionSum[2] / neighbourCount };
+        double center[3]  = { sums->cohesionSum[0] / neighbourCount,
+                              sums->cohesionSum[1] / neighbourCount,
+                              sums->cohesionSum[2] / neighbourCount };
         cohesionForce[0]  = (center[0] - pos[0]) * p->centeringFactor;
         cohesionForce[1]  = (center[1] - pos[1]) * p->centeringFactor;
         cohesionForce[2]  = (center[2] - pos[2]) * p->centeringFactor;
         
-        double avgVel[3]  = { alignmentSum[0] / neighbourCount,
-                              alignmentSum[1] / neighbourCount,
-                              alignmentSum[2] / neighbourCount };
+        double avgVel[3]  = { sums->alignmentSum[0] / neighbourCount,
+                              sums->alignmentSum[1] / neighbourCount,
+                              sums->alignmentSum[2] / neighbourCount };
         alignmentForce[0] = (avgVel[0] - vel[0]) * p->matchingFactor;
         alignmentForce[1] = (avgVel[1] - vel[1]) * p->matchingFactor;
         alignmentForce[2] = (avgVel[2] - vel[2]) * p->matchingFactor;
     }
     
-    double separationForce[3] = { separationVec[0] * p->avoidFactor,
-                                  separationVec[1] * p->avoidFactor,
-                                  separationVec[2] * p->avoidFactor };
-    
+    double separationForce[3] = { sums->separationVec[0] * p->avoidFactor,
+                                  sums->separationVec[1] * p->avoidFactor,
+                                  sums->separationVec[2] * p->avoidFactor };
     // Navigation force: steer toward target point.
     double toTarget[3]  = { p->targetPoint[0] - pos[0],
                             p->targetPoint[1] - pos[1],
@@ -175,12 +204,15 @@ void updateOneBoid(double *allStates, int i, int numBoids, const BoidParams *p)
         navForce[2] = (desiredVel[2] - vel[2]) * p->navigationGain;
     }
     
-    // Terrain avoidance force.
-    double ground           = terrainHeight(pos[0], pos[1], p);
-    double distAboveGnd     = pos[2] - ground;
+    // Terrain avoidance force. Boids clear of the highest ground nearby by
+    // terrainBuffer feel none, so the height is not looked up for them.
     double terrainAvoid[3]  = { 0.0, 0.0, 0.0 };
-    if (distAboveGnd < p->terrainBuffer) {
-        terrainAvoid[2] = (p->terrainBuffer - distAboveGnd) * p->terrainAvoidFactor;
+    if (terrainClearance(pos[0], pos[1], pos[2], p->terrainBuffer, p) != TERRAIN_CLEAR) {
+        double ground       = terrainHeight(pos[0], pos[1], p);
+        double distAboveGnd = pos[2] - ground;
+        if (distAboveGnd < p->terrainBuffer) {
+            terrainAvoid[2] = (p->terrainBuffer - distAboveGnd) * p->terrainAvoidFactor;
+        }
     }
     
     // Combine all forces.
@@ -223,37 +255,175 @@ void updateOneBoid(double *allStates, int i, int numBoids, const BoidParams *p)
     newPos[1] = pos[1] + vel[1];
     newPos[2] = pos[2] + vel[2];
     
-    // Final terrain collision check.
-    double newGround = terrainHeight(newPos[0], newPos[1], p);
-    if (newPos[2] < newGround + p->margin) {
+    // Final terrain collision check, decided by the terrain bounds where possible.
+    int clearance = terrainClearance(newPos[0], newPos[1], newPos[2], p->margin, p);
+    int crashed   = clearance == TERRAIN_BELOW;
+    if (clearance == TERRAIN_UNSURE)
+        crashed = newPos[2] < terrainHeight(newPos[0], newPos[1], p) + p->margin;
+    if (crashed) {
         // Mark boid as crashed.
-        myState[0] = newPos[0];
-        myState[1] = newPos[1];
-        myState[2] = newPos[2];
-        myState[3] = 0.0;
-        myState[4] = 0.0;
-        myState[5] = 0.0;
-        myState[6] = 0.0;
+        outState[0] = newPos[0];
+        outState[1] = newPos[1];
+        outState[2] = newPos[2];
+        outState[3] = 0.0;
+        outState[4] = 0.0;
+        outState[5] = 0.0;
+        outState[6] = 0.0;
     } else {
         // Update boid state.
-        myState[0] = newPos[0];
-        myState[1] = newPos[1];
-        myState[2] = newPos[2];
-        myState[3] = vel[0];
-        myState[4] = vel[1];
-        myState[5] = vel[2];
-        myState[6] = 1.0;
+        outState[0] = newPos[0];
+        outState[1] = newPos[1];
+        outState[2] = newPos[2];
+        outState[3] = vel[0];
+        outState[4] = vel[1];
+        outState[5] = vel[2];
+        outState[6] = 1.0;
+    }
+}
+
+// - End of applyBoidRules Function - //
+
+// ----------------------------- //
+
+// - updateOneBoidFrom Function - //
+
+// Inputs:
+//   - srcStates,   double, [Nx7],  States read for boid i and its neighbours
+//   - dstStates,   double, [Nx7],  States written for boid i (may equal srcStates)
+//   - i,           int,    [1x1],  Index of the boid to update
+//   - numBoids,    int,    [1x1],  Number of boids
+//   - BoidParams,  struct,      ,  Simulation parameters
+
+// Reference all-pairs search shared by the in-place and double-buffered modes.
+
+static void updateOneBoidFrom(const double *srcStates, double *dstStates, int i, int numBoids, const BoidParams *p)
+{
+    const double *myState = &srcStates[i * BOID_STATE_SIZE];
+    double *outState      = &dstStates[i * BOID_STATE_SIZE];
+    if (myState[6] == 0.0) {
+        // Already crashed; carry the state over unchanged.
+        if (outState != myState)
+            memcpy(outState, myState, BOID_STATE_SIZE * sizeof(double));
+        return;
     }
+    
+    // Extract current position and velocity.
+    double pos[3] = { myState[0], myState[1], myState[2] };
+    double vel[3] = { myState[3], myState[4], myState[5] };
+    
+    // Initialise sums for cohesion, alignment, and separation.
+    BoidNeighbourSums sums;
+    initNeighbourSums(&sums);
+    
+    // Loop over all other boids.
+    for (int j = 0; j < numBoids; j++) {
+        if (j == i)
+            continue;
+        const double *nbr = &srcStates[j * BOID_STATE_SIZE];
+        double diff[3]  = { pos[0] - nbr[0], pos[1] - nbr[1], pos[2] - nbr[2] };
+        double distSq   = diff[0]*diff[0] + diff[1]*diff[1] + diff[2]*diff[2];
+        
+        // If within visual range, add for cohesion and alignment.
+        if (distSq < p->visualRange * p->visualRange) {
+            sums.cohesionSum[0]  += nbr[0];
+            sums.cohesionSum[1]  += nbr[1];
+            sums.cohesionSum[2]  += nbr[2];
+            sums.alignmentSum[0] += nbr[3];
+            sums.alignmentSum[1] += nbr[4];
+            sums.alignmentSum[2] += nbr[5];
+            sums.neighbourCount++;
+        }
+        // If too close, add for separation.
+        if (distSq < p->minDistance * p->minDistance) {
+            sums.separationVec[0] += diff[0];
+            sums.separationVec[1] += diff[1];
+            sums.separationVec[2] += diff[2];
+        }
+    }
+    
+    applyBoidRules(outState, pos, vel, &sums, p);
+}
+
+// - End of updateOneBoidFrom Function - //
+
+// ----------------------------- //
+
+// - updateOneBoid / updateOneBoidSync Functions - //
+
+// Core function: update the state of one boid (index i) based on its neighbours.
+// Reference all-pairs search; stepBoidsSubset produces the same result via the grid.
+
+void updateOneBoid(double *allStates, int i, int numBoids, const BoidParams *p)
+{
+    updateOneBoidFrom(allStates, allStates, i, numBoids, p);
 }
 
-// - End of updateOneBoid Function - //
+void updateOneBoidSync(const double *prevStates, double *nextStates, int i, int numBoids, const BoidParams *p)
+{
+    updateOneBoidFrom(prevStates, nextStates, i, numBoids, p);
+}
+
+// - End of updateOneBoid / updateOneBoidSync Functions - //
 
 // ----------------------------- //
 
+// Shared grid reused across calls so steady-state steps do not allocate. This
+// makes stepBoidsSubset / stepBoidsSubsetSync unsafe to call concurrently.
+static NeighbourGrid stepGrid;
+
 // Update a subset of boids (from startIdx to endIdx) in one simulation step.
 void stepBoidsSubset(double *allStates, int numBoids, int startIdx, int endIdx, const BoidParams *p)
 {
+    if (stepBoidsSubsetGrid(allStates, numBoids, startIdx, endIdx, &stepGrid, p) == 0)
+        return;
+    // Fall back to the all-pairs search if the grid could not be allocated.
     for (int i = startIdx; i < endIdx; i++) {
         updateOneBoid(allStates, i, numBoids, p);
     }
 }
+
+// Double-buffered variant: every boid sees the state at the start of the step.
+void stepBoidsSubsetSync(const double *prevStates, double *nextStates, int numBoids,
+                         int startIdx, int endIdx, const BoidParams *p)
+{
+    if (stepBoidsSubsetGridSync(prevStates, nextStates, numBoids, startIdx, endIdx, &stepGrid, p) == 0)
+        return;
+    for (int i = startIdx; i < endIdx; i++) {
+        updateOneBoidSync(prevStates, nextStates, i, numBoids, p);
+    }
+}
+
+// ----------------------------- //
+
+// - BoidStateBuffers Functions - //
+
+int initBoidStateBuffers(BoidStateBuffers *b, int numBoids)
+{
+    size_t bytes = (size_t)numBoids * BOID_STATE_SIZE * sizeof(double);
+    b->numBoids = numBoids;
+    b->prev = (double*)malloc(bytes);
+    b->next = (double*)malloc(bytes);
+    if (!b->prev || !b->next) {
+        freeBoidStateBuffers(b);
+        return -1;
+    }
+    return 0;
+}
+
+void freeBoidStateBuffers(BoidStateBuffers *b)
+{
+    free(b->prev);
+    free(b->next);
+    b->prev = NULL;
+    b->next = NULL;
+    b->numBoids = 0;
+}
+
+void swapBoidStateBuffers(BoidStateBuffers *b)
+{
+    double *tmp = b->prev;
+    b->prev = b->next;
+    b->next = tmp;
+}
+
+// - End of BoidStateBuffers Functions - //
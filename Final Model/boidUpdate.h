@@ -9,6 +9,8 @@ extern "C" {
 // [posX, posY, posZ, velX, velY, velZ, flag]
 #define BOID_STATE_SIZE 7
 
+struct TerrainMap;
+
 // Structure to hold all simulation parameters.
 typedef struct {
     double bounds[3];           // Simulation Boundaries [x, y, z]
@@ -28,17 +30,75 @@ typedef struct {
     double terrainAmplitude;    // Random terrain amplitude
     double terrainScale;        // Horizontal scale for sin/cos
     double terrainBase;         // Base offset
+    const struct TerrainMap *terrainMap;  // Heightmap replacing the analytic terrain, or NULL (see terrain.h)
+    unsigned int seed;          // Seed of the random draws (see boidRandom.h)
 } BoidParams;
 
+// Neighbour sums gathered for one boid before the steering rules are applied.
+typedef struct {
+    double cohesionSum[3];      // Sum of neighbour positions
+    double alignmentSum[3];     // Sum of neighbour velocities
+    double separationVec[3];    // Sum of offsets from boids within minDistance
+    int neighbourCount;         // Count used to average the sums
+} BoidNeighbourSums;
+
+// Double-buffered boid state for the synchronous step mode. A step reads only
+// 'prev' and writes only 'next', so boids can be updated in any order or in
+// parallel with bit-identical results; swapBoidStateBuffers then makes the new
+// state current.
+typedef struct {
+    double *prev;               // State at the start of the step (read-only during the step)
+    double *next;               // State at the end of the step
+    int numBoids;               // Number of boids in each buffer
+} BoidStateBuffers;
+
 // Initialises simulation parameters and random seed.
 void initParameters(BoidParams *params, int seed);
 
+// Places boids firstBoid..firstBoid+numBoids-1 at random over the terrain with
+// random velocities, writing them to states[0..numBoids-1]. Each boid's state
+// depends only on params->seed and its ID, so ranks and threads can generate
+// any part of the flock and agree with a single generator.
+void initBoidStates(double *states, int firstBoid, int numBoids, const BoidParams *p);
+
 // Updates one boid (index i) given the full array of boid states.
 void updateOneBoid(double *allStates, int i, int numBoids, const BoidParams *p);
 
+// Resets the neighbour sums to the starting values used by updateOneBoid.
+void initNeighbourSums(BoidNeighbourSums *sums);
+
+// Applies cohesion, alignment, separation, navigation, terrain and boundary rules
+// to a boid at pos/vel with the given neighbour sums, writing the new 7-double
+// state (including the crash flag) to outState.
+void applyBoidRules(double *outState, const double pos[3], const double vel[3],
+                    const BoidNeighbourSums *sums, const BoidParams *p);
+
 // Updates a subset of boids (from startIdx to endIdx) in one simulation step.
+// Neighbours are found through a uniform grid rebuilt once per call; the result
+// is identical to calling updateOneBoid for each boid in turn.
+// stepBoidsSubset and stepBoidsSubsetSync share one internal grid and are not
+// thread-safe; concurrent callers should each pass their own grid to
+// stepBoidsSubsetGrid (neighbourGrid.h) or use a BoidStepPool.
 void stepBoidsSubset(double *allStates, int numBoids, int startIdx, int endIdx, const BoidParams *p);
 
+// Synchronous step mode: updates boid i from prevStates into nextStates.
+// Crashed boids are copied across unchanged.
+void updateOneBoidSync(const double *prevStates, double *nextStates, int i, int numBoids, const BoidParams *p);
+
+// Synchronous step mode: updates boids startIdx..endIdx-1 from prevStates into
+// nextStates using the neighbour grid. Boids outside the range are not written.
+void stepBoidsSubsetSync(const double *prevStates, double *nextStates, int numBoids,
+                         int startIdx, int endIdx, const BoidParams *p);
+
+// Allocates both buffers for numBoids boids. Returns 0 on success, nonzero on error.
+int initBoidStateBuffers(BoidStateBuffers *b, int numBoids);
+
+// Releases both buffers.
+void freeBoidStateBuffers(BoidStateBuffers *b);
+
+// Exchanges prev and next after a completed step.
+void swapBoidStateBuffers(BoidStateBuffers *b);
+
 // Exposes the terrain–height function so that other modules can query it.
 double getTerrainHeight(double x, double y, const BoidParams *p);
 
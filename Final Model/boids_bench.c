@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "boidProfile.h"
+#include "boidStepPool.h"
+#include "boidUpdate.h"
+#include "neighbourGrid.h"
+
+// End-to-end scaling benchmark: steps every combination of flock size, thread
+// count and neighbour search engine through the step pool and writes one CSV
+// row per combination. The workload is fixed by the seed (initial states come
+// from the counter-based generator), so results from different machines or
+// revisions compare like for like.
+//
+// Usage: boids_bench <results.csv> [baseline.csv]
+//
+// With a baseline (an earlier results file), every configuration present in
+// both is compared by steps/s and the exit status is 1 if any is slower by
+// more than the tolerance.
+//
+// Environment:
+//   BOIDS_BENCH_BOIDS      Flock sizes                     (default 1000,2000,5000,10000)
+//   BOIDS_BENCH_THREADS    Thread counts                   (default 1,2,4)
+//   BOIDS_BENCH_ENGINES    grid, lists, pairs and octree   (default all four)
+//   BOIDS_BENCH_STEPS      Timed steps per configuration   (default 50)
+//   BOIDS_BENCH_WARMUP     Untimed steps before timing     (default 5)
+//   BOIDS_BENCH_SKIN       Verlet skin of lists and pairs  (default 10)
+//   BOIDS_BENCH_TOLERANCE  Allowed slowdown vs baseline    (default 0.10)
+
+#define BENCH_SEED 124
+#define BENCH_MAX_VALUES 32
+
+static const char *engineNames[] = { "grid", "lists", "pairs", "octree" };
+#define NUM_ENGINES 4
+
+// One benchmarked configuration and its measurements.
+typedef struct {
+    int numBoids;
+    int numThreads;
+    int engine;                 // Index in engineNames
+    int steps;
+    double seconds;             // Wall time of the timed steps
+    double stepsPerSecond;
+    double interactions;        // Boid pairs within visualRange, summed over the timed steps
+    double nsPerInteraction;
+    long peakRssKiB;            // Peak resident set size while the configuration ran
+    double efficiency;          // Speed-up over the fewest threads, divided by the thread ratio
+} BenchResult;
+
+// Parses a comma-separated list of positive integers. Returns the count.
+static int parseIntList(const char *text, int *values)
+{
+    int count = 0;
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "%s", text);
+    for (char *tok = strtok(buffer, ", "); tok && count < BENCH_MAX_VALUES; tok = strtok(NULL, ", ")) {
+        int v = atoi(tok);
+        if (v <= 0) {
+            fprintf(stderr, "Invalid value '%s' in '%s'\n", tok, text);
+            exit(1);
+        }
+        values[count++] = v;
+    }
+    return count;
+}
+
+static int parseEngineList(const char *text, int *engines)
+{
+    int count = 0;
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "%s", text);
+    for (char *tok = strtok(buffer, ", "); tok && count < BENCH_MAX_VALUES; tok = strtok(NULL, ", ")) {
+        int e = 0;
+        while (e < NUM_ENGINES && strcmp(engineNames[e], tok) != 0)
+            e++;
+        if (e == NUM_ENGINES) {
+            fprintf(stderr, "Unknown engine '%s' (use grid, lists, pairs or octree)\n", tok);
+            exit(1);
+        }
+        engines[count++] = e;
+    }
+    return count;
+}
+
+// Resets the kernel's peak RSS counter so the next reading covers only the
+// configuration about to run. Returns 0 if the counter could be reset.
+static int resetPeakRss(void)
+{
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+    if (!fp)
+        return -1;
+    int ok = fputs("5", fp) >= 0;
+    return fclose(fp) == 0 && ok ? 0 : -1;
+}
+
+// Peak RSS in KiB: VmHWM, or the process-wide ru_maxrss if /proc is unavailable.
+static long peakRssKiB(void)
+{
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (fp) {
+        char line[256];
+        long kib = -1;
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "VmHWM: %ld kB", &kib) == 1)
+                break;
+        }
+        fclose(fp);
+        if (kib >= 0)
+            return kib;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Counts the boid pairs (i, j), i active, that lie within visualRange of
+// each other: the work the neighbour rules do in one step.
+static double countInteractions(const double *states, int numBoids, NeighbourGrid *grid,
+                                int *scratch, const BoidParams *p)
+{
+    double cellSize = neighbourGridCellSize(p);
+    if (buildNeighbourGrid(grid, states, numBoids, cellSize) != 0) {
+        fprintf(stderr, "Memory allocation failed for the interaction count\n");
+        exit(1);
+    }
+    double count = 0.0;
+    for (int i = 0; i < numBoids; i++) {
+        if (states[i * BOID_STATE_SIZE + 6] != 0.0)
+            count += neighbourGridQuery(grid, states, i, p->visualRange, scratch);
+    }
+    return count;
+}
+
+static void runConfiguration(BenchResult *r, int warmup, double skin, const BoidParams *params)
+{
+    resetPeakRss();
+
+    BoidStateBuffers buffers;
+    BoidStepPool pool;
+    if (initBoidStateBuffers(&buffers, r->numBoids) != 0 || initBoidStepPool(&pool, r->numThreads, 0) != 0) {
+        fprintf(stderr, "Failed to set up %d boids on %d threads\n", r->numBoids, r->numThreads);
+        exit(1);
+    }
+    initBoidStates(buffers.prev, 0, r->numBoids, params);
+    if (r->engine == 1 || r->engine == 2)
+        pool.neighbourSkin = skin;
+    pool.symmetricPairs = r->engine == 2;
+    pool.useOctree      = r->engine == 3;
+    pool.octreeTheta    = 0.0;
+
+    NeighbourGrid countGrid;
+    initNeighbourGrid(&countGrid);
+    int *scratch = (int*)malloc(r->numBoids * sizeof(int));
+    if (!scratch) {
+        fprintf(stderr, "Memory allocation failed for %d boids\n", r->numBoids);
+        exit(1);
+    }
+
+    for (int step = 0; step < warmup + r->steps; step++) {
+        // Interactions are counted from the state each timed step starts from.
+        if (step >= warmup)
+            r->interactions += countInteractions(buffers.prev, r->numBoids, &countGrid, scratch, params);
+        double start = wallSeconds();
+        if (stepBoidsParallel(&pool, &buffers, params) != 0) {
+            fprintf(stderr, "Step failed for %d boids on %d threads\n", r->numBoids, r->numThreads);
+            exit(1);
+        }
+        if (step >= warmup)
+            r->seconds += wallSeconds() - start;
+    }
+    r->peakRssKiB       = peakRssKiB();
+    r->stepsPerSecond   = r->seconds > 0.0 ? r->steps / r->seconds : 0.0;
+    r->nsPerInteraction = r->interactions > 0.0 ? 1e9 * r->seconds / r->interactions : 0.0;
+
+    free(scratch);
+    freeNeighbourGrid(&countGrid);
+    freeBoidStepPool(&pool);
+    freeBoidStateBuffers(&buffers);
+}
+
+// Parallel efficiency relative to the configuration with the same flock and
+// engine on the fewest threads.
+static void computeEfficiency(BenchResult *results, int numResults)
+{
+    for (int k = 0; k < numResults; k++) {
+        const BenchResult *base = NULL;
+        for (int b = 0; b < numResults; b++) {
+            if (results[b].numBoids == results[k].numBoids && results[b].engine == results[k].engine
+                && (!base || results[b].numThreads < base->numThreads))
+                base = &results[b];
+        }
+        results[k].efficiency = base->stepsPerSecond > 0.0
+            ? (results[k].stepsPerSecond / base->stepsPerSecond) * base->numThreads / results[k].numThreads
+            : 0.0;
+    }
+}
+
+#define BENCH_CSV_HEADER "boids,threads,engine,steps,seconds,stepsPerSecond,interactions," \
+                         "nsPerInteraction,peakRssKiB,parallelEfficiency"
+
+static void writeResults(const char *path, const BenchResult *results, int numResults)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        perror(path);
+        exit(1);
+    }
+    fprintf(fp, "%s\n", BENCH_CSV_HEADER);
+    for (int k = 0; k < numResults; k++) {
+        const BenchResult *r = &results[k];
+        fprintf(fp, "%d,%d,%s,%d,%.6f,%.3f,%.0f,%.3f,%ld,%.3f\n", r->numBoids, r->numThreads,
+                engineNames[r->engine], r->steps, r->seconds, r->stepsPerSecond, r->interactions,
+                r->nsPerInteraction, r->peakRssKiB, r->efficiency);
+    }
+    if (fclose(fp) != 0) {
+        perror(path);
+        exit(1);
+    }
+}
+
+// Compares steps/s against every matching row of the baseline file.
+// Returns the number of configurations slower than the tolerance allows.
+static int compareBaseline(const char *path, const BenchResult *results, int numResults, double tolerance)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        exit(1);
+    }
+    char line[512];
+    if (!fgets(line, sizeof(line), fp) || strncmp(line, "boids,threads,engine,", 21) != 0) {
+        fprintf(stderr, "%s is not a boids_bench results file\n", path);
+        exit(1);
+    }
+    int regressions = 0, compared = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        int boids, threads, steps;
+        char engine[32];
+        double seconds, stepsPerSecond;
+        if (sscanf(line, "%d,%d,%31[^,],%d,%lf,%lf", &boids, &threads, engine, &steps, &seconds, &stepsPerSecond) != 6)
+            continue;
+        for (int k = 0; k < numResults; k++) {
+            const BenchResult *r = &results[k];
+            if (r->numBoids != boids || r->numThreads != threads || strcmp(engineNames[r->engine], engine) != 0)
+                continue;
+            double ratio = stepsPerSecond > 0.0 ? r->stepsPerSecond / stepsPerSecond : 0.0;
+            int slower = ratio < 1.0 - tolerance;
+            printf("%6d boids %3d threads %-6s  %9.2f steps/s vs %9.2f  (%+.1f%%)%s\n", boids, threads, engine,
+                   r->stepsPerSecond, stepsPerSecond, 100.0 * (ratio - 1.0), slower ? "  REGRESSION" : "");
+            regressions += slower;
+            compared++;
+        }
+    }
+    fclose(fp);
+    printf("Compared %d configurations with %s: %d slower than %.0f%% tolerance\n",
+           compared, path, regressions, 100.0 * tolerance);
+    return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <results.csv> [baseline.csv]\n", argv[0]);
+        return 1;
+    }
+
+    int boidCounts[BENCH_MAX_VALUES], threadCounts[BENCH_MAX_VALUES], engines[BENCH_MAX_VALUES];
+    char *env_boids = getenv("BOIDS_BENCH_BOIDS");
+    char *env_threads = getenv("BOIDS_BENCH_THREADS");
+    char *env_engines = getenv("BOIDS_BENCH_ENGINES");
+    char *env_steps = getenv("BOIDS_BENCH_STEPS");
+    char *env_warmup = getenv("BOIDS_BENCH_WARMUP");
+    char *env_skin = getenv("BOIDS_BENCH_SKIN");
+    char *env_tolerance = getenv("BOIDS_BENCH_TOLERANCE");
+    int numBoidCounts   = parseIntList(env_boids ? env_boids : "1000,2000,5000,10000", boidCounts);
+    int numThreadCounts = parseIntList(env_threads ? env_threads : "1,2,4", threadCounts);
+    int numEngines      = parseEngineList(env_engines ? env_engines : "grid,lists,pairs,octree", engines);
+    int steps           = env_steps ? atoi(env_steps) : 50;
+    int warmup          = env_warmup ? atoi(env_warmup) : 5;
+    double skin         = env_skin ? atof(env_skin) : 10.0;
+    double tolerance    = env_tolerance ? atof(env_tolerance) : 0.10;
+    if (steps <= 0 || warmup < 0 || skin <= 0.0) {
+        fprintf(stderr, "BOIDS_BENCH_STEPS and BOIDS_BENCH_SKIN must be positive\n");
+        exit(1);
+    }
+
+    BoidParams params;
+    initParameters(&params, BENCH_SEED);
+
+    int numResults = numBoidCounts * numThreadCounts * numEngines;
+    BenchResult *results = (BenchResult*)calloc(numResults, sizeof(BenchResult));
+    if (!results) {
+        fprintf(stderr, "Memory allocation failed for %d results\n", numResults);
+        exit(1);
+    }
+    int k = 0;
+    for (int b = 0; b < numBoidCounts; b++) {
+        for (int e = 0; e < numEngines; e++) {
+            for (int t = 0; t < numThreadCounts; t++) {
+                BenchResult *r = &results[k++];
+                r->numBoids   = boidCounts[b];
+                r->numThreads = threadCounts[t];
+                r->engine     = engines[e];
+                r->steps      = steps;
+                runConfiguration(r, warmup, skin, &params);
+                printf("%6d boids %3d threads %-6s  %9.2f steps/s  %7.2f ns/interaction  %8ld KiB peak\n",
+                       r->numBoids, r->numThreads, engineNames[r->engine], r->stepsPerSecond,
+                       r->nsPerInteraction, r->peakRssKiB);
+                fflush(stdout);
+            }
+        }
+    }
+    computeEfficiency(results, numResults);
+    writeResults(argv[1], results, numResults);
+    printf("Wrote %s\n", argv[1]);
+
+    int regressions = 0;
+    if (argc == 3)
+        regressions = compareBaseline(argv[2], results, numResults, tolerance);
+    free(results);
+    return regressions > 0 ? 1 : 0;
+}
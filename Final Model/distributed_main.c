@@ -5,7 +5,14 @@
 #include <errno.h>
 #include <time.h>
 #include "boidUpdate.h"
+#include "boidExchange.h"
+#include "boidFraming.h"
+#include "boidProfile.h"
+#include "boidStateSoA.h"
+#include "boidTrajectory.h"
+#include "terrain.h"
 #include "messaging.h"
+#include "slabDomain.h"
 
 #define NUM_BOIDS 18000  // Change number of boids for distibuted model here.
 #define NUM_STEPS 500    // Change number of timesteps for distibuted model here.
@@ -47,28 +54,89 @@ void freeTerrainData(TerrainData *td) {
     free(td->data);
 }
 
-void writeCSVFilesDistr(const double *positions, const double *statuses, 
-                          int localNumBoids, int numSteps,
-                          const TerrainData *terrainData,
-                          const double bounds[3],
-                          int rank) {
+// Writes this rank's terrain samples (if collected) and the bounds into the
+// "output" folder. Positions and statuses come from the rank's trajectory file.
+void writeCSVFilesDistr(const TerrainData *terrainData, const double bounds[3], int rank) {
     char filename[256];
+    FILE *fp;
 
-    if (mkdir("output", 0777) != 0 && errno != EEXIST) {
-        perror("mkdir");
-        exit(1);
+    if (terrainData) {
+        sprintf(filename, "output/terrainData_distr_rank%d.csv", rank);
+        fp = fopen(filename, "w");
+        if (!fp) { perror(filename); exit(1); }
+        fprintf(fp, "x,y,z\n");
+        for (int i = 0; i < terrainData->size; i++) {
+            int idx = i * 3;
+            fprintf(fp, "%.6f,%.6f,%.6f\n", terrainData->data[idx + 0],
+                    terrainData->data[idx + 1], terrainData->data[idx + 2]);
+        }
+        fclose(fp);
+    }
+
+    sprintf(filename, "output/bounds_distr_rank%d.txt", rank);
+    fp = fopen(filename, "w");
+    if (!fp) { perror(filename); exit(1); }
+    fprintf(fp, "%.6f, %.6f, %.6f\n", bounds[0], bounds[1], bounds[2]);
+    fclose(fp);
+}
+
+// History rows recorded in slab mode, where the boids owned by a rank change
+// over time. Each row is [globalId, step, x, y, z, status].
+#define SLAB_HISTORY_ROW 6
+
+typedef struct {
+    double *rows;
+    int size;       // Number of rows stored
+    int capacity;   // Capacity in rows
+} SlabHistory;
+
+void appendSlabHistory(SlabHistory *h, const SlabDomain *d, int step) {
+    if (h->size + d->numOwned > h->capacity) {
+        int capacity = h->capacity > 0 ? h->capacity : 1024;
+        while (capacity < h->size + d->numOwned)
+            capacity *= 2;
+        h->rows = (double*)realloc(h->rows, (size_t)capacity * SLAB_HISTORY_ROW * sizeof(double));
+        if (!h->rows) {
+            fprintf(stderr, "Error reallocating slab history\n");
+            exit(1);
+        }
+        h->capacity = capacity;
     }
+    for (int k = 0; k < d->numOwned; k++) {
+        const double *rec = &d->owned[k * SLAB_RECORD_SIZE];
+        double *row = &h->rows[(h->size++) * SLAB_HISTORY_ROW];
+        row[0] = rec[0];
+        row[1] = step;
+        row[2] = rec[1];
+        row[3] = rec[2];
+        row[4] = rec[3];
+        row[5] = rec[7];
+    }
+}
+
+static int compareHistoryRows(const void *a, const void *b) {
+    const double *ra = (const double*)a;
+    const double *rb = (const double*)b;
+    if (ra[0] != rb[0]) return (ra[0] > rb[0]) - (ra[0] < rb[0]);
+    return (ra[1] > rb[1]) - (ra[1] < rb[1]);
+}
+
+// Writes the slab-mode history in the same CSV layout as the index-mode output,
+// grouped by boid then step, using global boid IDs. A boid appears in the file
+// of every rank that owned it, for the steps it was owned there. Terrain
+// samples under each row are written only if 'sampleTerrain' is set.
+void writeSlabCSVFiles(SlabHistory *h, const BoidParams *params, int rank, int sampleTerrain) {
+    char filename[256];
+
+    qsort(h->rows, h->size, SLAB_HISTORY_ROW * sizeof(double), compareHistoryRows);
 
     sprintf(filename, "output/positions_distr_rank%d.csv", rank);
     FILE *fp = fopen(filename, "w");
     if (!fp) { perror(filename); exit(1); }
     fprintf(fp, "boid,step,x,y,z\n");
-    for (int boid = 0; boid < localNumBoids; boid++) {
-        for (int step = 0; step < numSteps; step++) {
-            int idx = (step * localNumBoids + boid) * 3;
-            fprintf(fp, "%d,%d,%.6f,%.6f,%.6f\n", boid, step, 
-                    positions[idx + 0], positions[idx + 1], positions[idx + 2]);
-        }
+    for (int i = 0; i < h->size; i++) {
+        const double *row = &h->rows[i * SLAB_HISTORY_ROW];
+        fprintf(fp, "%d,%d,%.6f,%.6f,%.6f\n", (int)row[0], (int)row[1], row[2], row[3], row[4]);
     }
     fclose(fp);
 
@@ -76,35 +144,119 @@ void writeCSVFilesDistr(const double *positions, const double *statuses,
     fp = fopen(filename, "w");
     if (!fp) { perror(filename); exit(1); }
     fprintf(fp, "boid,step,status\n");
-    for (int boid = 0; boid < localNumBoids; boid++) {
-        for (int step = 0; step < numSteps; step++) {
-            int idx = step * localNumBoids + boid;
-            fprintf(fp, "%d,%d,%.0f\n", boid, step, statuses[idx]);
-        }
+    for (int i = 0; i < h->size; i++) {
+        const double *row = &h->rows[i * SLAB_HISTORY_ROW];
+        fprintf(fp, "%d,%d,%.0f\n", (int)row[0], (int)row[1], row[5]);
     }
     fclose(fp);
 
-    sprintf(filename, "output/terrainData_distr_rank%d.csv", rank);
-    fp = fopen(filename, "w");
-    if (!fp) { perror(filename); exit(1); }
-    fprintf(fp, "x,y,z\n");
-    for (int i = 0; i < terrainData->size; i++) {
-        int idx = i * 3;
-        fprintf(fp, "%.6f,%.6f,%.6f\n", terrainData->data[idx + 0],
-                terrainData->data[idx + 1], terrainData->data[idx + 2]);
+    if (sampleTerrain) {
+        sprintf(filename, "output/terrainData_distr_rank%d.csv", rank);
+        fp = fopen(filename, "w");
+        if (!fp) { perror(filename); exit(1); }
+        fprintf(fp, "x,y,z\n");
+        for (int i = 0; i < h->size; i++) {
+            const double *row = &h->rows[i * SLAB_HISTORY_ROW];
+            fprintf(fp, "%.6f,%.6f,%.6f\n", row[2], row[3], getTerrainHeight(row[2], row[3], params));
+        }
+        fclose(fp);
     }
-    fclose(fp);
 
     sprintf(filename, "output/bounds_distr_rank%d.txt", rank);
     fp = fopen(filename, "w");
     if (!fp) { perror(filename); exit(1); }
-    fprintf(fp, "%.6f, %.6f, %.6f\n", bounds[0], bounds[1], bounds[2]);
+    fprintf(fp, "%.6f, %.6f, %.6f\n", params->bounds[0], params->bounds[1], params->bounds[2]);
     fclose(fp);
 }
 
+#if BOIDS_PROFILE
+// Writes output/profile_rank<rank>.json and output/trace_rank<rank>.json.
+static void writeRankProfile(int rank) {
+    char summaryPath[256], tracePath[256];
+    sprintf(summaryPath, "output/profile_rank%d.json", rank);
+    sprintf(tracePath, "output/trace_rank%d.json", rank);
+    if (writeBoidProfile(summaryPath, tracePath) != 0) {
+        fprintf(stderr, "Failed to write %s and %s\n", summaryPath, tracePath);
+        exit(1);
+    }
+}
+#endif
+
+// Slab decomposition: each rank owns an x-slab of the domain and exchanges only
+// a visualRange-wide halo with its two neighbours, instead of the full state.
+void runSlabSimulation(const double *allStates, const BoidParams *params, int rank, int nProcs,
+                       int sampleTerrain, int mortonOrder) {
+    SlabDomain domain;
+    if (initSlabDomain(&domain, rank, nProcs, params) != 0) {
+        fprintf(stderr, "Failed to set up slab %d of %d\n", rank, nProcs);
+        exit(1);
+    }
+    domain.mortonOrder = mortonOrder;
+    if (slabTakeOwnership(&domain, allStates, NUM_BOIDS) != 0) {
+        fprintf(stderr, "Memory allocation failed for slab boids\n");
+        exit(1);
+    }
+    printf("Rank %d owns x in [%.1f, %.1f) with %d boids\n", rank, domain.lo, domain.hi, domain.numOwned);
+
+    SlabHistory history = { NULL, 0, 0 };
+    appendSlabHistory(&history, &domain, 0);
+    for (int step = 1; step < NUM_STEPS; step++) {
+        BOID_PROFILE_STEP(step);
+        BOID_PROFILE_BEGIN(stepStart);
+        if (stepSlabDomain(&domain, step, params) != 0) {
+            fprintf(stderr, "Slab step %d failed on rank %d\n", step, rank);
+            exit(1);
+        }
+        BOID_PROFILE_BEGIN(recordStart);
+        appendSlabHistory(&history, &domain, step);
+        BOID_PROFILE_END(recordStart, BOID_PHASE_RECORD, -1);
+        BOID_PROFILE_END(stepStart, BOID_PHASE_STEP, -1);
+    }
+
+    BOID_PROFILE_BEGIN(outputStart);
+    writeSlabCSVFiles(&history, params, rank, sampleTerrain);
+    BOID_PROFILE_END(outputStart, BOID_PHASE_OUTPUT, -1);
+#if BOIDS_PROFILE
+    writeRankProfile(rank);
+#endif
+    printf("Distributed simulation complete on rank %d. Output files saved in the 'output' folder.\n", rank);
+    free(history.rows);
+    freeSlabDomain(&domain);
+}
+
+// Grid search summed with a SIMD kernel (BOIDS_KERNEL), or kernel NULL for
+// the exact scalar step.
+typedef struct {
+    NeighbourKernelFn kernel;
+    NeighbourGrid grid;
+    BoidStateSoA cells;         // Boids in grid cell order
+} KernelStep;
+
+// Updates local boids startIdx..endIdx-1 into 'states': from prevStates in
+// synchronous mode, or in place when prevStates is NULL.
+static void stepLocalBoids(const double *prevStates, double *states, int startIdx, int endIdx,
+                           KernelStep *ks, const BoidParams *params) {
+    if (!ks->kernel) {
+        if (prevStates)
+            stepBoidsSubsetSync(prevStates, states, NUM_BOIDS, startIdx, endIdx, params);
+        else
+            stepBoidsSubset(states, NUM_BOIDS, startIdx, endIdx, params);
+        return;
+    }
+    int status = prevStates
+        ? stepBoidsSubsetGridKernelSync(prevStates, states, NUM_BOIDS, startIdx, endIdx,
+                                        &ks->grid, &ks->cells, ks->kernel, params)
+        : stepBoidsSubsetGridKernel(states, NUM_BOIDS, startIdx, endIdx,
+                                    &ks->grid, &ks->cells, ks->kernel, params);
+    if (status != 0) {
+        fprintf(stderr, "Memory allocation failed for the kernel grid\n");
+        exit(1);
+    }
+}
+
 int main(int argc, char *argv[])
 {
-    clock_t start_time = clock();
+    double start_time = wallSeconds();
     int nProcs = 1;
     char *env_nprocs = getenv("NPROCS");
     if (env_nprocs) {
@@ -122,12 +274,29 @@ int main(int argc, char *argv[])
     }
     printf("Using RANK=%d, NPROCS=%d\n", rank, nProcs);
 
-    // Enable messaging.
-    const char *host = getenv("RABBITMQ_HOST");
-    if (!host) host = "localhost";
-    printf("Using RabbitMQ host: %s\n", host);
-    if (initMessaging(host) != 0) {
-        fprintf(stderr, "initMessaging: Failed to open TCP socket to %s\n", host);
+    // Enable messaging. BOIDS_TRANSPORT selects the transport: amqp (default)
+    // through the RabbitMQ broker at RABBITMQ_HOST, shm through shared memory
+    // named BOIDS_SHM_NAME (default /boids) for ranks on one host, or tcp over
+    // direct connections to the ranks listed in BOIDS_TCP_PEERS (default
+    // 127.0.0.1:7470, every rank on this host listening on 7470 + rank).
+    const char *transport = getenv("BOIDS_TRANSPORT");
+    if (!transport) transport = "amqp";
+    const char *address;
+    if (strcmp(transport, "shm") == 0) {
+        address = getenv("BOIDS_SHM_NAME");
+        if (!address) address = "/boids";
+        printf("Using shared memory: %s\n", address);
+    } else if (strcmp(transport, "tcp") == 0) {
+        address = getenv("BOIDS_TCP_PEERS");
+        if (!address) address = "127.0.0.1:7470";
+        printf("Using TCP peers: %s\n", address);
+    } else {
+        address = getenv("RABBITMQ_HOST");
+        if (!address) address = "localhost";
+        printf("Using RabbitMQ host: %s\n", address);
+    }
+    if (initMessaging(transport, address, rank, nProcs) != 0) {
+        fprintf(stderr, "Failed to initialise the %s transport (%s)\n", transport, address);
         return -1;
     }
 
@@ -137,140 +306,216 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    // DECOMPOSITION=slab selects the spatial slab decomposition with halo exchange;
+    // otherwise boids are split by index and the full state is all-gathered.
+    char *env_decomp = getenv("DECOMPOSITION");
+    int useSlabs = env_decomp && strcmp(env_decomp, "slab") == 0;
+    if (useSlabs && setupDirectQueue(rank) != 0) {
+        fprintf(stderr, "Failed to bind rank queue\n");
+        exit(1);
+    }
+
     // Allow a short delay for all processes to finish setting up their queues.
     sleep(2);
 
     BoidParams params;
     initParameters(&params, 124);
 
+    // BOIDS_TERRAIN_FILE / BOIDS_TERRAIN_CACHE fly over a heightmap instead of
+    // evaluating the analytic terrain (see initTerrainMapFromEnv in terrain.h).
+    TerrainMap terrainMap;
+    int useTerrainMap = initTerrainMapFromEnv(&terrainMap, &params);
+    if (useTerrainMap < 0) {
+        exit(1);
+    }
+
     double *allStates = malloc(NUM_BOIDS * BOID_STATE_SIZE * sizeof(double));
     if (!allStates) {
         fprintf(stderr, "Memory allocation failed for boid states\n");
         exit(1);
     }
 
+    // Rank 0 writes the terrain once for the run (every rank shares the same
+    // parameters): its parameters plus a heightmap of BOIDS_TERRAIN_RESOLUTION
+    // samples per axis. BOIDS_TERRAIN_SAMPLES=1 also records the ground under
+    // every local boid at every step.
+    if (mkdir("output", 0777) != 0 && errno != EEXIST) {
+        perror("mkdir");
+        exit(1);
+    }
+    int terrainResolution = TERRAIN_DEFAULT_RESOLUTION;
+    char *env_resolution = getenv("BOIDS_TERRAIN_RESOLUTION");
+    if (env_resolution) {
+        terrainResolution = atoi(env_resolution);
+    }
+    char *env_samples = getenv("BOIDS_TERRAIN_SAMPLES");
+    int sampleTerrain = env_samples && atoi(env_samples) != 0;
+    if (rank == 0) {
+        if (writeTerrainDescriptor("output/terrain_distr.txt", &params) != 0
+            || writeTerrainHeightmap("output/terrainHeightmap_distr.csv", &params, terrainResolution) != 0) {
+            fprintf(stderr, "Failed to write the terrain (BOIDS_TERRAIN_RESOLUTION must be at least 2)\n");
+            exit(1);
+        }
+    }
+
     int boidsPerProc    = NUM_BOIDS / nProcs;
     int startIdx        = rank * boidsPerProc;
     int endIdx          = (rank == nProcs - 1) ? NUM_BOIDS : startIdx + boidsPerProc;
     int localNumBoids   = endIdx - startIdx;
 
     // --- Initialisation ---
-    if (rank == 0) {
-        // Rank 0 initialises the full global state.
-        for (int i = 0; i < NUM_BOIDS; i++) {
-            double x        = ((double)rand() / RAND_MAX) * params.bounds[0];
-            double y        = ((double)rand() / RAND_MAX) * params.bounds[1];
-            double ground   = getTerrainHeight(x, y, &params);
-            double z        = ground + params.margin + (((double)rand() / RAND_MAX) * (params.bounds[2] - ground));
-            double vx       = (((double)rand() / RAND_MAX) - 0.5) * params.maxSpeed;
-            double vy       = (((double)rand() / RAND_MAX) - 0.5) * params.maxSpeed;
-            double vz       = (((double)rand() / RAND_MAX) - 0.5) * params.maxSpeed;
-            allStates[i * BOID_STATE_SIZE + 0] = x;
-            allStates[i * BOID_STATE_SIZE + 1] = y;
-            allStates[i * BOID_STATE_SIZE + 2] = z;
-            allStates[i * BOID_STATE_SIZE + 3] = vx;
-            allStates[i * BOID_STATE_SIZE + 4] = vy;
-            allStates[i * BOID_STATE_SIZE + 5] = vz;
-            allStates[i * BOID_STATE_SIZE + 6] = 1.0;
+    // Every rank generates the initial global state itself: each boid's draws
+    // depend only on the seed and its ID, so all ranks agree without a broadcast.
+    initBoidStates(allStates, 0, NUM_BOIDS, &params);
+    BOID_PROFILE_START(rank);
+
+    if (useSlabs) {
+        // BOIDS_REORDER_INTERVAL > 0 lays each step's working set out along a
+        // Morton curve. Index slices are defined by boid ID and keep ID order.
+        char *env_reorder = getenv("BOIDS_REORDER_INTERVAL");
+        int mortonOrder = env_reorder && atoi(env_reorder) > 0;
+        runSlabSimulation(allStates, &params, rank, nProcs, sampleTerrain, mortonOrder);
+        releaseBoidFrames();
+        free(allStates);
+        if (useTerrainMap) {
+            freeTerrainMap(&terrainMap);
         }
-        // Publish the entire initial global state.
-        if (publishGlobalState(allStates, NUM_BOIDS * BOID_STATE_SIZE * sizeof(double), rank) != 0) {
-            fprintf(stderr, "Failed to publish global state\n");
+        printf("Elapsed simulation time: %f seconds\n", wallSeconds() - start_time);
+        return 0;
+    }
+
+    // A transport with shared memory holds the global state itself, double
+    // buffered: each step every rank updates its slice from one buffer into the
+    // other (synchronous mode, as with BOIDS_OVERLAP=1) and waits at the step
+    // barrier, so no state messages are sent.
+    double *sharedStates[2] = { NULL, NULL };
+    int useSharedState = messagingHasSharedState();
+    if (useSharedState) {
+        size_t stateBytes = (size_t)NUM_BOIDS * BOID_STATE_SIZE * sizeof(double);
+        if (mapSharedState(stateBytes, (void**)sharedStates) != 0) {
+            fprintf(stderr, "Failed to map the shared state on rank %d\n", rank);
             exit(1);
         }
-    } else {
-        // Other ranks consume the initial global state.
-        if (consumeGlobalState(allStates, NUM_BOIDS * BOID_STATE_SIZE * sizeof(double)) != 0) {
-            fprintf(stderr, "Failed to consume global state\n");
+        memcpy(&sharedStates[0][startIdx * BOID_STATE_SIZE], &allStates[startIdx * BOID_STATE_SIZE],
+               (size_t)localNumBoids * BOID_STATE_SIZE * sizeof(double));
+        if (waitSharedStep(0) != 0) {
+            fprintf(stderr, "Failed to share the initial state of rank %d\n", rank);
             exit(1);
         }
+        printf("Rank %d steps through the shared state (synchronous mode)\n", rank);
     }
 
-    // --- Allocate history arrays and terrain data ---
-    double *positionsHistory_local = malloc(NUM_STEPS * localNumBoids * 3 * sizeof(double));
-    double *statusesHistory_local = malloc(NUM_STEPS * localNumBoids * sizeof(double));
-    if (!positionsHistory_local || !statusesHistory_local) {
-        fprintf(stderr, "Memory allocation failed for local history arrays\n");
-        exit(1);
+    // BOIDS_OVERLAP=1 runs the exchange on a transport thread and steps in
+    // synchronous mode, updating boids as soon as the data they need is in.
+    char *env_overlap = getenv("BOIDS_OVERLAP");
+    int overlap = !useSharedState && env_overlap && atoi(env_overlap) != 0;
+
+    // BOIDS_KERNEL=<avx2|avx512|sse2> sums the grid search with that SIMD kernel
+    // (any other value but scalar picks the widest the CPU supports), as in
+    // local_main. Results then differ from the exact scalar loop in the last
+    // bits. The slab and overlapped decompositions keep the exact loop.
+    KernelStep kernelStep;
+    kernelStep.kernel = NULL;
+    initNeighbourGrid(&kernelStep.grid);
+    char *env_kernel = getenv("BOIDS_KERNEL");
+    if (env_kernel && !overlap && activeNeighbourKernelType() != NEIGHBOUR_KERNEL_SCALAR) {
+        if (initBoidStateSoA(&kernelStep.cells, NUM_BOIDS) != 0) {
+            fprintf(stderr, "Memory allocation failed for the kernel grid\n");
+            exit(1);
+        }
+        kernelStep.kernel = activeNeighbourKernel();
+        printf("Rank %d sums the grid search with the %s kernel\n", rank,
+               neighbourKernelName(activeNeighbourKernelType()));
     }
-    TerrainData terrainData;
-    initTerrainData(&terrainData);
 
-    // Record initial state (step 0) for local boids.
-    for (int i = startIdx; i < endIdx; i++) {
-        int localIndex  = i - startIdx;
-        int posIdx      = localIndex * 3;
-        positionsHistory_local[posIdx + 0]  = allStates[i * BOID_STATE_SIZE + 0];
-        positionsHistory_local[posIdx + 1]  = allStates[i * BOID_STATE_SIZE + 1];
-        positionsHistory_local[posIdx + 2]  = allStates[i * BOID_STATE_SIZE + 2];
-        statusesHistory_local[localIndex]   = allStates[i * BOID_STATE_SIZE + 6];
-        double ground = getTerrainHeight(allStates[i * BOID_STATE_SIZE + 0],
-                                         allStates[i * BOID_STATE_SIZE + 1],
-                                         &params);
-        appendTerrainData(&terrainData, allStates[i * BOID_STATE_SIZE + 0],
-                                    allStates[i * BOID_STATE_SIZE + 1],
-                                    ground);
+    // Otherwise a transport with a collective all-gather (the TCP ring) moves
+    // the f64 slices itself, in place, instead of one state message per pair
+    // of ranks. BOIDS_ENCODING does not apply to it.
+    int useAllGather = !useSharedState && !overlap && messagingHasAllGather();
+    size_t *sliceOffsets = malloc(nProcs * sizeof(size_t));
+    size_t *sliceBytes   = malloc(nProcs * sizeof(size_t));
+    if (!sliceOffsets || !sliceBytes) {
+        fprintf(stderr, "Memory allocation failed for slice sizes\n");
+        exit(1);
     }
+    for (int r = 0; r < nProcs; r++) {
+        int first = r * boidsPerProc;
+        int last  = (r == nProcs - 1) ? NUM_BOIDS : first + boidsPerProc;
+        sliceOffsets[r] = (size_t)first * BOID_STATE_SIZE * sizeof(double);
+        sliceBytes[r]   = (size_t)(last - first) * BOID_STATE_SIZE * sizeof(double);
+    }
+    if (useAllGather)
+        printf("Rank %d all-gathers state through the transport\n", rank);
 
-    // --- Simulation loop using an all-gather approach ---
-    for (int step = 1; step < NUM_STEPS; step++) {
-        // 1. Update local boids.
-        stepBoidsSubset(allStates, NUM_BOIDS, startIdx, endIdx, &params);
-
-        // 2. Publish local update.
-        int localMsgSize    = localNumBoids * BOID_STATE_SIZE * sizeof(double);
-        double *localBuffer = malloc(localMsgSize);
-        if (!localBuffer) {
-            perror("malloc for localBuffer");
+    // BOIDS_ENCODING selects the wire encoding of state messages (f64, f32 or q16);
+    // f32 and q16 are lossy for the copies of other ranks' boids. Boids whose
+    // crash has been sent are omitted unless BOIDS_ELIDE_CRASHED=0.
+    int encoding = BOID_ENCODING_F64;
+    char *env_encoding = getenv("BOIDS_ENCODING");
+    if (env_encoding) {
+        encoding = parseBoidEncoding(env_encoding);
+        if (encoding < 0) {
+            fprintf(stderr, "Unknown BOIDS_ENCODING '%s' (use f64, f32 or q16)\n", env_encoding);
             exit(1);
         }
-        memcpy(localBuffer, &allStates[startIdx * BOID_STATE_SIZE], localMsgSize);
-        if (publishGlobalState(localBuffer, localMsgSize, rank) != 0) {
-            fprintf(stderr, "Failed to publish local state from rank %d\n", rank);
+    }
+    char *env_elide = getenv("BOIDS_ELIDE_CRASHED");
+    if (!env_elide || atoi(env_elide) != 0)
+        encoding |= BOID_ENCODING_SPARSE;
+    BoidStateEncoder encoder;
+    if (initBoidStateEncoder(&encoder, encoding, startIdx, localNumBoids) != 0) {
+        fprintf(stderr, "Memory allocation failed for state encoder\n");
+        exit(1);
+    }
+    if (!useSharedState && !useAllGather) {
+        printf("Rank %d sends state as %s%s\n", rank, boidEncodingName(encoding),
+               (encoding & BOID_ENCODING_SPARSE) ? " without already-crashed boids" : "");
+    }
+
+    // --- Open the trajectory file and terrain samples ---
+    // Local boids are streamed to output/trajectory_distr_rank<rank>.bin as the
+    // simulation runs. BOIDS_TRAJECTORY_DTYPE=f32 halves its size, and
+    // BOIDS_OUTPUT=csv converts it to the positions and statuses CSVs at the end.
+    // Statuses are kept as one crash event per boid unless BOIDS_CRASH_EVENTS=0.
+    int trajectoryDtype = BOID_TRAJECTORY_F64;
+    char *env_dtype = getenv("BOIDS_TRAJECTORY_DTYPE");
+    if (env_dtype) {
+        trajectoryDtype = parseBoidTrajectoryDtype(env_dtype);
+        if (trajectoryDtype < 0) {
+            fprintf(stderr, "Unknown BOIDS_TRAJECTORY_DTYPE '%s' (use f64 or f32)\n", env_dtype);
             exit(1);
         }
-        // Save a copy of own update for merging.
-        double *myLocalCopy = malloc(localMsgSize);
-        if (!myLocalCopy) {
-            perror("malloc for myLocalCopy");
+    }
+    char *env_events = getenv("BOIDS_CRASH_EVENTS");
+    int trajectoryLayout = (!env_events || atoi(env_events) != 0)
+                         ? BOID_TRAJECTORY_CRASH_EVENTS : BOID_TRAJECTORY_STATUS_FRAMES;
+    int outputCSV = 0;
+    char *env_output = getenv("BOIDS_OUTPUT");
+    if (env_output) {
+        outputCSV = strcmp(env_output, "csv") == 0;
+        if (!outputCSV && strcmp(env_output, "binary") != 0) {
+            fprintf(stderr, "Unknown BOIDS_OUTPUT '%s' (use binary or csv)\n", env_output);
             exit(1);
         }
-        memcpy(myLocalCopy, localBuffer, localMsgSize);
-        free(localBuffer);
-
-        // 3. Gather updates from all ranks.
-        // For each rank r, expect a message of size computed from that rank's boids.
-        for (int r = 0; r < nProcs; r++) {
-            int boidsForRank        = (r == nProcs - 1) ? (NUM_BOIDS - r * boidsPerProc) : boidsPerProc;
-            size_t expectedSize     = boidsForRank * BOID_STATE_SIZE * sizeof(double);
-            if (r == rank) {
-                // Use local copy.
-                memcpy(&allStates[r * boidsPerProc * BOID_STATE_SIZE], myLocalCopy, expectedSize);
-            } else {
-                double *tempBuffer = malloc(expectedSize);
-                if (!tempBuffer) {
-                    perror("malloc for tempBuffer");
-                    exit(1);
-                }
-                if (consumeGlobalState(tempBuffer, expectedSize) != 0) {
-                    fprintf(stderr, "Failed to consume state message from rank %d\n", r);
-                    exit(1);
-                }
-                memcpy(&allStates[r * boidsPerProc * BOID_STATE_SIZE], tempBuffer, expectedSize);
-                free(tempBuffer);
-            }
-        }
-        free(myLocalCopy);
+    }
+    char trajectoryPath[256];
+    sprintf(trajectoryPath, "output/trajectory_distr_rank%d.bin", rank);
+    BoidTrajectoryWriter trajectory;
+    if (openBoidTrajectoryWriter(&trajectory, trajectoryPath, trajectoryDtype, trajectoryLayout,
+                                 localNumBoids, startIdx, params.bounds) != 0) {
+        fprintf(stderr, "Failed to create %s\n", trajectoryPath);
+        exit(1);
+    }
+    TerrainData terrainData;
+    initTerrainData(&terrainData);
 
-        // 4. Record updated state for local boids.
+    // Record initial state (step 0) for local boids.
+    if (appendBoidTrajectoryFrame(&trajectory, allStates) != 0) {
+        fprintf(stderr, "Failed to write %s\n", trajectoryPath);
+        exit(1);
+    }
+    if (sampleTerrain) {
         for (int i = startIdx; i < endIdx; i++) {
-            int localIndex = i - startIdx;
-            int posIdx = (step * localNumBoids + localIndex) * 3;
-            positionsHistory_local[posIdx + 0] = allStates[i * BOID_STATE_SIZE + 0];
-            positionsHistory_local[posIdx + 1] = allStates[i * BOID_STATE_SIZE + 1];
-            positionsHistory_local[posIdx + 2] = allStates[i * BOID_STATE_SIZE + 2];
-            statusesHistory_local[step * localNumBoids + localIndex] = allStates[i * BOID_STATE_SIZE + 6];
-
             double ground = getTerrainHeight(allStates[i * BOID_STATE_SIZE + 0],
                                              allStates[i * BOID_STATE_SIZE + 1],
                                              &params);
@@ -280,15 +525,142 @@ int main(int argc, char *argv[])
         }
     }
 
-    writeCSVFilesDistr(positionsHistory_local, statusesHistory_local, localNumBoids, NUM_STEPS, &terrainData, params.bounds, rank);
+    BoidExchange exchange;
+    if (overlap && initBoidExchange(&exchange, allStates, NUM_BOIDS, rank, nProcs, &encoder) != 0) {
+        fprintf(stderr, "Failed to start the transport thread on rank %d\n", rank);
+        exit(1);
+    }
+
+    // --- Simulation loop using an all-gather approach ---
+    for (int step = 1; step < NUM_STEPS; step++) {
+        BOID_PROFILE_STEP(step);
+        BOID_PROFILE_BEGIN(stepStart);
+        const double *states = allStates;
+        if (useSharedState) {
+            // 1-3. Update local boids into this step's buffer, then wait until
+            //      every rank has written its slice.
+            double *next = sharedStates[step & 1];
+            stepLocalBoids(sharedStates[(step - 1) & 1], next, startIdx, endIdx, &kernelStep, &params);
+            BOID_PROFILE_BEGIN(barrierStart);
+            if (waitSharedStep(step) != 0) {
+                fprintf(stderr, "Failed to share state for step %d on rank %d\n", step, rank);
+                exit(1);
+            }
+            BOID_PROFILE_END(barrierStart, BOID_PHASE_RECEIVE, -1);
+            states = next;
+        } else if (useAllGather) {
+            // 1. Update local boids.
+            stepLocalBoids(NULL, allStates, startIdx, endIdx, &kernelStep, &params);
+
+            // 2-3. Pass the slices round the ranks until every rank has them all.
+            BOID_PROFILE_BEGIN(gatherStart);
+            if (allGatherState(allStates, sliceOffsets, sliceBytes, step) != 0) {
+                fprintf(stderr, "Failed to gather state for step %d on rank %d\n", step, rank);
+                exit(1);
+            }
+            BOID_PROFILE_END(gatherStart, BOID_PHASE_RECEIVE, -1);
+        } else if (overlap) {
+            // 1-3. Update local boids while the exchange runs in the background.
+            if (stepBoidExchange(&exchange, step, &params) != 0) {
+                fprintf(stderr, "Failed to exchange state for step %d on rank %d\n", step, rank);
+                exit(1);
+            }
+            states = exchange.buffers.prev;
+        } else {
+            // 1. Update local boids.
+            stepLocalBoids(NULL, allStates, startIdx, endIdx, &kernelStep, &params);
+
+            // 2. Publish local update, tagged with the step and our slice of the state.
+            if (publishEncodedBoidStates(&encoder, allStates, step, rank) != 0) {
+                fprintf(stderr, "Failed to publish local state from rank %d\n", rank);
+                exit(1);
+            }
+
+            // 3. Gather updates from all other ranks. Each message is placed by its
+            //    header, so the order of arrival does not matter.
+            if (consumeBoidStates(allStates, NUM_BOIDS, step, rank, nProcs - 1) != 0) {
+                fprintf(stderr, "Failed to gather state for step %d on rank %d\n", step, rank);
+                exit(1);
+            }
+        }
+
+        // 4. Record updated state for local boids.
+        BOID_PROFILE_BEGIN(recordStart);
+        if (appendBoidTrajectoryFrame(&trajectory, states) != 0) {
+            fprintf(stderr, "Failed to write %s at step %d\n", trajectoryPath, step);
+            exit(1);
+        }
+        if (sampleTerrain) {
+            for (int i = startIdx; i < endIdx; i++) {
+                double ground = getTerrainHeight(states[i * BOID_STATE_SIZE + 0],
+                                                 states[i * BOID_STATE_SIZE + 1],
+                                                 &params);
+                appendTerrainData(&terrainData, states[i * BOID_STATE_SIZE + 0],
+                                            states[i * BOID_STATE_SIZE + 1],
+                                            ground);
+            }
+        }
+        BOID_PROFILE_END(recordStart, BOID_PHASE_RECORD, -1);
+        BOID_PROFILE_END(stepStart, BOID_PHASE_STEP, -1);
+    }
+
+    if (overlap) {
+        // Let the other ranks receive the final step before shutting down.
+        if (finishBoidExchange(&exchange) != 0) {
+            fprintf(stderr, "Failed to finish the final exchange on rank %d\n", rank);
+            exit(1);
+        }
+        long updates = exchange.interiorUpdates + exchange.boundaryUpdates;
+        printf("Rank %d updated %.1f%% of its boids before waiting for remote data\n",
+               rank, updates > 0 ? 100.0 * exchange.interiorUpdates / updates : 0.0);
+        freeBoidExchange(&exchange);
+    }
+
+    BOID_PROFILE_BEGIN(outputStart);
+    if (closeBoidTrajectoryWriter(&trajectory) != 0) {
+        fprintf(stderr, "Failed to write %s\n", trajectoryPath);
+        exit(1);
+    }
+    writeCSVFilesDistr(sampleTerrain ? &terrainData : NULL, params.bounds, rank);
+    if (outputCSV) {
+        char positionsPath[256], statusesPath[256];
+        sprintf(positionsPath, "output/positions_distr_rank%d.csv", rank);
+        sprintf(statusesPath, "output/statuses_distr_rank%d.csv", rank);
+        BoidTrajectory written;
+        if (openBoidTrajectory(&written, trajectoryPath) != 0
+            || writeBoidTrajectoryCSV(&written, positionsPath, statusesPath) != 0) {
+            fprintf(stderr, "Failed to convert %s to CSV\n", trajectoryPath);
+            exit(1);
+        }
+        closeBoidTrajectory(&written);
+        remove(trajectoryPath);
+    }
+    BOID_PROFILE_END(outputStart, BOID_PHASE_OUTPUT, -1);
+#if BOIDS_PROFILE
+    writeRankProfile(rank);
+#endif
     printf("Distributed simulation complete on rank %d. Output files saved in the 'output' folder.\n", rank);
+    if (encoder.frames > 0) {
+        double perStep = encoder.totalBytes / encoder.frames;
+        double rawBytes = (double)localNumBoids * BOID_STATE_SIZE * sizeof(double);
+        printf("Rank %d sent %.0f payload bytes per step (%.2fx smaller than f64)\n",
+               rank, perStep, perStep > 0.0 ? rawBytes / perStep : 0.0);
+    }
 
-    free(positionsHistory_local);
-    free(statusesHistory_local);
+    freeBoidStateEncoder(&encoder);
+    if (kernelStep.kernel) {
+        freeBoidStateSoA(&kernelStep.cells);
+    }
+    freeNeighbourGrid(&kernelStep.grid);
+    free(sliceOffsets);
+    free(sliceBytes);
     freeTerrainData(&terrainData);
+    releaseBoidFrames();
     free(allStates);
-    clock_t end_time = clock();
-    double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+    if (useTerrainMap) {
+        freeTerrainMap(&terrainMap);
+    }
+    double elapsed_time = wallSeconds() - start_time;
     printf("Elapsed simulation time: %f seconds\n", elapsed_time);
     return 0;
 }
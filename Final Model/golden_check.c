@@ -0,0 +1,321 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "boidKernels.h"
+#include "boidProfile.h"
+#include "boidStateSoA.h"
+#include "boidStepPool.h"
+#include "boidUpdate.h"
+#include "neighbourGrid.h"
+
+// Golden-trajectory equivalence harness. Runs the all-pairs reference update
+// and each candidate engine from the same seed and compares them step by step:
+// largest and rms position divergence, boids whose crash state differs, and
+// the speed-up over the reference.
+//
+// There are two reference behaviours. The synchronous engines (everything the
+// step pool runs) are compared with updateOneBoidSync; the in-place SoA
+// engines with updateOneBoid. Engines marked exact must reproduce their
+// reference bit for bit; the vector kernels (pool-kernel uses the one
+// BOIDS_KERNEL selects) and the octree are only reported.
+//
+// Usage: golden_check <divergence.csv>
+// The file receives one row per engine and step. The exit status is 1 if an
+// exact engine diverged.
+//
+// Environment:
+//   BOIDS_GOLDEN_BOIDS     Flock size                      (default 2000)
+//   BOIDS_GOLDEN_STEPS     Steps compared                  (default 100)
+//   BOIDS_GOLDEN_SEED      Seed of parameters and states   (default 124)
+//   BOIDS_GOLDEN_ENGINES   Comma-separated engine names    (default all)
+//   BOIDS_THREADS          Threads of the step pool        (default 1)
+//   BOIDS_VERLET_SKIN      Skin of lists and pairs         (default 10)
+//   BOIDS_OCTREE_THETA     Opening angle of the octree     (default 0)
+
+enum { FAMILY_SYNC, FAMILY_IN_PLACE };
+
+typedef enum {
+    ENGINE_GRID,                // stepBoidsSubsetGridSync
+    ENGINE_POOL,                // Step pool, grid search
+    ENGINE_LISTS,               // Step pool, Verlet lists
+    ENGINE_PAIRS,               // Step pool, half lists
+    ENGINE_MORTON,              // Step pool, Morton reordering every 10 steps
+    ENGINE_OCTREE,              // Step pool, octree
+    ENGINE_KERNEL,              // Step pool, grid search summed with activeNeighbourKernel()
+    ENGINE_SOA_GRID,            // stepBoidsSubsetSoA
+    ENGINE_SOA_SCALAR,          // updateOneBoidSoAKernel with each kernel
+    ENGINE_SOA_SSE2,
+    ENGINE_SOA_AVX2,
+    ENGINE_SOA_AVX512,
+    NUM_ENGINES
+} GoldenEngineType;
+
+static const char *engineNames[NUM_ENGINES] = {
+    "grid", "pool", "lists", "pairs", "morton", "octree", "pool-kernel",
+    "soa-grid", "soa-scalar", "soa-sse2", "soa-avx2", "soa-avx512"
+};
+
+// Settings shared by every run.
+typedef struct {
+    int numBoids;
+    int numSteps;
+    int numThreads;
+    double skin;
+    double theta;
+    BoidParams params;
+} GoldenConfig;
+
+// Per-step comparison of one engine with its reference.
+typedef struct {
+    double maxDiff;             // Largest position difference of any boid
+    double rmsDiff;
+    int crashDiffs;             // Boids whose crash flag differs
+} GoldenStep;
+
+static int engineFamily(int engine)
+{
+    return engine >= ENGINE_SOA_GRID ? FAMILY_IN_PLACE : FAMILY_SYNC;
+}
+
+// Whether the engine must match its reference bit for bit.
+static int engineIsExact(int engine)
+{
+    if (engine == ENGINE_OCTREE || engine == ENGINE_KERNEL || engine >= ENGINE_SOA_SSE2)
+        return 0;
+    return 1;
+}
+
+// Runs the all-pairs reference of 'family' and stores every step's state
+// ([numSteps x numBoids x 7], step 0 first). Returns the stepping time.
+static double runReference(int family, const GoldenConfig *c, double *trajectory)
+{
+    size_t frame = (size_t)c->numBoids * BOID_STATE_SIZE;
+    initBoidStates(trajectory, 0, c->numBoids, &c->params);
+    double seconds = 0.0;
+    for (int step = 1; step < c->numSteps; step++) {
+        const double *prev = &trajectory[(step - 1) * frame];
+        double *next = &trajectory[step * frame];
+        double start = wallSeconds();
+        if (family == FAMILY_SYNC) {
+            for (int i = 0; i < c->numBoids; i++)
+                updateOneBoidSync(prev, next, i, c->numBoids, &c->params);
+        } else {
+            memcpy(next, prev, frame * sizeof(double));
+            for (int i = 0; i < c->numBoids; i++)
+                updateOneBoid(next, i, c->numBoids, &c->params);
+        }
+        seconds += wallSeconds() - start;
+    }
+    return seconds;
+}
+
+static void compareStates(const double *a, const double *b, int numBoids, GoldenStep *out)
+{
+    double sumSq = 0.0;
+    out->maxDiff = 0.0;
+    out->crashDiffs = 0;
+    for (int i = 0; i < numBoids; i++) {
+        const double *sa = &a[i * BOID_STATE_SIZE];
+        const double *sb = &b[i * BOID_STATE_SIZE];
+        double dx = sa[0] - sb[0], dy = sa[1] - sb[1], dz = sa[2] - sb[2];
+        double d = sqrt(dx*dx + dy*dy + dz*dz);
+        if (d > out->maxDiff || d != d)
+            out->maxDiff = d;
+        sumSq += d * d;
+        out->crashDiffs += (sa[6] == 0.0) != (sb[6] == 0.0);
+    }
+    out->rmsDiff = numBoids > 0 ? sqrt(sumSq / numBoids) : 0.0;
+}
+
+// Runs one candidate engine from the reference's initial state and compares
+// every step. Returns the stepping time, or a negative value if the engine is
+// unavailable (a vector kernel the CPU lacks).
+static double runEngine(int engine, const GoldenConfig *c, const double *reference, GoldenStep *steps)
+{
+    int n = c->numBoids;
+    size_t frame = (size_t)n * BOID_STATE_SIZE;
+    NeighbourKernelFn kernel = NULL;
+    if (engine >= ENGINE_SOA_SCALAR) {
+        kernel = getNeighbourKernel((NeighbourKernelType)(NEIGHBOUR_KERNEL_SCALAR + engine - ENGINE_SOA_SCALAR));
+        if (!kernel)
+            return -1.0;
+    }
+
+    BoidStateBuffers buffers;
+    BoidStepPool pool;
+    NeighbourGrid grid;
+    BoidStateSoA soa;
+    double *current = (double*)malloc(frame * sizeof(double));
+    initNeighbourGrid(&grid);
+    if (!current || initBoidStateBuffers(&buffers, n) != 0 || initBoidStateSoA(&soa, n) != 0
+        || initBoidStepPool(&pool, c->numThreads, 0) != 0) {
+        fprintf(stderr, "Failed to set up engine %s\n", engineNames[engine]);
+        exit(1);
+    }
+    memcpy(buffers.prev, reference, frame * sizeof(double));
+    boidStateFromFlat(&soa, reference);
+    if (engine == ENGINE_LISTS || engine == ENGINE_PAIRS)
+        pool.neighbourSkin = c->skin;
+    pool.symmetricPairs  = engine == ENGINE_PAIRS;
+    pool.useOctree       = engine == ENGINE_OCTREE;
+    pool.octreeTheta     = c->theta;
+    pool.reorderInterval = engine == ENGINE_MORTON ? 10 : 0;
+    pool.kernel          = engine == ENGINE_KERNEL ? activeNeighbourKernel() : NULL;
+
+    compareStates(reference, reference, n, &steps[0]);
+    double seconds = 0.0;
+    for (int step = 1; step < c->numSteps; step++) {
+        int status = 0;
+        double start = wallSeconds();
+        switch (engine) {
+        case ENGINE_GRID:
+            status = stepBoidsSubsetGridSync(buffers.prev, buffers.next, n, 0, n, &grid, &c->params);
+            swapBoidStateBuffers(&buffers);
+            break;
+        case ENGINE_SOA_GRID:
+            status = stepBoidsSubsetSoA(&soa, 0, n, &grid, &c->params);
+            break;
+        case ENGINE_SOA_SCALAR:
+        case ENGINE_SOA_SSE2:
+        case ENGINE_SOA_AVX2:
+        case ENGINE_SOA_AVX512:
+            for (int i = 0; i < n; i++)
+                updateOneBoidSoAKernel(&soa, i, kernel, &c->params);
+            break;
+        default:
+            status = stepBoidsParallel(&pool, &buffers, &c->params);
+            break;
+        }
+        seconds += wallSeconds() - start;
+        if (status != 0) {
+            fprintf(stderr, "Engine %s failed at step %d\n", engineNames[engine], step);
+            exit(1);
+        }
+
+        const double *states = buffers.prev;
+        if (engineFamily(engine) == FAMILY_IN_PLACE) {
+            boidStateToFlat(&soa, current);
+            states = current;
+        } else if (pool.reorderInterval > 0) {
+            gatherBoidStates(&pool.ordering, buffers.prev, current);
+            states = current;
+        }
+        compareStates(states, &reference[step * frame], n, &steps[step]);
+    }
+
+    freeBoidStepPool(&pool);
+    freeBoidStateSoA(&soa);
+    freeBoidStateBuffers(&buffers);
+    freeNeighbourGrid(&grid);
+    free(current);
+    return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <divergence.csv>\n", argv[0]);
+        return 1;
+    }
+
+    GoldenConfig config;
+    char *env_boids = getenv("BOIDS_GOLDEN_BOIDS");
+    char *env_steps = getenv("BOIDS_GOLDEN_STEPS");
+    char *env_seed = getenv("BOIDS_GOLDEN_SEED");
+    char *env_threads = getenv("BOIDS_THREADS");
+    char *env_skin = getenv("BOIDS_VERLET_SKIN");
+    char *env_theta = getenv("BOIDS_OCTREE_THETA");
+    config.numBoids   = env_boids ? atoi(env_boids) : 2000;
+    config.numSteps   = env_steps ? atoi(env_steps) + 1 : 101;
+    config.numThreads = env_threads ? atoi(env_threads) : 1;
+    config.skin       = env_skin ? atof(env_skin) : 10.0;
+    config.theta      = env_theta ? atof(env_theta) : 0.0;
+    if (config.numBoids <= 0 || config.numSteps <= 1 || config.skin <= 0.0 || config.theta < 0.0) {
+        fprintf(stderr, "BOIDS_GOLDEN_BOIDS, BOIDS_GOLDEN_STEPS and BOIDS_VERLET_SKIN must be positive\n");
+        exit(1);
+    }
+    initParameters(&config.params, env_seed ? atoi(env_seed) : 124);
+
+    int selected[NUM_ENGINES];
+    char *env_engines = getenv("BOIDS_GOLDEN_ENGINES");
+    for (int e = 0; e < NUM_ENGINES; e++)
+        selected[e] = env_engines == NULL;
+    if (env_engines) {
+        char buffer[512];
+        snprintf(buffer, sizeof(buffer), "%s", env_engines);
+        for (char *tok = strtok(buffer, ", "); tok; tok = strtok(NULL, ", ")) {
+            int e = 0;
+            while (e < NUM_ENGINES && strcmp(engineNames[e], tok) != 0)
+                e++;
+            if (e == NUM_ENGINES) {
+                fprintf(stderr, "Unknown engine '%s'\n", tok);
+                exit(1);
+            }
+            selected[e] = 1;
+        }
+    }
+
+    size_t frame = (size_t)config.numBoids * BOID_STATE_SIZE;
+    double *references[2];
+    double referenceSeconds[2];
+    GoldenStep *steps = (GoldenStep*)malloc(config.numSteps * sizeof(GoldenStep));
+    for (int f = 0; f < 2; f++)
+        references[f] = (double*)malloc(config.numSteps * frame * sizeof(double));
+    if (!steps || !references[0] || !references[1]) {
+        fprintf(stderr, "Memory allocation failed for %d steps of %d boids\n", config.numSteps, config.numBoids);
+        exit(1);
+    }
+    printf("Reference: %d boids, %d steps, seed %u\n", config.numBoids, config.numSteps - 1, config.params.seed);
+    for (int f = 0; f < 2; f++)
+        referenceSeconds[f] = runReference(f, &config, references[f]);
+
+    FILE *fp = fopen(argv[1], "w");
+    if (!fp) {
+        perror(argv[1]);
+        exit(1);
+    }
+    fprintf(fp, "engine,step,maxPosDiff,rmsPosDiff,crashDiffs\n");
+    printf("%-11s %-6s %12s %10s %12s %9s\n", "engine", "exact", "max |dx|", "first step", "crash diffs", "speed-up");
+
+    int failures = 0;
+    for (int e = 0; e < NUM_ENGINES; e++) {
+        if (!selected[e])
+            continue;
+        int family = engineFamily(e);
+        double seconds = runEngine(e, &config, references[family], steps);
+        if (seconds < 0.0) {
+            printf("%-11s not supported by this CPU or build\n", engineNames[e]);
+            continue;
+        }
+        double maxDiff = 0.0;
+        int firstStep = -1, crashDiffs = 0;
+        for (int s = 0; s < config.numSteps; s++) {
+            fprintf(fp, "%s,%d,%.9e,%.9e,%d\n", engineNames[e], s, steps[s].maxDiff, steps[s].rmsDiff,
+                    steps[s].crashDiffs);
+            if ((steps[s].maxDiff != 0.0 || steps[s].crashDiffs != 0) && firstStep < 0)
+                firstStep = s;
+            if (steps[s].maxDiff > maxDiff || steps[s].maxDiff != steps[s].maxDiff)
+                maxDiff = steps[s].maxDiff;
+            if (steps[s].crashDiffs > crashDiffs)
+                crashDiffs = steps[s].crashDiffs;
+        }
+        int exact = engineIsExact(e);
+        int failed = exact && firstStep >= 0;
+        failures += failed;
+        printf("%-11s %-6s %12.3e %10d %12d %8.2fx%s\n", engineNames[e], exact ? "yes" : "no", maxDiff,
+               firstStep, crashDiffs, seconds > 0.0 ? referenceSeconds[family] / seconds : 0.0,
+               failed ? "  DIVERGED" : "");
+        fflush(stdout);
+    }
+    if (fclose(fp) != 0) {
+        perror(argv[1]);
+        exit(1);
+    }
+    printf("Wrote %s; %d exact engine%s diverged\n", argv[1], failures, failures == 1 ? "" : "s");
+
+    free(references[0]);
+    free(references[1]);
+    free(steps);
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,306 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "boidKernels.h"
+#include "boidProfile.h"
+#include "boidRandom.h"
+#include "boidStateSoA.h"
+#include "boidUpdate.h"
+#include "neighbourGrid.h"
+
+// Microbenchmarks of the neighbour kernels on fixed synthetic neighbour
+// distributions, so a kernel can be measured and checked in isolation from
+// the flock's evolving layout:
+//
+//   sparse     candidates spread over a cube 4 x visualRange wide (~7% in range)
+//   dense      candidates uniform within 0.9 x visualRange (all in range)
+//   clustered  tight clumps a few minDistance wide, mostly within minDistance
+//
+// Two groups are timed. "accumulate" runs each compiled-in accumulation kernel
+// over the candidates of one boid and reports ns per candidate and the largest
+// relative difference of its sums from the scalar kernel. "update" updates
+// every boid of a synthetic flock with the same layout through each boid
+// update path, including the grid search summed with each kernel
+// ("grid-<kernel>"), and reports ns per boid update.
+//
+// Usage: kernel_bench <results.csv>
+// BOIDS_BENCH_SCALE multiplies the repetitions (default 1).
+
+#define KERNEL_BENCH_CANDIDATES 4096
+#define KERNEL_BENCH_FLOCK      4096
+#define KERNEL_BENCH_CLUSTERS   16
+#define KERNEL_BENCH_SEED       7
+
+enum { DIST_SPARSE, DIST_DENSE, DIST_CLUSTERED, NUM_DISTRIBUTIONS };
+static const char *distributionNames[NUM_DISTRIBUTIONS] = { "sparse", "dense", "clustered" };
+
+// Fills 'states' with n boids around 'centre' laid out as 'distribution',
+// spread over a box 'spread' wide (the dense layout ignores it). Velocities
+// are random within maxSpeed; every boid is active.
+static void syntheticLayout(double *states, int n, int distribution, const double centre[3],
+                            const double spread[3], const BoidParams *p)
+{
+    double clusterCentres[KERNEL_BENCH_CLUSTERS][3];
+    for (int c = 0; c < KERNEL_BENCH_CLUSTERS; c++) {
+        double u[3];
+        boidRandomUniforms(KERNEL_BENCH_SEED, 2, (uint32_t)c, u, 3);
+        for (int d = 0; d < 3; d++)
+            clusterCentres[c][d] = centre[d] + (u[d] - 0.5) * spread[d];
+    }
+    for (int i = 0; i < n; i++) {
+        double u[8];
+        boidRandomUniforms(KERNEL_BENCH_SEED, (uint32_t)(3 + distribution), (uint32_t)i, u, 8);
+        double *s = &states[i * BOID_STATE_SIZE];
+        if (distribution == DIST_SPARSE) {
+            for (int d = 0; d < 3; d++)
+                s[d] = centre[d] + (u[d] - 0.5) * spread[d];
+        } else if (distribution == DIST_DENSE) {
+            // Within a ball of radius 0.9 x visualRange: cube-root radius along
+            // a direction taken from the unit cube.
+            double dir[3], norm = 0.0;
+            for (int d = 0; d < 3; d++) {
+                dir[d] = u[d] - 0.5;
+                norm += dir[d] * dir[d];
+            }
+            norm = norm > 0.0 ? sqrt(norm) : 1.0;
+            double r = 0.9 * p->visualRange * cbrt(u[3]);
+            for (int d = 0; d < 3; d++)
+                s[d] = centre[d] + dir[d] / norm * r;
+        } else {
+            const double *c = clusterCentres[(int)(u[3] * KERNEL_BENCH_CLUSTERS) % KERNEL_BENCH_CLUSTERS];
+            for (int d = 0; d < 3; d++)
+                s[d] = c[d] + (u[d] - 0.5) * 3.0 * p->minDistance;
+        }
+        for (int d = 0; d < 3; d++)
+            s[3 + d] = (u[5 + d] - 0.5) * p->maxSpeed;
+        s[6] = 1.0;
+    }
+}
+
+static double relativeError(double a, double b)
+{
+    double scale = fabs(b) > 1.0 ? fabs(b) : 1.0;
+    return fabs(a - b) / scale;
+}
+
+// Largest relative difference between two sets of neighbour sums.
+static double sumsError(const BoidNeighbourSums *a, const BoidNeighbourSums *b)
+{
+    double err = a->neighbourCount == b->neighbourCount ? 0.0 : INFINITY;
+    for (int d = 0; d < 3; d++) {
+        err = fmax(err, relativeError(a->cohesionSum[d], b->cohesionSum[d]));
+        err = fmax(err, relativeError(a->alignmentSum[d], b->alignmentSum[d]));
+        err = fmax(err, relativeError(a->separationVec[d], b->separationVec[d]));
+    }
+    return err;
+}
+
+static void writeRow(FILE *fp, const char *group, const char *variant, int distribution,
+                     long items, double seconds, double maxRelError)
+{
+    double ns = items > 0 ? 1e9 * seconds / items : 0.0;
+    fprintf(fp, "%s,%s,%s,%ld,%.3f,%.3e\n", group, variant, distributionNames[distribution], items, ns, maxRelError);
+    printf("%-10s %-14s %-9s  %9.3f ns/item  max rel. error %.3e\n",
+           group, variant, distributionNames[distribution], ns, maxRelError);
+    fflush(stdout);
+}
+
+// Times every available accumulation kernel over one boid's candidates.
+static void benchAccumulate(FILE *fp, int distribution, int scale, const BoidParams *p)
+{
+    int n = KERNEL_BENCH_CANDIDATES;
+    double *states = (double*)malloc((size_t)n * BOID_STATE_SIZE * sizeof(double));
+    BoidStateSoA soa;
+    if (!states || initBoidStateSoA(&soa, n) != 0) {
+        fprintf(stderr, "Memory allocation failed for %d candidates\n", n);
+        exit(1);
+    }
+    const double pos[3] = { 0.0, 0.0, 0.0 };
+    const double spread[3] = { 4.0 * p->visualRange, 4.0 * p->visualRange, 4.0 * p->visualRange };
+    syntheticLayout(states, n, distribution, pos, spread, p);
+    boidStateFromFlat(&soa, states);
+    double visualSq = p->visualRange * p->visualRange;
+    double minSq    = p->minDistance * p->minDistance;
+
+    BoidNeighbourSums reference;
+    initNeighbourSums(&reference);
+    accumulateNeighboursScalar(soa.posX, soa.posY, soa.posZ, soa.velX, soa.velY, soa.velZ,
+                               0, n, pos, visualSq, minSq, &reference);
+
+    int reps = 4000 * scale;
+    NeighbourRange all = { 0, n };
+    for (int type = 0; type < NEIGHBOUR_KERNEL_COUNT; type++) {
+        NeighbourKernelFn kernel = getNeighbourKernel((NeighbourKernelType)type);
+        if (!kernel)
+            continue;
+        BoidNeighbourSums sums;
+        double maxError = 0.0;
+        double start = wallSeconds();
+        for (int r = 0; r < reps; r++) {
+            initNeighbourSums(&sums);
+            kernel(soa.posX, soa.posY, soa.posZ, soa.velX, soa.velY, soa.velZ,
+                   &all, 1, pos, visualSq, minSq, &sums);
+            maxError = fmax(maxError, sumsError(&sums, &reference));
+        }
+        writeRow(fp, "accumulate", neighbourKernelName((NeighbourKernelType)type), distribution,
+                 (long)reps * n, wallSeconds() - start, maxError);
+    }
+    freeBoidStateSoA(&soa);
+    free(states);
+}
+
+// Times the boid update paths over a synthetic flock. Errors are against
+// updateOneBoidSync, the synchronous all-pairs reference, except for the
+// in-place SoA paths, which are checked against updateOneBoid.
+static void benchUpdate(FILE *fp, int distribution, int scale, const BoidParams *p)
+{
+    int n = KERNEL_BENCH_FLOCK;
+    size_t bytes = (size_t)n * BOID_STATE_SIZE * sizeof(double);
+    double *prev      = (double*)malloc(bytes);
+    double *reference = (double*)malloc(bytes);
+    double *inPlace   = (double*)malloc(bytes);
+    double *next      = (double*)malloc(bytes);
+    int *scratch      = (int*)malloc(n * sizeof(int));
+    BoidStateSoA soa, cells;
+    if (!prev || !reference || !inPlace || !next || !scratch ||
+        initBoidStateSoA(&soa, n) != 0 || initBoidStateSoA(&cells, n) != 0) {
+        fprintf(stderr, "Memory allocation failed for %d boids\n", n);
+        exit(1);
+    }
+    // Spread the flock over most of the domain, above the terrain.
+    const double centre[3] = { 0.5 * p->bounds[0], 0.5 * p->bounds[1], 0.75 * p->bounds[2] };
+    const double spread[3] = { 0.8 * p->bounds[0], 0.8 * p->bounds[1], 0.4 * p->bounds[2] };
+    syntheticLayout(prev, n, distribution, centre, spread, p);
+    for (int i = 0; i < n; i++)
+        updateOneBoidSync(prev, reference, i, n, p);
+    memcpy(inPlace, prev, bytes);
+    for (int i = 0; i < n; i++)
+        updateOneBoid(inPlace, i, n, p);
+
+    NeighbourGrid grid;
+    initNeighbourGrid(&grid);
+    if (buildNeighbourGrid(&grid, prev, n, neighbourGridCellSize(p)) != 0) {
+        fprintf(stderr, "Memory allocation failed for the neighbour grid\n");
+        exit(1);
+    }
+    boidStateFromFlatByCell(&cells, prev, &grid);
+
+    enum {
+        UPDATE_ALL_PAIRS, UPDATE_GRID, UPDATE_SOA_GRID, UPDATE_SOA_KERNEL,
+        UPDATE_GRID_KERNEL = UPDATE_SOA_KERNEL + NEIGHBOUR_KERNEL_COUNT
+    };
+    int allPairsReps = scale;
+    int gridReps     = 20 * scale;
+    for (int variant = UPDATE_ALL_PAIRS; variant < UPDATE_GRID_KERNEL + NEIGHBOUR_KERNEL_COUNT; variant++) {
+        char name[32];
+        NeighbourKernelFn kernel = NULL;
+        int reps = gridReps;
+        const double *expected = reference;
+        if (variant == UPDATE_ALL_PAIRS) {
+            strcpy(name, "allpairs");
+            reps = allPairsReps;
+        } else if (variant == UPDATE_GRID) {
+            strcpy(name, "grid");
+        } else if (variant == UPDATE_SOA_GRID) {
+            strcpy(name, "soa-grid");
+            expected = inPlace;
+        } else if (variant >= UPDATE_GRID_KERNEL) {
+            NeighbourKernelType type = (NeighbourKernelType)(variant - UPDATE_GRID_KERNEL);
+            kernel = getNeighbourKernel(type);
+            if (!kernel)
+                continue;
+            snprintf(name, sizeof(name), "grid-%s", neighbourKernelName(type));
+        } else {
+            NeighbourKernelType type = (NeighbourKernelType)(variant - UPDATE_SOA_KERNEL);
+            kernel = getNeighbourKernel(type);
+            if (!kernel)
+                continue;
+            snprintf(name, sizeof(name), "soa-%s", neighbourKernelName(type));
+            reps = allPairsReps;
+            expected = inPlace;
+        }
+
+        double seconds = 0.0;
+        for (int r = 0; r < reps; r++) {
+            // The SoA paths update in place, so each repetition starts afresh.
+            if (variant >= UPDATE_SOA_GRID && variant < UPDATE_GRID_KERNEL)
+                boidStateFromFlat(&soa, prev);
+            double start = wallSeconds();
+            if (variant == UPDATE_ALL_PAIRS) {
+                for (int i = 0; i < n; i++)
+                    updateOneBoidSync(prev, next, i, n, p);
+            } else if (variant == UPDATE_GRID) {
+                for (int i = 0; i < n; i++)
+                    updateOneBoidGridSync(prev, next, i, &grid, scratch, p);
+            } else if (variant == UPDATE_SOA_GRID) {
+                // Includes the grid build, which the SoA step does itself (from
+                // the same start-of-step positions, so 'grid' stays valid).
+                if (stepBoidsSubsetSoA(&soa, 0, n, &grid, p) != 0) {
+                    fprintf(stderr, "Memory allocation failed for the SoA step\n");
+                    exit(1);
+                }
+            } else if (variant >= UPDATE_GRID_KERNEL) {
+                for (int i = 0; i < n; i++)
+                    updateOneBoidGridKernelSync(prev, next, i, &grid, &cells, kernel, p);
+            } else {
+                for (int i = 0; i < n; i++)
+                    updateOneBoidSoAKernel(&soa, i, kernel, p);
+            }
+            seconds += wallSeconds() - start;
+        }
+        if (variant >= UPDATE_SOA_GRID && variant < UPDATE_GRID_KERNEL)
+            boidStateToFlat(&soa, next);
+
+        double maxError = 0.0;
+        for (size_t k = 0; k < (size_t)n * BOID_STATE_SIZE; k++)
+            maxError = fmax(maxError, relativeError(next[k], expected[k]));
+        writeRow(fp, "update", name, distribution, (long)reps * n, seconds, maxError);
+    }
+
+    freeNeighbourGrid(&grid);
+    freeBoidStateSoA(&cells);
+    freeBoidStateSoA(&soa);
+    free(scratch);
+    free(next);
+    free(inPlace);
+    free(reference);
+    free(prev);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <results.csv>\n", argv[0]);
+        return 1;
+    }
+    int scale = 1;
+    char *env_scale = getenv("BOIDS_BENCH_SCALE");
+    if (env_scale) {
+        scale = atoi(env_scale);
+        if (scale <= 0) {
+            fprintf(stderr, "BOIDS_BENCH_SCALE must be positive\n");
+            exit(1);
+        }
+    }
+
+    BoidParams params;
+    initParameters(&params, 124);
+
+    FILE *fp = fopen(argv[1], "w");
+    if (!fp) {
+        perror(argv[1]);
+        exit(1);
+    }
+    fprintf(fp, "group,variant,distribution,items,nsPerItem,maxRelError\n");
+    for (int d = 0; d < NUM_DISTRIBUTIONS; d++)
+        benchAccumulate(fp, d, scale, &params);
+    for (int d = 0; d < NUM_DISTRIBUTIONS; d++)
+        benchUpdate(fp, d, scale, &params);
+    if (fclose(fp) != 0) {
+        perror(argv[1]);
+        exit(1);
+    }
+    printf("Wrote %s\n", argv[1]);
+    return 0;
+}
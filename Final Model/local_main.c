@@ -1,9 +1,14 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include "boidUpdate.h"
+#include "boidProfile.h"
+#include "boidStepPool.h"
+#include "boidTrajectory.h"
+#include "terrain.h"
 
 // Define simulation dimensions
 #define NUM_BOIDS 5000
@@ -50,53 +55,20 @@ void freeTerrainData(TerrainData *td) {
     free(td->data);
 }
 
-// Save CSV files into the "output" folder.
-void writeCSVFiles(const double *positions, const double *statuses, 
-    int numBoids, int numSteps,
-    const TerrainData *terrainData,
-    const double bounds[3]) {
-    // Create the output folder if it doesn't exist.
-    if (mkdir("output", 0777) != 0 && errno != EEXIST) {
-        perror("mkdir");
-        exit(1);
-    }
-
-    // Write positions.csv: output all time steps for a given boid, then next boid.
-    FILE *fp = fopen("output/positions.csv", "w");
-    if (!fp) { perror("fopen positions.csv"); exit(1); }
-    fprintf(fp, "boid,step,x,y,z\n");
-    for (int boid = 0; boid < numBoids; boid++) {
-        for (int step = 0; step < numSteps; step++) {
-            // positions is stored as [step][boid][3] flattened:
-            int idx = (step * numBoids + boid) * 3;
-            fprintf(fp, "%d,%d,%.6f,%.6f,%.6f\n", boid, step, 
-                    positions[idx + 0], positions[idx + 1], positions[idx + 2]);
+// Save the terrain samples (if collected) and bounds into the "output" folder.
+void writeCSVFiles(const TerrainData *terrainData, const double bounds[3]) {
+    FILE *fp;
+    if (terrainData) {
+        fp = fopen("output/terrainData.csv", "w");
+        if (!fp) { perror("fopen terrainData.csv"); exit(1); }
+        fprintf(fp, "x,y,z\n");
+        for (int i = 0; i < terrainData->size; i++) {
+            int idx = i * 3;
+            fprintf(fp, "%.6f,%.6f,%.6f\n", terrainData->data[idx + 0], 
+                    terrainData->data[idx + 1], terrainData->data[idx + 2]);
         }
+        fclose(fp);
     }
-    fclose(fp);
-
-    // Write statuses.csv: output all time steps for each boid.
-    fp = fopen("output/statuses.csv", "w");
-    if (!fp) { perror("fopen statuses.csv"); exit(1); }
-    fprintf(fp, "boid,step,status\n");
-    for (int boid = 0; boid < numBoids; boid++) {
-        for (int step = 0; step < numSteps; step++) {
-            int idx = step * numBoids + boid;
-            fprintf(fp, "%d,%d,%.0f\n", boid, step, statuses[idx]);
-        }
-    }
-    fclose(fp);
-
-    // Write terrainData.csv (order remains the same).
-    fp = fopen("output/terrainData.csv", "w");
-    if (!fp) { perror("fopen terrainData.csv"); exit(1); }
-    fprintf(fp, "x,y,z\n");
-    for (int i = 0; i < terrainData->size; i++) {
-        int idx = i * 3;
-        fprintf(fp, "%.6f,%.6f,%.6f\n", terrainData->data[idx + 0], 
-                terrainData->data[idx + 1], terrainData->data[idx + 2]);
-    }
-    fclose(fp);
 
     // Write bounds.txt.
     fp = fopen("output/bounds.txt", "w");
@@ -110,77 +82,160 @@ int main(void)
     BoidParams params;
     initParameters(&params, 124);  // use seed 123
 
-    // Allocate the global boid state array.
+    // BOIDS_TERRAIN_FILE / BOIDS_TERRAIN_CACHE fly over a heightmap instead of
+    // evaluating the analytic terrain (see initTerrainMapFromEnv in terrain.h).
+    TerrainMap terrainMap;
+    int useTerrainMap = initTerrainMapFromEnv(&terrainMap, &params);
+    if (useTerrainMap < 0) {
+        exit(1);
+    }
+
+    // Allocate the double-buffered global boid state.
     // Each boid state is 7 doubles: x,y,z, vx,vy,vz, flag.
-    double *allStates = (double*)malloc(NUM_BOIDS * BOID_STATE_SIZE * sizeof(double));
-    if (!allStates) {
+    BoidStateBuffers buffers;
+    if (initBoidStateBuffers(&buffers, NUM_BOIDS) != 0) {
         fprintf(stderr, "Memory allocation failed for boid states\n");
         exit(1);
     }
+    double *allStates = buffers.prev;
+
+    // Start the stepping threads. BOIDS_THREADS sets the thread count;
+    // by default every online CPU is used.
+    int numThreads = 0;
+    char *env_threads = getenv("BOIDS_THREADS");
+    if (env_threads) {
+        numThreads = atoi(env_threads);
+    }
+    BoidStepPool stepPool;
+    if (initBoidStepPool(&stepPool, numThreads, BOID_STEP_CHUNK) != 0) {
+        fprintf(stderr, "Failed to start stepping threads\n");
+        exit(1);
+    }
+    printf("Using %d stepping thread(s)\n", stepPool.numThreads);
+
+    // BOIDS_VERLET_SKIN=<skin> keeps a neighbour list per boid covering
+    // visualRange + skin, rebuilt only once some boid has moved skin / 2.
+    char *env_skin = getenv("BOIDS_VERLET_SKIN");
+    if (env_skin) {
+        stepPool.neighbourSkin = atof(env_skin);
+    }
+
+    // BOIDS_SYMMETRIC_PAIRS=1 evaluates each boid pair once on half lists
+    // (rebuilt every step unless BOIDS_VERLET_SKIN is also set).
+    char *env_symmetric = getenv("BOIDS_SYMMETRIC_PAIRS");
+    if (env_symmetric) {
+        stepPool.symmetricPairs = atoi(env_symmetric) != 0;
+    }
+
+    // BOIDS_OCTREE_THETA=<theta> searches an octree that takes cohesion and
+    // alignment from whole nodes (theta = 0 only takes nodes entirely in range).
+    // BOIDS_OCTREE_ERROR=1 also measures every step against the exact update.
+    int measureOctree = 0;
+    BoidOctree errorTree;
+    BoidOctreeError octreeError = { 0.0, 0.0, 0, 0 };
+    char *env_theta = getenv("BOIDS_OCTREE_THETA");
+    if (env_theta) {
+        stepPool.useOctree = 1;
+        stepPool.octreeTheta = atof(env_theta);
+        char *env_octree_error = getenv("BOIDS_OCTREE_ERROR");
+        measureOctree = env_octree_error && atoi(env_octree_error) != 0;
+        initBoidOctree(&errorTree);
+        printf("Octree neighbour search with opening angle %.3f\n", stepPool.octreeTheta);
+    }
+
+    // BOIDS_REORDER_INTERVAL=<k> sorts the boids in memory along a Morton curve
+    // every k steps. Frames are then gathered back into boid ID order.
+    double *frameStates = NULL;
+    char *env_reorder = getenv("BOIDS_REORDER_INTERVAL");
+    if (env_reorder && atoi(env_reorder) > 0) {
+        stepPool.reorderInterval = atoi(env_reorder);
+        frameStates = (double*)malloc(NUM_BOIDS * BOID_STATE_SIZE * sizeof(double));
+        if (!frameStates) {
+            fprintf(stderr, "Memory allocation failed for reordered frames\n");
+            exit(1);
+        }
+        printf("Reordering boids along a Morton curve every %d step(s)\n", stepPool.reorderInterval);
+    }
+
+    // BOIDS_KERNEL=<avx2|avx512|sse2> sums the grid search with that SIMD kernel
+    // (any other value but scalar picks the widest the CPU supports). Results
+    // then differ from the default exact scalar loop in the last bits.
+    char *env_kernel = getenv("BOIDS_KERNEL");
+    if (env_kernel && activeNeighbourKernelType() != NEIGHBOUR_KERNEL_SCALAR) {
+        stepPool.kernel = activeNeighbourKernel();
+        printf("Grid search summed with the %s kernel\n", neighbourKernelName(activeNeighbourKernelType()));
+    }
     
-    // Allocate history arrays:
-    double *positionsHistory = (double*)malloc(NUM_STEPS * NUM_BOIDS * 3 * sizeof(double));
-    double *statusesHistory  = (double*)malloc(NUM_STEPS * NUM_BOIDS * sizeof(double));
-    if (!positionsHistory || !statusesHistory) {
-        fprintf(stderr, "Memory allocation failed for history arrays\n");
+    // Create the output folder if it doesn't exist.
+    if (mkdir("output", 0777) != 0 && errno != EEXIST) {
+        perror("mkdir");
+        exit(1);
+    }
+
+    // Positions and statuses are streamed to output/trajectory.bin as the
+    // simulation runs. BOIDS_TRAJECTORY_DTYPE=f32 halves its size, and
+    // BOIDS_OUTPUT=csv converts it to positions.csv and statuses.csv at the end.
+    // Statuses are kept as one crash event per boid unless BOIDS_CRASH_EVENTS=0.
+    int trajectoryDtype = BOID_TRAJECTORY_F64;
+    char *env_dtype = getenv("BOIDS_TRAJECTORY_DTYPE");
+    if (env_dtype) {
+        trajectoryDtype = parseBoidTrajectoryDtype(env_dtype);
+        if (trajectoryDtype < 0) {
+            fprintf(stderr, "Unknown BOIDS_TRAJECTORY_DTYPE '%s' (use f64 or f32)\n", env_dtype);
+            exit(1);
+        }
+    }
+    char *env_events = getenv("BOIDS_CRASH_EVENTS");
+    int trajectoryLayout = (!env_events || atoi(env_events) != 0)
+                         ? BOID_TRAJECTORY_CRASH_EVENTS : BOID_TRAJECTORY_STATUS_FRAMES;
+    int outputCSV = 0;
+    char *env_output = getenv("BOIDS_OUTPUT");
+    if (env_output) {
+        outputCSV = strcmp(env_output, "csv") == 0;
+        if (!outputCSV && strcmp(env_output, "binary") != 0) {
+            fprintf(stderr, "Unknown BOIDS_OUTPUT '%s' (use binary or csv)\n", env_output);
+            exit(1);
+        }
+    }
+    BoidTrajectoryWriter trajectory;
+    if (openBoidTrajectoryWriter(&trajectory, "output/trajectory.bin", trajectoryDtype, trajectoryLayout,
+                                 NUM_BOIDS, 0, params.bounds) != 0) {
+        fprintf(stderr, "Failed to create output/trajectory.bin\n");
         exit(1);
     }
     
+    // The terrain is written once: its parameters plus a heightmap of
+    // BOIDS_TERRAIN_RESOLUTION samples per axis. BOIDS_TERRAIN_SAMPLES=1 also
+    // records the ground under every boid at every step (terrainData.csv).
+    int terrainResolution = TERRAIN_DEFAULT_RESOLUTION;
+    char *env_resolution = getenv("BOIDS_TERRAIN_RESOLUTION");
+    if (env_resolution) {
+        terrainResolution = atoi(env_resolution);
+    }
+    char *env_samples = getenv("BOIDS_TERRAIN_SAMPLES");
+    int sampleTerrain = env_samples && atoi(env_samples) != 0;
+    if (writeTerrainDescriptor("output/terrain.txt", &params) != 0
+        || writeTerrainHeightmap("output/terrainHeightmap.csv", &params, terrainResolution) != 0) {
+        fprintf(stderr, "Failed to write the terrain (BOIDS_TERRAIN_RESOLUTION must be at least 2)\n");
+        exit(1);
+    }
+
     // Terrain data structure.
     TerrainData terrainData;
     initTerrainData(&terrainData);
     
     // Initialise boids.
-    for (int i = 0; i < NUM_BOIDS; i++) {
-        double x = ((double)rand() / RAND_MAX) * params.bounds[0];
-        double y = ((double)rand() / RAND_MAX) * params.bounds[1];
-        double ground = getTerrainHeight(x, y, &params);
-        // Choose z as ground + margin plus a random fraction of the remaining depth.
-        double z = ground + params.margin + (((double)rand() / RAND_MAX) * (params.bounds[2] - ground));
-        double vx = (((double)rand() / RAND_MAX) - 0.5) * params.maxSpeed;
-        double vy = (((double)rand() / RAND_MAX) - 0.5) * params.maxSpeed;
-        double vz = (((double)rand() / RAND_MAX) - 0.5) * params.maxSpeed;
-        allStates[i * BOID_STATE_SIZE + 0] = x;
-        allStates[i * BOID_STATE_SIZE + 1] = y;
-        allStates[i * BOID_STATE_SIZE + 2] = z;
-        allStates[i * BOID_STATE_SIZE + 3] = vx;
-        allStates[i * BOID_STATE_SIZE + 4] = vy;
-        allStates[i * BOID_STATE_SIZE + 5] = vz;
-        allStates[i * BOID_STATE_SIZE + 6] = 1.0;  // active
-    }
+    initBoidStates(allStates, 0, NUM_BOIDS, &params);
+    BOID_PROFILE_START(0);
     
     // Record initial state (step 0)
-    for (int i = 0; i < NUM_BOIDS; i++) {
-        int posIdx = i * 3;
-        positionsHistory[posIdx + 0] = allStates[i * BOID_STATE_SIZE + 0];
-        positionsHistory[posIdx + 1] = allStates[i * BOID_STATE_SIZE + 1];
-        positionsHistory[posIdx + 2] = allStates[i * BOID_STATE_SIZE + 2];
-        statusesHistory[i] = allStates[i * BOID_STATE_SIZE + 6];
-        
-        // Record a terrain sample for each boid (optional)
-        double ground = getTerrainHeight(allStates[i * BOID_STATE_SIZE + 0],
-                                         allStates[i * BOID_STATE_SIZE + 1],
-                                         &params);
-        appendTerrainData(&terrainData, allStates[i * BOID_STATE_SIZE + 0],
-                                    allStates[i * BOID_STATE_SIZE + 1],
-                                    ground);
+    if (appendBoidTrajectoryFrame(&trajectory, allStates) != 0) {
+        fprintf(stderr, "Failed to write output/trajectory.bin\n");
+        exit(1);
     }
-    
-    // Simulation loop: for each time step from 1 to NUM_STEPS-1,
-    // update all boids and record positions and statuses.
-    for (int step = 1; step < NUM_STEPS; step++) {
-        // Update all boids using shared step function.
-        stepBoidsSubset(allStates, NUM_BOIDS, 0, NUM_BOIDS, &params);
-        
-        // Record state after update.
+    if (sampleTerrain) {
         for (int i = 0; i < NUM_BOIDS; i++) {
-            int posIdx = (step * NUM_BOIDS + i) * 3;
-            positionsHistory[posIdx + 0] = allStates[i * BOID_STATE_SIZE + 0];
-            positionsHistory[posIdx + 1] = allStates[i * BOID_STATE_SIZE + 1];
-            positionsHistory[posIdx + 2] = allStates[i * BOID_STATE_SIZE + 2];
-            statusesHistory[step * NUM_BOIDS + i] = allStates[i * BOID_STATE_SIZE + 6];
-            
-            // Record terrain sample for this boid update.
+            // Record a terrain sample for each boid (optional)
             double ground = getTerrainHeight(allStates[i * BOID_STATE_SIZE + 0],
                                              allStates[i * BOID_STATE_SIZE + 1],
                                              &params);
@@ -188,6 +243,49 @@ int main(void)
                                         allStates[i * BOID_STATE_SIZE + 1],
                                         ground);
         }
+    }
+    
+    // Simulation loop: for each time step from 1 to NUM_STEPS-1,
+    // update all boids and record positions and statuses.
+    for (int step = 1; step < NUM_STEPS; step++) {
+        BOID_PROFILE_STEP(step);
+        BOID_PROFILE_BEGIN(stepStart);
+        if (measureOctree && measureBoidOctreeError(&errorTree, buffers.prev, NUM_BOIDS,
+                                                     stepPool.octreeTheta, &params, &octreeError) != 0) {
+            fprintf(stderr, "Octree error measurement failed at step %d\n", step);
+            exit(1);
+        }
+
+        // Update all boids in parallel from the previous step's state.
+        if (stepBoidsParallel(&stepPool, &buffers, &params) != 0) {
+            fprintf(stderr, "Parallel step failed at step %d\n", step);
+            exit(1);
+        }
+        allStates = buffers.prev;
+        if (frameStates) {
+            gatherBoidStates(&stepPool.ordering, buffers.prev, frameStates);
+            allStates = frameStates;
+        }
+        
+        // Record state after update.
+        BOID_PROFILE_BEGIN(recordStart);
+        if (appendBoidTrajectoryFrame(&trajectory, allStates) != 0) {
+            fprintf(stderr, "Failed to write output/trajectory.bin at step %d\n", step);
+            exit(1);
+        }
+        if (sampleTerrain) {
+            for (int i = 0; i < NUM_BOIDS; i++) {
+                // Record terrain sample for this boid update.
+                double ground = getTerrainHeight(allStates[i * BOID_STATE_SIZE + 0],
+                                                 allStates[i * BOID_STATE_SIZE + 1],
+                                                 &params);
+                appendTerrainData(&terrainData, allStates[i * BOID_STATE_SIZE + 0],
+                                            allStates[i * BOID_STATE_SIZE + 1],
+                                            ground);
+            }
+        }
+        BOID_PROFILE_END(recordStart, BOID_PHASE_RECORD, -1);
+        BOID_PROFILE_END(stepStart, BOID_PHASE_STEP, -1);
         
         // Update and display progress bar
         float progress = (float)step / (NUM_STEPS - 1);
@@ -213,16 +311,60 @@ int main(void)
     printf("]\n");
     
     // Write simulation outputs to CSV and TXT files.
-    writeCSVFiles(positionsHistory, statusesHistory, NUM_BOIDS, NUM_STEPS, &terrainData, params.bounds);
+    BOID_PROFILE_BEGIN(outputStart);
+    if (closeBoidTrajectoryWriter(&trajectory) != 0) {
+        fprintf(stderr, "Failed to write output/trajectory.bin\n");
+        exit(1);
+    }
+    writeCSVFiles(sampleTerrain ? &terrainData : NULL, params.bounds);
+    if (outputCSV) {
+        BoidTrajectory written;
+        if (openBoidTrajectory(&written, "output/trajectory.bin") != 0
+            || writeBoidTrajectoryCSV(&written, "output/positions.csv", "output/statuses.csv") != 0) {
+            fprintf(stderr, "Failed to convert output/trajectory.bin to CSV\n");
+            exit(1);
+        }
+        closeBoidTrajectory(&written);
+        remove("output/trajectory.bin");
+    }
+    BOID_PROFILE_END(outputStart, BOID_PHASE_OUTPUT, -1);
+#if BOIDS_PROFILE
+    if (writeBoidProfile("output/profile.json", "output/trace.json") != 0) {
+        fprintf(stderr, "Failed to write output/profile.json and output/trace.json\n");
+        exit(1);
+    }
+#endif
     
+    if (stepPool.neighbourSkin > 0.0 || stepPool.symmetricPairs) {
+        printf("%s: %ld builds in %ld steps (mean interval %.1f, longest %d), "
+               "%ld entries, %.1f MiB\n",
+               stepPool.symmetricPairs ? "Half neighbour lists" : "Neighbour lists", stepPool.lists.builds, stepPool.lists.steps, neighbourListMeanInterval(&stepPool.lists),
+               stepPool.lists.longestInterval, stepPool.lists.entries,
+               neighbourListBytes(&stepPool.lists) / (1024.0 * 1024.0));
+    }
+
+    if (measureOctree && octreeError.boidUpdates > 0) {
+        printf("Octree error against the exact update: max |dv| %.3e, rms |dv| %.3e "
+               "over %ld boid updates, %ld crash flag mismatches\n",
+               octreeError.maxVelError, sqrt(octreeError.sumSqVelError / octreeError.boidUpdates),
+               octreeError.boidUpdates, octreeError.crashMismatches);
+    }
+
     // Optionally, print a message.
     printf("Simulation complete. Output files saved in the 'output' folder.\n");
     
     // Free allocated memory.
-    free(allStates);
-    free(positionsHistory);
-    free(statusesHistory);
+    // The octree flag lives in the pool, so free the tree before the pool is cleared.
+    if (stepPool.useOctree) {
+        freeBoidOctree(&errorTree);
+    }
+    freeBoidStepPool(&stepPool);
+    freeBoidStateBuffers(&buffers);
+    free(frameStates);
     freeTerrainData(&terrainData);
+    if (useTerrainMap) {
+        freeTerrainMap(&terrainMap);
+    }
     
     return 0;
 }
@@ -7,24 +7,92 @@
 extern "C" {
 #endif
 
-// Initialise RabbitMQ messaging by connecting to the specified host.
-// Returns 0 on success, nonzero on error.
-int initMessaging(const char *host);
+// A transport moves messages between ranks. The functions below forward to
+// the transport chosen by initMessaging:
+//   - "amqp": through a RabbitMQ broker; 'address' is the broker host.
+//   - "shm":  through POSIX shared memory, for ranks on one host; 'address' is
+//             the name of the shared memory objects (e.g. "/boids"). It also
+//             provides a shared, double-buffered global state (mapSharedState).
+//   - "tcp":  over direct connections between the ranks, without a broker;
+//             'address' lists the ranks' endpoints (see messagingTcp.c). It also
+//             provides a ring all-gather (allGatherState).
+typedef struct {
+    const char *name;
+    int (*init)(const char *address, int rank, int nProcs);
+    int (*setupConsumerQueue)(void);
+    int (*setupDirectQueue)(int rank);
+    int (*publishMessageParts)(const void *header, size_t headerSize,
+                               const void *payload, size_t payloadSize, int destRank, int rank);
+    int (*receiveMessage)(size_t *bodySize);
+    int (*readMessageBody)(void *dest, size_t size);
+    int (*mapSharedState)(size_t size, void *buffers[2]);   // NULL if not supported
+    int (*waitSharedStep)(int step);                        // NULL if not supported
+    int (*allGather)(void *buffer, const size_t *offsets,
+                     const size_t *counts, int step);       // NULL if not supported
+} MessagingTransport;
 
-// Publish a binary message containing 'dataSize' bytes from 'allStates'.
-// The 'rank' parameter is used for logging.
-int publishGlobalState(const double *allStates, size_t dataSize, int rank);
+extern const MessagingTransport amqpTransport;    // messagingAmqp.c
+extern const MessagingTransport shmTransport;     // messagingShm.c
+extern const MessagingTransport tcpTransport;     // messagingTcp.c
 
-// Consume a binary message and copy its content into the provided buffer 'allStates'.
-// The caller must ensure that 'allStates' has room for 'dataSize' bytes.
-// Returns 0 on success, nonzero on error.
-int consumeGlobalState(double *allStates, size_t dataSize);
+// Initialise messaging for rank 'rank' of 'nProcs' over the transport named
+// 'transport' ("amqp", "shm" or "tcp"), connecting to 'address'.
+// Returns 0 on success, nonzero on error or for an unknown transport.
+int initMessaging(const char *transport, const char *address, int rank, int nProcs);
 
 // Set up (declare and bind) a consumer queue for this connection.
 // This function does not wait for a message—it only ensures that the queue exists.
 // Returns 0 on success, nonzero on error.
 int setupConsumerQueue(void);
 
+// Bind this process's consumer queue to the "boids_direct" exchange under the
+// routing key "rank<rank>", so that other ranks can address it directly.
+// setupConsumerQueue must have been called first.
+// Returns 0 on success, nonzero on error.
+int setupDirectQueue(int rank);
+
+// Publish one message whose body is 'header' followed by 'payload'. The two
+// parts are sent from where they lie, without being joined into one buffer.
+// destRank >= 0 sends to that rank's queue only; destRank < 0 sends to every
+// queue through the fanout exchange. The 'rank' parameter is used for logging.
+// Returns 0 on success, nonzero on error.
+int publishMessageParts(const void *header, size_t headerSize,
+                        const void *payload, size_t payloadSize, int destRank, int rank);
+
+// Wait for the next message and store the length of its body in '*bodySize'.
+// The body is then read in pieces with readMessageBody; any part left unread
+// is skipped by the next call. Returns 0 on success, nonzero on timeout or error.
+int receiveMessage(size_t *bodySize);
+
+// Copy the next 'size' bytes of the current message body into 'dest', straight
+// from the connection's receive buffer. A NULL 'dest' skips the bytes.
+// Returns 0 on success, nonzero on error or if fewer than 'size' bytes remain.
+int readMessageBody(void *dest, size_t size);
+
+// Nonzero if the chosen transport provides a shared state (mapSharedState).
+int messagingHasSharedState(void);
+
+// Map a global state of 'size' bytes shared by every rank, twice over: step s
+// is written to buffers[s & 1] while buffers[(s - 1) & 1] holds step s - 1.
+// Every rank must call this once. Returns 0 on success, nonzero on error or if
+// the transport has no shared memory.
+int mapSharedState(size_t size, void *buffers[2]);
+
+// Step-counter barrier: record that this rank has written its slice of step
+// 'step' to buffers[step & 1], then wait until every rank has done the same.
+// Returns 0 on success, nonzero on timeout or error.
+int waitSharedStep(int step);
+
+// Nonzero if the chosen transport has a collective all-gather (allGatherState).
+int messagingHasAllGather(void);
+
+// All-gather the state of step 'step': rank r's slice is the counts[r] bytes at
+// offsets[r] of 'buffer'. Each rank fills in its own slice first; on return every
+// slice holds its owner's bytes. Every rank must call this for every step, with
+// no other messages in flight. Returns 0 on success, nonzero on timeout, error
+// or if the transport has no all-gather.
+int allGatherState(void *buffer, const size_t *offsets, const size_t *counts, int step);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "messaging.h"
+
+// RabbitMQ transport: every message goes through the broker, fanout messages
+// via the "boids_exchange" fanout exchange and rank-addressed ones via the
+// "boids_direct" exchange.
+
+// Include rabbitmq-c headers.
+#include <amqp.h>
+#include <amqp_tcp_socket.h>
+#include <amqp_framing.h>
+
+// Global variables for connection.
+static amqp_connection_state_t conn;
+static amqp_socket_t *socket = NULL;
+static int channel = 1;
+
+// For consuming, we store a declared queue name.
+static int queueDeclared = 0;
+static amqp_bytes_t queueName = {0};
+
+// Body of the message being read by readMessageBody: the unread part of the
+// current body frame and the bytes still to come in later frames.
+static amqp_bytes_t bodyFragment = {0};
+static size_t fragmentOffset = 0;
+static size_t bodyRemaining = 0;
+
+static int amqpReadMessageBody(void *dest, size_t size);
+
+static int amqpInit(const char *host, int rank, int nProcs) {
+    (void)rank;
+    (void)nProcs;
+    // Create a new connection.
+    conn = amqp_new_connection();
+    socket = amqp_tcp_socket_new(conn);
+    if (!socket) {
+        fprintf(stderr, "initMessaging: Failed to create TCP socket\n");
+        return -1;
+    }
+    // Open a TCP socket to the host on port 5672.
+    int status = amqp_socket_open(socket, host, 5672);
+    if (status) {
+        fprintf(stderr, "initMessaging: Failed to open TCP socket to %s\n", host);
+        return -1;
+    }
+    // Login using default vhost "/" and guest credentials.
+    amqp_rpc_reply_t reply = amqp_login(conn, "/", 0, 131072, 0,
+                                          AMQP_SASL_METHOD_PLAIN, "guest", "guest");
+    if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+        fprintf(stderr, "initMessaging: Failed to login\n");
+        return -1;
+    }
+    // Open a channel.
+    amqp_channel_open(conn, channel);
+    reply = amqp_get_rpc_reply(conn);
+    if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+        fprintf(stderr, "initMessaging: Failed to open channel\n");
+        return -1;
+    }
+    // Declare an exchange named "boids_direct" of type "direct" for rank-addressed messages.
+    amqp_exchange_declare(conn, channel, amqp_cstring_bytes("boids_direct"),
+                          amqp_cstring_bytes("direct"),
+                          0, 0, 0, 0, amqp_empty_table);
+    reply = amqp_get_rpc_reply(conn);
+    if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+        fprintf(stderr, "initMessaging: Failed to declare direct exchange\n");
+        return -1;
+    }
+    // Declare an exchange named "boids_exchange" of type "fanout".
+    amqp_exchange_declare(conn, channel, amqp_cstring_bytes("boids_exchange"),
+                          amqp_cstring_bytes("fanout"),
+                          0, 0, 0, 0, amqp_empty_table);
+    reply = amqp_get_rpc_reply(conn);
+    if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+        fprintf(stderr, "initMessaging: Failed to declare exchange\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int amqpSetupConsumerQueue(void) {
+    if (!queueDeclared) {
+        amqp_queue_declare_ok_t *r = amqp_queue_declare(conn, channel,
+                                                        amqp_empty_bytes, // let the server choose a name
+                                                        0, 1, 0, 1, amqp_empty_table);
+        amqp_rpc_reply_t reply = amqp_get_rpc_reply(conn);
+        if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+            fprintf(stderr, "setupConsumerQueue: Failed to declare queue\n");
+            return -1;
+        }
+        queueName = amqp_bytes_malloc_dup(r->queue);
+        if (queueName.bytes == NULL) {
+            fprintf(stderr, "setupConsumerQueue: Out of memory while copying queue name\n");
+            return -1;
+        }
+        amqp_queue_bind(conn, channel, queueName,
+                        amqp_cstring_bytes("boids_exchange"),
+                        amqp_empty_bytes, amqp_empty_table);
+        reply = amqp_get_rpc_reply(conn);
+        if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+            fprintf(stderr, "setupConsumerQueue: Failed to bind queue\n");
+            return -1;
+        }
+        // *** NEW: Register a consumer on the declared queue.
+        amqp_basic_consume(conn, channel, queueName,
+                           amqp_empty_bytes, // consumer tag (server-assigned)
+                           1,                // no_local
+                           1,                // no_ack (auto-acknowledge messages)
+                           0,                // not exclusive
+                           amqp_empty_table);
+        reply = amqp_get_rpc_reply(conn);
+        if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+            fprintf(stderr, "setupConsumerQueue: Failed to start consuming\n");
+            return -1;
+        }
+        queueDeclared = 1;
+    }
+    return 0;
+}
+
+
+static int amqpSetupDirectQueue(int rank) {
+    if (!queueDeclared) {
+        fprintf(stderr, "setupDirectQueue: Consumer queue has not been declared\n");
+        return -1;
+    }
+    char routingKey[32];
+    snprintf(routingKey, sizeof(routingKey), "rank%d", rank);
+    amqp_queue_bind(conn, channel, queueName,
+                    amqp_cstring_bytes("boids_direct"),
+                    amqp_cstring_bytes(routingKey), amqp_empty_table);
+    amqp_rpc_reply_t reply = amqp_get_rpc_reply(conn);
+    if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+        fprintf(stderr, "setupDirectQueue: Failed to bind queue for rank %d\n", rank);
+        return -1;
+    }
+    return 0;
+}
+
+static int amqpPublishMessageParts(const void *header, size_t headerSize,
+                                   const void *payload, size_t payloadSize, int destRank, int rank) {
+    // Send the publish method, content header and body frames ourselves so that
+    // each body frame can point directly at the caller's memory.
+    char routingKey[32];
+    amqp_basic_publish_t method;
+    memset(&method, 0, sizeof(method));
+    if (destRank >= 0) {
+        snprintf(routingKey, sizeof(routingKey), "rank%d", destRank);
+        method.exchange    = amqp_cstring_bytes("boids_direct");
+        method.routing_key = amqp_cstring_bytes(routingKey);
+    } else {
+        method.exchange    = amqp_cstring_bytes("boids_exchange");
+        method.routing_key = amqp_empty_bytes;
+    }
+    if (amqp_send_method(conn, channel, AMQP_BASIC_PUBLISH_METHOD, &method) != AMQP_STATUS_OK) {
+        fprintf(stderr, "publishMessageParts: Failed to publish message from rank %d\n", rank);
+        return -1;
+    }
+
+    amqp_basic_properties_t properties;
+    memset(&properties, 0, sizeof(properties));
+    amqp_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.frame_type = AMQP_FRAME_HEADER;
+    frame.channel = channel;
+    frame.payload.properties.class_id = AMQP_BASIC_CLASS;
+    frame.payload.properties.body_size = headerSize + payloadSize;
+    frame.payload.properties.decoded = &properties;
+    if (amqp_send_frame(conn, &frame) != AMQP_STATUS_OK) {
+        fprintf(stderr, "publishMessageParts: Failed to send content header from rank %d\n", rank);
+        return -1;
+    }
+
+    // Body frames carry at most frame_max minus the 8 bytes of frame overhead.
+    size_t maxFragment = (size_t)amqp_get_frame_max(conn) - 8;
+    const void *parts[2] = { header, payload };
+    size_t sizes[2] = { headerSize, payloadSize };
+    for (int part = 0; part < 2; part++) {
+        const char *data = (const char*)parts[part];
+        size_t left = sizes[part];
+        while (left > 0) {
+            size_t len = left < maxFragment ? left : maxFragment;
+            frame.frame_type = AMQP_FRAME_BODY;
+            frame.payload.body_fragment.bytes = (void *)data;
+            frame.payload.body_fragment.len = len;
+            if (amqp_send_frame(conn, &frame) != AMQP_STATUS_OK) {
+                fprintf(stderr, "publishMessageParts: Failed to send message body from rank %d\n", rank);
+                return -1;
+            }
+            data += len;
+            left -= len;
+        }
+    }
+    return 0;
+}
+
+static int waitForFrame(amqp_frame_t *frame) {
+    struct timeval timeout;
+    timeout.tv_sec = 10;
+    timeout.tv_usec = 0;
+    int status = amqp_simple_wait_frame_noblock(conn, frame, &timeout);
+    if (status != AMQP_STATUS_OK) {
+        fprintf(stderr, "receiveMessage: Timeout or error waiting for message (status %d)\n", status);
+        return -1;
+    }
+    return 0;
+}
+
+static int amqpReceiveMessage(size_t *bodySize) {
+    if (bodyRemaining > 0 && amqpReadMessageBody(NULL, bodyRemaining) != 0)
+        return -1;
+    // The previous body has been consumed, so its frames can be recycled.
+    amqp_maybe_release_buffers(conn);
+
+    amqp_frame_t frame;
+    for (;;) {
+        if (waitForFrame(&frame) != 0)
+            return -1;
+        if (frame.frame_type != AMQP_FRAME_METHOD)
+            continue;
+        if (frame.payload.method.id == AMQP_BASIC_DELIVER_METHOD)
+            break;
+        if (frame.payload.method.id == AMQP_CHANNEL_CLOSE_METHOD ||
+            frame.payload.method.id == AMQP_CONNECTION_CLOSE_METHOD) {
+            fprintf(stderr, "receiveMessage: Broker closed the channel\n");
+            return -1;
+        }
+    }
+    if (waitForFrame(&frame) != 0)
+        return -1;
+    if (frame.frame_type != AMQP_FRAME_HEADER) {
+        fprintf(stderr, "receiveMessage: Expected a content header, got frame type %d\n", frame.frame_type);
+        return -1;
+    }
+    bodyRemaining = (size_t)frame.payload.properties.body_size;
+    bodyFragment.len = 0;
+    fragmentOffset = 0;
+    *bodySize = bodyRemaining;
+    return 0;
+}
+
+static int amqpReadMessageBody(void *dest, size_t size) {
+    if (size > bodyRemaining) {
+        fprintf(stderr, "readMessageBody: Asked for %zu bytes, %zu remain\n", size, bodyRemaining);
+        return -1;
+    }
+    char *out = (char *)dest;
+    while (size > 0) {
+        if (fragmentOffset == bodyFragment.len) {
+            amqp_frame_t frame;
+            if (waitForFrame(&frame) != 0)
+                return -1;
+            if (frame.frame_type != AMQP_FRAME_BODY) {
+                fprintf(stderr, "readMessageBody: Expected a body frame, got frame type %d\n", frame.frame_type);
+                return -1;
+            }
+            bodyFragment = frame.payload.body_fragment;
+            fragmentOffset = 0;
+        }
+        size_t len = bodyFragment.len - fragmentOffset;
+        if (len > size)
+            len = size;
+        if (out) {
+            memcpy(out, (const char *)bodyFragment.bytes + fragmentOffset, len);
+            out += len;
+        }
+        fragmentOffset += len;
+        bodyRemaining -= len;
+        size -= len;
+    }
+    return 0;
+}
+
+const MessagingTransport amqpTransport = {
+    "amqp",
+    amqpInit,
+    amqpSetupConsumerQueue,
+    amqpSetupDirectQueue,
+    amqpPublishMessageParts,
+    amqpReceiveMessage,
+    amqpReadMessageBody,
+    NULL,
+    NULL,
+    NULL,
+};
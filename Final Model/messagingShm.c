@@ -0,0 +1,583 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "messaging.h"
+
+// Shared memory transport for ranks on one host. Rank 0 creates two shared
+// memory objects and the other ranks open them:
+//   - "<name>" holds one mailbox per rank: a byte ring that other ranks write
+//     messages into and its owner reads them out of.
+//   - "<name>_state" holds the double-buffered global state and one step
+//     counter per rank (mapSharedState / waitSharedStep).
+// Rank 0 removes each name once every rank has opened the object, so nothing
+// is left in /dev/shm after the run. Ranks in separate containers must share
+// an IPC namespace (docker "ipc: shareable" / "ipc: service:<name>").
+
+#define SHM_MAGIC           0x4D485342u // "BSHM" in memory order
+#define SHM_ALIGN           64          // Keeps each rank's data on its own cache lines
+#define SHM_MAILBOX_BYTES   (1u << 20)  // Ring size per rank; longer messages stream through it
+#define SHM_TIMEOUT_SECONDS 10          // Wait for a message or a step, as for the AMQP transport
+#define SHM_ATTACH_SECONDS  60          // Wait for rank 0 to create an object or the others to open it
+
+// Start of both objects.
+typedef struct {
+    uint32_t magic;
+    int ready;                  // Set by rank 0 once the object is initialised
+    int attached;               // Ranks that have opened the object
+    int nProcs;
+    size_t size;                // Object size in bytes
+} ShmPrologue;
+
+// A rank's mailbox, followed by its SHM_MAILBOX_BYTES ring. head and tail count
+// every byte ever written and read, so head - tail bytes are waiting.
+typedef struct {
+    pthread_mutex_t lock;       // Guards head and tail
+    pthread_mutex_t writeLock;  // Held by a sender for a whole message
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    uint64_t head;
+    uint64_t tail;
+} ShmMailbox;
+
+// Start of the state object, followed by nProcs step counters and the two buffers.
+typedef struct {
+    pthread_mutex_t lock;       // Guards the step counters
+    pthread_cond_t stepped;     // Broadcast when every rank has reached a step
+} ShmStateHeader;
+
+static int myRank = 0;
+static int numProcs = 1;
+static char objectName[256];
+
+static unsigned char *mailboxBase = NULL;
+static size_t mailboxStride = 0;
+
+static ShmStateHeader *stateHeader = NULL;
+static int *stepCounters = NULL;
+
+// Bytes of the current message not yet read by readMessageBody.
+static uint64_t bodyRemaining = 0;
+
+// Bytes taken out of this rank's ring while it waited to send (see ringWrite),
+// read before anything still in the ring.
+static unsigned char *spill = NULL;
+static size_t spillStart = 0;
+static size_t spillEnd = 0;
+static size_t spillCapacity = 0;
+
+static size_t alignUp(size_t n)
+{
+    return (n + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+}
+
+static void sleepMilliseconds(long ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static void initSharedLock(pthread_mutex_t *lock)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static void initSharedCond(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Waits on 'cond' until 'deadline'. Returns 0 when woken, nonzero on timeout.
+static int waitUntil(pthread_cond_t *cond, pthread_mutex_t *lock, const struct timespec *deadline)
+{
+    int status = pthread_cond_timedwait(cond, lock, deadline);
+    return status == ETIMEDOUT ? -1 : 0;
+}
+
+static struct timespec deadlineIn(long ms)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec  += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+// ----------------------------- //
+
+// - openSharedObject Function - //
+
+// Rank 0 creates the object 'name' of 'size' bytes, lets 'initBody' set up
+// everything after the prologue and waits for the other ranks to open it before
+// removing the name. The other ranks wait for the object to be ready and open it.
+// An object left by an earlier run is told apart by its attach count.
+// Returns the mapped object, or NULL on error or timeout.
+
+static void *openSharedObject(const char *name, size_t size, void (*initBody)(unsigned char *base))
+{
+    time_t giveUp = time(NULL) + SHM_ATTACH_SECONDS;
+    unsigned char *base = NULL;
+
+    if (myRank == 0) {
+        shm_unlink(name);
+        int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            fprintf(stderr, "openSharedObject: Failed to create %s: %s\n", name, strerror(errno));
+            return NULL;
+        }
+        if (ftruncate(fd, (off_t)size) != 0) {
+            fprintf(stderr, "openSharedObject: Failed to size %s to %zu bytes: %s\n", name, size, strerror(errno));
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+        base = (unsigned char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            fprintf(stderr, "openSharedObject: Failed to map %s: %s\n", name, strerror(errno));
+            shm_unlink(name);
+            return NULL;
+        }
+        ShmPrologue *p = (ShmPrologue*)base;
+        p->magic    = SHM_MAGIC;
+        p->nProcs   = numProcs;
+        p->size     = size;
+        p->attached = 1;
+        if (initBody)
+            initBody(base);
+        __atomic_store_n(&p->ready, 1, __ATOMIC_RELEASE);
+
+        while (__atomic_load_n(&p->attached, __ATOMIC_ACQUIRE) < numProcs) {
+            if (time(NULL) > giveUp) {
+                fprintf(stderr, "openSharedObject: Only %d of %d ranks opened %s\n",
+                        __atomic_load_n(&p->attached, __ATOMIC_ACQUIRE), numProcs, name);
+                shm_unlink(name);
+                munmap(base, size);
+                return NULL;
+            }
+            sleepMilliseconds(1);
+        }
+        shm_unlink(name);
+        return base;
+    }
+
+    for (;;) {
+        if (time(NULL) > giveUp) {
+            fprintf(stderr, "openSharedObject: Timed out waiting for rank 0 to create %s\n", name);
+            return NULL;
+        }
+        int fd = shm_open(name, O_RDWR, 0600);
+        if (fd < 0) {
+            sleepMilliseconds(10);
+            continue;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size != size) {
+            // Not sized yet, or left by a run with another configuration.
+            close(fd);
+            sleepMilliseconds(10);
+            continue;
+        }
+        base = (unsigned char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            fprintf(stderr, "openSharedObject: Failed to map %s: %s\n", name, strerror(errno));
+            return NULL;
+        }
+        ShmPrologue *p = (ShmPrologue*)base;
+        while (!__atomic_load_n(&p->ready, __ATOMIC_ACQUIRE) && time(NULL) <= giveUp)
+            sleepMilliseconds(1);
+        if (__atomic_load_n(&p->ready, __ATOMIC_ACQUIRE) && p->magic == SHM_MAGIC
+            && p->nProcs == numProcs
+            && __atomic_add_fetch(&p->attached, 1, __ATOMIC_ACQ_REL) <= numProcs)
+            return base;
+        // Every rank of that object's run has already opened it: it is stale.
+        munmap(base, size);
+        sleepMilliseconds(10);
+    }
+}
+
+// - End of openSharedObject Function - //
+
+// ----------------------------- //
+
+// - Mailbox Functions - //
+
+static ShmMailbox *mailboxOf(int rank)
+{
+    return (ShmMailbox*)(mailboxBase + alignUp(sizeof(ShmPrologue)) + (size_t)rank * mailboxStride);
+}
+
+static unsigned char *ringOf(ShmMailbox *m)
+{
+    return (unsigned char*)m + alignUp(sizeof(ShmMailbox));
+}
+
+static void initMailboxes(unsigned char *base)
+{
+    mailboxBase = base;
+    for (int r = 0; r < numProcs; r++) {
+        ShmMailbox *m = mailboxOf(r);
+        initSharedLock(&m->lock);
+        initSharedLock(&m->writeLock);
+        initSharedCond(&m->notEmpty);
+        initSharedCond(&m->notFull);
+        m->head = 0;
+        m->tail = 0;
+    }
+}
+
+// Moves everything waiting in this rank's ring to the spill buffer.
+static int spillMailbox(void)
+{
+    ShmMailbox *m = mailboxOf(myRank);
+    unsigned char *ring = ringOf(m);
+    pthread_mutex_lock(&m->lock);
+    uint64_t tail = m->tail;
+    size_t waiting = (size_t)(m->head - tail);
+    pthread_mutex_unlock(&m->lock);
+    if (waiting == 0)
+        return 0;
+
+    if (spillStart == spillEnd)
+        spillStart = spillEnd = 0;
+    if (spillEnd + waiting > spillCapacity) {
+        size_t cap = spillCapacity ? spillCapacity : SHM_MAILBOX_BYTES;
+        while (cap < spillEnd + waiting)
+            cap *= 2;
+        unsigned char *grown = (unsigned char*)realloc(spill, cap);
+        if (!grown) {
+            fprintf(stderr, "publishMessageParts: Out of memory while holding back received messages\n");
+            return -1;
+        }
+        spill = grown;
+        spillCapacity = cap;
+    }
+    size_t at = (size_t)(tail % SHM_MAILBOX_BYTES);
+    size_t first = waiting < SHM_MAILBOX_BYTES - at ? waiting : SHM_MAILBOX_BYTES - at;
+    memcpy(spill + spillEnd, ring + at, first);
+    memcpy(spill + spillEnd + first, ring, waiting - first);
+    spillEnd += waiting;
+
+    pthread_mutex_lock(&m->lock);
+    m->tail += waiting;
+    pthread_cond_broadcast(&m->notFull);
+    pthread_mutex_unlock(&m->lock);
+    return 0;
+}
+
+// Copies 'size' bytes into the ring of 'm', waiting for room as the owner
+// drains it. The caller holds m->writeLock, so the bytes between head and the
+// end of each copy belong to it alone and are copied outside m->lock.
+// While it waits, this rank empties its own ring into the spill buffer: ranks
+// that send to each other before receiving would otherwise all wait forever.
+static int ringWrite(ShmMailbox *m, const void *data, size_t size)
+{
+    const unsigned char *in = (const unsigned char*)data;
+    unsigned char *ring = ringOf(m);
+    while (size > 0) {
+        time_t giveUp = time(NULL) + SHM_TIMEOUT_SECONDS;
+        pthread_mutex_lock(&m->lock);
+        while (m->head - m->tail == SHM_MAILBOX_BYTES) {
+            pthread_mutex_unlock(&m->lock);
+            if (spillMailbox() != 0)
+                return -1;
+            if (time(NULL) > giveUp) {
+                fprintf(stderr, "publishMessageParts: Timed out waiting for room in a mailbox\n");
+                return -1;
+            }
+            struct timespec pause = deadlineIn(1);
+            pthread_mutex_lock(&m->lock);
+            if (m->head - m->tail == SHM_MAILBOX_BYTES)
+                waitUntil(&m->notFull, &m->lock, &pause);
+        }
+        uint64_t head = m->head;
+        size_t room = SHM_MAILBOX_BYTES - (size_t)(head - m->tail);
+        pthread_mutex_unlock(&m->lock);
+
+        size_t at = (size_t)(head % SHM_MAILBOX_BYTES);
+        size_t len = size;
+        if (len > room)
+            len = room;
+        if (len > SHM_MAILBOX_BYTES - at)
+            len = SHM_MAILBOX_BYTES - at;
+        memcpy(ring + at, in, len);
+
+        pthread_mutex_lock(&m->lock);
+        m->head += len;
+        pthread_cond_signal(&m->notEmpty);
+        pthread_mutex_unlock(&m->lock);
+        in += len;
+        size -= len;
+    }
+    return 0;
+}
+
+// Copies the next 'size' bytes out of this rank's ring into 'dest' (or skips
+// them if 'dest' is NULL), waiting for the senders to write them.
+static int ringRead(void *dest, size_t size)
+{
+    ShmMailbox *m = mailboxOf(myRank);
+    unsigned char *out = (unsigned char*)dest;
+    unsigned char *ring = ringOf(m);
+    if (spillStart < spillEnd) {
+        size_t len = spillEnd - spillStart;
+        if (len > size)
+            len = size;
+        if (out) {
+            memcpy(out, spill + spillStart, len);
+            out += len;
+        }
+        spillStart += len;
+        size -= len;
+    }
+    while (size > 0) {
+        struct timespec deadline = deadlineIn(SHM_TIMEOUT_SECONDS * 1000L);
+        pthread_mutex_lock(&m->lock);
+        while (m->head == m->tail) {
+            if (waitUntil(&m->notEmpty, &m->lock, &deadline) != 0) {
+                pthread_mutex_unlock(&m->lock);
+                fprintf(stderr, "receiveMessage: Timeout waiting for message\n");
+                return -1;
+            }
+        }
+        uint64_t tail = m->tail;
+        size_t waiting = (size_t)(m->head - tail);
+        pthread_mutex_unlock(&m->lock);
+
+        size_t at = (size_t)(tail % SHM_MAILBOX_BYTES);
+        size_t len = size;
+        if (len > waiting)
+            len = waiting;
+        if (len > SHM_MAILBOX_BYTES - at)
+            len = SHM_MAILBOX_BYTES - at;
+        if (out) {
+            memcpy(out, ring + at, len);
+            out += len;
+        }
+
+        pthread_mutex_lock(&m->lock);
+        m->tail += len;
+        pthread_cond_broadcast(&m->notFull);
+        pthread_mutex_unlock(&m->lock);
+        size -= len;
+    }
+    return 0;
+}
+
+static int sendToMailbox(int destRank, const void *header, size_t headerSize,
+                         const void *payload, size_t payloadSize)
+{
+    ShmMailbox *m = mailboxOf(destRank);
+    uint64_t bodySize = headerSize + payloadSize;
+    // The sender holding the mailbox may be waiting for room itself, so keep
+    // our own ring moving while we wait for it (see ringWrite).
+    time_t giveUp = time(NULL) + SHM_TIMEOUT_SECONDS;
+    while (pthread_mutex_trylock(&m->writeLock) != 0) {
+        if (spillMailbox() != 0)
+            return -1;
+        if (time(NULL) > giveUp) {
+            fprintf(stderr, "publishMessageParts: Timed out waiting for rank %d's mailbox\n", destRank);
+            return -1;
+        }
+        sched_yield();
+    }
+    int status = ringWrite(m, &bodySize, sizeof(bodySize));
+    if (status == 0 && headerSize > 0)
+        status = ringWrite(m, header, headerSize);
+    if (status == 0 && payloadSize > 0)
+        status = ringWrite(m, payload, payloadSize);
+    pthread_mutex_unlock(&m->writeLock);
+    return status;
+}
+
+// - End of Mailbox Functions - //
+
+// ----------------------------- //
+
+// - Transport Functions - //
+
+static int shmInit(const char *name, int rank, int nProcs)
+{
+    if (nProcs < 1 || rank < 0 || rank >= nProcs) {
+        fprintf(stderr, "initMessaging: Invalid rank %d of %d\n", rank, nProcs);
+        return -1;
+    }
+    if (name[0] != '/' || strlen(name) + sizeof("_state") > sizeof(objectName)) {
+        fprintf(stderr, "initMessaging: Shared memory name '%s' must start with '/'\n", name);
+        return -1;
+    }
+    myRank   = rank;
+    numProcs = nProcs;
+    strcpy(objectName, name);
+
+    mailboxStride = alignUp(sizeof(ShmMailbox)) + SHM_MAILBOX_BYTES;
+    size_t size = alignUp(sizeof(ShmPrologue)) + (size_t)nProcs * mailboxStride;
+    unsigned char *base = (unsigned char*)openSharedObject(objectName, size, initMailboxes);
+    if (!base)
+        return -1;
+    mailboxBase = base;
+    return 0;
+}
+
+// Every mailbox exists from the start and receives both kinds of message.
+static int shmSetupConsumerQueue(void)
+{
+    return 0;
+}
+
+static int shmSetupDirectQueue(int rank)
+{
+    (void)rank;
+    return 0;
+}
+
+static int shmPublishMessageParts(const void *header, size_t headerSize,
+                                  const void *payload, size_t payloadSize, int destRank, int rank)
+{
+    if (destRank >= numProcs) {
+        fprintf(stderr, "publishMessageParts: No rank %d to send to from rank %d\n", destRank, rank);
+        return -1;
+    }
+    if (destRank >= 0)
+        return sendToMailbox(destRank, header, headerSize, payload, payloadSize);
+    // A fanout goes to every other rank; receivers skip their own frames anyway.
+    for (int r = 0; r < numProcs; r++) {
+        if (r != myRank && sendToMailbox(r, header, headerSize, payload, payloadSize) != 0) {
+            fprintf(stderr, "publishMessageParts: Failed to publish message from rank %d\n", rank);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int shmReadMessageBody(void *dest, size_t size)
+{
+    if (size > bodyRemaining) {
+        fprintf(stderr, "readMessageBody: Asked for %zu bytes, %llu remain\n",
+                size, (unsigned long long)bodyRemaining);
+        return -1;
+    }
+    if (ringRead(dest, size) != 0)
+        return -1;
+    bodyRemaining -= size;
+    return 0;
+}
+
+static int shmReceiveMessage(size_t *bodySize)
+{
+    if (bodyRemaining > 0 && shmReadMessageBody(NULL, (size_t)bodyRemaining) != 0)
+        return -1;
+    uint64_t size;
+    if (ringRead(&size, sizeof(size)) != 0)
+        return -1;
+    bodyRemaining = size;
+    *bodySize = (size_t)size;
+    return 0;
+}
+
+static size_t stateCountersOffset(void)
+{
+    return alignUp(sizeof(ShmPrologue)) + alignUp(sizeof(ShmStateHeader));
+}
+
+static size_t stateBufferOffset(void)
+{
+    return stateCountersOffset() + alignUp((size_t)numProcs * sizeof(int));
+}
+
+static void initSharedState(unsigned char *base)
+{
+    ShmStateHeader *h = (ShmStateHeader*)(base + alignUp(sizeof(ShmPrologue)));
+    initSharedLock(&h->lock);
+    initSharedCond(&h->stepped);
+    int *steps = (int*)(base + stateCountersOffset());
+    for (int r = 0; r < numProcs; r++)
+        steps[r] = -1;
+}
+
+static int shmMapSharedState(size_t size, void *buffers[2])
+{
+    if (stateHeader) {
+        fprintf(stderr, "mapSharedState: The shared state is already mapped\n");
+        return -1;
+    }
+    char name[sizeof(objectName) + sizeof("_state")];
+    snprintf(name, sizeof(name), "%s_state", objectName);
+    size_t bufferSize = alignUp(size);
+    unsigned char *base = (unsigned char*)openSharedObject(name, stateBufferOffset() + 2 * bufferSize,
+                                                           initSharedState);
+    if (!base)
+        return -1;
+    stateHeader  = (ShmStateHeader*)(base + alignUp(sizeof(ShmPrologue)));
+    stepCounters = (int*)(base + stateCountersOffset());
+    buffers[0] = base + stateBufferOffset();
+    buffers[1] = base + stateBufferOffset() + bufferSize;
+    return 0;
+}
+
+static int shmWaitSharedStep(int step)
+{
+    ShmStateHeader *h = stateHeader;
+    if (!h) {
+        fprintf(stderr, "waitSharedStep: The shared state has not been mapped\n");
+        return -1;
+    }
+    struct timespec deadline = deadlineIn(SHM_TIMEOUT_SECONDS * 1000L);
+    pthread_mutex_lock(&h->lock);
+    stepCounters[myRank] = step;
+    int waited = 0;
+    for (;;) {
+        int r = 0;
+        while (r < numProcs && stepCounters[r] >= step)
+            r++;
+        if (r == numProcs)
+            break;
+        if (waitUntil(&h->stepped, &h->lock, &deadline) != 0) {
+            pthread_mutex_unlock(&h->lock);
+            fprintf(stderr, "waitSharedStep: Timed out at step %d waiting for rank %d\n", step, r);
+            return -1;
+        }
+        waited = 1;
+    }
+    // The last rank to arrive finds every counter at 'step' and wakes the others.
+    if (!waited)
+        pthread_cond_broadcast(&h->stepped);
+    pthread_mutex_unlock(&h->lock);
+    return 0;
+}
+
+// - End of Transport Functions - //
+
+const MessagingTransport shmTransport = {
+    "shm",
+    shmInit,
+    shmSetupConsumerQueue,
+    shmSetupDirectQueue,
+    shmPublishMessageParts,
+    shmReceiveMessage,
+    shmReadMessageBody,
+    shmMapSharedState,
+    shmWaitSharedStep,
+    NULL,
+};
@@ -0,0 +1,578 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "messaging.h"
+
+// Brokerless TCP transport: every pair of ranks shares one connection and a
+// message is a 64-bit body length followed by the body. The all-gather runs as
+// a ring, so each rank sends and receives one copy of the other slices per step
+// however many ranks there are.
+//
+// The address lists the ranks' listening endpoints as "host[:port]" entries
+// separated by commas, one per rank in rank order (e.g. "boids0:7470,boids1:7470").
+// A single entry puts every rank on that host, rank r listening on port + r, which
+// is how several ranks run on one machine.
+
+#define TCP_DEFAULT_PORT     7470
+#define TCP_TIMEOUT_SECONDS  10     // Wait for a message, as for the other transports
+#define TCP_CONNECT_SECONDS  60     // Wait for every rank to start listening
+#define TCP_READ_CHUNK       65536  // Bytes read into an inbox at a time
+
+// A connection to another rank. Bytes that arrive before they are asked for
+// (while this rank was sending, or from other peers) wait in the inbox.
+typedef struct {
+    int fd;                     // -1 for this rank and once the peer has closed
+    unsigned char *inbox;
+    size_t start;               // First unread inbox byte
+    size_t end;                 // End of the inbox bytes
+    size_t capacity;
+} TcpPeer;
+
+static TcpPeer *peers = NULL;
+static int myRank = 0;
+static int numProcs = 1;
+
+// Message being read by readMessageBody.
+static int currentPeer = -1;
+static uint64_t bodyRemaining = 0;
+static int nextPeer = 0;        // Where receiveMessage starts looking, for fairness
+
+static long millisecondsLeft(const struct timespec *deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (deadline->tv_sec - now.tv_sec) * 1000L + (deadline->tv_nsec - now.tv_nsec) / 1000000L;
+    return ms > 0 ? ms : 0;
+}
+
+static struct timespec deadlineIn(int seconds)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += seconds;
+    return ts;
+}
+
+static size_t inboxBytes(const TcpPeer *p)
+{
+    return p->end - p->start;
+}
+
+// Makes room for 'size' more bytes at the end of the inbox.
+static int reserveInbox(TcpPeer *p, size_t size)
+{
+    if (p->start == p->end)
+        p->start = p->end = 0;
+    if (p->end + size <= p->capacity)
+        return 0;
+    if (p->start > 0) {
+        memmove(p->inbox, p->inbox + p->start, p->end - p->start);
+        p->end -= p->start;
+        p->start = 0;
+        if (p->end + size <= p->capacity)
+            return 0;
+    }
+    size_t cap = p->capacity ? p->capacity : TCP_READ_CHUNK;
+    while (cap < p->end + size)
+        cap *= 2;
+    unsigned char *grown = (unsigned char*)realloc(p->inbox, cap);
+    if (!grown) {
+        fprintf(stderr, "receiveMessage: Out of memory while buffering received messages\n");
+        return -1;
+    }
+    p->inbox = grown;
+    p->capacity = cap;
+    return 0;
+}
+
+// Moves whatever peer r has sent into its inbox without waiting.
+static int pumpPeer(int r)
+{
+    TcpPeer *p = &peers[r];
+    for (;;) {
+        if (reserveInbox(p, TCP_READ_CHUNK) != 0)
+            return -1;
+        ssize_t got = recv(p->fd, p->inbox + p->end, TCP_READ_CHUNK, MSG_DONTWAIT);
+        if (got > 0) {
+            p->end += (size_t)got;
+            if ((size_t)got < TCP_READ_CHUNK)
+                return 0;
+        } else if (got == 0) {
+            // The peer has finished; anything it sent is already in the inbox.
+            close(p->fd);
+            p->fd = -1;
+            return 0;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        } else if (errno != EINTR) {
+            fprintf(stderr, "receiveMessage: Connection to rank %d failed: %s\n", r, strerror(errno));
+            return -1;
+        }
+    }
+}
+
+// ----------------------------- //
+
+// - pollPeers Function - //
+
+// Waits up to 'timeoutMs' for input from any open peer, or for room to send
+// to 'writer' (if >= 0). Input from peers other than 'reader' is moved into
+// their inboxes, so that ranks sending to each other never wait on each other.
+// Returns a mask: 1 if 'writer' can take more, 2 if 'reader' has input (or has
+// closed); 0 on timeout and -1 on error.
+
+static int pollPeers(int writer, int reader, long timeoutMs)
+{
+    struct pollfd fds[numProcs];
+    int ranks[numProcs];
+    int n = 0;
+    for (int r = 0; r < numProcs; r++) {
+        if (peers[r].fd < 0)
+            continue;
+        fds[n].fd = peers[r].fd;
+        fds[n].events = POLLIN | (r == writer ? POLLOUT : 0);
+        fds[n].revents = 0;
+        ranks[n++] = r;
+    }
+    int ready = poll(fds, n, (int)timeoutMs);
+    if (ready < 0)
+        return errno == EINTR ? 0 : -1;
+
+    int mask = 0;
+    for (int i = 0; i < n; i++) {
+        int r = ranks[i];
+        short ev = fds[i].revents;
+        if (ev & POLLOUT)
+            mask |= 1;
+        if (r == writer && (ev & (POLLERR | POLLHUP)) && !(ev & POLLIN)) {
+            fprintf(stderr, "publishMessageParts: Rank %d has closed the connection\n", r);
+            return -1;
+        }
+        if (ev & (POLLIN | POLLHUP | POLLERR)) {
+            if (r == reader)
+                mask |= 2;
+            else if (pumpPeer(r) != 0)
+                return -1;
+        }
+    }
+    return mask;
+}
+
+// - End of pollPeers Function - //
+
+// ----------------------------- //
+
+// - sendToPeer / readFromPeer Functions - //
+
+// Sends one message ('header' then 'payload') to rank 'dest'.
+static int sendToPeer(int dest, const void *header, size_t headerSize,
+                      const void *payload, size_t payloadSize)
+{
+    if (dest == myRank) {
+        // A message to ourselves goes straight into our own inbox.
+        TcpPeer *p = &peers[myRank];
+        uint64_t bodySize = headerSize + payloadSize;
+        if (reserveInbox(p, sizeof(bodySize) + bodySize) != 0)
+            return -1;
+        memcpy(p->inbox + p->end, &bodySize, sizeof(bodySize));
+        if (headerSize > 0)
+            memcpy(p->inbox + p->end + sizeof(bodySize), header, headerSize);
+        if (payloadSize > 0)
+            memcpy(p->inbox + p->end + sizeof(bodySize) + headerSize, payload, payloadSize);
+        p->end += sizeof(bodySize) + bodySize;
+        return 0;
+    }
+    if (peers[dest].fd < 0) {
+        fprintf(stderr, "publishMessageParts: Rank %d has closed the connection\n", dest);
+        return -1;
+    }
+
+    uint64_t bodySize = headerSize + payloadSize;
+    struct iovec iov[3] = {
+        { &bodySize, sizeof(bodySize) },
+        { (void*)header, headerSize },
+        { (void*)payload, payloadSize },
+    };
+    struct iovec *part = iov;
+    int parts = 3;
+    struct timespec deadline = deadlineIn(TCP_TIMEOUT_SECONDS);
+    while (parts > 0) {
+        if (part->iov_len == 0) {
+            part++;
+            parts--;
+            continue;
+        }
+        int mask = pollPeers(dest, -1, millisecondsLeft(&deadline));
+        if (mask < 0)
+            return -1;
+        if (peers[dest].fd < 0) {
+            fprintf(stderr, "publishMessageParts: Rank %d has closed the connection\n", dest);
+            return -1;
+        }
+        if (!(mask & 1)) {
+            if (millisecondsLeft(&deadline) == 0) {
+                fprintf(stderr, "publishMessageParts: Timed out sending to rank %d\n", dest);
+                return -1;
+            }
+            continue;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = part;
+        msg.msg_iovlen = parts;
+        ssize_t sent = sendmsg(peers[dest].fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                continue;
+            fprintf(stderr, "publishMessageParts: Failed to send to rank %d: %s\n", dest, strerror(errno));
+            return -1;
+        }
+        while (sent > 0) {
+            size_t len = (size_t)sent < part->iov_len ? (size_t)sent : part->iov_len;
+            part->iov_base = (char*)part->iov_base + len;
+            part->iov_len -= len;
+            sent -= (ssize_t)len;
+            if (part->iov_len == 0) {
+                part++;
+                parts--;
+            }
+        }
+    }
+    return 0;
+}
+
+// Reads the next 'size' bytes sent by rank r into 'dest' (NULL skips them):
+// first from its inbox, then straight from the connection.
+static int readFromPeer(int r, void *dest, size_t size)
+{
+    TcpPeer *p = &peers[r];
+    unsigned char *out = (unsigned char*)dest;
+    size_t len = inboxBytes(p) < size ? inboxBytes(p) : size;
+    if (out) {
+        memcpy(out, p->inbox + p->start, len);
+        out += len;
+    }
+    p->start += len;
+    size -= len;
+
+    static unsigned char discard[TCP_READ_CHUNK];
+    struct timespec deadline = deadlineIn(TCP_TIMEOUT_SECONDS);
+    while (size > 0) {
+        if (p->fd < 0) {
+            fprintf(stderr, "receiveMessage: Rank %d closed the connection %zu bytes early\n", r, size);
+            return -1;
+        }
+        int mask = pollPeers(-1, r, millisecondsLeft(&deadline));
+        if (mask < 0)
+            return -1;
+        if (!(mask & 2)) {
+            if (millisecondsLeft(&deadline) == 0) {
+                fprintf(stderr, "receiveMessage: Timeout waiting for rank %d\n", r);
+                return -1;
+            }
+            continue;
+        }
+        size_t want = size;
+        if (!out && want > sizeof(discard))
+            want = sizeof(discard);
+        ssize_t got = recv(p->fd, out ? (void*)out : (void*)discard, want, MSG_DONTWAIT);
+        if (got > 0) {
+            if (out)
+                out += got;
+            size -= (size_t)got;
+        } else if (got == 0) {
+            close(p->fd);
+            p->fd = -1;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            fprintf(stderr, "receiveMessage: Connection to rank %d failed: %s\n", r, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// - End of sendToPeer / readFromPeer Functions - //
+
+// ----------------------------- //
+
+// - Connection Setup Functions - //
+
+// Finds rank 'rank''s entry in the address list.
+static int peerEndpoint(const char *address, int rank, char *host, size_t hostSize, int *port)
+{
+    int entries = 1;
+    for (const char *c = address; *c; c++)
+        entries += *c == ',';
+    if (entries != 1 && entries != numProcs) {
+        fprintf(stderr, "initMessaging: '%s' lists %d ranks, expected 1 or %d\n", address, entries, numProcs);
+        return -1;
+    }
+    const char *entry = address;
+    for (int i = 0; entries > 1 && i < rank; i++)
+        entry = strchr(entry, ',') + 1;
+    size_t length = strcspn(entry, ",");
+    const char *colon = memchr(entry, ':', length);
+    size_t hostLength = colon ? (size_t)(colon - entry) : length;
+    if (hostLength == 0 || hostLength >= hostSize) {
+        fprintf(stderr, "initMessaging: Bad host in '%.*s'\n", (int)length, entry);
+        return -1;
+    }
+    memcpy(host, entry, hostLength);
+    host[hostLength] = '\0';
+    *port = colon ? atoi(colon + 1) : TCP_DEFAULT_PORT;
+    if (entries == 1)
+        *port += rank;
+    if (*port <= 0 || *port > 65535) {
+        fprintf(stderr, "initMessaging: Bad port for rank %d in '%s'\n", rank, address);
+        return -1;
+    }
+    return 0;
+}
+
+static void setNoDelay(int fd)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Connects to rank r, retrying until it listens, and introduces this rank.
+static int connectToPeer(const char *address, int r, const struct timespec *deadline)
+{
+    char host[256], service[16];
+    int port;
+    if (peerEndpoint(address, r, host, sizeof(host), &port) != 0)
+        return -1;
+    snprintf(service, sizeof(service), "%d", port);
+    for (;;) {
+        struct addrinfo hints, *found = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, service, &hints, &found) == 0) {
+            for (struct addrinfo *a = found; a; a = a->ai_next) {
+                int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (fd < 0)
+                    continue;
+                if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+                    int32_t me = myRank;
+                    if (send(fd, &me, sizeof(me), MSG_NOSIGNAL) == (ssize_t)sizeof(me)) {
+                        freeaddrinfo(found);
+                        setNoDelay(fd);
+                        peers[r].fd = fd;
+                        return 0;
+                    }
+                }
+                close(fd);
+            }
+            freeaddrinfo(found);
+        }
+        if (millisecondsLeft(deadline) == 0) {
+            fprintf(stderr, "initMessaging: Could not connect to rank %d at %s:%d\n", r, host, port);
+            return -1;
+        }
+        usleep(50000);
+    }
+}
+
+// - End of Connection Setup Functions - //
+
+// ----------------------------- //
+
+// - Transport Functions - //
+
+static int tcpInit(const char *address, int rank, int nProcs)
+{
+    if (nProcs < 1 || rank < 0 || rank >= nProcs) {
+        fprintf(stderr, "initMessaging: Invalid rank %d of %d\n", rank, nProcs);
+        return -1;
+    }
+    myRank   = rank;
+    numProcs = nProcs;
+    peers = (TcpPeer*)calloc(nProcs, sizeof(TcpPeer));
+    if (!peers)
+        return -1;
+    for (int r = 0; r < nProcs; r++)
+        peers[r].fd = -1;
+
+    char host[256];
+    int port;
+    if (peerEndpoint(address, rank, host, sizeof(host), &port) != 0)
+        return -1;
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        fprintf(stderr, "initMessaging: Failed to create a socket: %s\n", strerror(errno));
+        return -1;
+    }
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons((uint16_t)port);
+    if (bind(listener, (struct sockaddr*)&local, sizeof(local)) != 0 || listen(listener, nProcs) != 0) {
+        fprintf(stderr, "initMessaging: Failed to listen on port %d: %s\n", port, strerror(errno));
+        close(listener);
+        return -1;
+    }
+
+    // Each rank connects to the ranks below it and accepts the ranks above it.
+    struct timespec deadline = deadlineIn(TCP_CONNECT_SECONDS);
+    for (int r = 0; r < rank; r++) {
+        if (connectToPeer(address, r, &deadline) != 0) {
+            close(listener);
+            return -1;
+        }
+    }
+    for (int accepted = 0; accepted < nProcs - 1 - rank; ) {
+        struct pollfd pfd = { listener, POLLIN, 0 };
+        if (poll(&pfd, 1, (int)millisecondsLeft(&deadline)) <= 0) {
+            fprintf(stderr, "initMessaging: Only %d of %d higher ranks connected to rank %d\n",
+                    accepted, nProcs - 1 - rank, rank);
+            close(listener);
+            return -1;
+        }
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+            continue;
+        int32_t from = -1;
+        if (recv(fd, &from, sizeof(from), MSG_WAITALL) != (ssize_t)sizeof(from)
+            || from <= rank || from >= nProcs || peers[from].fd >= 0) {
+            fprintf(stderr, "initMessaging: Rejected a connection claiming to be rank %d\n", (int)from);
+            close(fd);
+            continue;
+        }
+        setNoDelay(fd);
+        peers[from].fd = fd;
+        accepted++;
+    }
+    close(listener);
+    return 0;
+}
+
+// Every connection exists from the start and carries both kinds of message.
+static int tcpSetupConsumerQueue(void)
+{
+    return 0;
+}
+
+static int tcpSetupDirectQueue(int rank)
+{
+    (void)rank;
+    return 0;
+}
+
+static int tcpPublishMessageParts(const void *header, size_t headerSize,
+                                  const void *payload, size_t payloadSize, int destRank, int rank)
+{
+    if (destRank >= numProcs) {
+        fprintf(stderr, "publishMessageParts: No rank %d to send to from rank %d\n", destRank, rank);
+        return -1;
+    }
+    if (destRank >= 0)
+        return sendToPeer(destRank, header, headerSize, payload, payloadSize);
+    // A fanout goes to every other rank; receivers skip their own frames anyway.
+    for (int r = 0; r < numProcs; r++) {
+        if (r != myRank && sendToPeer(r, header, headerSize, payload, payloadSize) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int tcpReadMessageBody(void *dest, size_t size)
+{
+    if (size > bodyRemaining) {
+        fprintf(stderr, "readMessageBody: Asked for %zu bytes, %llu remain\n",
+                size, (unsigned long long)bodyRemaining);
+        return -1;
+    }
+    if (readFromPeer(currentPeer, dest, size) != 0)
+        return -1;
+    bodyRemaining -= size;
+    return 0;
+}
+
+static int tcpReceiveMessage(size_t *bodySize)
+{
+    if (bodyRemaining > 0 && tcpReadMessageBody(NULL, (size_t)bodyRemaining) != 0)
+        return -1;
+    struct timespec deadline = deadlineIn(TCP_TIMEOUT_SECONDS);
+    for (;;) {
+        for (int i = 0; i < numProcs; i++) {
+            int r = (nextPeer + i) % numProcs;
+            if (inboxBytes(&peers[r]) >= sizeof(uint64_t)) {
+                uint64_t size;
+                memcpy(&size, peers[r].inbox + peers[r].start, sizeof(size));
+                peers[r].start += sizeof(size);
+                currentPeer = r;
+                nextPeer = (r + 1) % numProcs;
+                bodyRemaining = size;
+                *bodySize = (size_t)size;
+                return 0;
+            }
+        }
+        long left = millisecondsLeft(&deadline);
+        int mask = pollPeers(-1, -1, left);
+        if (mask < 0)
+            return -1;
+        if (left == 0) {
+            fprintf(stderr, "receiveMessage: Timeout waiting for message\n");
+            return -1;
+        }
+    }
+}
+
+// Ring all-gather: in round k every rank passes slice (rank - k) on to the next
+// rank and takes slice (rank - k - 1) from the previous one, straight into its
+// place in 'buffer'. Each transfer carries the step and slice as a check.
+static int tcpAllGather(void *buffer, const size_t *offsets, const size_t *counts, int step)
+{
+    int next = (myRank + 1) % numProcs;
+    int prev = (myRank + numProcs - 1) % numProcs;
+    unsigned char *base = (unsigned char*)buffer;
+    for (int k = 0; k < numProcs - 1; k++) {
+        int sendSlice = (myRank - k + numProcs) % numProcs;
+        int recvSlice = (myRank - k - 1 + 2 * numProcs) % numProcs;
+        int32_t tag[2] = { step, sendSlice };
+        if (sendToPeer(next, tag, sizeof(tag), base + offsets[sendSlice], counts[sendSlice]) != 0) {
+            fprintf(stderr, "allGatherState: Failed to pass slice %d to rank %d\n", sendSlice, next);
+            return -1;
+        }
+        uint64_t size;
+        if (readFromPeer(prev, &size, sizeof(size)) != 0 || readFromPeer(prev, tag, sizeof(tag)) != 0)
+            return -1;
+        if (tag[0] != step || tag[1] != recvSlice || size != sizeof(tag) + counts[recvSlice]) {
+            fprintf(stderr, "allGatherState: Expected slice %d of step %d from rank %d, got slice %d of step %d\n",
+                    recvSlice, step, prev, (int)tag[1], (int)tag[0]);
+            return -1;
+        }
+        if (readFromPeer(prev, base + offsets[recvSlice], counts[recvSlice]) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// - End of Transport Functions - //
+
+const MessagingTransport tcpTransport = {
+    "tcp",
+    tcpInit,
+    tcpSetupConsumerQueue,
+    tcpSetupDirectQueue,
+    tcpPublishMessageParts,
+    tcpReceiveMessage,
+    tcpReadMessageBody,
+    NULL,
+    NULL,
+    tcpAllGather,
+};
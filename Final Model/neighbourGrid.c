@@ -0,0 +1,463 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "neighbourGrid.h"
+#include "boidProfile.h"
+
+// Upper bound on grid cells per binned boid. Sparse or widely scattered flocks
+// get coarser cells rather than a huge, mostly empty cell array.
+#define MAX_CELLS_PER_BOID 4
+#define MIN_CELL_BUDGET    64
+
+// - initNeighbourGrid Function - //
+
+void initNeighbourGrid(NeighbourGrid *grid)
+{
+    memset(grid, 0, sizeof(*grid));
+}
+
+// - End of initNeighbourGrid Function - //
+
+// ----------------------------- //
+
+// - freeNeighbourGrid Function - //
+
+void freeNeighbourGrid(NeighbourGrid *grid)
+{
+    free(grid->cellStart);
+    free(grid->cellBoids);
+    free(grid->boidCell);
+    free(grid->scratch);
+    initNeighbourGrid(grid);
+}
+
+// - End of freeNeighbourGrid Function - //
+
+// ----------------------------- //
+
+// - neighbourGridCellSize Function - //
+
+// Inputs:
+//   - BoidParams,  struct,      ,  Simulation parameters
+
+// Boids updated earlier in the same step have already moved when later boids
+// read them, so the cell must also cover one step of displacement. After the
+// speed limit a boid can still gain turnFactor on both x and y.
+
+double neighbourGridCellSize(const BoidParams *p)
+{
+    double range = p->visualRange > p->minDistance ? p->visualRange : p->minDistance;
+    double maxStep = fabs(p->speedLimit) + 2.0 * fabs(p->turnFactor);
+    return range + maxStep + 1e-6;
+}
+
+// - End of neighbourGridCellSize Function - //
+
+// ----------------------------- //
+
+// - neighbourGridCellOf Function - //
+
+static int clampCell(double offset, double cellSize, int dim)
+{
+    double c = floor(offset / cellSize);
+    if (!(c > 0.0))
+        return 0;
+    if (c >= (double)(dim - 1))
+        return dim - 1;
+    return (int)c;
+}
+
+int neighbourGridCellOf(const NeighbourGrid *grid, double x, double y, double z)
+{
+    int cx = clampCell(x - grid->origin[0], grid->cellSize, grid->dims[0]);
+    int cy = clampCell(y - grid->origin[1], grid->cellSize, grid->dims[1]);
+    int cz = clampCell(z - grid->origin[2], grid->cellSize, grid->dims[2]);
+    return (cz * grid->dims[1] + cy) * grid->dims[0] + cx;
+}
+
+// - End of neighbourGridCellOf Function - //
+
+// ----------------------------- //
+
+// - buildNeighbourGrid Function - //
+
+// Inputs:
+//   - grid,        struct,         ,  Grid to (re)build
+//   - allStates,   double, [Nx7]   ,  Flat boid state array
+//   - numBoids,    int,    [1x1]   ,  Number of boids to bin
+//   - cellSize,    double, [1x1]   ,  Minimum cell edge length
+//   - x, y, z,     double, [Nx1]   ,  Coordinate arrays read with 'stride' (Coords variant)
+
+// Counting sort by cell: one pass to count, a prefix sum, then a scatter in
+// boid order so every cell lists its boids in ascending index order (ID order
+// under grid->ordering, which must then cover all numBoids boids).
+
+int buildNeighbourGrid(NeighbourGrid *grid, const double *allStates, int numBoids, double cellSize)
+{
+    return buildNeighbourGridCoords(grid, &allStates[0], &allStates[1], &allStates[2],
+                                    BOID_STATE_SIZE, numBoids, cellSize);
+}
+
+int buildNeighbourGridCoords(NeighbourGrid *grid, const double *x, const double *y, const double *z,
+                             int stride, int numBoids, double cellSize)
+{
+    if (numBoids > grid->boidCapacity) {
+        int *cellBoids = (int*)realloc(grid->cellBoids, numBoids * sizeof(int));
+        if (!cellBoids)
+            return -1;
+        grid->cellBoids = cellBoids;
+        int *boidCell = (int*)realloc(grid->boidCell, numBoids * sizeof(int));
+        if (!boidCell)
+            return -1;
+        grid->boidCell = boidCell;
+        grid->boidCapacity = numBoids;
+    }
+
+    // Occupied extent of the flock. Non-finite coordinates are ignored here
+    // and clamped into the edge cells below.
+    double lo[3] = { 0.0, 0.0, 0.0 };
+    double hi[3] = { 0.0, 0.0, 0.0 };
+    int seen = 0;
+    for (int i = 0; i < numBoids; i++) {
+        double s[3] = { x[i * stride], y[i * stride], z[i * stride] };
+        if (!isfinite(s[0]) || !isfinite(s[1]) || !isfinite(s[2]))
+            continue;
+        for (int d = 0; d < 3; d++) {
+            if (!seen || s[d] < lo[d]) lo[d] = s[d];
+            if (!seen || s[d] > hi[d]) hi[d] = s[d];
+        }
+        seen = 1;
+    }
+
+    // Choose dimensions, growing the cell size until the budget is met.
+    double budget = (double)numBoids * MAX_CELLS_PER_BOID + MIN_CELL_BUDGET;
+    double size = cellSize > 0.0 ? cellSize : 1.0;
+    double n[3];
+    for (;;) {
+        for (int d = 0; d < 3; d++)
+            n[d] = floor((hi[d] - lo[d]) / size) + 1.0;
+        if (n[0] * n[1] * n[2] <= budget)
+            break;
+        size *= 1.5;
+    }
+    grid->cellSize = size;
+    for (int d = 0; d < 3; d++) {
+        grid->origin[d] = lo[d];
+        grid->dims[d] = (int)n[d];
+    }
+    grid->numCells = grid->dims[0] * grid->dims[1] * grid->dims[2];
+    grid->numBoids = numBoids;
+
+    if (grid->numCells > grid->cellCapacity) {
+        int *cellStart = (int*)realloc(grid->cellStart, (grid->numCells + 1) * sizeof(int));
+        if (!cellStart)
+            return -1;
+        grid->cellStart = cellStart;
+        grid->cellCapacity = grid->numCells;
+    }
+
+    memset(grid->cellStart, 0, (grid->numCells + 1) * sizeof(int));
+    for (int i = 0; i < numBoids; i++) {
+        int c = neighbourGridCellOf(grid, x[i * stride], y[i * stride], z[i * stride]);
+        grid->boidCell[i] = c;
+        grid->cellStart[c + 1]++;
+    }
+    for (int c = 0; c < grid->numCells; c++)
+        grid->cellStart[c + 1] += grid->cellStart[c];
+
+    // Scatter using cellStart as a running cursor, then shift it back. Reordered
+    // boids are scattered in ID order, so candidate runs stay nearly sorted.
+    for (int k = 0; k < numBoids; k++) {
+        int i = grid->ordering ? grid->ordering->slots[k] : k;
+        grid->cellBoids[grid->cellStart[grid->boidCell[i]]++] = i;
+    }
+    for (int c = grid->numCells; c > 0; c--)
+        grid->cellStart[c] = grid->cellStart[c - 1];
+    grid->cellStart[0] = 0;
+    return 0;
+}
+
+// - End of buildNeighbourGrid Function - //
+
+// ----------------------------- //
+
+// - sortNeighbourIndices / sortNeighbourIndicesById Functions - //
+
+static int compareIndex(const void *a, const void *b)
+{
+    int ia = *(const int*)a;
+    int ib = *(const int*)b;
+    return (ia > ib) - (ia < ib);
+}
+
+// Neighbour lists are short, so insertion sort covers the common case.
+void sortNeighbourIndices(int *idx, int count)
+{
+    if (count > 32) {
+        qsort(idx, count, sizeof(int), compareIndex);
+        return;
+    }
+    for (int a = 1; a < count; a++) {
+        int v = idx[a];
+        int b = a - 1;
+        while (b >= 0 && idx[b] > v) {
+            idx[b + 1] = idx[b];
+            b--;
+        }
+        idx[b + 1] = v;
+    }
+}
+
+// Sorts the IDs, then maps them back to slots.
+void sortNeighbourIndicesById(int *idx, int count, const BoidOrdering *ordering)
+{
+    if (!ordering) {
+        sortNeighbourIndices(idx, count);
+        return;
+    }
+    for (int k = 0; k < count; k++)
+        idx[k] = ordering->ids[idx[k]];
+    sortNeighbourIndices(idx, count);
+    for (int k = 0; k < count; k++)
+        idx[k] = ordering->slots[idx[k]];
+}
+
+// - End of sortNeighbourIndices / sortNeighbourIndicesById Functions - //
+
+// ----------------------------- //
+
+// - neighbourGridQuery Function - //
+
+int neighbourGridQuery(const NeighbourGrid *grid, const double *states, int i, double radius, int *out)
+{
+    const double *pos = &states[i * BOID_STATE_SIZE];
+    double radiusSq = radius * radius;
+    int home = grid->boidCell[i];
+    int cx   = home % grid->dims[0];
+    int cy   = (home / grid->dims[0]) % grid->dims[1];
+    int cz   = home / (grid->dims[0] * grid->dims[1]);
+    int count = 0;
+    for (int z = cz - 1; z <= cz + 1; z++) {
+        if (z < 0 || z >= grid->dims[2])
+            continue;
+        for (int y = cy - 1; y <= cy + 1; y++) {
+            if (y < 0 || y >= grid->dims[1])
+                continue;
+            for (int x = cx - 1; x <= cx + 1; x++) {
+                if (x < 0 || x >= grid->dims[0])
+                    continue;
+                int c = (z * grid->dims[1] + y) * grid->dims[0] + x;
+                for (int k = grid->cellStart[c]; k < grid->cellStart[c + 1]; k++) {
+                    int j = grid->cellBoids[k];
+                    if (j == i)
+                        continue;
+                    const double *nbr = &states[j * BOID_STATE_SIZE];
+                    double diff[3] = { pos[0] - nbr[0], pos[1] - nbr[1], pos[2] - nbr[2] };
+                    if (diff[0]*diff[0] + diff[1]*diff[1] + diff[2]*diff[2] < radiusSq)
+                        out[count++] = j;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// - End of neighbourGridQuery Function - //
+
+// ----------------------------- //
+
+// - updateOneBoidGrid / updateOneBoidGridSync Functions - //
+
+// ID that orders boid slot j in the accumulation.
+static int neighbourKey(const NeighbourGrid *grid, int j)
+{
+    return grid->ordering ? grid->ordering->ids[j] : j;
+}
+
+// Inputs:
+//   - srcStates,   double, [Nx7]   ,  States read for boid i and its neighbours
+//   - dstStates,   double, [Nx7]   ,  States written for boid i (may equal srcStates)
+//   - i,           int,    [1x1]   ,  Index of the boid to update
+//   - grid,        struct,         ,  Grid built from srcStates at the start of the step
+//   - scratch,     int,    [Nx1]   ,  Workspace for candidate indices
+//   - BoidParams,  struct,         ,  Simulation parameters
+
+static void updateOneBoidGridFrom(const double *srcStates, double *dstStates, int i,
+                                  const NeighbourGrid *grid, int *scratch, const BoidParams *p)
+{
+    const double *myState = &srcStates[i * BOID_STATE_SIZE];
+    double *outState      = &dstStates[i * BOID_STATE_SIZE];
+    if (myState[6] == 0.0) {
+        // Already crashed; carry the state over unchanged.
+        if (outState != myState)
+            memcpy(outState, myState, BOID_STATE_SIZE * sizeof(double));
+        return;
+    }
+
+    double pos[3] = { myState[0], myState[1], myState[2] };
+    double vel[3] = { myState[3], myState[4], myState[5] };
+    double visualSq = p->visualRange * p->visualRange;
+    double minSq    = p->minDistance * p->minDistance;
+    double rangeSq  = visualSq > minSq ? visualSq : minSq;
+
+    // Collect the boids in range from the surrounding cells. Each cell lists its
+    // boids in ascending ID order and filtering keeps that order, so every cell
+    // leaves one sorted run in scratch.
+    int runPos[27], runEnd[27], runKey[27];
+    int numRuns = 0;
+    int home = grid->boidCell[i];
+    int cx   = home % grid->dims[0];
+    int cy   = (home / grid->dims[0]) % grid->dims[1];
+    int cz   = home / (grid->dims[0] * grid->dims[1]);
+    int count = 0;
+    for (int z = cz - 1; z <= cz + 1; z++) {
+        if (z < 0 || z >= grid->dims[2])
+            continue;
+        for (int y = cy - 1; y <= cy + 1; y++) {
+            if (y < 0 || y >= grid->dims[1])
+                continue;
+            for (int x = cx - 1; x <= cx + 1; x++) {
+                if (x < 0 || x >= grid->dims[0])
+                    continue;
+                int c = (z * grid->dims[1] + y) * grid->dims[0] + x;
+                int first = count;
+                for (int k = grid->cellStart[c]; k < grid->cellStart[c + 1]; k++) {
+                    int j = grid->cellBoids[k];
+                    if (j == i)
+                        continue;
+                    const double *nbr = &srcStates[j * BOID_STATE_SIZE];
+                    double diff[3] = { pos[0] - nbr[0], pos[1] - nbr[1], pos[2] - nbr[2] };
+                    double distSq  = diff[0]*diff[0] + diff[1]*diff[1] + diff[2]*diff[2];
+                    if (distSq < rangeSq)
+                        scratch[count++] = j;
+                }
+                if (count > first) {
+                    runPos[numRuns] = first;
+                    runEnd[numRuns] = count;
+                    runKey[numRuns] = neighbourKey(grid, scratch[first]);
+                    numRuns++;
+                }
+            }
+        }
+    }
+
+    // Merge the runs, taking the lowest head ID each time, so neighbours are
+    // accumulated in ascending ID order exactly as the all-pairs loop does.
+    // With at most 27 runs a branch-free scan of the heads beats a heap.
+    BoidNeighbourSums sums;
+    initNeighbourSums(&sums);
+    while (numRuns > 0) {
+        int r = 0;
+        int best = runKey[0];
+        for (int q = 1; q < numRuns; q++) {
+            int better = runKey[q] < best;
+            best = better ? runKey[q] : best;
+            r = better ? q : r;
+        }
+        const double *nbr = &srcStates[scratch[runPos[r]] * BOID_STATE_SIZE];
+        if (++runPos[r] < runEnd[r]) {
+            runKey[r] = neighbourKey(grid, scratch[runPos[r]]);
+        } else {
+            // Run exhausted: move the last run into its place.
+            numRuns--;
+            runPos[r] = runPos[numRuns];
+            runEnd[r] = runEnd[numRuns];
+            runKey[r] = runKey[numRuns];
+        }
+
+        double diff[3] = { pos[0] - nbr[0], pos[1] - nbr[1], pos[2] - nbr[2] };
+        double distSq  = diff[0]*diff[0] + diff[1]*diff[1] + diff[2]*diff[2];
+        if (distSq < visualSq) {
+            sums.cohesionSum[0]  += nbr[0];
+            sums.cohesionSum[1]  += nbr[1];
+            sums.cohesionSum[2]  += nbr[2];
+            sums.alignmentSum[0] += nbr[3];
+            sums.alignmentSum[1] += nbr[4];
+            sums.alignmentSum[2] += nbr[5];
+            sums.neighbourCount++;
+        }
+        if (distSq < minSq) {
+            sums.separationVec[0] += diff[0];
+            sums.separationVec[1] += diff[1];
+            sums.separationVec[2] += diff[2];
+        }
+    }
+
+    applyBoidRules(outState, pos, vel, &sums, p);
+}
+
+void updateOneBoidGrid(double *allStates, int i, const NeighbourGrid *grid, int *scratch, const BoidParams *p)
+{
+    updateOneBoidGridFrom(allStates, allStates, i, grid, scratch, p);
+}
+
+void updateOneBoidGridSync(const double *prevStates, double *nextStates, int i,
+                           const NeighbourGrid *grid, int *scratch, const BoidParams *p)
+{
+    updateOneBoidGridFrom(prevStates, nextStates, i, grid, scratch, p);
+}
+
+// - End of updateOneBoidGrid / updateOneBoidGridSync Functions - //
+
+// ----------------------------- //
+
+// - stepBoidsSubsetGrid Function - //
+
+// Candidate workspace for the last build, kept in the grid so steady-state
+// steps do not allocate. Returns NULL on allocation failure.
+static int *neighbourGridScratch(NeighbourGrid *grid)
+{
+    int needed = grid->numBoids > 0 ? grid->numBoids : 1;
+    if (needed > grid->scratchCapacity) {
+        int *scratch = (int*)realloc(grid->scratch, needed * sizeof(int));
+        if (!scratch)
+            return NULL;
+        grid->scratch = scratch;
+        grid->scratchCapacity = needed;
+    }
+    return grid->scratch;
+}
+
+int stepBoidsSubsetGrid(double *allStates, int numBoids, int startIdx, int endIdx,
+                        NeighbourGrid *grid, const BoidParams *p)
+{
+    BOID_PROFILE_BEGIN(searchStart);
+    if (buildNeighbourGrid(grid, allStates, numBoids, neighbourGridCellSize(p)) != 0)
+        return -1;
+    BOID_PROFILE_END(searchStart, BOID_PHASE_SEARCH, -1);
+    int *scratch = neighbourGridScratch(grid);
+    if (!scratch)
+        return -1;
+    BOID_PROFILE_BEGIN(forcesStart);
+    for (int i = startIdx; i < endIdx; i++) {
+        updateOneBoidGrid(allStates, i, grid, scratch, p);
+    }
+    BOID_PROFILE_END(forcesStart, BOID_PHASE_FORCES, -1);
+    return 0;
+}
+
+// - End of stepBoidsSubsetGrid Function - //
+
+// ----------------------------- //
+
+// - stepBoidsSubsetGridSync Function - //
+
+int stepBoidsSubsetGridSync(const double *prevStates, double *nextStates, int numBoids,
+                            int startIdx, int endIdx, NeighbourGrid *grid, const BoidParams *p)
+{
+    BOID_PROFILE_BEGIN(searchStart);
+    if (buildNeighbourGrid(grid, prevStates, numBoids, neighbourGridCellSize(p)) != 0)
+        return -1;
+    BOID_PROFILE_END(searchStart, BOID_PHASE_SEARCH, -1);
+    int *scratch = neighbourGridScratch(grid);
+    if (!scratch)
+        return -1;
+    BOID_PROFILE_BEGIN(forcesStart);
+    for (int i = startIdx; i < endIdx; i++) {
+        updateOneBoidGridSync(prevStates, nextStates, i, grid, scratch, p);
+    }
+    BOID_PROFILE_END(forcesStart, BOID_PHASE_FORCES, -1);
+    return 0;
+}
+
+// - End of stepBoidsSubsetGridSync Function - //
@@ -0,0 +1,95 @@
+#ifndef NEIGHBOURGRID_H
+#define NEIGHBOURGRID_H
+
+#include "boidOrdering.h"
+#include "boidUpdate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Uniform cell list used to restrict the neighbour search to the 27 cells
+// surrounding a boid. Boids are binned by the positions held in allStates at
+// build time; within each cell the indices are stored in ascending order, or
+// in ascending ID order when 'ordering' is set before the build.
+typedef struct {
+    double cellSize;            // Edge length of one cubic cell
+    double origin[3];           // Lower corner of cell (0, 0, 0)
+    int dims[3];                // Number of cells along x, y, z
+    int numCells;               // dims[0] * dims[1] * dims[2]
+    int numBoids;               // Number of boids binned at the last build
+    int *cellStart;             // Offset of each cell's first entry in cellBoids [numCells + 1]
+    int *cellBoids;             // Boid indices ordered by cell [numBoids]
+    int *boidCell;              // Cell index of each boid [numBoids]
+    int cellCapacity;           // Allocated length of cellStart (minus one)
+    int boidCapacity;           // Allocated length of cellBoids / boidCell
+    int *scratch;               // Candidate workspace of stepBoidsSubsetGrid(Sync)
+    int scratchCapacity;        // Allocated length of scratch
+    const BoidOrdering *ordering;   // Slot/ID maps when the states have been reordered,
+                                    // or NULL if indices are the IDs
+} NeighbourGrid;
+
+// Initialises an empty grid. No memory is allocated until the first build.
+void initNeighbourGrid(NeighbourGrid *grid);
+
+// Releases all memory held by the grid.
+void freeNeighbourGrid(NeighbourGrid *grid);
+
+// Cell size that keeps the 27-cell search exact for one in-place step:
+// the larger of visualRange and minDistance, padded by the furthest a boid
+// can move in a single update.
+double neighbourGridCellSize(const BoidParams *p);
+
+// Bins every boid in allStates into cells of at least 'cellSize'.
+// The cell size is enlarged if the occupied extent would need an excessive
+// number of cells. Returns 0 on success, nonzero on allocation failure.
+int buildNeighbourGrid(NeighbourGrid *grid, const double *allStates, int numBoids, double cellSize);
+
+// As buildNeighbourGrid, but reads coordinates from separate arrays with the given
+// element stride (1 for structure-of-arrays storage).
+int buildNeighbourGridCoords(NeighbourGrid *grid, const double *x, const double *y, const double *z,
+                             int stride, int numBoids, double cellSize);
+
+// Returns the index of the cell containing position (x, y, z), clamped to the grid.
+int neighbourGridCellOf(const NeighbourGrid *grid, double x, double y, double z);
+
+// Collects into 'out' the boids j != i whose positions in 'states' lie strictly
+// within 'radius' of boid i, searching the 27 cells around boid i's cell, and
+// returns how many there are. 'radius' must not exceed grid->cellSize, and
+// 'out' must hold room for grid->numBoids indices. The order is unspecified.
+int neighbourGridQuery(const NeighbourGrid *grid, const double *states, int i, double radius, int *out);
+
+// Sorts a candidate list of boid indices into ascending order.
+void sortNeighbourIndices(int *idx, int count);
+
+// Sorts a candidate list of boid slots into ascending order of their IDs under
+// 'ordering', or of the slots themselves if ordering is NULL.
+void sortNeighbourIndicesById(int *idx, int count, const BoidOrdering *ordering);
+
+// Updates boid i in place, visiting only the 27 cells around it. 'scratch' must
+// hold room for grid->numBoids indices. Neighbours are accumulated in ascending
+// index order (of IDs under grid->ordering when set), so the result matches updateOneBoid
+// bit for bit.
+void updateOneBoidGrid(double *allStates, int i, const NeighbourGrid *grid, int *scratch, const BoidParams *p);
+
+// Synchronous variant of updateOneBoidGrid: reads boid i and its neighbours from
+// prevStates (which 'grid' was built from) and writes the result to nextStates.
+void updateOneBoidGridSync(const double *prevStates, double *nextStates, int i,
+                           const NeighbourGrid *grid, int *scratch, const BoidParams *p);
+
+// Rebuilds 'grid' from allStates and updates boids startIdx..endIdx-1 in place,
+// using workspace kept in the grid. Returns 0 on success, nonzero if the grid or scratch space could not be allocated
+// (allStates is left untouched in that case).
+int stepBoidsSubsetGrid(double *allStates, int numBoids, int startIdx, int endIdx,
+                        NeighbourGrid *grid, const BoidParams *p);
+
+// Synchronous variant of stepBoidsSubsetGrid: builds 'grid' from prevStates and
+// writes boids startIdx..endIdx-1 to nextStates. Returns 0 on success.
+int stepBoidsSubsetGridSync(const double *prevStates, double *nextStates, int numBoids,
+                            int startIdx, int endIdx, NeighbourGrid *grid, const BoidParams *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NEIGHBOURGRID_H
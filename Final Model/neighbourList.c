@@ -0,0 +1,407 @@
+#include <stdlib.h>
+#include <string.h>
+#include "neighbourList.h"
+
+// - initNeighbourList Function - //
+
+void initNeighbourList(NeighbourList *list)
+{
+    memset(list, 0, sizeof(*list));
+    initNeighbourGrid(&list->grid);
+}
+
+// - End of initNeighbourList Function - //
+
+// ----------------------------- //
+
+// - freeNeighbourList Function - //
+
+void freeNeighbourList(NeighbourList *list)
+{
+    free(list->listStart);
+    free(list->listBoids);
+    free(list->buildPositions);
+    free(list->scratch);
+    free(list->lowerStart);
+    free(list->lowerPairs);
+    freeNeighbourGrid(&list->grid);
+    initNeighbourList(list);
+}
+
+// - End of freeNeighbourList Function - //
+
+// ----------------------------- //
+
+// - buildLowerPairs Function - //
+
+// Indexes the half lists the other way round: for each boid, the earlier boids
+// whose lists hold it and the entry that holds it. Owners are visited in ID
+// order, so each boid's earlier partners come out in ID order too.
+
+static int buildLowerPairs(NeighbourList *list, int numBoids)
+{
+    long count = list->listStart[numBoids];
+    if (count > list->lowerCapacity) {
+        int *lowerPairs = (int*)realloc(list->lowerPairs, count * 2 * sizeof(int));
+        if (!lowerPairs)
+            return -1;
+        list->lowerPairs = lowerPairs;
+        list->lowerCapacity = count;
+    }
+    memset(list->lowerStart, 0, (numBoids + 1) * sizeof(int));
+    for (long k = 0; k < count; k++)
+        list->lowerStart[list->listBoids[k] + 1]++;
+    for (int i = 0; i < numBoids; i++) {
+        list->lowerStart[i + 1] += list->lowerStart[i];
+        list->scratch[i] = list->lowerStart[i];
+    }
+    const BoidOrdering *ordering = list->ordering;
+    for (int r = 0; r < numBoids; r++) {
+        int i = ordering ? ordering->slots[r] : r;
+        for (int k = list->listStart[i]; k < list->listStart[i + 1]; k++) {
+            int at = list->scratch[list->listBoids[k]]++;
+            list->lowerPairs[2 * at + 0] = i;
+            list->lowerPairs[2 * at + 1] = k;
+        }
+    }
+    return 0;
+}
+
+// - End of buildLowerPairs Function - //
+
+// ----------------------------- //
+
+// - buildNeighbourList Function - //
+
+// Inputs:
+//   - list,        struct,         ,  Lists to rebuild
+//   - states,      double, [Nx7]   ,  Boid states to build from
+//   - numBoids,    int,    [1x1]   ,  Number of boids
+//   - skin,        double, [1x1]   ,  Extra radius beyond the interaction range
+//   - halfLists,   int,    [1x1]   ,  Nonzero to keep only partners later in ID order
+//   - radius,      double, [1x1]   ,  Candidate radius (range + skin, padded)
+
+static int buildNeighbourList(NeighbourList *list, const double *states, int numBoids,
+                              double skin, int halfLists, double radius)
+{
+    if (!list->listStart || numBoids > list->boidCapacity) {
+        int capacity = numBoids > 0 ? numBoids : 1;
+        int *listStart = (int*)realloc(list->listStart, (capacity + 1) * sizeof(int));
+        if (!listStart)
+            return -1;
+        list->listStart = listStart;
+        double *buildPositions = (double*)realloc(list->buildPositions, capacity * 3 * sizeof(double));
+        if (!buildPositions)
+            return -1;
+        list->buildPositions = buildPositions;
+        int *scratch = (int*)realloc(list->scratch, capacity * sizeof(int));
+        if (!scratch)
+            return -1;
+        list->scratch = scratch;
+        int *lowerStart = (int*)realloc(list->lowerStart, (capacity + 1) * sizeof(int));
+        if (!lowerStart)
+            return -1;
+        list->lowerStart = lowerStart;
+        list->boidCapacity = capacity;
+    }
+    list->grid.ordering = list->ordering;
+    if (buildNeighbourGrid(&list->grid, states, numBoids, radius) != 0)
+        return -1;
+
+    // Crashed boids are never updated again, so they get empty full lists; they
+    // still appear on the lists of the boids around them.
+    const BoidOrdering *ordering = list->ordering;
+    long count = 0;
+    for (int i = 0; i < numBoids; i++) {
+        const double *state = &states[i * BOID_STATE_SIZE];
+        list->listStart[i] = (int)count;
+        list->buildPositions[i * 3 + 0] = state[0];
+        list->buildPositions[i * 3 + 1] = state[1];
+        list->buildPositions[i * 3 + 2] = state[2];
+        if (!halfLists && state[6] == 0.0)
+            continue;
+
+        int found = neighbourGridQuery(&list->grid, states, i, radius, list->scratch);
+        if (halfLists) {
+            int myId = ordering ? ordering->ids[i] : i;
+            int kept = 0;
+            for (int k = 0; k < found; k++) {
+                int j = list->scratch[k];
+                if ((ordering ? ordering->ids[j] : j) > myId)
+                    list->scratch[kept++] = j;
+            }
+            found = kept;
+        }
+        sortNeighbourIndicesById(list->scratch, found, ordering);
+        if (count + found > list->entryCapacity) {
+            long capacity = list->entryCapacity > 0 ? list->entryCapacity : 1024;
+            while (capacity < count + found)
+                capacity *= 2;
+            int *listBoids = (int*)realloc(list->listBoids, capacity * sizeof(int));
+            if (!listBoids)
+                return -1;
+            list->listBoids = listBoids;
+            list->entryCapacity = capacity;
+        }
+        memcpy(&list->listBoids[count], list->scratch, found * sizeof(int));
+        count += found;
+    }
+    list->listStart[numBoids] = (int)count;
+    list->numBoids = numBoids;
+    list->skin      = skin;
+    list->halfLists = halfLists;
+    list->radius    = radius;
+    list->entries  = count;
+    if (halfLists && buildLowerPairs(list, numBoids) != 0)
+        return -1;
+    return 0;
+}
+
+// - End of buildNeighbourList Function - //
+
+// ----------------------------- //
+
+// - updateNeighbourList Function - //
+
+// Inputs:
+//   - list,        struct,         ,  Lists to check and, if needed, rebuild
+//   - states,      double, [Nx7]   ,  State at the start of the step
+//   - numBoids,    int,    [1x1]   ,  Number of boids
+//   - skin,        double, [1x1]   ,  Extra radius beyond the interaction range
+//   - halfLists,   int,    [1x1]   ,  Nonzero to store each pair once
+//   - BoidParams,  struct,         ,  Simulation parameters
+
+// Two boids that are now closer than the range were within range + skin at
+// the build if neither has moved more than skin / 2 since. The radius carries
+// the same small pad as the grid cell size against rounding.
+
+int updateNeighbourList(NeighbourList *list, const double *states, int numBoids,
+                        double skin, int halfLists, const BoidParams *p)
+{
+    double range  = p->visualRange > p->minDistance ? p->visualRange : p->minDistance;
+    double radius = range + skin + 1e-6;
+    int rebuild = list->builds == 0 || list->stale || numBoids != list->numBoids
+               || skin != list->skin || halfLists != list->halfLists || radius != list->radius;
+
+    double limitSq = 0.25 * skin * skin;
+    for (int i = 0; !rebuild && i < numBoids; i++) {
+        const double *pos  = &states[i * BOID_STATE_SIZE];
+        const double *base = &list->buildPositions[i * 3];
+        double d[3] = { pos[0] - base[0], pos[1] - base[1], pos[2] - base[2] };
+        // Written so that a non-finite position also forces a rebuild.
+        if (!(d[0]*d[0] + d[1]*d[1] + d[2]*d[2] <= limitSq))
+            rebuild = 1;
+    }
+
+    list->steps++;
+    if (!rebuild) {
+        list->stepsSinceBuild++;
+        if (list->stepsSinceBuild > list->longestInterval)
+            list->longestInterval = list->stepsSinceBuild;
+        return 0;
+    }
+    if (buildNeighbourList(list, states, numBoids, skin, halfLists, radius) != 0) {
+        list->stale = 1;
+        return -1;
+    }
+    list->stale = 0;
+    list->builds++;
+    list->stepsSinceBuild = 1;
+    if (list->longestInterval < 1)
+        list->longestInterval = 1;
+    return 1;
+}
+
+// - End of updateNeighbourList Function - //
+
+// ----------------------------- //
+
+// - invalidateNeighbourList Function - //
+
+void invalidateNeighbourList(NeighbourList *list)
+{
+    list->stale = 1;
+}
+
+// - End of invalidateNeighbourList Function - //
+
+// ----------------------------- //
+
+// - neighbourListMeanInterval / neighbourListBytes Functions - //
+
+double neighbourListMeanInterval(const NeighbourList *list)
+{
+    return list->builds > 0 ? (double)list->steps / (double)list->builds : 0.0;
+}
+
+size_t neighbourListBytes(const NeighbourList *list)
+{
+    size_t bytes = 0;
+    if (list->boidCapacity > 0) {
+        bytes += (size_t)(list->boidCapacity + 1) * sizeof(int);        // listStart
+        bytes += (size_t)list->boidCapacity * 3 * sizeof(double);       // buildPositions
+        bytes += (size_t)list->boidCapacity * sizeof(int);              // scratch
+        bytes += (size_t)(list->boidCapacity + 1) * sizeof(int);        // lowerStart
+    }
+    bytes += (size_t)list->entryCapacity * sizeof(int);                 // listBoids
+    bytes += (size_t)list->lowerCapacity * 2 * sizeof(int);             // lowerPairs
+    bytes += (size_t)list->grid.boidCapacity * 2 * sizeof(int);         // cellBoids, boidCell
+    if (list->grid.cellCapacity > 0)
+        bytes += (size_t)(list->grid.cellCapacity + 1) * sizeof(int);   // cellStart
+    return bytes;
+}
+
+// - End of neighbourListMeanInterval / neighbourListBytes Functions - //
+
+// ----------------------------- //
+
+// - updateOneBoidListSync Function - //
+
+// Inputs:
+//   - prevStates,  double, [Nx7]   ,  State at the start of the step
+//   - nextStates,  double, [Nx7]   ,  State written for boid i
+//   - i,           int,    [1x1]   ,  Index of the boid to update
+//   - list,        struct,         ,  Lists prepared from prevStates
+//   - BoidParams,  struct,         ,  Simulation parameters
+
+void updateOneBoidListSync(const double *prevStates, double *nextStates, int i,
+                           const NeighbourList *list, const BoidParams *p)
+{
+    const double *myState = &prevStates[i * BOID_STATE_SIZE];
+    double *outState      = &nextStates[i * BOID_STATE_SIZE];
+    if (myState[6] == 0.0) {
+        // Already crashed; carry the state over unchanged.
+        memcpy(outState, myState, BOID_STATE_SIZE * sizeof(double));
+        return;
+    }
+
+    double pos[3] = { myState[0], myState[1], myState[2] };
+    double vel[3] = { myState[3], myState[4], myState[5] };
+    double visualSq = p->visualRange * p->visualRange;
+    double minSq    = p->minDistance * p->minDistance;
+
+    BoidNeighbourSums sums;
+    initNeighbourSums(&sums);
+    for (int k = list->listStart[i]; k < list->listStart[i + 1]; k++) {
+        const double *nbr = &prevStates[list->listBoids[k] * BOID_STATE_SIZE];
+        double diff[3] = { pos[0] - nbr[0], pos[1] - nbr[1], pos[2] - nbr[2] };
+        double distSq  = diff[0]*diff[0] + diff[1]*diff[1] + diff[2]*diff[2];
+        if (distSq < visualSq) {
+            sums.cohesionSum[0]  += nbr[0];
+            sums.cohesionSum[1]  += nbr[1];
+            sums.cohesionSum[2]  += nbr[2];
+            sums.alignmentSum[0] += nbr[3];
+            sums.alignmentSum[1] += nbr[4];
+            sums.alignmentSum[2] += nbr[5];
+            sums.neighbourCount++;
+        }
+        if (distSq < minSq) {
+            sums.separationVec[0] += diff[0];
+            sums.separationVec[1] += diff[1];
+            sums.separationVec[2] += diff[2];
+        }
+    }
+
+    applyBoidRules(outState, pos, vel, &sums, p);
+}
+
+// - End of updateOneBoidListSync Function - //
+
+// ----------------------------- //
+
+// - markNeighbourPairs Function - //
+
+// Inputs:
+//   - prevStates,  double, [Nx7]   ,  State at the start of the step
+//   - startIdx,    int,    [1x1]   ,  First slot to sweep
+//   - endIdx,      int,    [1x1]   ,  One past the last slot to sweep
+//   - list,        struct,         ,  Half lists prepared from prevStates
+//   - pairFlags,   uchar,  [Ex1]   ,  Flags per half-list entry, written
+//   - BoidParams,  struct,         ,  Simulation parameters
+
+void markNeighbourPairs(const double *prevStates, int startIdx, int endIdx,
+                        const NeighbourList *list, unsigned char *pairFlags, const BoidParams *p)
+{
+    double visualSq = p->visualRange * p->visualRange;
+    double minSq    = p->minDistance * p->minDistance;
+    for (int i = startIdx; i < endIdx; i++) {
+        const double *me = &prevStates[i * BOID_STATE_SIZE];
+        for (int k = list->listStart[i]; k < list->listStart[i + 1]; k++) {
+            const double *nbr = &prevStates[list->listBoids[k] * BOID_STATE_SIZE];
+            double diff[3] = { me[0] - nbr[0], me[1] - nbr[1], me[2] - nbr[2] };
+            double distSq  = diff[0]*diff[0] + diff[1]*diff[1] + diff[2]*diff[2];
+            pairFlags[k] = (unsigned char)((distSq < visualSq ? NEIGHBOUR_PAIR_VISUAL : 0) |
+                                           (distSq < minSq ? NEIGHBOUR_PAIR_CLOSE : 0));
+        }
+    }
+}
+
+// - End of markNeighbourPairs Function - //
+
+// ----------------------------- //
+
+// - updateOneBoidPairsSync Function - //
+
+// Adds neighbour j of the boid at 'pos' to 'sums' as its pair flags say.
+static inline void addFlaggedNeighbour(BoidNeighbourSums *sums, const double pos[3],
+                                       const double *nbr, unsigned flags)
+{
+    if (flags & NEIGHBOUR_PAIR_VISUAL) {
+        sums->cohesionSum[0]  += nbr[0];
+        sums->cohesionSum[1]  += nbr[1];
+        sums->cohesionSum[2]  += nbr[2];
+        sums->alignmentSum[0] += nbr[3];
+        sums->alignmentSum[1] += nbr[4];
+        sums->alignmentSum[2] += nbr[5];
+        sums->neighbourCount++;
+    }
+    if (flags & NEIGHBOUR_PAIR_CLOSE) {
+        sums->separationVec[0] += pos[0] - nbr[0];
+        sums->separationVec[1] += pos[1] - nbr[1];
+        sums->separationVec[2] += pos[2] - nbr[2];
+    }
+}
+
+// Inputs:
+//   - prevStates,  double, [Nx7]   ,  State at the start of the step
+//   - nextStates,  double, [Nx7]   ,  State written for boid i
+//   - i,           int,    [1x1]   ,  Slot of the boid to update
+//   - list,        struct,         ,  Half lists prepared from prevStates
+//   - pairFlags,   uchar,  [Ex1]   ,  Flags set by markNeighbourPairs
+//   - BoidParams,  struct,         ,  Simulation parameters
+
+// Offsets are antisymmetric and squares even in floating point, so a pair's
+// flags are the same whichever of its boids evaluated it.
+
+void updateOneBoidPairsSync(const double *prevStates, double *nextStates, int i,
+                            const NeighbourList *list, const unsigned char *pairFlags,
+                            const BoidParams *p)
+{
+    const double *myState = &prevStates[i * BOID_STATE_SIZE];
+    double *outState      = &nextStates[i * BOID_STATE_SIZE];
+    if (myState[6] == 0.0) {
+        // Already crashed; carry the state over unchanged.
+        memcpy(outState, myState, BOID_STATE_SIZE * sizeof(double));
+        return;
+    }
+
+    double pos[3] = { myState[0], myState[1], myState[2] };
+    double vel[3] = { myState[3], myState[4], myState[5] };
+
+    BoidNeighbourSums sums;
+    initNeighbourSums(&sums);
+    for (int t = list->lowerStart[i]; t < list->lowerStart[i + 1]; t++) {
+        unsigned flags = pairFlags[list->lowerPairs[2 * t + 1]];
+        if (flags)
+            addFlaggedNeighbour(&sums, pos, &prevStates[list->lowerPairs[2 * t] * BOID_STATE_SIZE], flags);
+    }
+    for (int k = list->listStart[i]; k < list->listStart[i + 1]; k++) {
+        unsigned flags = pairFlags[k];
+        if (flags)
+            addFlaggedNeighbour(&sums, pos, &prevStates[list->listBoids[k] * BOID_STATE_SIZE], flags);
+    }
+
+    applyBoidRules(outState, pos, vel, &sums, p);
+}
+
+// - End of updateOneBoidPairsSync Function - //
@@ -0,0 +1,105 @@
+#ifndef NEIGHBOURLIST_H
+#define NEIGHBOURLIST_H
+
+#include <stddef.h>
+#include "boidUpdate.h"
+#include "neighbourGrid.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Verlet neighbour lists for the synchronous step. Each boid keeps the boids
+// that were within max(visualRange, minDistance) + skin of it when the lists
+// were built. While no boid has moved more than skin / 2 since then, every
+// pair now in range is still on those lists, so a step only has to check the
+// cached candidates instead of rebinning the flock and searching 27 cells.
+// Lists are stored back to back (CSR layout) in ascending ID order.
+//
+// Half lists keep only the candidates after each boid in ID order, so every
+// pair is stored once. markNeighbourPairs then evaluates each distance once,
+// and updateOneBoidPairsSync credits the pair to both boids. Each half list is
+// also indexed the other way round (lowerStart / lowerPairs), so a boid can
+// find the earlier boids whose lists hold it.
+typedef struct {
+    double skin;                // Skin the lists were built with
+    int halfLists;              // Nonzero if the lists are half lists
+    double radius;              // Candidate radius the lists were built with
+    int numBoids;               // Boids covered by the lists
+    int *listStart;             // Offset of each boid's list in listBoids [numBoids + 1]
+    int *listBoids;             // Candidate indices, boid by boid
+    double *buildPositions;     // x, y, z of every boid at the last build [numBoids x 3]
+    int boidCapacity;           // Allocated boids in listStart / buildPositions
+    long entryCapacity;         // Allocated length of listBoids
+    const BoidOrdering *ordering;   // Slot/ID maps when the states have been reordered,
+                                    // or NULL if indices are the IDs
+    int stale;                  // Set to force a rebuild on the next update
+    NeighbourGrid grid;         // Grid used to build the lists
+    int *scratch;               // Candidate workspace [boidCapacity]
+    int *lowerStart;            // Half lists: offset of each boid's earlier partners in lowerPairs [numBoids + 1]
+    int *lowerPairs;            // Half lists: (boid, listBoids entry) of each earlier partner, in ID order
+    long lowerCapacity;         // Allocated pairs in lowerPairs
+
+    // Statistics since initNeighbourList.
+    long steps;                 // Calls to updateNeighbourList
+    long builds;                // Steps that rebuilt the lists
+    int stepsSinceBuild;        // Steps that reused the current lists
+    int longestInterval;        // Most steps one set of lists has served
+    long entries;               // Candidates in the current lists
+} NeighbourList;
+
+// Initialises empty lists. No memory is allocated until the first build.
+void initNeighbourList(NeighbourList *list);
+
+// Releases all memory held by the lists.
+void freeNeighbourList(NeighbourList *list);
+
+// Prepares the lists for a synchronous step from 'states': rebuilds them if
+// any boid has moved more than skin / 2 since the last build (or the boid
+// count, skin, ranges or list kind changed), and otherwise keeps them.
+// Full lists (halfLists = 0) skip crashed boids; half lists keep them, since
+// their pairs are still needed by the boids after them.
+// Returns 1 if the lists were rebuilt, 0 if reused, -1 on allocation failure.
+int updateNeighbourList(NeighbourList *list, const double *states, int numBoids,
+                        double skin, int halfLists, const BoidParams *p);
+
+// Forces the next updateNeighbourList to rebuild, e.g. after the boids have
+// been permuted in memory.
+void invalidateNeighbourList(NeighbourList *list);
+
+// Mean number of steps served by each build.
+double neighbourListMeanInterval(const NeighbourList *list);
+
+// Bytes currently allocated for the lists, their build positions and grid.
+size_t neighbourListBytes(const NeighbourList *list);
+
+// Synchronous update of boid i using only its cached list. 'list' must have been
+// prepared from prevStates by updateNeighbourList. Neighbours are accumulated
+// in ascending ID order, so the result matches updateOneBoidGridSync bit for bit.
+void updateOneBoidListSync(const double *prevStates, double *nextStates, int i,
+                           const NeighbourList *list, const BoidParams *p);
+
+// Flags recorded by markNeighbourPairs for each half-list entry.
+#define NEIGHBOUR_PAIR_VISUAL 1     // Pair within visualRange
+#define NEIGHBOUR_PAIR_CLOSE  2     // Pair within minDistance
+
+// First pass of the symmetric step: evaluates each pair on the half lists of
+// the boids in slots startIdx..endIdx-1 once and sets pairFlags[k] for every
+// entry k of those lists. Different slot ranges write disjoint flags, so the
+// ranges can be swept in parallel in any order.
+void markNeighbourPairs(const double *prevStates, int startIdx, int endIdx,
+                        const NeighbourList *list, unsigned char *pairFlags, const BoidParams *p);
+
+// Second pass: updates boid i from the flags of its pairs, visiting its earlier
+// partners and then its own half list. Neighbours are accumulated in ascending
+// ID order, so the result matches updateOneBoidListSync bit for bit whichever
+// thread marked each pair.
+void updateOneBoidPairsSync(const double *prevStates, double *nextStates, int i,
+                            const NeighbourList *list, const unsigned char *pairFlags,
+                            const BoidParams *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NEIGHBOURLIST_H
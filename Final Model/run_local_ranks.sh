@@ -0,0 +1,32 @@
+#!/bin/bash
+# This script runs the distributed model as several ranks on this machine, without a RabbitMQ broker.
+# Usage: bash run_local_ranks.sh [nProcs] [transport]
+#   nProcs:    number of ranks to start (default 4).
+#   transport: tcp (default) or shm; see messaging.h.
+# Other settings (DECOMPOSITION, BOIDS_OUTPUT, BOIDS_TCP_PEERS, ...) are passed through from the environment.
+
+NPROCS=${1:-4}
+TRANSPORT=${2:-tcp}
+
+# Change directory to the build folder where distributed_main resides.
+cd build || { echo "Build directory not found"; exit 1; }
+
+# Start every rank in the background, each logging to output/rank<rank>.log.
+mkdir -p output
+pids=""
+for ((rank = 0; rank < NPROCS; rank++)); do
+    RANK=$rank NPROCS=$NPROCS BOIDS_TRANSPORT=$TRANSPORT ./distributed_main > "output/rank$rank.log" 2>&1 &
+    pids="$pids $!"
+done
+
+# Wait for all ranks and report any that failed.
+status=0
+rank=0
+for pid in $pids; do
+    if ! wait "$pid"; then
+        echo "Rank $rank failed; see build/output/rank$rank.log"
+        status=1
+    fi
+    rank=$((rank + 1))
+done
+exit $status
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slabDomain.h"
+#include "boidFraming.h"
+#include "boidProfile.h"
+
+// Working-set entries carry one extra double marking ownership:
+// [globalId, state[7], owned].
+#define SLAB_LOCAL_SIZE (SLAB_RECORD_SIZE + 1)
+
+// - Capacity Helpers - //
+
+static int growDoubles(double **buf, int *capacity, int needed, int stride)
+{
+    if (needed <= *capacity)
+        return 0;
+    int cap = *capacity > 0 ? *capacity : 64;
+    while (cap < needed)
+        cap *= 2;
+    double *grown = (double*)realloc(*buf, (size_t)cap * stride * sizeof(double));
+    if (!grown)
+        return -1;
+    *buf = grown;
+    *capacity = cap;
+    return 0;
+}
+
+static int reserveLocal(SlabDomain *d, int needed)
+{
+    if (needed <= d->localCapacity)
+        return 0;
+    int cap = d->localCapacity > 0 ? d->localCapacity : 64;
+    while (cap < needed)
+        cap *= 2;
+    double *records = (double*)realloc(d->localRecords, (size_t)cap * SLAB_LOCAL_SIZE * sizeof(double));
+    if (records) d->localRecords = records;
+    double *prev = (double*)realloc(d->localPrev, (size_t)cap * BOID_STATE_SIZE * sizeof(double));
+    if (prev) d->localPrev = prev;
+    double *next = (double*)realloc(d->localNext, (size_t)cap * BOID_STATE_SIZE * sizeof(double));
+    if (next) d->localNext = next;
+    int *owned = (int*)realloc(d->localOwned, (size_t)cap * sizeof(int));
+    if (owned) d->localOwned = owned;
+    int *ids = (int*)realloc(d->localIds, (size_t)cap * sizeof(int));
+    if (ids) d->localIds = ids;
+    int *scratch = (int*)realloc(d->scratch, (size_t)cap * sizeof(int));
+    if (scratch) d->scratch = scratch;
+    if (!records || !prev || !next || !owned || !ids || !scratch)
+        return -1;
+    d->localCapacity = cap;
+    return 0;
+}
+
+// - End of Capacity Helpers - //
+
+// ----------------------------- //
+
+// - initSlabDomain / freeSlabDomain Functions - //
+
+int initSlabDomain(SlabDomain *d, int rank, int nProcs, const BoidParams *p)
+{
+    memset(d, 0, sizeof(*d));
+    if (nProcs < 1 || rank < 0 || rank >= nProcs)
+        return -1;
+    d->rank      = rank;
+    d->nProcs    = nProcs;
+    d->slabWidth = p->bounds[0] / nProcs;
+    d->lo        = rank * d->slabWidth;
+    d->hi        = (rank + 1) * d->slabWidth;
+    d->halo      = p->visualRange > p->minDistance ? p->visualRange : p->minDistance;
+    initNeighbourGrid(&d->grid);
+    initBoidOrdering(&d->ordering);
+
+    // Ghosts only come from the adjacent slabs, so a slab narrower than the
+    // halo would miss neighbours two ranks away.
+    if (nProcs > 1 && d->slabWidth < d->halo) {
+        fprintf(stderr, "initSlabDomain: Slab width %.3f is narrower than the halo %.3f; "
+                        "use fewer ranks\n", d->slabWidth, d->halo);
+        return -1;
+    }
+    return 0;
+}
+
+void freeSlabDomain(SlabDomain *d)
+{
+    free(d->owned);
+    free(d->localRecords);
+    free(d->localPrev);
+    free(d->localNext);
+    free(d->localOwned);
+    free(d->localIds);
+    free(d->scratch);
+    free(d->sendBuffer);
+    free(d->recvBuffer);
+    freeNeighbourGrid(&d->grid);
+    freeBoidOrdering(&d->ordering);
+    memset(d, 0, sizeof(*d));
+}
+
+// - End of initSlabDomain / freeSlabDomain Functions - //
+
+// ----------------------------- //
+
+// - slabOwnerOf Function - //
+
+int slabOwnerOf(const SlabDomain *d, double x)
+{
+    if (!(x >= d->slabWidth))
+        return 0;           // Also catches NaN.
+    int r = (int)(x / d->slabWidth);
+    return r >= d->nProcs ? d->nProcs - 1 : r;
+}
+
+// - End of slabOwnerOf Function - //
+
+// ----------------------------- //
+
+// - slabTakeOwnership Function - //
+
+int slabTakeOwnership(SlabDomain *d, const double *allStates, int numBoids)
+{
+    d->numOwned = 0;
+    for (int i = 0; i < numBoids; i++) {
+        const double *s = &allStates[i * BOID_STATE_SIZE];
+        if (slabOwnerOf(d, s[0]) != d->rank)
+            continue;
+        if (growDoubles(&d->owned, &d->ownedCapacity, d->numOwned + 1, SLAB_RECORD_SIZE) != 0)
+            return -1;
+        double *rec = &d->owned[d->numOwned * SLAB_RECORD_SIZE];
+        rec[0] = (double)i;
+        memcpy(&rec[1], s, BOID_STATE_SIZE * sizeof(double));
+        d->numOwned++;
+    }
+    return 0;
+}
+
+// - End of slabTakeOwnership Function - //
+
+// ----------------------------- //
+
+// - Message Functions - //
+
+// Publishes the first 'count' records of d->sendBuffer to 'dest'.
+static int sendRecords(SlabDomain *d, int dest, int step, int kind, int count)
+{
+    BoidFrameHeader header = { BOID_FRAME_MAGIC, (uint16_t)kind, BOID_ENCODING_F64_ID,
+                               step, d->rank, 0, count };
+    return publishBoidFrame(&header, d->sendBuffer, boidFramePayloadSize(BOID_ENCODING_F64_ID, count), dest);
+}
+
+// Waits for the (step, kind, src) frame and returns its record count. The
+// records must then be read with readBoidFramePayload.
+static int waitForRecords(int step, int kind, int src, int *count)
+{
+    BoidFrameHeader h;
+    size_t size;
+    if (waitBoidFrame(step, kind, src, &h, &size) != 0)
+        return -1;
+    if (h.encoding != BOID_ENCODING_F64_ID) {
+        fprintf(stderr, "stepSlabDomain: Rank %d sent records in encoding %d\n", src, h.encoding);
+        return -1;
+    }
+    *count = h.numBoids;
+    return 0;
+}
+
+// - End of Message Functions - //
+
+// ----------------------------- //
+
+// - compareLocalIds Function - //
+
+static int compareLocalIds(const void *a, const void *b)
+{
+    double ia = ((const double*)a)[0];
+    double ib = ((const double*)b)[0];
+    return (ia > ib) - (ia < ib);
+}
+
+// - End of compareLocalIds Function - //
+
+// ----------------------------- //
+
+// - stepSlabDomain Function - //
+
+// Inputs:
+//   - d,           struct,      ,  Slab owned by this rank
+//   - step,        int,    [1x1],  Step being computed (tags the messages)
+//   - BoidParams,  struct,      ,  Simulation parameters
+
+// The working set is sorted by global ID before the update, so each owned boid
+// accumulates its neighbours in the same order as a single-process synchronous
+// step and the result does not depend on the number of ranks.
+
+int stepSlabDomain(SlabDomain *d, int step, const BoidParams *p)
+{
+    int neighbours[2] = { d->rank - 1, d->rank + 1 };
+
+    // 1. Send the halo on each side that has a neighbour.
+    if (growDoubles(&d->sendBuffer, &d->sendCapacity, d->numOwned, SLAB_RECORD_SIZE) != 0)
+        return -1;
+    for (int side = 0; side < 2; side++) {
+        int nb = neighbours[side];
+        if (nb < 0 || nb >= d->nProcs)
+            continue;
+        double *out = d->sendBuffer;
+        int count = 0;
+        for (int k = 0; k < d->numOwned; k++) {
+            const double *rec = &d->owned[k * SLAB_RECORD_SIZE];
+            int inHalo = side == 0 ? rec[1] < d->lo + d->halo : rec[1] >= d->hi - d->halo;
+            if (inHalo)
+                memcpy(&out[(count++) * SLAB_RECORD_SIZE], rec, SLAB_RECORD_SIZE * sizeof(double));
+        }
+        if (sendRecords(d, nb, step, BOID_FRAME_HALO, count) != 0)
+            return -1;
+    }
+
+    // 2. Assemble the working set: owned boids plus ghosts from both neighbours.
+    if (reserveLocal(d, d->numOwned) != 0)
+        return -1;
+    d->numLocal = 0;
+    for (int k = 0; k < d->numOwned; k++) {
+        double *entry = &d->localRecords[(d->numLocal++) * SLAB_LOCAL_SIZE];
+        memcpy(entry, &d->owned[k * SLAB_RECORD_SIZE], SLAB_RECORD_SIZE * sizeof(double));
+        entry[SLAB_RECORD_SIZE] = 1.0;
+    }
+    for (int side = 0; side < 2; side++) {
+        int nb = neighbours[side];
+        if (nb < 0 || nb >= d->nProcs)
+            continue;
+        int count;
+        if (waitForRecords(step, BOID_FRAME_HALO, nb, &count) != 0) {
+            fprintf(stderr, "stepSlabDomain: No halo from rank %d for step %d\n", nb, step);
+            return -1;
+        }
+        if (reserveLocal(d, d->numLocal + count) != 0 ||
+            growDoubles(&d->recvBuffer, &d->recvCapacity, count, SLAB_RECORD_SIZE) != 0 ||
+            readBoidFramePayload(d->recvBuffer) != 0)
+            return -1;
+        for (int k = 0; k < count; k++) {
+            double *entry = &d->localRecords[(d->numLocal++) * SLAB_LOCAL_SIZE];
+            memcpy(entry, &d->recvBuffer[k * SLAB_RECORD_SIZE], SLAB_RECORD_SIZE * sizeof(double));
+            entry[SLAB_RECORD_SIZE] = 0.0;
+        }
+    }
+    BOID_PROFILE_BEGIN(searchStart);
+    qsort(d->localRecords, d->numLocal, SLAB_LOCAL_SIZE * sizeof(double), compareLocalIds);
+    if (d->mortonOrder) {
+        // Lay the working set out along a Morton curve. The ordering's IDs are
+        // ranks in global ID order, so neighbours are still accumulated in ID order.
+        if (resetBoidOrdering(&d->ordering, d->numLocal) != 0 ||
+            mortonOrderBoids(&d->ordering, &d->localRecords[1], &d->localRecords[2], &d->localRecords[3],
+                             SLAB_LOCAL_SIZE, NULL, d->numLocal, d->ordering.ids) != 0)
+            return -1;
+        for (int k = 0; k < d->numLocal; k++)
+            d->ordering.slots[d->ordering.ids[k]] = k;
+    }
+    for (int k = 0; k < d->numLocal; k++) {
+        int r = d->mortonOrder ? d->ordering.ids[k] : k;
+        const double *entry = &d->localRecords[r * SLAB_LOCAL_SIZE];
+        memcpy(&d->localPrev[k * BOID_STATE_SIZE], &entry[1], BOID_STATE_SIZE * sizeof(double));
+        d->localOwned[k] = entry[SLAB_RECORD_SIZE] != 0.0;
+        d->localIds[k]   = (int)entry[0];
+    }
+
+    // 3. Update the owned boids from the start-of-step working set.
+    d->grid.ordering = d->mortonOrder ? &d->ordering : NULL;
+    if (buildNeighbourGrid(&d->grid, d->localPrev, d->numLocal, neighbourGridCellSize(p)) != 0)
+        return -1;
+    BOID_PROFILE_END(searchStart, BOID_PHASE_SEARCH, -1);
+    BOID_PROFILE_BEGIN(forcesStart);
+    int kept = 0;
+    for (int k = 0; k < d->numLocal; k++) {
+        if (!d->localOwned[k])
+            continue;
+        updateOneBoidGridSync(d->localPrev, d->localNext, k, &d->grid, d->scratch, p);
+        double *rec = &d->owned[(kept++) * SLAB_RECORD_SIZE];
+        rec[0] = (double)d->localIds[k];
+        memcpy(&rec[1], &d->localNext[k * BOID_STATE_SIZE], BOID_STATE_SIZE * sizeof(double));
+    }
+    BOID_PROFILE_END(forcesStart, BOID_PHASE_FORCES, -1);
+
+    // 4. Hand boids that left the slab to the neighbour on that side. Boids that
+    //    skipped a whole slab are forwarded again on the next step.
+    for (int side = 0; side < 2; side++) {
+        int nb = neighbours[side];
+        if (nb < 0 || nb >= d->nProcs)
+            continue;
+        double *out = d->sendBuffer;
+        int count = 0;
+        int remaining = 0;
+        for (int k = 0; k < kept; k++) {
+            double *rec = &d->owned[k * SLAB_RECORD_SIZE];
+            int owner = slabOwnerOf(d, rec[1]);
+            int leaves = side == 0 ? owner < d->rank : owner > d->rank;
+            if (leaves)
+                memcpy(&out[(count++) * SLAB_RECORD_SIZE], rec, SLAB_RECORD_SIZE * sizeof(double));
+            else
+                memmove(&d->owned[(remaining++) * SLAB_RECORD_SIZE], rec, SLAB_RECORD_SIZE * sizeof(double));
+        }
+        kept = remaining;
+        if (sendRecords(d, nb, step, BOID_FRAME_MIGRATE, count) != 0)
+            return -1;
+    }
+    d->numOwned = kept;
+
+    // 5. Adopt the boids migrating in.
+    for (int side = 0; side < 2; side++) {
+        int nb = neighbours[side];
+        if (nb < 0 || nb >= d->nProcs)
+            continue;
+        int count;
+        if (waitForRecords(step, BOID_FRAME_MIGRATE, nb, &count) != 0) {
+            fprintf(stderr, "stepSlabDomain: No migration message from rank %d for step %d\n", nb, step);
+            return -1;
+        }
+        // Migrants are decoded straight onto the end of the owned list.
+        if (growDoubles(&d->owned, &d->ownedCapacity, d->numOwned + count, SLAB_RECORD_SIZE) != 0 ||
+            readBoidFramePayload(&d->owned[d->numOwned * SLAB_RECORD_SIZE]) != 0)
+            return -1;
+        d->numOwned += count;
+    }
+    return 0;
+}
+
+// - End of stepSlabDomain Function - //
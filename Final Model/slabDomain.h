@@ -0,0 +1,73 @@
+#ifndef SLABDOMAIN_H
+#define SLABDOMAIN_H
+
+#include "boidOrdering.h"
+#include "boidUpdate.h"
+#include "neighbourGrid.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Each boid travels as 8 doubles: [globalId, posX, posY, posZ, velX, velY, velZ, flag],
+// in BOID_FRAME_HALO and BOID_FRAME_MIGRATE frames (BOID_ENCODING_F64_ID).
+#define SLAB_RECORD_SIZE (BOID_STATE_SIZE + 1)
+
+// Spatial slab decomposition along x. Rank r owns boids with
+// x in [r, r + 1) * bounds[0] / nProcs (the outer slabs extend to infinity).
+// Each step the rank exchanges a halo of ghost boids with its two neighbours,
+// updates its own boids in synchronous mode and hands boids that crossed a
+// boundary to the neighbour on that side.
+typedef struct {
+    int rank;                   // This rank
+    int nProcs;                 // Number of slabs
+    double slabWidth;           // bounds[0] / nProcs
+    double lo, hi;              // Owned x-range (before the outer slabs are extended)
+    double halo;                // Ghost zone width: max(visualRange, minDistance)
+
+    int numOwned;               // Boids owned by this rank
+    int ownedCapacity;
+    double *owned;              // Owned boids as SLAB_RECORD_SIZE records [numOwned]
+
+    int numLocal;               // Owned plus ghost boids in the working set
+    int localCapacity;
+    double *localRecords;       // Working set as assembled [numLocal]
+    double *localPrev;          // Working set in flat 7-double layout, in global ID
+                                // order or Morton order [numLocal]
+    double *localNext;          // Updated working set [numLocal]
+    int *localOwned;            // Nonzero where the working-set entry is owned [numLocal]
+    int *localIds;              // Global ID of each working-set entry [numLocal]
+    int *scratch;               // Grid search workspace [numLocal]
+    NeighbourGrid grid;
+    int mortonOrder;            // Nonzero to lay the working set out in Morton order
+    BoidOrdering ordering;      // Morton order of the working set (ranks by global ID)
+
+    int sendCapacity;           // Records that fit in sendBuffer
+    double *sendBuffer;         // Records for outgoing messages
+    int recvCapacity;           // Records that fit in recvBuffer
+    double *recvBuffer;         // Halo records received from a neighbour
+} SlabDomain;
+
+// Sets up the slab owned by 'rank'. Returns 0 on success, nonzero on error.
+int initSlabDomain(SlabDomain *d, int rank, int nProcs, const BoidParams *p);
+
+// Releases all memory held by the domain.
+void freeSlabDomain(SlabDomain *d);
+
+// Rank that owns a boid at x-coordinate x.
+int slabOwnerOf(const SlabDomain *d, double x);
+
+// Takes ownership of the boids in the full initial state that fall in this slab.
+// Global IDs are the indices into allStates. Returns 0 on success.
+int slabTakeOwnership(SlabDomain *d, const double *allStates, int numBoids);
+
+// Advances the owned boids by one step: exchanges halos with the neighbouring
+// ranks, updates the owned boids, then migrates boids that left the slab.
+// Returns 0 on success, nonzero on messaging or allocation failure.
+int stepSlabDomain(SlabDomain *d, int step, const BoidParams *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SLABDOMAIN_H
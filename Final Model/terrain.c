@@ -0,0 +1,353 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "terrain.h"
+
+// Slack on the bounds used by terrainClearance, so that rounding in the exact
+// height and comparison can never disagree with a culled test.
+#define TERRAIN_CLEARANCE_PAD 1e-6
+
+// - writeTerrainDescriptor Function - //
+
+// Inputs:
+//   - path,        char*,       ,  File to create
+//   - BoidParams,  struct,      ,  Terrain parameters
+
+int writeTerrainDescriptor(const char *path, const BoidParams *p)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return -1;
+    fprintf(fp, "z = amplitude * sin(x / scale) * cos(y / scale) + base\n");
+    fprintf(fp, "amplitude, %.17g\n", p->terrainAmplitude);
+    fprintf(fp, "scale, %.17g\n", p->terrainScale);
+    fprintf(fp, "base, %.17g\n", p->terrainBase);
+    if (p->terrainMap) {
+        // The heightmap replaces the function above in the simulation.
+        const TerrainMap *m = p->terrainMap;
+        fprintf(fp, "heightmap, %d, %d\n", m->width, m->height);
+        fprintf(fp, "origin, %.17g, %.17g\n", m->origin[0], m->origin[1]);
+        fprintf(fp, "spacing, %.17g, %.17g\n", m->spacing[0], m->spacing[1]);
+    }
+    int status = ferror(fp) ? -1 : 0;
+    if (fclose(fp) != 0)
+        status = -1;
+    return status;
+}
+
+// - End of writeTerrainDescriptor Function - //
+
+// ----------------------------- //
+
+// - writeTerrainHeightmap Function - //
+
+// Inputs:
+//   - path,        char*,       ,  File to create
+//   - BoidParams,  struct,      ,  Terrain parameters and bounds
+//   - resolution,  int,    [1x1],  Samples along each axis (at least 2)
+
+int writeTerrainHeightmap(const char *path, const BoidParams *p, int resolution)
+{
+    if (resolution < 2)
+        return -1;
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return -1;
+    fprintf(fp, "x,y,z\n");
+    for (int iy = 0; iy < resolution; iy++) {
+        double y = p->bounds[1] * iy / (resolution - 1);
+        for (int ix = 0; ix < resolution; ix++) {
+            double x = p->bounds[0] * ix / (resolution - 1);
+            fprintf(fp, "%.6f,%.6f,%.6f\n", x, y, getTerrainHeight(x, y, p));
+        }
+    }
+    int status = ferror(fp) ? -1 : 0;
+    if (fclose(fp) != 0)
+        status = -1;
+    return status;
+}
+
+// - End of writeTerrainHeightmap Function - //
+
+// ----------------------------- //
+
+// - buildQuadtree Function - //
+
+// Computes the min/max pyramid over the heights of m.
+// Returns 0 on success, nonzero on allocation failure.
+
+static int buildQuadtree(TerrainMap *m)
+{
+    int w = (m->width - 1 + TERRAIN_TILE - 1) / TERRAIN_TILE;
+    int h = (m->height - 1 + TERRAIN_TILE - 1) / TERRAIN_TILE;
+    size_t total = 0;
+    m->numLevels = 0;
+    for (;;) {
+        if (m->numLevels == TERRAIN_MAX_LEVELS)
+            return -1;
+        m->levelWidth[m->numLevels]  = w;
+        m->levelHeight[m->numLevels] = h;
+        m->levelOffset[m->numLevels] = total;
+        m->numLevels++;
+        total += (size_t)w * h;
+        if (w == 1 && h == 1)
+            break;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+    m->nodeMin = (float*)malloc(total * sizeof(float));
+    m->nodeMax = (float*)malloc(total * sizeof(float));
+    if (!m->nodeMin || !m->nodeMax)
+        return -1;
+
+    // Leaves: every sample a point in the tile can interpolate from, which
+    // includes the shared row and column on the far edges.
+    for (int ty = 0; ty < m->levelHeight[0]; ty++) {
+        int y0 = ty * TERRAIN_TILE;
+        int y1 = y0 + TERRAIN_TILE < m->height - 1 ? y0 + TERRAIN_TILE : m->height - 1;
+        for (int tx = 0; tx < m->levelWidth[0]; tx++) {
+            int x0 = tx * TERRAIN_TILE;
+            int x1 = x0 + TERRAIN_TILE < m->width - 1 ? x0 + TERRAIN_TILE : m->width - 1;
+            float lo = m->heights[(size_t)y0 * m->width + x0];
+            float hi = lo;
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    float v = m->heights[(size_t)y * m->width + x];
+                    if (v < lo) lo = v;
+                    if (v > hi) hi = v;
+                }
+            }
+            m->nodeMin[(size_t)ty * m->levelWidth[0] + tx] = lo;
+            m->nodeMax[(size_t)ty * m->levelWidth[0] + tx] = hi;
+        }
+    }
+
+    // Each node above covers up to 2 x 2 nodes of the level below.
+    for (int l = 1; l < m->numLevels; l++) {
+        const float *childMin = &m->nodeMin[m->levelOffset[l - 1]];
+        const float *childMax = &m->nodeMax[m->levelOffset[l - 1]];
+        int cw = m->levelWidth[l - 1], ch = m->levelHeight[l - 1];
+        for (int j = 0; j < m->levelHeight[l]; j++) {
+            for (int i = 0; i < m->levelWidth[l]; i++) {
+                float lo = childMin[(size_t)(2 * j) * cw + 2 * i];
+                float hi = childMax[(size_t)(2 * j) * cw + 2 * i];
+                for (int cj = 2 * j; cj <= 2 * j + 1 && cj < ch; cj++) {
+                    for (int ci = 2 * i; ci <= 2 * i + 1 && ci < cw; ci++) {
+                        if (childMin[(size_t)cj * cw + ci] < lo) lo = childMin[(size_t)cj * cw + ci];
+                        if (childMax[(size_t)cj * cw + ci] > hi) hi = childMax[(size_t)cj * cw + ci];
+                    }
+                }
+                m->nodeMin[m->levelOffset[l] + (size_t)j * m->levelWidth[l] + i] = lo;
+                m->nodeMax[m->levelOffset[l] + (size_t)j * m->levelWidth[l] + i] = hi;
+            }
+        }
+    }
+    return 0;
+}
+
+// - End of buildQuadtree Function - //
+
+// ----------------------------- //
+
+// - buildTerrainMap / loadTerrainMap / freeTerrainMap Functions - //
+
+// Inputs:
+//   - m,           struct,      ,  Heightmap to fill
+//   - BoidParams,  struct,      ,  Analytic terrain and bounds to sample
+//   - spacing,     double, [1x1],  Distance between samples
+
+int buildTerrainMap(TerrainMap *m, const BoidParams *p, double spacing)
+{
+    memset(m, 0, sizeof(*m));
+    if (!(spacing > 0.0))
+        return -1;
+    BoidParams analytic = *p;
+    analytic.terrainMap = NULL;
+
+    for (int a = 0; a < 2; a++) {
+        double border = 0.1 * p->bounds[a];
+        m->origin[a]  = -border;
+        m->spacing[a] = spacing;
+    }
+    m->width  = (int)ceil(1.2 * p->bounds[0] / spacing) + 1;
+    m->height = (int)ceil(1.2 * p->bounds[1] / spacing) + 1;
+    if (m->width < 2 || m->height < 2)
+        return -1;
+
+    m->ownedHeights = (float*)malloc((size_t)m->width * m->height * sizeof(float));
+    if (!m->ownedHeights)
+        return -1;
+    for (int j = 0; j < m->height; j++) {
+        double y = m->origin[1] + j * spacing;
+        for (int i = 0; i < m->width; i++) {
+            double x = m->origin[0] + i * spacing;
+            m->ownedHeights[(size_t)j * m->width + i] = (float)getTerrainHeight(x, y, &analytic);
+        }
+    }
+    m->heights = m->ownedHeights;
+    if (buildQuadtree(m) != 0) {
+        freeTerrainMap(m);
+        return -1;
+    }
+    return 0;
+}
+
+int loadTerrainMap(TerrainMap *m, const char *path)
+{
+    memset(m, 0, sizeof(*m));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TerrainMapFileHeader)) {
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+    m->mapping = data;
+    m->mappedBytes = (size_t)st.st_size;
+
+    TerrainMapFileHeader h;
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, TERRAIN_MAP_MAGIC, sizeof(h.magic)) != 0
+        || h.width < 2 || h.height < 2 || !(h.spacing[0] > 0.0) || !(h.spacing[1] > 0.0)
+        || (m->mappedBytes - sizeof(h)) / sizeof(float) / h.width < (size_t)h.height) {
+        freeTerrainMap(m);
+        return -1;
+    }
+    m->width      = h.width;
+    m->height     = h.height;
+    m->origin[0]  = h.origin[0];
+    m->origin[1]  = h.origin[1];
+    m->spacing[0] = h.spacing[0];
+    m->spacing[1] = h.spacing[1];
+    m->heights    = (const float*)((const unsigned char*)data + sizeof(h));
+    if (buildQuadtree(m) != 0) {
+        freeTerrainMap(m);
+        return -1;
+    }
+    return 0;
+}
+
+void freeTerrainMap(TerrainMap *m)
+{
+    if (m->mapping)
+        munmap(m->mapping, m->mappedBytes);
+    free(m->ownedHeights);
+    free(m->nodeMin);
+    free(m->nodeMax);
+    memset(m, 0, sizeof(*m));
+}
+
+// - End of buildTerrainMap / loadTerrainMap / freeTerrainMap Functions - //
+
+// ----------------------------- //
+
+// - initTerrainMapFromEnv Function - //
+
+// Inputs:
+//   - m,           struct,      ,  Heightmap to fill
+//   - BoidParams,  struct,      ,  Parameters whose terrainMap is set
+
+int initTerrainMapFromEnv(TerrainMap *m, BoidParams *p)
+{
+    const char *file = getenv("BOIDS_TERRAIN_FILE");
+    const char *cache = getenv("BOIDS_TERRAIN_CACHE");
+    if (file) {
+        if (loadTerrainMap(m, file) != 0) {
+            fprintf(stderr, "Failed to load heightmap file %s\n", file);
+            return -1;
+        }
+    } else if (cache) {
+        if (buildTerrainMap(m, p, atof(cache)) != 0) {
+            fprintf(stderr, "Failed to build a heightmap with spacing '%s'\n", cache);
+            return -1;
+        }
+    } else {
+        return 0;
+    }
+    p->terrainMap = m;
+    printf("Terrain heightmap: %d x %d samples, %d quadtree levels\n",
+           m->width, m->height, m->numLevels);
+    return 1;
+}
+
+// - End of initTerrainMapFromEnv Function - //
+
+// ----------------------------- //
+
+// - terrainMapHeight Function - //
+
+// Finds the cell holding (x, y), clamped to the map, and the position within it.
+static void locateCell(const TerrainMap *m, double x, double y, int *cx, int *cy, double *fx, double *fy)
+{
+    double gx = (x - m->origin[0]) / m->spacing[0];
+    double gy = (y - m->origin[1]) / m->spacing[1];
+    gx = gx > 0.0 ? (gx < m->width - 1 ? gx : m->width - 1) : 0.0;
+    gy = gy > 0.0 ? (gy < m->height - 1 ? gy : m->height - 1) : 0.0;
+    *cx = (int)gx < m->width - 2 ? (int)gx : m->width - 2;
+    *cy = (int)gy < m->height - 2 ? (int)gy : m->height - 2;
+    *fx = gx - *cx;
+    *fy = gy - *cy;
+}
+
+double terrainMapHeight(const TerrainMap *m, double x, double y)
+{
+    int cx, cy;
+    double fx, fy;
+    locateCell(m, x, y, &cx, &cy, &fx, &fy);
+    const float *row0 = &m->heights[(size_t)cy * m->width + cx];
+    const float *row1 = row0 + m->width;
+    double h0 = row0[0] + (row0[1] - row0[0]) * fx;
+    double h1 = row1[0] + (row1[1] - row1[0]) * fx;
+    return h0 + (h1 - h0) * fy;
+}
+
+// - End of terrainMapHeight Function - //
+
+// ----------------------------- //
+
+// - terrainClearance Function - //
+
+// Inputs:
+//   - x, y, z,     double, [1x1],  Position to test
+//   - clearance,   double, [1x1],  Height above the ground being tested for
+//   - BoidParams,  struct,      ,  Terrain parameters (and heightmap, if any)
+
+int terrainClearance(double x, double y, double z, double clearance, const BoidParams *p)
+{
+    const TerrainMap *m = p->terrainMap;
+    if (!m) {
+        // amplitude * sin * cos + base never leaves base -/+ |amplitude|.
+        double amplitude = fabs(p->terrainAmplitude);
+        if (z >= p->terrainBase + amplitude + clearance + TERRAIN_CLEARANCE_PAD)
+            return TERRAIN_CLEAR;
+        if (z < p->terrainBase - amplitude + clearance - TERRAIN_CLEARANCE_PAD)
+            return TERRAIN_BELOW;
+        return TERRAIN_UNSURE;
+    }
+
+    // Walk down from the root until a node's range settles the comparison.
+    int cx, cy;
+    double fx, fy;
+    locateCell(m, x, y, &cx, &cy, &fx, &fy);
+    int tx = cx / TERRAIN_TILE, ty = cy / TERRAIN_TILE;
+    for (int l = m->numLevels - 1; l >= 0; l--) {
+        size_t k = m->levelOffset[l] + (size_t)(ty >> l) * m->levelWidth[l] + (tx >> l);
+        if (z >= m->nodeMax[k] + clearance + TERRAIN_CLEARANCE_PAD)
+            return TERRAIN_CLEAR;
+        if (z < m->nodeMin[k] + clearance - TERRAIN_CLEARANCE_PAD)
+            return TERRAIN_BELOW;
+    }
+    return TERRAIN_UNSURE;
+}
+
+// - End of terrainClearance Function - //
@@ -0,0 +1,98 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "boidUpdate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Heightmap resolution (samples per axis) used when none is configured.
+#define TERRAIN_DEFAULT_RESOLUTION 201
+
+// Results of terrainClearance.
+#define TERRAIN_BELOW  -1       // Below (ground + clearance) everywhere nearby
+#define TERRAIN_UNSURE  0       // Needs the exact ground height
+#define TERRAIN_CLEAR   1       // At or above (ground + clearance) everywhere nearby
+
+// Heightmap files: a TerrainMapFileHeader followed by width x height float32
+// heights, row by row along y (native byte order). Sample (i, j) lies at
+// origin + (i * spacing[0], j * spacing[1]).
+#define TERRAIN_MAP_MAGIC "BOIDDEM1"
+
+typedef struct {
+    char magic[8];              // TERRAIN_MAP_MAGIC (not NUL-terminated)
+    int32_t width, height;      // Samples along x and y (at least 2 each)
+    double origin[2];           // World x, y of sample (0, 0)
+    double spacing[2];          // World distance between samples along x, y
+} TerrainMapFileHeader;
+
+// Quadtree leaves are TERRAIN_TILE x TERRAIN_TILE cells of the heightmap.
+#define TERRAIN_TILE 16
+#define TERRAIN_MAX_LEVELS 32
+
+// Heightmap with bilinear lookup, replacing the analytic terrain when it is
+// set as BoidParams.terrainMap. The min/max quadtree is stored as a pyramid:
+// level 0 holds one node per tile, and each level above merges 2 x 2 nodes of
+// the one below until a single root is left. Points outside the map take the
+// height of the nearest edge.
+typedef struct TerrainMap {
+    int width, height;          // Samples along x and y
+    double origin[2];           // World x, y of sample (0, 0)
+    double spacing[2];          // World distance between samples along x, y
+    const float *heights;       // Samples [height x width]
+    float *ownedHeights;        // Heights allocated by buildTerrainMap, or NULL
+    void *mapping;              // Mapping of the file loadTerrainMap read, or NULL
+    size_t mappedBytes;
+    int numLevels;              // Quadtree levels (numLevels - 1 is the root)
+    int levelWidth[TERRAIN_MAX_LEVELS];     // Nodes along x at each level
+    int levelHeight[TERRAIN_MAX_LEVELS];    // Nodes along y at each level
+    size_t levelOffset[TERRAIN_MAX_LEVELS]; // First node of each level in nodeMin / nodeMax
+    float *nodeMin;             // Lowest sample under each node
+    float *nodeMax;             // Highest sample under each node
+} TerrainMap;
+
+// Writes the terrain as text: the analytic height function followed by
+// "amplitude", "scale" and "base" lines, plus the heightmap size and spacing
+// when p->terrainMap is set. Returns 0 on success, nonzero on error.
+int writeTerrainDescriptor(const char *path, const BoidParams *p);
+
+// Writes the terrain sampled on a regular grid of resolution x resolution
+// points spanning [0, bounds[0]] x [0, bounds[1]], as "x,y,z" CSV rows (the
+// layout of the per-boid terrain samples). Returns 0 on success, nonzero on error.
+int writeTerrainHeightmap(const char *path, const BoidParams *p, int resolution);
+
+// Samples the analytic terrain of 'p' every 'spacing' units over the bounds,
+// plus a 10% border. Returns 0 on success, nonzero on error.
+int buildTerrainMap(TerrainMap *m, const BoidParams *p, double spacing);
+
+// Maps the heightmap file at 'path' (see TerrainMapFileHeader).
+// Returns 0 on success, nonzero on error.
+int loadTerrainMap(TerrainMap *m, const char *path);
+
+// Releases the heights (or unmaps the file) and the quadtree.
+void freeTerrainMap(TerrainMap *m);
+
+// Sets up the heightmap requested by the environment: BOIDS_TERRAIN_FILE=<path>
+// maps a heightmap file and BOIDS_TERRAIN_CACHE=<spacing> samples the analytic
+// terrain of 'p' with that spacing. Returns 1 if 'm' was filled and set as
+// p->terrainMap (release it with freeTerrainMap), 0 if neither is set (the
+// analytic terrain is evaluated directly), or -1 on error.
+int initTerrainMapFromEnv(TerrainMap *m, BoidParams *p);
+
+// Bilinearly interpolated height at (x, y).
+double terrainMapHeight(const TerrainMap *m, double x, double y);
+
+// Compares altitude z at (x, y) with (ground + clearance) without evaluating
+// the ground height where a bound settles it: the global range of the analytic
+// terrain, or the quadtree node ranges of p->terrainMap.
+// Returns TERRAIN_CLEAR, TERRAIN_BELOW or TERRAIN_UNSURE.
+int terrainClearance(double x, double y, double z, double clearance, const BoidParams *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TERRAIN_H
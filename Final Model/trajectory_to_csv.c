@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "boidTrajectory.h"
+
+// Converts a binary trajectory written by local_main or distributed_main into
+// the positions and statuses CSV files the simulation used to write directly.
+
+int main(int argc, char *argv[])
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <trajectory.bin> <positions.csv> <statuses.csv>\n", argv[0]);
+        return 1;
+    }
+
+    BoidTrajectory trajectory;
+    if (openBoidTrajectory(&trajectory, argv[1]) != 0) {
+        fprintf(stderr, "Failed to read trajectory file %s\n", argv[1]);
+        exit(1);
+    }
+    printf("%s: %d boids (from boid %d), %d steps, %s, statuses %s\n", argv[1],
+           trajectory.header.numBoids, trajectory.header.firstBoid, trajectory.header.numSteps,
+           trajectory.header.dtype == BOID_TRAJECTORY_F64 ? "f64" : "f32",
+           trajectory.header.layout == BOID_TRAJECTORY_CRASH_EVENTS ? "as crash events" : "per frame");
+
+    if (writeBoidTrajectoryCSV(&trajectory, argv[2], argv[3]) != 0) {
+        fprintf(stderr, "Failed to write %s and %s\n", argv[2], argv[3]);
+        exit(1);
+    }
+    closeBoidTrajectory(&trajectory);
+    return 0;
+}